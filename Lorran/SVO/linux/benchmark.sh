@@ -0,0 +1,55 @@
+#!/bin/bash
+
+## SVO PIPELINE BENCHMARK
+## Generates synthetic meshes with tri_generate and runs svo_builder (partition, voxelize, build) on them at several
+## grid sizes and memory limits. Every run writes its metrics (-metrics) to ${OUT_DIR}, and a summary is printed.
+## Build svo_builder first (build_svo_builder.sh). Usage: ./benchmark.sh [triangles]
+
+TRIANGLES=${1:-1000000}
+GRIDSIZES="256 512 1024"
+MEMORY_LIMITS="256 2048"
+SHAPES="sphere terrain soup"
+SOURCE_DIR=../src/tri_convert/
+OUT_DIR=benchmark_results
+## BINARY=1 benchmarks binary voxelization (geometry-only meshes, tri_generate -binary)
+BINARY=${BINARY:-0}
+GENERATE=./tri_generate
+BUILDER=./svo_builder
+GENERATE_OPTS=""
+if [ "${BINARY}" = "1" ]; then
+	GENERATE_OPTS="-binary"
+fi
+
+if [ ! -x ${BUILDER} ]; then
+	echo "${BUILDER} not found, run build_svo_builder.sh first."
+	exit 1
+fi
+
+echo "Building ${GENERATE} ..."
+g++ -std=c++11 -O3 -o ${GENERATE} ${SOURCE_DIR}tri_generate.cpp || exit 1
+mkdir -p ${OUT_DIR}
+
+## GENERATE MESHES
+for SHAPE in ${SHAPES}; do
+	${GENERATE} ${GENERATE_OPTS} -shape ${SHAPE} -n ${TRIANGLES} -clusters 8 -o ${OUT_DIR}/${SHAPE} > /dev/null || exit 1
+done
+
+## RUN THE PIPELINE
+printf "%-8s %6s %6s %10s %12s %12s %12s %14s %10s\n" shape grid limit total_ms partition_ms voxelize_ms build_ms voxels peak_MB
+for SHAPE in ${SHAPES}; do
+	for GRID in ${GRIDSIZES}; do
+		for LIMIT in ${MEMORY_LIMITS}; do
+			METRICS=${OUT_DIR}/${SHAPE}_${GRID}_${LIMIT}.csv
+			${BUILDER} -f ${OUT_DIR}/${SHAPE}.tri -s ${GRID} -l ${LIMIT} -metrics ${METRICS} > ${OUT_DIR}/${SHAPE}_${GRID}_${LIMIT}.log || { echo "${SHAPE} ${GRID} ${LIMIT} failed"; continue; }
+			rm -f ${OUT_DIR}/${SHAPE}${GRID}_*.octree* ${OUT_DIR}/${SHAPE}${GRID}_*.pontos
+			## columns: phase,partition,total_ms,... (see the header line of the metrics file)
+			awk -F, -v shape=${SHAPE} -v grid=${GRID} -v limit=${LIMIT} '
+				$1 == "main" { total = $3; voxels = $9; peak = $14 / 1048576 }
+				$1 == "partitioning" { part = $3 }
+				$1 == "voxelizing" { vox = $3 }
+				$1 == "svo_building" { build = $3 }
+				END { printf "%-8s %6s %6s %10.1f %12.1f %12.1f %12.1f %14d %10.1f\n", shape, grid, limit, total, part, vox, build, voxels, peak }' ${METRICS}
+		done
+	done
+done
+echo "Metrics for every run are in ${OUT_DIR}"
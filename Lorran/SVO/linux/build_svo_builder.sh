@@ -3,12 +3,14 @@
 ## SPECIFY TRIMESH LOCATION HERE (and do a make there first)
 TRIMESH_DIR=../../trimesh2-master
 SOURCE_DIR=../src/svo_builder/
+## EXTRA DEFINES
+## (one build handles geometry-only and colored .tri files, packed payloads are the -packed option)
+DEFINES=""
 
 ## COMPILE AND LINK DEFINITIONS
-COMPILE="g++ -std=c++11 -g -c -O3 -I../src/libs/tri_tools/include/ -I ${TRIMESH_DIR}/include/"
-COMPILE_BINARY="g++ -std=c++11 -c -O3 -I../src/libs/tri_tools/include/ -I ${TRIMESH_DIR}/include/ -D BINARY_VOXELIZATION"
-LINK="g++ -std=c++11 -g -o svo_builder"
-LINK_BINARY="g++ -std=c++11 -g -o svo_builder_binary"
+COMPILE="g++ -std=c++11 -g -c -O3 -fopenmp -pthread ${DEFINES} -I../src/libs/tri_tools/include/ -I ${TRIMESH_DIR}/include/"
+LINK="g++ -std=c++11 -g -fopenmp -pthread -o svo_builder"
+MERGE="g++ -std=c++11 -O3 -pthread ${DEFINES} -I../src/libs/tri_tools/include/ -I ${TRIMESH_DIR}/include/"
 
 #############################################################################################
 ## BUILDING STARTS HERE
@@ -16,28 +18,21 @@ LINK_BINARY="g++ -std=c++11 -g -o svo_builder_binary"
 ## CLEAN
 echo "Removing old versions ..."
 rm -f svo_builder
-rm -f svo_builder_binary
+rm -f svo_merge
 rm -f *.o
 
-## BUILD BINARY VOXELIZATION VERSION
-echo "Compiling binary voxelization build..."
-${COMPILE_BINARY} ${SOURCE_DIR}main.cpp
-${COMPILE_BINARY} ${SOURCE_DIR}OctreeBuilder.cpp
-${COMPILE_BINARY} ${SOURCE_DIR}partitioner.cpp
-${COMPILE_BINARY} ${SOURCE_DIR}voxelizer.cpp
-echo "Linking binary voxelization build..."
-${LINK_BINARY} *.o
-
-echo "Cleaning up ..."
-rm *.o
-
-## BUILD REGULAR VERSION
-echo "Compiling regular version build..."
+## BUILD
+echo "Compiling svo_builder..."
 ${COMPILE} ${SOURCE_DIR}main.cpp
 ${COMPILE} ${SOURCE_DIR}OctreeBuilder.cpp
 ${COMPILE} ${SOURCE_DIR}partitioner.cpp
 ${COMPILE} ${SOURCE_DIR}voxelizer.cpp
-echo "Linking regular version build..."
+${COMPILE} ${SOURCE_DIR}voxelizer_kernels.cpp
+echo "Linking svo_builder..."
 ${LINK} *.o
 
+## BUILD SVO MERGE (stitches sub-octrees)
+echo "Building svo_merge ..."
+${MERGE} -o svo_merge ${SOURCE_DIR}svo_merge.cpp
+
 echo "Done"
@@ -28,6 +28,14 @@ template<typename morton, typename coord> inline void m3D_d_magicbits(const mort
 template<typename morton, typename coord> inline void m3D_d_for(const morton m, coord& x, coord& y, coord& z);
 template<typename morton, typename coord> inline void m3D_d_for_ET(const morton m, coord& x, coord& y, coord& z);
 
+// AVAILABLE METHODS FOR STEPPING (move an existing morton code one step along a single axis)
+template<typename morton> inline morton m3D_inc_x(const morton m);
+template<typename morton> inline morton m3D_inc_y(const morton m);
+template<typename morton> inline morton m3D_inc_z(const morton m);
+template<typename morton> inline morton m3D_dec_x(const morton m);
+template<typename morton> inline morton m3D_dec_y(const morton m);
+template<typename morton> inline morton m3D_dec_z(const morton m);
+
 // ENCODE 3D Morton code : Pre-Shifted LookUpTable (sLUT)
 template<typename morton, typename coord>
 inline morton m3D_e_sLUT(const coord x, const coord y, const coord z) {
@@ -102,6 +110,9 @@ static inline morton morton3D_SplitBy3bits(const coord a) {
 	const morton* masks = (sizeof(morton) <= 4) ? reinterpret_cast<const morton*>(magicbit3D_masks32) : reinterpret_cast<const morton*>(magicbit3D_masks64);
 	morton x = a;
 	x = x & masks[0];
+	if (sizeof(morton) > 4) {
+		x = (x | (x << 16) << 16) & static_cast<morton>(magicbit3D_split64);
+	}
 	x = (x | x << 16) & masks[1];
 	x = (x | x << 8)  & masks[2];
 	x = (x | x << 4)  & masks[3];
@@ -230,7 +241,13 @@ static inline coord morton3D_GetThirdBits(const morton m) {
 	x = (x ^ (x >> 2)) & masks[3];
 	x = (x ^ (x >> 4)) & masks[2];
 	x = (x ^ (x >> 8)) & masks[1];
-	x = (x ^ (x >> 16)) & masks[0];
+	if (sizeof(morton) > 4) {
+		x = (x ^ (x >> 16)) & static_cast<morton>(magicbit3D_split64);
+		x = (x ^ ((x >> 16) >> 16)) & masks[0];
+	}
+	else {
+		x = (x ^ (x >> 16)) & masks[0];
+	}
 	return static_cast<coord>(x);
 }
 
@@ -275,3 +292,50 @@ inline void m3D_d_for_ET(const morton m, coord& x, coord& y, coord& z) {
 		z |= (m & (selector << (shift_selector + 2))) >> (shiftback + 2);
 	}
 }
+
+// HELPER METHOD: bits belonging to the x axis in a morton code (y and z are this mask shifted by 1 and 2)
+template<typename morton>
+inline morton m3D_x_mask() {
+	return static_cast<morton>(sizeof(morton) <= 4 ? 0x09249249 : 0x1249249249249249);
+}
+
+// HELPER METHOD: add the axis bits of delta to the axis bits of m, leaving the other two axes alone
+// Filling the other axes' bits with ones lets carries ripple straight through them.
+template<typename morton>
+inline morton m3D_add_axis(const morton m, const morton delta, const morton axis_mask) {
+	return (((m | ~axis_mask) + (delta & axis_mask)) & axis_mask) | (m & ~axis_mask);
+}
+
+// HELPER METHOD: subtract the axis bits of delta from the axis bits of m, leaving the other two axes alone
+// Clearing the other axes' bits lets borrows ripple straight through them.
+template<typename morton>
+inline morton m3D_sub_axis(const morton m, const morton delta, const morton axis_mask) {
+	return (((m & axis_mask) - (delta & axis_mask)) & axis_mask) | (m & ~axis_mask);
+}
+
+// STEP 3D Morton code : increment / decrement a single coordinate without decoding and re-encoding.
+// Stepping past the first or last coordinate wraps around on that axis.
+template<typename morton>
+inline morton m3D_inc_x(const morton m) {
+	return m3D_add_axis<morton>(m, 1, m3D_x_mask<morton>());
+}
+template<typename morton>
+inline morton m3D_inc_y(const morton m) {
+	return m3D_add_axis<morton>(m, 2, m3D_x_mask<morton>() << 1);
+}
+template<typename morton>
+inline morton m3D_inc_z(const morton m) {
+	return m3D_add_axis<morton>(m, 4, m3D_x_mask<morton>() << 2);
+}
+template<typename morton>
+inline morton m3D_dec_x(const morton m) {
+	return m3D_sub_axis<morton>(m, 1, m3D_x_mask<morton>());
+}
+template<typename morton>
+inline morton m3D_dec_y(const morton m) {
+	return m3D_sub_axis<morton>(m, 2, m3D_x_mask<morton>() << 1);
+}
+template<typename morton>
+inline morton m3D_dec_z(const morton m) {
+	return m3D_sub_axis<morton>(m, 4, m3D_x_mask<morton>() << 2);
+}
@@ -4,7 +4,9 @@
 
 // Magicbits masks
 static uint_fast32_t magicbit3D_masks32[5] = { 0x000003ff, 0x30000ff, 0x0300f00f, 0x30c30c3, 0x9249249 };
-static uint_fast64_t magicbit3D_masks64[5] = { 0x1f000000001ffff, 0x1f0000ff0000ff, 0x100f00f00f00f00f, 0x10c30c30c30c30c3, 0x1249249249249249 };
+static uint_fast64_t magicbit3D_masks64[5] = { 0x1fffff, 0x1f0000ff0000ff, 0x100f00f00f00f00f, 0x10c30c30c30c30c3, 0x1249249249249249 };
+// 64-bit codes need one more split step (21 bits don't fit in the 32-bit steps above)
+static const uint_fast64_t magicbit3D_split64 = 0x1f00000000ffff;
 
 // Version with lookup table
 static const uint_fast32_t Morton3D_encode_x_256[256] =
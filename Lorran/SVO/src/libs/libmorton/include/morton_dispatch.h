@@ -0,0 +1,112 @@
+#pragma once
+
+// Libmorton - Runtime dispatch for 64-bit 3D morton codes
+// morton.h picks its method at compile time, so a binary built without -mbmi2 never uses BMI2.
+// These functions pick BMI2, magic bits or a lookup table once, from what the CPU reports (CPUID),
+// so one portable binary still gets the fast path on CPUs that have it.
+
+#include <stdint.h>
+#include "morton3D.h"
+
+#if _MSC_VER && _WIN64
+#include <intrin.h>
+#include <immintrin.h>
+#define MORTON_DISPATCH_BMI2
+#define MORTON_TARGET_BMI2
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <immintrin.h>
+#define MORTON_DISPATCH_BMI2
+#define MORTON_TARGET_BMI2 __attribute__((target("bmi2")))
+#endif
+
+typedef uint_fast64_t(*morton3D_64_encode_f)(const uint_fast32_t x, const uint_fast32_t y, const uint_fast32_t z);
+typedef void(*morton3D_64_decode_f)(const uint_fast64_t m, uint_fast32_t& x, uint_fast32_t& y, uint_fast32_t& z);
+
+struct morton3D_64_method {
+	const char* name;
+	morton3D_64_encode_f encode;
+	morton3D_64_decode_f decode;
+};
+
+// LookUpTable (pre-shifted) and magic bits versions, available everywhere
+inline uint_fast64_t morton3D_64_encode_LUT(const uint_fast32_t x, const uint_fast32_t y, const uint_fast32_t z) {
+	return m3D_e_sLUT<uint_fast64_t, uint_fast32_t>(x, y, z);
+}
+inline void morton3D_64_decode_LUT(const uint_fast64_t m, uint_fast32_t& x, uint_fast32_t& y, uint_fast32_t& z) {
+	m3D_d_sLUT<uint_fast64_t, uint_fast32_t>(m, x, y, z);
+}
+inline uint_fast64_t morton3D_64_encode_magicbits(const uint_fast32_t x, const uint_fast32_t y, const uint_fast32_t z) {
+	return m3D_e_magicbits<uint_fast64_t, uint_fast32_t>(x, y, z);
+}
+inline void morton3D_64_decode_magicbits(const uint_fast64_t m, uint_fast32_t& x, uint_fast32_t& y, uint_fast32_t& z) {
+	m3D_d_magicbits<uint_fast64_t, uint_fast32_t>(m, x, y, z);
+}
+
+#ifdef MORTON_DISPATCH_BMI2
+// BMI2 versions, compiled for BMI2 whatever the flags of the including file (only called when the CPU has it)
+MORTON_TARGET_BMI2 inline uint_fast64_t morton3D_64_encode_BMI2(const uint_fast32_t x, const uint_fast32_t y, const uint_fast32_t z) {
+	return _pdep_u64(x, 0x9249249249249249) | _pdep_u64(y, 0x2492492492492492) | _pdep_u64(z, 0x4924924924924924);
+}
+MORTON_TARGET_BMI2 inline void morton3D_64_decode_BMI2(const uint_fast64_t m, uint_fast32_t& x, uint_fast32_t& y, uint_fast32_t& z) {
+	x = static_cast<uint_fast32_t>(_pext_u64(m, 0x9249249249249249));
+	y = static_cast<uint_fast32_t>(_pext_u64(m, 0x2492492492492492));
+	z = static_cast<uint_fast32_t>(_pext_u64(m, 0x4924924924924924));
+}
+
+// Does the CPU have BMI2, with a PDEP/PEXT that is worth using?
+// AMD implemented them in microcode before Zen 3, where they are slower than magic bits.
+inline bool morton_cpuHasFastBMI2() {
+#if _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	bool amd = (info[1] == 0x68747541); // "Auth"enticAMD
+	__cpuidex(info, 7, 0);
+	if (!(info[1] & (1 << 8))) { return false; } // EBX bit 8: BMI2
+	if (!amd) { return true; }
+	__cpuid(info, 1);
+	unsigned int family = ((info[0] >> 8) & 0xf) + ((info[0] >> 20) & 0xff);
+	return family >= 0x19; // Zen 3 and later
+#else
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("bmi2")) { return false; }
+	if (__builtin_cpu_is("amd") && (__builtin_cpu_is("bdver4") || __builtin_cpu_is("znver1") || __builtin_cpu_is("znver2"))) { return false; }
+	return true;
+#endif
+}
+#endif
+
+// Pick the method for this CPU: BMI2 when it's fast, magic bits on other 64-bit builds (plain shifts and masks),
+// the lookup table when 64-bit arithmetic has to be emulated.
+inline morton3D_64_method morton3D_64_selectMethod() {
+#ifdef MORTON_DISPATCH_BMI2
+	if (morton_cpuHasFastBMI2()) {
+		morton3D_64_method bmi2 = { "BMI2", &morton3D_64_encode_BMI2, &morton3D_64_decode_BMI2 };
+		return bmi2;
+	}
+#endif
+	if (sizeof(void*) >= 8) {
+		morton3D_64_method magicbits = { "magic bits", &morton3D_64_encode_magicbits, &morton3D_64_decode_magicbits };
+		return magicbits;
+	}
+	morton3D_64_method lut = { "LUT", &morton3D_64_encode_LUT, &morton3D_64_decode_LUT };
+	return lut;
+}
+
+// The method in use, selected on first use
+inline const morton3D_64_method& morton3D_64_dispatch() {
+	static const morton3D_64_method method = morton3D_64_selectMethod();
+	return method;
+}
+
+// ENCODE / DECODE 3D 64-bit morton code with the method selected for this CPU
+inline uint_fast64_t morton3D_64_encode_dispatch(const uint_fast32_t x, const uint_fast32_t y, const uint_fast32_t z) {
+	return morton3D_64_dispatch().encode(x, y, z);
+}
+template<typename coord>
+inline void morton3D_64_decode_dispatch(const uint_fast64_t m, coord& x, coord& y, coord& z) {
+	uint_fast32_t dx, dy, dz;
+	morton3D_64_dispatch().decode(m, dx, dy, dz);
+	x = static_cast<coord>(dx);
+	y = static_cast<coord>(dy);
+	z = static_cast<coord>(dz);
+}
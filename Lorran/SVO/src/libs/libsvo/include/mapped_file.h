@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <stdio.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#undef NOMINMAX
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// A read-only memory mapping of a whole file (mmap on POSIX, CreateFileMapping on Windows).
+// Nothing is read when the file is opened: the OS pages parts of the file in as they are touched.
+class MappedFile {
+public:
+	MappedFile() : m_data(NULL), m_size(0), m_open(false) {
+#if defined(_WIN32) || defined(_WIN64)
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = NULL;
+#endif
+	}
+	~MappedFile() { close(); }
+
+	bool open(const std::string &filename);
+	void close();
+	bool isOpen() const { return m_open; }
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+	// Tell the OS we'll jump around in the file (octree traversals do), so it doesn't read ahead
+	void adviseRandomAccess() const;
+
+private:
+	MappedFile(const MappedFile &); // not copyable: the mapping is released in the destructor
+	MappedFile& operator=(const MappedFile &);
+
+	const char* m_data;
+	size_t m_size;
+	bool m_open;
+#if defined(_WIN32) || defined(_WIN64)
+	HANDLE m_file;
+	HANDLE m_mapping;
+#endif
+};
+
+#if defined(_WIN32) || defined(_WIN64)
+
+inline bool MappedFile::open(const std::string &filename){
+	close();
+	m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE) { return false; }
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size)) { close(); return false; }
+	m_size = static_cast<size_t>(size.QuadPart);
+	if (m_size == 0) { m_open = true; return true; } // empty files can't be mapped, but there's nothing to read anyway
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping == NULL) { close(); return false; }
+	m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == NULL) { close(); return false; }
+	m_open = true;
+	return true;
+}
+
+inline void MappedFile::close(){
+	if (m_data != NULL) { UnmapViewOfFile(m_data); }
+	if (m_mapping != NULL) { CloseHandle(m_mapping); }
+	if (m_file != INVALID_HANDLE_VALUE) { CloseHandle(m_file); }
+	m_data = NULL;
+	m_mapping = NULL;
+	m_file = INVALID_HANDLE_VALUE;
+	m_size = 0;
+	m_open = false;
+}
+
+inline void MappedFile::adviseRandomAccess() const{
+	// no equivalent for a mapped view, Windows reads ahead conservatively anyway
+}
+
+#else
+
+inline bool MappedFile::open(const std::string &filename){
+	close();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) { return false; }
+	struct stat st;
+	if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+	m_size = static_cast<size_t>(st.st_size);
+	if (m_size == 0) { ::close(fd); m_open = true; return true; } // empty files can't be mapped, but there's nothing to read anyway
+	void* p = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd); // the mapping keeps the file alive
+	if (p == MAP_FAILED) { m_size = 0; return false; }
+	m_data = static_cast<const char*>(p);
+	m_open = true;
+	return true;
+}
+
+inline void MappedFile::close(){
+	if (m_data != NULL) { munmap(const_cast<char*>(m_data), m_size); }
+	m_data = NULL;
+	m_size = 0;
+	m_open = false;
+}
+
+inline void MappedFile::adviseRandomAccess() const{
+	if (m_data != NULL) { madvise(const_cast<char*>(m_data), m_size, MADV_RANDOM); }
+}
+
+#endif
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <float.h>
+#include "svo_reader.h"
+
+// CPU ray caster for SVOReader octrees, after Laine & Karras' Efficient Sparse Voxel Octrees (ESVO).
+// The octree is mapped to [1,2]^3 so the position of a cube at every level is exact in the float mantissa, and the
+// ray is mirrored so its direction is negative on all axes. Every step then only compares the three plane
+// distances of the current cube: descend into the first child the ray enters, step to the next sibling when the
+// ray leaves it, and pop straight up to the level where the position bits differ when it leaves the parent.
+
+struct SVORayHit {
+	float t; // ray parameter where the ray enters the voxel
+	uvec3 position; // voxel coordinates at the hit depth
+	int depth; // depth of the hit node (maxDepth() for voxels)
+	SVONode node;
+};
+
+inline int svoFloatAsInt(float f){ int i; memcpy(&i, &f, sizeof(i)); return i; }
+inline float svoIntAsFloat(int i){ float f; memcpy(&f, &i, sizeof(f)); return f; }
+
+// Cast a ray origin + t * direction, t in [0, t_limit], through the octree. Origin and direction are in grid units:
+// the octree spans [0, gridlength]^3. Stops at the first existing node at max_depth (default: the voxels).
+// Returns false if the ray misses.
+inline bool castRay(const SVOReader &svo, const vec3 &origin, const vec3 &direction, SVORayHit &hit, const float t_limit = FLT_MAX, int max_depth = -1){
+	const int s_max = 23; // scale of the root: a cube at scale s has size 2^(s - s_max), so a node at depth d is at scale s_max - d
+	const float epsilon = ldexpf(1.0f, -s_max);
+	if (max_depth < 0 || max_depth > svo.maxDepth()) { max_depth = svo.maxDepth(); }
+	struct StackEntry { SVONode parent; float t_max; } stack[s_max + 1];
+
+	// to octree space [1,2]^3: the ray parameter doesn't change
+	float inv_grid = 1.0f / static_cast<float>(svo.gridLength());
+	vec3 p = origin * inv_grid + vec3(1.0f);
+	vec3 d = direction * inv_grid;
+	// get rid of small direction components, to avoid division by zero
+	if (fabsf(d.x) < epsilon) { d.x = copysignf(epsilon, d.x); }
+	if (fabsf(d.y) < epsilon) { d.y = copysignf(epsilon, d.y); }
+	if (fabsf(d.z) < epsilon) { d.z = copysignf(epsilon, d.z); }
+
+	// precompute the coefficients of tx(x), ty(y), tz(z): the octree is mirrored so the ray direction is negative
+	float tx_coef = 1.0f / -fabsf(d.x);
+	float ty_coef = 1.0f / -fabsf(d.y);
+	float tz_coef = 1.0f / -fabsf(d.z);
+	float tx_bias = tx_coef * p.x;
+	float ty_bias = ty_coef * p.y;
+	float tz_bias = tz_coef * p.z;
+	int mirror = 0; // bit set: axis is mirrored, child i in mirrored space is child i ^ mirror in the octree
+	if (d.x > 0.0f) { mirror ^= 1; tx_bias = 3.0f * tx_coef - tx_bias; }
+	if (d.y > 0.0f) { mirror ^= 2; ty_bias = 3.0f * ty_coef - ty_bias; }
+	if (d.z > 0.0f) { mirror ^= 4; tz_bias = 3.0f * tz_coef - tz_bias; }
+
+	// initialize the active span of t-values
+	float t_min = std::max(std::max(2.0f * tx_coef - tx_bias, 2.0f * ty_coef - ty_bias), 2.0f * tz_coef - tz_bias);
+	float t_max = std::min(std::min(tx_coef - tx_bias, ty_coef - ty_bias), tz_coef - tz_bias);
+	float h = t_max;
+	t_min = std::max(t_min, 0.0f);
+	t_max = std::min(t_max, t_limit);
+	if (t_min > t_max) { return false; }
+
+	// initialize the current voxel to the first child of the root
+	SVONode parent = svo.root();
+	int idx = 0;
+	vec3 pos = vec3(1.0f);
+	int scale = s_max - 1;
+	float scale_exp2 = 0.5f;
+	if (1.5f * tx_coef - tx_bias > t_min) { idx ^= 1; pos.x = 1.5f; }
+	if (1.5f * ty_coef - ty_bias > t_min) { idx ^= 2; pos.y = 1.5f; }
+	if (1.5f * tz_coef - tz_bias > t_min) { idx ^= 4; pos.z = 1.5f; }
+
+	// traverse voxels along the ray as long as the current voxel stays within the octree
+	while (scale < s_max) {
+		// t where the ray leaves the current cube
+		float tx_corner = pos.x * tx_coef - tx_bias;
+		float ty_corner = pos.y * ty_coef - ty_bias;
+		float tz_corner = pos.z * tz_coef - tz_bias;
+		float tc_max = std::min(std::min(tx_corner, ty_corner), tz_corner);
+
+		// PUSH: the child exists and the active t-span is non-empty
+		unsigned int child_index = idx ^ mirror;
+		if (parent.hasChild(child_index) && t_min <= t_max) {
+			float tv_max = std::min(t_max, tc_max);
+			float half = scale_exp2 * 0.5f;
+			float tx_center = half * tx_coef + tx_corner;
+			float ty_center = half * ty_coef + ty_corner;
+			float tz_center = half * tz_coef + tz_corner;
+			if (t_min <= tv_max) {
+				SVONode c;
+				svo.child(parent, child_index, c);
+				int depth = s_max - scale;
+				if (depth >= max_depth || c.isLeaf()) { // hit
+					hit.t = t_min;
+					hit.depth = depth;
+					hit.node = c;
+					// undo the mirroring, the cube is [pos, pos + scale_exp2)
+					if (mirror & 1) { pos.x = 3.0f - scale_exp2 - pos.x; }
+					if (mirror & 2) { pos.y = 3.0f - scale_exp2 - pos.y; }
+					if (mirror & 4) { pos.z = 3.0f - scale_exp2 - pos.z; }
+					float cells = ldexpf(1.0f, depth);
+					hit.position = uvec3(static_cast<unsigned int>((pos.x - 1.0f) * cells), static_cast<unsigned int>((pos.y - 1.0f) * cells), static_cast<unsigned int>((pos.z - 1.0f) * cells));
+					return true;
+				}
+				// write the parent to the stack, unless it's already there from an earlier visit of this level
+				if (tc_max < h) { stack[scale].parent = parent; stack[scale].t_max = t_max; }
+				h = tc_max;
+				// find the child it enters first
+				parent = c;
+				idx = 0;
+				scale--;
+				scale_exp2 = half;
+				if (tx_center > t_min) { idx ^= 1; pos.x += scale_exp2; }
+				if (ty_center > t_min) { idx ^= 2; pos.y += scale_exp2; }
+				if (tz_center > t_min) { idx ^= 4; pos.z += scale_exp2; }
+				t_max = tv_max;
+				continue;
+			}
+		}
+
+		// ADVANCE: step along the axes whose planes the ray leaves the cube through
+		int step_mask = 0;
+		if (tx_corner <= tc_max) { step_mask ^= 1; pos.x -= scale_exp2; }
+		if (ty_corner <= tc_max) { step_mask ^= 2; pos.y -= scale_exp2; }
+		if (tz_corner <= tc_max) { step_mask ^= 4; pos.z -= scale_exp2; }
+		t_min = tc_max;
+		idx ^= step_mask;
+
+		// POP: the bits of idx we flipped went from 0 to 1, so we left the parent
+		if ((idx & step_mask) != 0) {
+			// the highest bit where the old and new positions differ tells how far up to go
+			unsigned int differing_bits = 0;
+			if (step_mask & 1) { differing_bits |= svoFloatAsInt(pos.x) ^ svoFloatAsInt(pos.x + scale_exp2); }
+			if (step_mask & 2) { differing_bits |= svoFloatAsInt(pos.y) ^ svoFloatAsInt(pos.y + scale_exp2); }
+			if (step_mask & 4) { differing_bits |= svoFloatAsInt(pos.z) ^ svoFloatAsInt(pos.z + scale_exp2); }
+			scale = (svoFloatAsInt(static_cast<float>(differing_bits)) >> 23) - 127; // position of the highest bit
+			if (scale >= s_max) { break; } // left the octree
+			scale_exp2 = svoIntAsFloat((scale - s_max + 127) << 23); // exp2f(scale - s_max)
+			parent = stack[scale].parent;
+			t_max = stack[scale].t_max;
+			// round the position down to the cube at the new scale, and get its child index
+			int shx = svoFloatAsInt(pos.x) >> scale;
+			int shy = svoFloatAsInt(pos.y) >> scale;
+			int shz = svoFloatAsInt(pos.z) >> scale;
+			pos.x = svoIntAsFloat(shx << scale);
+			pos.y = svoIntAsFloat(shy << scale);
+			pos.z = svoIntAsFloat(shz << scale);
+			idx = (shx & 1) | ((shy & 1) << 1) | ((shz & 1) << 2);
+			h = 0.0f; // the stack entries below this scale are stale now
+		}
+	}
+	return false;
+}
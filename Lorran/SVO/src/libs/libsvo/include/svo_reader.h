@@ -0,0 +1,407 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <stdint.h>
+#include <glm/glm.hpp>
+#include "mapped_file.h"
+#include "../../libmorton/include/morton_dispatch.h"
+#include "../../libtri/include/octnormal.h"
+
+using namespace std;
+using namespace glm;
+
+// Random-access reader for the octrees svo_builder writes (.octree header, .octreenodes, .octreedata and .octreelevels).
+// The node and payload files are memory-mapped: opening costs nothing, queries only touch the pages they need,
+// and any number of threads can query the same reader at once.
+
+// On-disk formats, as written by svo_builder/octree_io.h
+#define SVO_FORMAT_CLASSIC 1
+#define SVO_FORMAT_COMPACT 2
+#define SVO_FORMAT_DAG 3
+#define SVO_COMPACT_SHARED_LEAF_DATA 0x1
+
+// Classic node: data, children_base, children_offset[8] (-1: no child)
+struct SVOClassicNode {
+	size_t data;
+	size_t children_base;
+	signed char children_offset[8];
+};
+
+// Compact node: children are stored next to each other, leaves are payload indices instead of nodes
+struct SVOCompactNode {
+	uint32_t child_ptr;
+	uint8_t valid_mask;
+	uint8_t leaf_mask;
+	uint16_t flags;
+};
+
+// DAG node: a header word (valid mask in bits 0-7, leaf mask in bits 8-15), then the word offset of every
+// non-leaf child, in child order. Subtrees are shared, and all voxels use payload 1.
+#define SVO_DAG_LEAF_DATA 1
+
+// Octree header info
+struct SVOInfo {
+	int version;
+	string base_filename;
+	size_t gridlength;
+	size_t n_nodes;
+	size_t n_data;
+	bool levels; // compact format: internal node payloads in .octreelevels, one per node
+	bool packed_data; // packed payloads (octahedral normal + RGBA8)
+	size_t root; // DAG format: word offset of the root node
+	int brick_size; // brick output: node data are bricks of brick_size^3 texels, and the leaves are bricks
+	size_t n_bricks;
+	size_t atlas_size[3]; // in bricks
+
+	SVOInfo() : version(SVO_FORMAT_CLASSIC), gridlength(0), n_nodes(0), n_data(0), levels(false), packed_data(false), root(0), brick_size(0), n_bricks(0) {
+		atlas_size[0] = atlas_size[1] = atlas_size[2] = 0;
+	}
+};
+
+// A voxel payload, decoded
+struct SVOVoxel {
+	vec3 color;
+	vec3 normal;
+	SVOVoxel() : color(vec3()), normal(vec3()) {}
+};
+
+#define SVO_NODE_LEVEL_DATA 0x1 // payload is in .octreelevels, at the node index
+
+// A node as the reader hands it out, whatever the format on disk.
+// Children are numbered like the morton order: bit 0 of i is x, bit 1 is y, bit 2 is z.
+struct SVONode {
+	size_t index; // position in .octreenodes, in words for the DAG format (for leaves of the compact format: in .octreedata)
+	size_t data; // payload index in .octreedata, 0 if none
+	uint8_t child_mask; // bit i set: child i exists
+	uint8_t flags;
+
+	SVONode() : index(0), data(0), child_mask(0), flags(0) {}
+	bool hasChild(unsigned int i) const { return (child_mask >> i) & 1; }
+	bool isLeaf() const { return child_mask == 0; }
+	bool hasData() const { return data != 0 || (flags & SVO_NODE_LEVEL_DATA); }
+};
+
+// Payloads mirror VoxelData.h, but the reader decodes both layouts whatever it was compiled with
+const size_t SVO_VOXELDATA_SIZE = sizeof(::uint64_t) + 2 * (3 * sizeof(float)); // morton, color, normal
+const size_t SVO_VOXELDATA_PACKED_SIZE = 2 * sizeof(::uint32_t); // octahedral normal (octnormal.h), RGBA8 color
+inline vec3 svoDecodeRGBA8(::uint32_t e){
+	return vec3((e & 0xFF) / 255.0f, ((e >> 8) & 0xFF) / 255.0f, ((e >> 16) & 0xFF) / 255.0f);
+}
+
+inline unsigned int svoBitCount8(unsigned int v){
+	v = v - ((v >> 1) & 0x55);
+	v = (v & 0x33) + ((v >> 2) & 0x33);
+	return (v + (v >> 4)) & 0x0F;
+}
+
+// Parse an octree header (same keywords as svo_builder's parseOctreeHeader, but quiet unless something is wrong)
+inline bool parseSVOHeader(const std::string &filename, SVOInfo &i){
+	ifstream headerfile(filename.c_str(), ios::in);
+	if (!headerfile.good()) { cout << "Error: can't open octree header " << filename << endl; return false; }
+	i.base_filename = filename.substr(0, filename.find_last_of("."));
+
+	string line;
+	headerfile >> line >> i.version;
+	if (line.compare("#octreeheader") != 0) { cout << "Error: first line of " << filename << " reads [" << line << "] instead of [#octreeheader]" << endl; return false; }
+	bool done = false;
+	while (headerfile.good() && !done) {
+		headerfile >> line;
+		if (line.compare("END") == 0) done = true;
+		else if (line.compare("gridlength") == 0) { headerfile >> i.gridlength; }
+		else if (line.compare("n_nodes") == 0) { headerfile >> i.n_nodes; }
+		else if (line.compare("n_data") == 0) { headerfile >> i.n_data; }
+		else if (line.compare("levels") == 0) { headerfile >> i.levels; }
+		else if (line.compare("root") == 0) { headerfile >> i.root; }
+		else if (line.compare("bricks") == 0) { headerfile >> i.brick_size; }
+		else if (line.compare("n_bricks") == 0) { headerfile >> i.n_bricks; }
+		else if (line.compare("brick_atlas") == 0) { headerfile >> i.atlas_size[0] >> i.atlas_size[1] >> i.atlas_size[2]; }
+		else if (line.compare("data_format") == 0) { headerfile >> line; i.packed_data = (line.compare("packed") == 0); }
+		else { char c; do { c = headerfile.get(); } while (headerfile.good() && (c != '\n')); } // unknown keyword: skip the line
+	}
+	return done;
+}
+
+class SVOReader {
+public:
+	SVOReader() : m_maxdepth(0), m_brick_levels(0), m_node_size(0), m_data_size(0) {}
+
+	// Open an octree by its header file (.octree). Returns false (and says why) if the files don't match the header.
+	bool open(const std::string &header_filename);
+	void close();
+
+	const SVOInfo& info() const { return m_info; }
+	size_t gridLength() const { return m_info.gridlength; }
+	int maxDepth() const { return m_maxdepth; } // depth of the leaves (voxels, or bricks), the root is at depth 0
+	int brickSize() const { return m_info.brick_size; } // 0 if the octree has no bricks
+
+	// TRAVERSAL
+	SVONode root() const;
+	// Get child i of n, returns false if there is no such child
+	bool child(const SVONode &n, unsigned int i, SVONode &c) const;
+	// Call f(i, child) for every child of n, in child order
+	template <typename F> void forEachChild(const SVONode &n, F f) const;
+	// Decode the payload of a node, returns false if it has none (or if the octree has bricks instead)
+	bool voxel(const SVONode &n, SVOVoxel &v) const;
+	// Brick output: decode texel t of the brick of a node, and the fraction of it that is filled
+	bool brickVoxel(const SVONode &n, const uvec3 &t, SVOVoxel &v, float &coverage) const;
+
+	// POINT LOOKUP: find the node at the given depth (default: the voxel, or its brick) that contains a morton code of the full grid
+	bool lookup(const ::uint64_t morton, SVONode &n, int depth = -1) const;
+	bool lookup(const unsigned int x, const unsigned int y, const unsigned int z, SVONode &n) const;
+
+	// BOX QUERY: call f(position, leaf) for every voxel with min <= position <= max, in morton order. Returns the number of voxels.
+	// With bricks, the leaves are the bricks that overlap the box, and position is their first voxel.
+	template <typename F> size_t queryBox(const uvec3 &min, const uvec3 &max, F f) const;
+
+private:
+	SVOReader(const SVOReader &);
+	SVOReader& operator=(const SVOReader &);
+
+	SVONode readNode(const size_t index) const;
+
+	SVOInfo m_info;
+	int m_maxdepth;
+	int m_brick_levels; // voxel levels inside a leaf brick
+	size_t m_node_size;
+	size_t m_data_size;
+	MappedFile m_nodes;
+	MappedFile m_data;
+	MappedFile m_levels;
+	MappedFile m_bricks;
+	MappedFile m_brick_normals;
+};
+
+inline bool SVOReader::open(const std::string &header_filename){
+	close();
+	if (!parseSVOHeader(header_filename, m_info)) { return false; }
+	if (m_info.version != SVO_FORMAT_CLASSIC && m_info.version != SVO_FORMAT_COMPACT && m_info.version != SVO_FORMAT_DAG) {
+		cout << "Error: unknown octree format version " << m_info.version << endl;
+		return false;
+	}
+	if (m_info.gridlength == 0 || (m_info.gridlength & (m_info.gridlength - 1)) != 0 || m_info.n_nodes == 0) {
+		cout << "Error: octree header " << header_filename << " has no valid gridlength / n_nodes" << endl;
+		return false;
+	}
+	m_maxdepth = 0;
+	while ((size_t(1) << m_maxdepth) < m_info.gridlength) { m_maxdepth++; }
+	m_brick_levels = 0;
+	while (m_info.brick_size > 0 && (1 << m_brick_levels) < m_info.brick_size) { m_brick_levels++; }
+	m_maxdepth -= m_brick_levels; // the tree stops at the leaf bricks
+	m_node_size = (m_info.version == SVO_FORMAT_CLASSIC) ? 3 * sizeof(size_t) : sizeof(SVOCompactNode);
+	if (m_info.version == SVO_FORMAT_DAG) { m_node_size = sizeof(uint32_t); } // nodes have different sizes: count in words
+	m_data_size = m_info.packed_data ? SVO_VOXELDATA_PACKED_SIZE : SVO_VOXELDATA_SIZE;
+
+	string nodes_name = m_info.base_filename + string(".octreenodes");
+	string data_name = m_info.base_filename + string(".octreedata");
+	string levels_name = m_info.base_filename + string(".octreelevels");
+	bool uses_levels = (m_info.version == SVO_FORMAT_COMPACT && m_info.levels);
+	if (!m_nodes.open(nodes_name) || !m_data.open(data_name) || (uses_levels && !m_levels.open(levels_name))) {
+		cout << "Error: can't map the octree files of " << m_info.base_filename << endl;
+		close();
+		return false;
+	}
+	size_t min_nodes_size = (m_info.version == SVO_FORMAT_DAG) ? (m_info.root + 1) * m_node_size : m_info.n_nodes * m_node_size;
+	if (m_nodes.size() < min_nodes_size || m_data.size() < m_info.n_data * m_data_size
+		|| (uses_levels && m_levels.size() < m_info.n_nodes * m_data_size)) {
+		cout << "Error: the octree files of " << m_info.base_filename << " are smaller than their header says" << endl;
+		close();
+		return false;
+	}
+	if (m_info.brick_size > 0) {
+		size_t atlas_bytes = m_info.atlas_size[0] * m_info.atlas_size[1] * m_info.atlas_size[2] * m_info.brick_size * m_info.brick_size * m_info.brick_size * sizeof(uint32_t);
+		if (!m_bricks.open(m_info.base_filename + string(".octreebricks")) || !m_brick_normals.open(m_info.base_filename + string(".octreebricknormals"))
+			|| m_bricks.size() < atlas_bytes || m_brick_normals.size() < atlas_bytes) {
+			cout << "Error: the brick atlases of " << m_info.base_filename << " are missing or smaller than their header says" << endl;
+			close();
+			return false;
+		}
+	}
+	m_nodes.adviseRandomAccess();
+	m_data.adviseRandomAccess();
+	return true;
+}
+
+inline void SVOReader::close(){
+	m_nodes.close();
+	m_data.close();
+	m_levels.close();
+	m_bricks.close();
+	m_brick_normals.close();
+	m_info = SVOInfo();
+	m_maxdepth = 0;
+	m_brick_levels = 0;
+}
+
+// The root is the last node written
+inline SVONode SVOReader::root() const{
+	if (m_info.version == SVO_FORMAT_DAG) { return readNode(m_info.root); }
+	return readNode(m_info.n_nodes - 1);
+}
+
+inline SVONode SVOReader::readNode(const size_t index) const{
+	SVONode n;
+	n.index = index;
+	const char* p = m_nodes.data() + index * m_node_size;
+	if (m_info.version == SVO_FORMAT_CLASSIC) {
+		SVOClassicNode c;
+		memcpy(&c, p, sizeof(SVOClassicNode));
+		n.data = c.data;
+		for (unsigned int i = 0; i < 8; i++) {
+			if (c.children_offset[i] != -1) { n.child_mask |= (1 << i); }
+		}
+	}
+	else if (m_info.version == SVO_FORMAT_COMPACT) {
+		SVOCompactNode c;
+		memcpy(&c, p, sizeof(SVOCompactNode));
+		n.child_mask = c.valid_mask;
+		if (m_info.levels) { n.flags |= SVO_NODE_LEVEL_DATA; }
+	}
+	else {
+		uint32_t header;
+		memcpy(&header, p, sizeof(uint32_t));
+		n.child_mask = header & 0xFF;
+	}
+	return n;
+}
+
+inline bool SVOReader::child(const SVONode &n, unsigned int i, SVONode &c) const{
+	if (!n.hasChild(i)) { return false; }
+	const char* p = m_nodes.data() + n.index * m_node_size;
+	if (m_info.version == SVO_FORMAT_CLASSIC) {
+		SVOClassicNode raw;
+		memcpy(&raw, p, sizeof(SVOClassicNode));
+		c = readNode(raw.children_base + raw.children_offset[i]);
+		return true;
+	}
+	if (m_info.version == SVO_FORMAT_DAG) {
+		uint32_t header;
+		memcpy(&header, p, sizeof(uint32_t));
+		if ((header >> (8 + i)) & 1) { // voxel
+			c = SVONode();
+			c.index = c.data = (m_info.n_data > SVO_DAG_LEAF_DATA) ? SVO_DAG_LEAF_DATA : 0;
+			return true;
+		}
+		unsigned int nodes_before = svoBitCount8(header & ~(header >> 8) & ((1u << i) - 1)); // non-leaf children before i
+		uint32_t pos;
+		memcpy(&pos, p + (1 + nodes_before) * sizeof(uint32_t), sizeof(uint32_t));
+		c = readNode(pos);
+		return true;
+	}
+	SVOCompactNode raw;
+	memcpy(&raw, p, sizeof(SVOCompactNode));
+	size_t pos = raw.child_ptr;
+	bool leaf = (raw.leaf_mask >> i) & 1;
+	if (!(leaf && (raw.flags & SVO_COMPACT_SHARED_LEAF_DATA))) {
+		pos += svoBitCount8(raw.valid_mask & ((1u << i) - 1)); // children are stored in child order
+	}
+	if (leaf) { // leaves are payload indices
+		c = SVONode();
+		c.index = pos;
+		c.data = pos;
+		return true;
+	}
+	c = readNode(pos);
+	return true;
+}
+
+template <typename F>
+inline void SVOReader::forEachChild(const SVONode &n, F f) const{
+	SVONode c;
+	for (unsigned int i = 0; i < 8; i++) {
+		if (child(n, i, c)) { f(i, c); }
+	}
+}
+
+inline bool SVOReader::voxel(const SVONode &n, SVOVoxel &v) const{
+	if (!n.hasData() || m_info.brick_size > 0) { return false; }
+	const char* p;
+	if (n.flags & SVO_NODE_LEVEL_DATA) { p = m_levels.data() + n.index * m_data_size; }
+	else { p = m_data.data() + n.data * m_data_size; }
+	if (m_info.packed_data) {
+		::uint32_t e[2];
+		memcpy(e, p, sizeof(e));
+		v.normal = decodeOctNormal(e[0]);
+		v.color = svoDecodeRGBA8(e[1]);
+	}
+	else {
+		float f[6];
+		memcpy(f, p + sizeof(::uint64_t), sizeof(f));
+		v.color = vec3(f[0], f[1], f[2]);
+		v.normal = vec3(f[3], f[4], f[5]);
+	}
+	return true;
+}
+
+// Brick i sits at (i % W, (i / W) % H, i / (W * H)) in the atlas, in brick units. Texels are RGBA8 (alpha is coverage)
+// and octahedral normals, stored x fastest.
+inline bool SVOReader::brickVoxel(const SVONode &n, const uvec3 &t, SVOVoxel &v, float &coverage) const{
+	if (m_info.brick_size == 0 || n.data == 0) { return false; }
+	size_t b = static_cast<size_t>(m_info.brick_size);
+	size_t w = m_info.atlas_size[0] * b, h = m_info.atlas_size[1] * b;
+	size_t x = (n.data % m_info.atlas_size[0]) * b + t.x;
+	size_t y = ((n.data / m_info.atlas_size[0]) % m_info.atlas_size[1]) * b + t.y;
+	size_t z = (n.data / (m_info.atlas_size[0] * m_info.atlas_size[1])) * b + t.z;
+	size_t offset = ((z * h + y) * w + x) * sizeof(uint32_t);
+	uint32_t color, normal;
+	memcpy(&color, m_bricks.data() + offset, sizeof(uint32_t));
+	memcpy(&normal, m_brick_normals.data() + offset, sizeof(uint32_t));
+	v.color = svoDecodeRGBA8(color);
+	v.normal = decodeOctNormal(normal);
+	coverage = (color >> 24) / 255.0f;
+	return true;
+}
+
+// Each level down takes the next 3 bits of the morton code, from the top
+inline bool SVOReader::lookup(const ::uint64_t morton, SVONode &n, int depth) const{
+	if (depth < 0 || depth > m_maxdepth) { depth = m_maxdepth; }
+	n = root();
+	for (int d = 0; d < depth; d++) {
+		unsigned int i = static_cast<unsigned int>(morton >> (3 * (m_maxdepth + m_brick_levels - 1 - d))) & 7;
+		if (!child(n, i, n)) { return false; }
+	}
+	return true;
+}
+
+inline bool SVOReader::lookup(const unsigned int x, const unsigned int y, const unsigned int z, SVONode &n) const{
+	if (x >= m_info.gridlength || y >= m_info.gridlength || z >= m_info.gridlength) { return false; }
+	return lookup(morton3D_64_encode_dispatch(x, y, z), n);
+}
+
+template <typename F>
+inline size_t SVOReader::queryBox(const uvec3 &min, const uvec3 &max, F f) const{
+	struct Entry { SVONode node; uvec3 corner; int depth; };
+	size_t found = 0;
+	vector<Entry> stack;
+	Entry e;
+	e.node = root();
+	e.corner = uvec3(0, 0, 0);
+	e.depth = 0;
+	stack.push_back(e);
+	while (!stack.empty()) {
+		Entry top = stack.back();
+		stack.pop_back();
+		if (top.depth == m_maxdepth) {
+			f(top.corner, top.node);
+			found++;
+			continue;
+		}
+		unsigned int half = static_cast<unsigned int>(m_info.gridlength >> (top.depth + 1));
+		// push in reverse child order, so voxels come out in morton order
+		for (int i = 7; i >= 0; i--) {
+			if (!top.node.hasChild(i)) { continue; }
+			uvec3 lo = top.corner + uvec3(i & 1, (i >> 1) & 1, (i >> 2) & 1) * half;
+			if (lo.x > max.x || lo.y > max.y || lo.z > max.z) { continue; }
+			if (lo.x + half - 1 < min.x || lo.y + half - 1 < min.y || lo.z + half - 1 < min.z) { continue; }
+			Entry c;
+			child(top.node, i, c.node);
+			c.corner = lo;
+			c.depth = top.depth + 1;
+			stack.push_back(c);
+		}
+	}
+	return found;
+}
@@ -1,65 +1,229 @@
 #pragma once
 
 #include "tri_tools.h"
+#include "tri_compress.h"
+#include "tri_indexed.h"
 #include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TRIREADER_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
-// A class to read triangles from a .tridata file.
+// How far ahead of the current position we ask the OS to prefetch when memory-mapped (in bytes)
+#define TRIREADER_READAHEAD (32*1024*1024)
+
+// A class to read triangles from a .tridata file, as records of type T (GeometryTriangle or ColorTriangle, see tri_util.h).
+// On platforms with mmap, the file is mapped and triangles are served straight from the mapping (no copies),
+// otherwise it falls back to buffered fread. Compressed streams (see tri_compress.h) are recognized by their header,
+// and decoded a batch of blocks at a time. Given a vertex file, the file holds index triples (see tri_indexed.h), which
+// are read a buffer at a time and expanded into triangles. Triangles that are already in memory (in chunks) are served in place, a chunk at a time.
+// Given a sort bbox, every buffer fill is sorted by the morton code of the triangle centroids (a mapping is read into a buffer instead),
+// so consumers walk space in morton order: a buffer as big as the file sorts it all, smaller ones give sorted runs.
+template <typename T>
 class TriReader{
 	size_t n_triangles;
-	size_t n_read; 
-	size_t n_served; 
+	size_t n_read;
+	size_t n_served;
 
 	size_t current_tri; // current triangle id we're going to read
 
-	size_t buffersize; 
-	Triangle* buffer;
+	size_t buffersize;
+	size_t buffer_fill; // triangles in the buffer
+	T* buffer;
 
 	FILE* file;
+	TriBlockReader<T>* blocks; // compressed stream, NULL otherwise
+
+	// indexed mode
+	const TriVertices<T>* vertices; // NULL if the file holds full triangles
+	IndexedTriangle<T>* records; // index triples of the triangles in the buffer
+	size_t batch_start; // buffer position of the last batch handed out
+
+	// in-memory mode
+	const vector<vector<T> >* chunks; // NULL if we read a file
+	size_t next_chunk;
+
+	// morton sorting
+	bool sorting;
+	AABox<glm::vec3> sort_bbox;
+	T* sort_scratch;
+	vector<pair< ::uint64_t, ::uint32_t> > sort_keys, sort_keys_scratch;
+	double sort_ms;
+
+	// memory-mapped mode
+	const T* mapped; // start of the mapped file, NULL if we're using fread
+	size_t mapped_bytes;
+	size_t advised_until; // byte offset up to which we've already requested readahead
 
 public:
 	TriReader();
-	TriReader(const TriReader&);
-	TriReader(const std::string &filename, size_t n_triangles, size_t buffersize);
-	void getTriangle(Triangle& t);
-	Triangle getTriangle();
+	TriReader(TriReader&& other); // takes over the file, mapping and buffers of other
+	TriReader(const std::string &filename, size_t n_triangles, size_t buffersize, const TriVertices<T>* vertices = NULL, const AABox<glm::vec3>* sort_bbox = NULL);
+	TriReader(const vector<vector<T> > &chunks, size_t n_triangles, size_t buffersize = 0, const AABox<glm::vec3>* sort_bbox = NULL);
+	void getTriangle(T& t);
+	T getTriangle();
+	size_t getTriangles(const T* &tris, size_t max_count);
+	const IndexedTriangle<T>* indices() const;
+	double sortMilliseconds() const;
 	bool hasNext();
 	~TriReader();
 private:
+	// a reader owns its file, mapping and buffers: it can be moved, but not copied
+	TriReader(const TriReader&);
+	TriReader& operator=(const TriReader&);
+
 	void fillBuffer();
+	void readBuffer();
+	void sortBuffer();
+	bool mapFile(const std::string &filename);
+	bool openCompressed(const std::string &filename);
+	void adviseReadahead();
 };
 
-inline TriReader::TriReader(){
-	// TODO
+// A reader without triangles
+template <typename T>
+inline TriReader<T>::TriReader(): n_triangles(0), n_read(0), n_served(0), current_tri(0), buffersize(0), buffer_fill(0), buffer(NULL), file(NULL), blocks(NULL),
+	vertices(NULL), records(NULL), batch_start(0), chunks(NULL), next_chunk(0), sorting(false), sort_scratch(NULL), sort_ms(0.0), mapped(NULL), mapped_bytes(0), advised_until(0){
 }
 
-inline TriReader::TriReader(const TriReader&){
-	// TODO
+template <typename T>
+inline TriReader<T>::TriReader(TriReader&& other): n_triangles(other.n_triangles), n_read(other.n_read), n_served(other.n_served), current_tri(other.current_tri),
+	buffersize(other.buffersize), buffer_fill(other.buffer_fill), buffer(other.buffer), file(other.file), blocks(other.blocks), vertices(other.vertices),
+	records(other.records), batch_start(other.batch_start), chunks(other.chunks), next_chunk(other.next_chunk), sorting(other.sorting), sort_bbox(other.sort_bbox),
+	sort_scratch(other.sort_scratch), sort_keys(std::move(other.sort_keys)), sort_keys_scratch(std::move(other.sort_keys_scratch)), sort_ms(other.sort_ms),
+	mapped(other.mapped), mapped_bytes(other.mapped_bytes), advised_until(other.advised_until){
+	// other keeps nothing to free
+	other.buffer = NULL;
+	other.file = NULL;
+	other.blocks = NULL;
+	other.records = NULL;
+	other.sort_scratch = NULL;
+	other.mapped = NULL;
+	other.mapped_bytes = 0;
 }
 
-inline TriReader::TriReader(const std::string &filename, size_t n_triangles, size_t buffersize): n_triangles(n_triangles), buffersize(buffersize), n_read(0), current_tri(0), n_served(0){
+template <typename T>
+inline TriReader<T>::TriReader(const std::string &filename, size_t n_triangles, size_t buffersize, const TriVertices<T>* vertices, const AABox<glm::vec3>* sort_bbox): n_triangles(n_triangles), buffersize(buffersize), n_read(0), current_tri(0), n_served(0),
+	buffer_fill(0), buffer(NULL), file(NULL), blocks(NULL), vertices(vertices), records(NULL), batch_start(0), chunks(NULL), next_chunk(0),
+	sorting(sort_bbox != NULL), sort_scratch(NULL), sort_ms(0.0), mapped(NULL), mapped_bytes(0), advised_until(0){
+	if (sorting) { this->sort_bbox = *sort_bbox; }
+	if (vertices != NULL) {
+		buffer = new T[buffersize];
+		records = new IndexedTriangle<T>[buffersize];
+		file = fopen(filename.c_str(), "rb");
+		return;
+	}
+	if (openCompressed(filename)) {
+		return;
+	}
+	if (!sorting && mapFile(filename)) {
+		return; // served from the mapping, no buffer needed
+	}
 	// prepare buffer
-	buffer = new Triangle[buffersize];
+	buffer = new T[buffersize];
 	// prepare file
 	file = fopen(filename.c_str(), "rb");
-	// fill Buffer
-	fillBuffer();
+	// the buffer is filled on the first read, so reading (and sorting) is timed where the triangles are consumed
 }
 
-inline Triangle TriReader::getTriangle(){
-	if(current_tri == buffersize){ // at end of buffer, refill it
-		fillBuffer();
-		current_tri = 0;
+// Serve triangles from memory, a chunk at a time (they have to outlive the reader). Sorting copies as many chunks as fit the buffer.
+template <typename T>
+inline TriReader<T>::TriReader(const vector<vector<T> > &chunks, size_t n_triangles, size_t buffersize, const AABox<glm::vec3>* sort_bbox): n_triangles(n_triangles), buffersize(buffersize), n_read(0), current_tri(0), n_served(0),
+	buffer_fill(0), buffer(NULL), file(NULL), blocks(NULL), vertices(NULL), records(NULL), batch_start(0), chunks(&chunks), next_chunk(0),
+	sorting(sort_bbox != NULL), sort_scratch(NULL), sort_ms(0.0), mapped(NULL), mapped_bytes(0), advised_until(0){
+	if (sorting) {
+		this->sort_bbox = *sort_bbox;
+		for (size_t c = 0; c < chunks.size(); c++) { this->buffersize = std::max(this->buffersize, chunks[c].size()); }
+		buffer = new T[this->buffersize];
 	}
-	Triangle t = buffer[current_tri]; // assign triangle from buffer
-	current_tri++; // set index for next triangle
-	n_served++;
+}
+
+// If the file is a compressed stream, decode it into a buffer of whole blocks
+template <typename T>
+inline bool TriReader<T>::openCompressed(const std::string &filename){
+	file = fopen(filename.c_str(), "rb");
+	TriLattice lattice;
+	bool geometry_only;
+	if (!readTriStreamHeader(file, lattice, geometry_only)) {
+		if (file != NULL) { fclose(file); }
+		file = NULL;
+		return false;
+	}
+	buffersize = std::max<size_t>(buffersize, TRIZ_BLOCK_TRIANGLES);
+	buffer = new T[buffersize];
+	blocks = new TriBlockReader<T>(file, lattice, geometry_only);
+	return true;
+}
+
+// Map the whole file read-only and tell the OS we'll read it front to back.
+template <typename T>
+inline bool TriReader<T>::mapFile(const std::string &filename){
+#ifdef TRIREADER_MMAP
+	size_t bytes = n_triangles*sizeof(T);
+	if (bytes == 0) { return false; }
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1) { return false; }
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < bytes) { close(fd); return false; }
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, bytes, POSIX_FADV_SEQUENTIAL);
+#endif
+	void* m = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps the file referenced
+	if (m == MAP_FAILED) { return false; }
+	madvise(m, bytes, MADV_SEQUENTIAL);
+	mapped = static_cast<const T*>(m);
+	mapped_bytes = bytes;
+	adviseReadahead();
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Ask the OS to start reading the next window of the mapping before we touch it.
+template <typename T>
+inline void TriReader<T>::adviseReadahead(){
+#ifdef TRIREADER_MMAP
+	size_t position = n_served*sizeof(T);
+	if (position + (TRIREADER_READAHEAD / 2) < advised_until || advised_until == mapped_bytes) {
+		return; // still far enough ahead
+	}
+	size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t from = (std::max(position, advised_until) / page) * page;
+	size_t until = std::min(mapped_bytes, position + TRIREADER_READAHEAD);
+	if (until > from) {
+		madvise(const_cast<char*>(reinterpret_cast<const char*>(mapped)) + from, until - from, MADV_WILLNEED);
+	}
+	advised_until = until;
+#endif
+}
+
+template <typename T>
+inline T TriReader<T>::getTriangle(){
+	T t;
+	getTriangle(t);
 	return t;
 }
 
-inline void TriReader::getTriangle(Triangle& t){
-	if(current_tri == buffersize){ // at end of buffer, refill it
+template <typename T>
+inline void TriReader<T>::getTriangle(T& t){
+	if (mapped != NULL) {
+		t = mapped[n_served];
+		n_served++;
+		if ((n_served & 0xFFF) == 0) { adviseReadahead(); }
+		return;
+	}
+	if(current_tri == buffer_fill){ // at end of buffer, refill it
 		fillBuffer();
 		current_tri = 0;
 	}
@@ -68,17 +232,166 @@ inline void TriReader::getTriangle(Triangle& t){
 	n_served++;
 }
 
-inline bool TriReader::hasNext(){
+// Get a contiguous batch of at most max_count triangles without copying them, returns how many there are (0 at the end).
+// The pointer stays valid until the next call to any of the get methods.
+template <typename T>
+inline size_t TriReader<T>::getTriangles(const T* &tris, size_t max_count){
+	if (mapped != NULL) {
+		size_t count = std::min(max_count, n_triangles - n_served);
+		tris = mapped + n_served;
+		n_served += count;
+		adviseReadahead();
+		return count;
+	}
+	if (n_served == n_triangles) {
+		return 0;
+	}
+	if(current_tri == buffer_fill){ // at end of buffer, refill it
+		fillBuffer();
+		current_tri = 0;
+	}
+	size_t in_buffer = std::min(buffer_fill - current_tri, n_triangles - n_served);
+	size_t count = std::min(max_count, in_buffer);
+	tris = buffer + current_tri;
+	batch_start = current_tri;
+	current_tri += count;
+	n_served += count;
+	return count;
+}
+
+// The index triples of the last batch from getTriangles (indexed mode only), valid as long as the batch is
+template <typename T>
+inline const IndexedTriangle<T>* TriReader<T>::indices() const{
+	return records + batch_start;
+}
+
+// Time spent sorting buffers so far
+template <typename T>
+inline double TriReader<T>::sortMilliseconds() const{
+	return sort_ms;
+}
+
+template <typename T>
+inline bool TriReader<T>::hasNext(){
 	return (n_served < n_triangles);
 }
 
-inline void TriReader::fillBuffer(){
+template <typename T>
+inline void TriReader<T>::fillBuffer(){
+	readBuffer();
+	if (sorting && buffer_fill > 1) {
+		sortBuffer();
+	}
+}
+
+template <typename T>
+inline void TriReader<T>::readBuffer(){
+	if (chunks != NULL && sorting) { // copy whole chunks while they fit
+		buffer_fill = 0;
+		while (next_chunk < chunks->size() && buffer_fill + (*chunks)[next_chunk].size() <= buffersize) {
+			std::copy((*chunks)[next_chunk].begin(), (*chunks)[next_chunk].end(), buffer + buffer_fill);
+			buffer_fill += (*chunks)[next_chunk].size();
+			next_chunk++;
+		}
+		n_read += buffer_fill;
+		return;
+	}
+	if (chunks != NULL) { // the next chunk is the buffer (only read from, never written)
+		buffer_fill = 0;
+		if (next_chunk < chunks->size()) {
+			buffer = const_cast<T*>(&(*chunks)[next_chunk][0]);
+			buffer_fill = (*chunks)[next_chunk].size();
+			next_chunk++;
+		}
+		n_read += buffer_fill;
+		return;
+	}
+	if (blocks != NULL) {
+		buffer_fill = blocks->read(buffer, buffersize);
+		if (buffer_fill == 0 && n_read < n_triangles) {
+			cout << "Error: compressed triangle stream ends after " << n_read << " of " << n_triangles << " triangles" << endl;
+			exit(1);
+		}
+		n_read += buffer_fill;
+		return;
+	}
+	if (vertices != NULL) {
+		size_t readcount = std::min(buffersize, n_triangles - n_read);
+		if (readcount > 0 && (file == NULL || fread(records, sizeof(IndexedTriangle<T>), readcount, file) != readcount)) {
+			cout << "Error: indexed triangle file ends after " << n_read << " of " << n_triangles << " triangles" << endl;
+			exit(1);
+		}
+		for (size_t i = 0; i < readcount; i++) {
+			if (!vertices->expand(records[i], buffer[i])) {
+				cout << "Error: triangle " << n_read + i << " points past the " << vertices->size() << " vertices of the vertex file" << endl;
+				exit(1);
+			}
+		}
+		n_read += readcount;
+		buffer_fill = readcount;
+		return;
+	}
 	size_t readcount = glm::min(buffersize, n_triangles - n_read); // don't read more than there are
 	readTriangles(file,buffer[0],readcount); // read new triangles
 	n_read += readcount; // update the number of tri's we've read
+	buffer_fill = readcount;
 }
 
-inline TriReader::~TriReader(){
-	delete buffer;
-	fclose(file);
+// Sort the buffer by the morton code of the triangle centroids (and the index triples along with it).
+// The keys are radix sorted (LSD, 11 bits a pass) on the top 33 bits of their range: 2048 cells a side of what the buffer covers,
+// finer than any voxel grid (ties keep their order).
+template <typename T>
+inline void TriReader<T>::sortBuffer(){
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	sort_keys.resize(buffer_fill);
+	sort_keys_scratch.resize(buffer_fill);
+	::uint64_t lowest = ~::uint64_t(0), highest = 0;
+	for (size_t i = 0; i < buffer_fill; i++) {
+		glm::vec3 centroid = (buffer[i].v0 + buffer[i].v1 + buffer[i].v2) / 3.0f;
+		::uint64_t key = triVertexMorton(centroid, sort_bbox);
+		lowest = std::min(lowest, key);
+		highest = std::max(highest, key);
+		sort_keys[i] = make_pair(key, static_cast< ::uint32_t>(i));
+	}
+	const ::uint64_t range = highest - lowest;
+	int range_bits = 0;
+	while (range_bits < 64 && (range >> range_bits) != 0) { range_bits++; }
+	size_t counts[2048];
+	for (int shift = std::max(0, range_bits - 33); shift < range_bits; shift += 11) {
+		std::fill(counts, counts + 2048, 0);
+		for (size_t i = 0; i < buffer_fill; i++) { counts[((sort_keys[i].first - lowest) >> shift) & 2047]++; }
+		size_t offset = 0;
+		for (int d = 0; d < 2048; d++) { size_t c = counts[d]; counts[d] = offset; offset += c; }
+		for (size_t i = 0; i < buffer_fill; i++) { sort_keys_scratch[counts[((sort_keys[i].first - lowest) >> shift) & 2047]++] = sort_keys[i]; }
+		sort_keys.swap(sort_keys_scratch);
+	}
+	if (sort_scratch == NULL) { sort_scratch = new T[buffersize]; }
+	for (size_t i = 0; i < buffer_fill; i++) {
+		sort_scratch[i] = buffer[sort_keys[i].second];
+	}
+	std::swap(buffer, sort_scratch);
+	if (records != NULL) {
+		vector<IndexedTriangle<T> > unsorted(records, records + buffer_fill);
+		for (size_t i = 0; i < buffer_fill; i++) {
+			records[i] = unsorted[sort_keys[i].second];
+		}
+	}
+	sort_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+template <typename T>
+inline TriReader<T>::~TriReader(){
+#ifdef TRIREADER_MMAP
+	if (mapped != NULL) {
+		munmap(const_cast<T*>(mapped), mapped_bytes);
+		return;
+	}
+#endif
+	delete blocks;
+	delete[] records;
+	if (chunks == NULL || sorting) { delete[] buffer; }
+	delete[] sort_scratch;
+	if (file != NULL) {
+		fclose(file);
+	}
 }
\ No newline at end of file
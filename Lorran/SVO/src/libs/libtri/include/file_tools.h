@@ -3,6 +3,14 @@
 #include <string>
 #include <stdio.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <sys/stat.h>
+#elif defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
 using namespace std;
 
 // Various file operations, implemented in standard C
@@ -20,6 +28,39 @@ inline void copy_file(const std::string& src, const std::string& dst){
     fclose(dest);
 }
 
+// Make dst another name for src (a hard link), so nothing gets copied. Falls back to a copy where
+// we can't link (no POSIX, or dst on another filesystem).
+inline void link_file(const std::string& src, const std::string& dst){
+	remove(dst.c_str()); // link won't replace an existing file
+#if defined(__unix__) || defined(__APPLE__)
+	if (link(src.c_str(), dst.c_str()) == 0) {
+		return;
+	}
+#endif
+	copy_file(src, dst);
+}
+
+// Cut a file back to its first size bytes. False if it doesn't exist, or is shorter than that.
+inline bool truncate_file(const std::string& name, const size_t size){
+#if defined(__unix__) || defined(__APPLE__)
+	struct stat st;
+	if (stat(name.c_str(), &st) != 0 || static_cast<size_t>(st.st_size) < size) {
+		return false;
+	}
+	return truncate(name.c_str(), static_cast<off_t>(size)) == 0;
+#elif defined(_WIN32)
+	int fd = _open(name.c_str(), _O_RDWR | _O_BINARY);
+	if (fd == -1) {
+		return false;
+	}
+	bool ok = _filelengthi64(fd) >= static_cast<__int64>(size) && _chsize_s(fd, static_cast<__int64>(size)) == 0;
+	_close(fd);
+	return ok;
+#else
+	return false;
+#endif
+}
+
 // Check if a file exists using stdio
 inline bool file_exists(const std::string& name) {
 	if (FILE *file = fopen(name.c_str(), "r")) {
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+// Octahedral normals: a normal as two 16-bit snorms on the octahedron (Cigolle et al., A Survey of Efficient Representations for
+// Independent Unit Vectors). The one codec for compressed triangle streams (tri_compress.h), packed svo payloads and brick atlases
+// (svo_builder VoxelData.h) and the octree reader (libsvo svo_reader.h).
+
+// Encoding of the zero vector (the encoder never produces -32768 as a component)
+const ::uint32_t OCTNORMAL_ZERO = 0x00008000;
+
+// Encode a normal (a zero or NaN normal encodes as OCTNORMAL_ZERO)
+inline ::uint32_t encodeOctNormal(const glm::vec3 &n){
+	float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (!(l1 > 0.0f)) { return OCTNORMAL_ZERO; }
+	float x = n.x / l1, y = n.y / l1;
+	if (n.z < 0.0f) { // copysign: a -0 on the fold keeps its side, so a decoded normal encodes back to its code
+		float fx = std::copysign(1.0f - std::abs(y), x);
+		float fy = std::copysign(1.0f - std::abs(x), y);
+		x = fx; y = fy;
+	}
+	::int16_t ex = static_cast<::int16_t>(std::round(std::min(std::max(x, -1.0f), 1.0f) * 32767.0f));
+	::int16_t ey = static_cast<::int16_t>(std::round(std::min(std::max(y, -1.0f), 1.0f) * 32767.0f));
+	return (static_cast<::uint32_t>(static_cast<::uint16_t>(ey)) << 16) | static_cast<::uint16_t>(ex);
+}
+
+// Decode an octahedral normal
+inline glm::vec3 decodeOctNormal(const ::uint32_t e){
+	if (e == OCTNORMAL_ZERO) { return glm::vec3(0.0f); }
+	float x = static_cast<::int16_t>(e & 0xFFFF) / 32767.0f;
+	float y = static_cast<::int16_t>(e >> 16) / 32767.0f;
+	glm::vec3 n(x, y, 1.0f - std::abs(x) - std::abs(y));
+	if (n.z < 0.0f) {
+		n.x = std::copysign(1.0f - std::abs(y), x);
+		n.y = std::copysign(1.0f - std::abs(x), y);
+	}
+	return glm::normalize(n);
+}
@@ -0,0 +1,487 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "tri_util.h"
+#include "octnormal.h"
+
+using namespace std;
+
+// Compressed triangle stream (.tridata / .tripdata written with -compress)
+//
+// File: a header (magic, version, geometry-only flag, quantization lattice), then blocks of up to TRIZ_BLOCK_TRIANGLES triangles.
+// Block: triangle count, decoded size, stored size, then the stored bytes (LZ-coded, or as-is when that doesn't shrink them).
+// Decoded block: a vertex stream with the vertex coordinates on the file's lattice, where vertices shared with recent triangles
+// are references into a small cache, and the others are bit-packed with as many bits as the block needs. Then, unless
+// geometry-only, octahedral normals (octnormal.h) and RGB8 vertex colors.
+// Decoding and re-encoding a triangle with the same lattice gives the same triangle, so partitions keep the exact geometry.
+
+#define TRIZ_MAGIC 0x5A495254 // "TRIZ"
+#define TRIZ_VERSION 2 // 2: normals in the octahedral encoding of octnormal.h
+#define TRIZ_HEADER_SIZE 48
+#define TRIZ_BLOCK_HEADER_SIZE 12
+#define TRIZ_BLOCK_TRIANGLES 4096
+#define TRIZ_QUANT_BITS 20 // lattice steps along the longest bbox side
+#define TRIZ_QUANT_LIMIT (1 << 29) // clamp for coordinates far outside the bbox, keeps deltas in 32 bits
+
+// The lattice vertex coordinates are snapped to
+struct TriLattice {
+	double origin[3];
+	double step;
+
+	TriLattice() : step(1.0) { origin[0] = origin[1] = origin[2] = 0.0; }
+};
+
+// Lattice with 2^TRIZ_QUANT_BITS steps along the longest side of the mesh bbox
+inline TriLattice triLattice(const AABox<glm::vec3> &bbox){
+	TriLattice l;
+	double extent = 0.0;
+	for (int a = 0; a < 3; a++) {
+		l.origin[a] = bbox.min[a];
+		extent = std::max(extent, static_cast<double>(bbox.max[a]) - bbox.min[a]);
+	}
+	l.step = extent > 0.0 ? extent / (1 << TRIZ_QUANT_BITS) : 1.0;
+	return l;
+}
+
+inline ::int32_t quantize(const float v, const TriLattice &l, const int axis){
+	double q = floor((v - l.origin[axis]) / l.step + 0.5);
+	return static_cast<::int32_t>(std::min<double>(std::max<double>(q, -TRIZ_QUANT_LIMIT), TRIZ_QUANT_LIMIT));
+}
+
+inline float dequantize(const ::int32_t q, const TriLattice &l, const int axis){
+	return static_cast<float>(l.origin[axis] + q * l.step);
+}
+
+// A vertex as it comes back out of a stream on this lattice
+inline glm::vec3 snapToLattice(const glm::vec3 &v, const TriLattice &l){
+	return glm::vec3(dequantize(quantize(v.x, l, 0), l, 0), dequantize(quantize(v.y, l, 1), l, 1), dequantize(quantize(v.z, l, 2), l, 2));
+}
+
+inline ::uint32_t zigzag(const ::int32_t v){ return (static_cast<::uint32_t>(v) << 1) ^ static_cast<::uint32_t>(v >> 31); }
+inline ::int32_t unzigzag(const ::uint32_t v){ return static_cast<::int32_t>(v >> 1) ^ -static_cast<::int32_t>(v & 1); }
+
+// bits needed to store values up to v
+inline int bitsFor(::uint32_t v){
+	int bits = 0;
+	while (v != 0) { bits++; v >>= 1; }
+	return bits;
+}
+
+inline unsigned char encodeColor(const float c){
+	return static_cast<unsigned char>(floor(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f));
+}
+
+// Little-endian bit packing
+class TriBitWriter {
+public:
+	TriBitWriter(vector<unsigned char> &out) : out(out), acc(0), n(0) {}
+	void put(const ::uint32_t v, const int bits){
+		acc |= static_cast<::uint64_t>(v) << n;
+		n += bits;
+		while (n >= 8) { out.push_back(static_cast<unsigned char>(acc & 0xFF)); acc >>= 8; n -= 8; }
+	}
+	void finish(){
+		if (n > 0) { out.push_back(static_cast<unsigned char>(acc & 0xFF)); }
+		acc = 0; n = 0;
+	}
+private:
+	vector<unsigned char> &out;
+	::uint64_t acc;
+	int n;
+};
+
+class TriBitReader {
+public:
+	TriBitReader(const unsigned char* data, const size_t size) : data(data), size(size), pos(0), acc(0), n(0) {}
+	::uint32_t get(const int bits){
+		while (n < bits) {
+			acc |= static_cast<::uint64_t>(pos < size ? data[pos] : 0) << n;
+			pos++; n += 8;
+		}
+		::uint32_t v = static_cast<::uint32_t>(acc & ((static_cast<::uint64_t>(1) << bits) - 1));
+		acc >>= bits; n -= bits;
+		return v;
+	}
+private:
+	const unsigned char* data;
+	size_t size, pos;
+	::uint64_t acc;
+	int n;
+};
+
+// LZ77 byte coder (LZ4-style sequences: token, literals, 16-bit offset, match length; the last sequence has only literals)
+inline void lzWriteLength(vector<unsigned char> &out, size_t len){
+	while (len >= 255) { out.push_back(255); len -= 255; }
+	out.push_back(static_cast<unsigned char>(len));
+}
+
+inline void lzCompress(const unsigned char* in, const size_t size, vector<unsigned char> &out){
+	const int hash_bits = 14;
+	vector<int> table(1 << hash_bits, -1);
+	size_t anchor = 0, i = 0;
+	while (i + 4 <= size) {
+		::uint32_t word; memcpy(&word, in + i, 4);
+		::uint32_t h = (word * 2654435761u) >> (32 - hash_bits);
+		int candidate = table[h];
+		table[h] = static_cast<int>(i);
+		if (candidate < 0 || i - candidate > 65535 || memcmp(in + candidate, in + i, 4) != 0) { i++; continue; }
+		size_t len = 4;
+		while (i + len < size && in[candidate + len] == in[i + len]) { len++; }
+		size_t literals = i - anchor;
+		out.push_back(static_cast<unsigned char>((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(len - 4, 15)));
+		if (literals >= 15) { lzWriteLength(out, literals - 15); }
+		out.insert(out.end(), in + anchor, in + i);
+		size_t offset = i - candidate;
+		out.push_back(static_cast<unsigned char>(offset & 0xFF));
+		out.push_back(static_cast<unsigned char>(offset >> 8));
+		if (len - 4 >= 15) { lzWriteLength(out, len - 4 - 15); }
+		i += len;
+		anchor = i;
+	}
+	size_t literals = size - anchor;
+	out.push_back(static_cast<unsigned char>(std::min<size_t>(literals, 15) << 4));
+	if (literals >= 15) { lzWriteLength(out, literals - 15); }
+	out.insert(out.end(), in + anchor, in + size);
+}
+
+// Decode into exactly out_size bytes, false if the input is corrupt
+inline bool lzDecompress(const unsigned char* in, const size_t size, unsigned char* out, const size_t out_size){
+	size_t ip = 0, op = 0;
+	while (ip < size) {
+		unsigned int token = in[ip++];
+		size_t literals = token >> 4;
+		if (literals == 15) {
+			unsigned char b;
+			do { if (ip >= size) { return false; } b = in[ip++]; literals += b; } while (b == 255);
+		}
+		if (literals > size - ip || literals > out_size - op) { return false; }
+		memcpy(out + op, in + ip, literals);
+		ip += literals; op += literals;
+		if (ip == size) { break; } // last sequence
+		if (size - ip < 2) { return false; }
+		size_t offset = in[ip] | (static_cast<size_t>(in[ip + 1]) << 8);
+		ip += 2;
+		size_t len = (token & 15) + 4;
+		if ((token & 15) == 15) {
+			unsigned char b;
+			do { if (ip >= size) { return false; } b = in[ip++]; len += b; } while (b == 255);
+		}
+		if (offset == 0 || offset > op || len > out_size - op) { return false; }
+		for (size_t k = 0; k < len; k++, op++) { out[op] = out[op - offset]; } // matches may overlap
+	}
+	return op == out_size;
+}
+
+// A vertex as stored in a block: lattice coordinates and RGB8 color (black in geometry-only streams)
+struct TriZVertex {
+	::int32_t q[3];
+	unsigned char c[3];
+
+	bool operator==(const TriZVertex &o) const{
+		return q[0] == o.q[0] && q[1] == o.q[1] && q[2] == o.q[2] && c[0] == o.c[0] && c[1] == o.c[1] && c[2] == o.c[2];
+	}
+};
+
+// The last TRIZ_CACHE_SIZE new vertices of a block. Encoder and decoder fill it the same way, so a vertex that is
+// already in it is stored as its 4-bit index (in connected meshes, most vertices of a triangle are).
+#define TRIZ_CACHE_SIZE 16
+struct TriZCache {
+	TriZVertex v[TRIZ_CACHE_SIZE];
+	int size, next;
+
+	TriZCache() : size(0), next(0) {}
+	int find(const TriZVertex &x) const{
+		for (int k = 0; k < size; k++) { if (v[k] == x) { return k; } }
+		return -1;
+	}
+	void insert(const TriZVertex &x){
+		v[next] = x;
+		next = (next + 1) % TRIZ_CACHE_SIZE;
+		size = std::min(size + 1, TRIZ_CACHE_SIZE);
+	}
+};
+
+// Decoded block layout: v0 minimum (3 x int32), bit widths (6 bytes, 2 padding), new vertex count, vertex stream size,
+// vertex stream, normals (4 bytes per triangle), colors (3 bytes per new vertex)
+#define TRIZ_BLOCK_FIXED 28
+inline size_t triBlockSize(const size_t n, const size_t n_new, const size_t vertex_bytes, const bool geometry_only){
+	return TRIZ_BLOCK_FIXED + vertex_bytes + (geometry_only ? 0 : n * 4 + n_new * 3);
+}
+
+// Encode n (at most TRIZ_BLOCK_TRIANGLES) triangles as one block, appended to out.
+// Vertex stream, per vertex: 1 bit cached or not, then either the 4-bit cache index, or the lattice coordinates: for v0
+// offsets from the block minimum, for v1 and v2 zigzag deltas from v0. Geometry-only triangles give a geometry-only block.
+template <typename T>
+inline void encodeTriBlock(const T* tris, const size_t n, const TriLattice &lattice, vector<unsigned char> &out){
+	const bool geometry_only = T::geometry_only;
+	vector<TriZVertex> verts(n * 3);
+	for (size_t i = 0; i < n; i++) {
+		for (int a = 0; a < 3; a++) {
+			verts[i * 3].q[a] = quantize(tris[i].v0[a], lattice, a);
+			verts[i * 3 + 1].q[a] = quantize(tris[i].v1[a], lattice, a);
+			verts[i * 3 + 2].q[a] = quantize(tris[i].v2[a], lattice, a);
+			verts[i * 3].c[a] = encodeColor(tris[i].getColor(0)[a]); // black for geometry-only triangles
+			verts[i * 3 + 1].c[a] = encodeColor(tris[i].getColor(1)[a]);
+			verts[i * 3 + 2].c[a] = encodeColor(tris[i].getColor(2)[a]);
+		}
+	}
+
+	// which vertices are cached, and the ranges of the others
+	vector<int> cached(n * 3);
+	TriZCache cache;
+	size_t n_new = 0;
+	::int32_t qmin[3] = { TRIZ_QUANT_LIMIT, TRIZ_QUANT_LIMIT, TRIZ_QUANT_LIMIT };
+	for (size_t v = 0; v < n * 3; v++) {
+		cached[v] = cache.find(verts[v]);
+		if (cached[v] >= 0) { continue; }
+		cache.insert(verts[v]);
+		n_new++;
+		if (v % 3 == 0) {
+			for (int a = 0; a < 3; a++) { qmin[a] = std::min(qmin[a], verts[v].q[a]); }
+		}
+	}
+	::uint32_t vmax[6] = { 0, 0, 0, 0, 0, 0 };
+	for (size_t v = 0; v < n * 3; v++) {
+		if (cached[v] >= 0) { continue; }
+		const TriZVertex &v0 = verts[v - v % 3];
+		for (int a = 0; a < 3; a++) {
+			if (v % 3 == 0) { vmax[a] = std::max(vmax[a], static_cast<::uint32_t>(verts[v].q[a] - qmin[a])); }
+			else { vmax[3 + a] = std::max(vmax[3 + a], zigzag(verts[v].q[a] - v0.q[a])); }
+		}
+	}
+	int bits[6];
+	for (int k = 0; k < 6; k++) { bits[k] = bitsFor(vmax[k]); }
+
+	vector<unsigned char> raw(TRIZ_BLOCK_FIXED);
+	TriBitWriter w(raw);
+	for (size_t v = 0; v < n * 3; v++) {
+		if (cached[v] >= 0) {
+			w.put(1 | (static_cast<::uint32_t>(cached[v]) << 1), 5);
+			continue;
+		}
+		w.put(0, 1);
+		const TriZVertex &v0 = verts[v - v % 3];
+		for (int a = 0; a < 3; a++) {
+			if (v % 3 == 0) { w.put(static_cast<::uint32_t>(verts[v].q[a] - qmin[a]), bits[a]); }
+			else { w.put(zigzag(verts[v].q[a] - v0.q[a]), bits[3 + a]); }
+		}
+	}
+	w.finish();
+	::uint32_t counts[2] = { static_cast<::uint32_t>(n_new), static_cast<::uint32_t>(raw.size() - TRIZ_BLOCK_FIXED) };
+	memcpy(&raw[0], qmin, 12);
+	for (int k = 0; k < 6; k++) { raw[12 + k] = static_cast<unsigned char>(bits[k]); }
+	raw[18] = raw[19] = 0;
+	memcpy(&raw[20], counts, 8);
+	if (!geometry_only) {
+		for (size_t i = 0; i < n; i++) {
+			::uint32_t code = encodeOctNormal(tris[i].getNormal());
+			for (int b = 0; b < 4; b++) { raw.push_back(static_cast<unsigned char>(code >> (8 * b))); }
+		}
+		for (size_t v = 0; v < n * 3; v++) {
+			if (cached[v] < 0) { raw.insert(raw.end(), verts[v].c, verts[v].c + 3); }
+		}
+	}
+
+	vector<unsigned char> packed;
+	packed.reserve(raw.size());
+	lzCompress(&raw[0], raw.size(), packed);
+	const vector<unsigned char> &stored = packed.size() < raw.size() ? packed : raw;
+	::uint32_t header[3] = { static_cast<::uint32_t>(n), static_cast<::uint32_t>(raw.size()), static_cast<::uint32_t>(stored.size()) };
+	size_t at = out.size();
+	out.resize(at + TRIZ_BLOCK_HEADER_SIZE + stored.size());
+	memcpy(&out[at], header, TRIZ_BLOCK_HEADER_SIZE);
+	memcpy(&out[at + TRIZ_BLOCK_HEADER_SIZE], &stored[0], stored.size());
+}
+
+// Decode a block (without its block header) into n triangles, false if it is corrupt.
+// Geometry-only blocks decode with zero normals and colors; geometry-only triangles drop colors and normals.
+template <typename T>
+inline bool decodeTriBlock(const unsigned char* data, const size_t n, const size_t raw_size, const size_t stored_size, const TriLattice &lattice,
+	const bool geometry_only, T* tris){
+	if (raw_size < TRIZ_BLOCK_FIXED || stored_size == 0) { return false; }
+	vector<unsigned char> decoded;
+	const unsigned char* raw = data;
+	if (stored_size != raw_size) {
+		decoded.resize(raw_size);
+		if (!lzDecompress(data, stored_size, &decoded[0], raw_size)) { return false; }
+		raw = &decoded[0];
+	}
+	::int32_t qmin[3];
+	memcpy(qmin, raw, 12);
+	int bits[6];
+	for (int k = 0; k < 6; k++) {
+		bits[k] = raw[12 + k];
+		if (bits[k] > 32) { return false; }
+	}
+	::uint32_t counts[2];
+	memcpy(counts, raw + 20, 8);
+	const size_t n_new = counts[0], vertex_bytes = counts[1];
+	if (n_new > n * 3 || vertex_bytes > raw_size || triBlockSize(n, n_new, vertex_bytes, geometry_only) != raw_size) { return false; }
+	const unsigned char* colors = raw + TRIZ_BLOCK_FIXED + vertex_bytes + n * 4;
+
+	TriBitReader r(raw + TRIZ_BLOCK_FIXED, vertex_bytes);
+	TriZCache cache;
+	size_t new_seen = 0;
+	TriZVertex v[3];
+	for (size_t i = 0; i < n; i++) {
+		for (int k = 0; k < 3; k++) {
+			if (r.get(1)) {
+				int index = static_cast<int>(r.get(4));
+				if (index >= cache.size) { return false; }
+				v[k] = cache.v[index];
+				continue;
+			}
+			for (int a = 0; a < 3; a++) {
+				if (k == 0) { v[k].q[a] = qmin[a] + static_cast<::int32_t>(r.get(bits[a])); }
+				else { v[k].q[a] = v[0].q[a] + unzigzag(r.get(bits[3 + a])); }
+			}
+			if (new_seen == n_new) { return false; }
+			for (int a = 0; a < 3; a++) { v[k].c[a] = geometry_only ? 0 : colors[new_seen * 3 + a]; }
+			new_seen++;
+			cache.insert(v[k]);
+		}
+		for (int a = 0; a < 3; a++) {
+			tris[i].v0[a] = dequantize(v[0].q[a], lattice, a);
+			tris[i].v1[a] = dequantize(v[1].q[a], lattice, a);
+			tris[i].v2[a] = dequantize(v[2].q[a], lattice, a);
+		}
+		if (!T::geometry_only) {
+			tris[i].setColors(glm::vec3(v[0].c[0], v[0].c[1], v[0].c[2]) / 255.0f, glm::vec3(v[1].c[0], v[1].c[1], v[1].c[2]) / 255.0f,
+				glm::vec3(v[2].c[0], v[2].c[1], v[2].c[2]) / 255.0f);
+			if (geometry_only) { tris[i].setNormal(glm::vec3(0.0f)); }
+			else {
+				const unsigned char* nb = raw + TRIZ_BLOCK_FIXED + vertex_bytes + i * 4;
+				tris[i].setNormal(decodeOctNormal(nb[0] | (nb[1] << 8) | (nb[2] << 16) | (static_cast<::uint32_t>(nb[3]) << 24)));
+			}
+		}
+	}
+	return new_seen == n_new;
+}
+
+// Read the header of a compressed stream, false if the file doesn't start with one
+inline bool readTriStreamHeader(FILE* f, TriLattice &lattice, bool &geometry_only){
+	unsigned char header[TRIZ_HEADER_SIZE];
+	if (f == NULL || fread(header, 1, TRIZ_HEADER_SIZE, f) != TRIZ_HEADER_SIZE) { return false; }
+	::uint32_t fields[3];
+	memcpy(fields, header, 12);
+	if (fields[0] != TRIZ_MAGIC) { return false; }
+	if (fields[1] != TRIZ_VERSION) {
+		cout << "Error: compressed triangle stream of version " << fields[1] << ", this build reads version " << TRIZ_VERSION << ": convert the mesh again" << endl;
+		return false;
+	}
+	geometry_only = fields[2] != 0;
+	memcpy(lattice.origin, header + 16, 3 * sizeof(double));
+	memcpy(&lattice.step, header + 40, sizeof(double));
+	return true;
+}
+
+// Is filename a compressed stream? (if so, also returns its lattice)
+inline bool isCompressedTriStream(const std::string &filename, TriLattice &lattice){
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (f == NULL) { return false; }
+	bool geometry_only;
+	bool compressed = readTriStreamHeader(f, lattice, geometry_only);
+	fclose(f);
+	return compressed;
+}
+
+// Writes triangles to a compressed stream. Every write() is cut into blocks, which are encoded in parallel.
+template <typename T>
+class TriBlockWriter {
+public:
+	size_t bytes; // written so far
+
+	TriBlockWriter(FILE* file, const TriLattice &lattice) : bytes(0), file(file), lattice(lattice) {
+		unsigned char header[TRIZ_HEADER_SIZE];
+		memset(header, 0, TRIZ_HEADER_SIZE);
+		::uint32_t fields[3] = { TRIZ_MAGIC, TRIZ_VERSION, T::geometry_only ? 1u : 0u };
+		memcpy(header, fields, 12);
+		memcpy(header + 16, lattice.origin, 3 * sizeof(double));
+		memcpy(header + 40, &lattice.step, sizeof(double));
+		bytes += fwrite(header, 1, TRIZ_HEADER_SIZE, file);
+	}
+
+	void write(const T* tris, const size_t n){
+		const long long n_blocks = static_cast<long long>((n + TRIZ_BLOCK_TRIANGLES - 1) / TRIZ_BLOCK_TRIANGLES);
+		if (n_blocks == 1) { // the common case for partition buffers, which already write from several threads
+			encoded.resize(1);
+			encoded[0].clear();
+			encodeTriBlock(tris, n, lattice, encoded[0]);
+		}
+		else {
+			encoded.resize(static_cast<size_t>(n_blocks));
+#pragma omp parallel for schedule(dynamic)
+			for (long long b = 0; b < n_blocks; b++) {
+				size_t first = static_cast<size_t>(b) * TRIZ_BLOCK_TRIANGLES;
+				encoded[b].clear();
+				encodeTriBlock(tris + first, std::min<size_t>(TRIZ_BLOCK_TRIANGLES, n - first), lattice, encoded[b]);
+			}
+		}
+		for (long long b = 0; b < n_blocks; b++) {
+			bytes += fwrite(&encoded[b][0], 1, encoded[b].size(), file);
+		}
+	}
+
+private:
+	FILE* file;
+	TriLattice lattice;
+	vector<vector<unsigned char> > encoded;
+};
+
+// Reads the blocks of a compressed stream, decoding a batch of them in parallel
+template <typename T>
+class TriBlockReader {
+public:
+	TriBlockReader(FILE* file, const TriLattice &lattice, const bool geometry_only) : file(file), lattice(lattice), geometry_only(geometry_only), has_next(false) {
+		readBlockHeader();
+	}
+
+	// Decode as many whole blocks as fit in capacity (which should be at least TRIZ_BLOCK_TRIANGLES) into tris, returns the triangle count (0 at the end)
+	size_t read(T* tris, const size_t capacity){
+		blocks.clear(); firsts.clear(); headers.clear();
+		size_t count = 0;
+		while (has_next && count + next[0] <= capacity) {
+			blocks.push_back(vector<unsigned char>(next[2]));
+			if (next[2] > 0 && fread(&blocks.back()[0], 1, next[2], file) != next[2]) { corrupt(); }
+			firsts.push_back(count);
+			headers.push_back(next[0]); headers.push_back(next[1]); headers.push_back(next[2]);
+			count += next[0];
+			readBlockHeader();
+		}
+		const long long n_blocks = static_cast<long long>(blocks.size());
+		bool ok = true;
+#pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+		for (long long b = 0; b < n_blocks; b++) {
+			ok = decodeTriBlock(blocks[b].empty() ? NULL : &blocks[b][0], headers[b * 3], headers[b * 3 + 1], headers[b * 3 + 2], lattice, geometry_only, tris + firsts[b]) && ok;
+		}
+		if (!ok) { corrupt(); }
+		return count;
+	}
+
+private:
+	FILE* file;
+	TriLattice lattice;
+	bool geometry_only;
+	bool has_next;
+	::uint32_t next[3]; // header of the next block: triangles, decoded size, stored size
+	vector<vector<unsigned char> > blocks;
+	vector<size_t> firsts, headers;
+
+	void readBlockHeader(){
+		has_next = fread(next, 1, TRIZ_BLOCK_HEADER_SIZE, file) == TRIZ_BLOCK_HEADER_SIZE;
+		if (has_next && (next[0] == 0 || next[0] > TRIZ_BLOCK_TRIANGLES || next[2] > next[1])) { corrupt(); }
+	}
+
+	void corrupt(){
+		cout << "Error: corrupt or truncated block in compressed triangle stream" << endl;
+		exit(1);
+	}
+};
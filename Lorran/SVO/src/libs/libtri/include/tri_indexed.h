@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "tri_util.h"
+#include "../../libmorton/include/morton_dispatch.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TRIVERTICES_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Indexed tri format (.tri header "indexed 1"): the vertices go once to a .trivertices file, and .tridata (and every
+// .tripdata made from it) holds index triples into it instead of full triangles. The converters sort the vertices in
+// morton order and the triangles by their first vertex, so a partition reads a few compact runs of the vertex file.
+
+// The records depend on the triangle type they expand to (T is GeometryTriangle or ColorTriangle). Like the triangles,
+// they have payload accessors that do nothing without a payload.
+template <typename T> struct TriVertex;
+template <typename T> struct IndexedTriangle;
+
+template <>
+struct TriVertex<GeometryTriangle> {
+	glm::vec3 position;
+
+	glm::vec3 getColor() const { return glm::vec3(); }
+	void setColor(const glm::vec3 &) {}
+};
+
+template <>
+struct IndexedTriangle<GeometryTriangle> {
+	::uint32_t v[3];
+
+	glm::vec3 getNormal() const { return glm::vec3(); }
+	void setNormal(const glm::vec3 &) {}
+};
+
+template <>
+struct TriVertex<ColorTriangle> {
+	glm::vec3 position;
+	glm::vec3 color;
+
+	glm::vec3 getColor() const { return color; }
+	void setColor(const glm::vec3 &c) { color = c; }
+};
+
+template <>
+struct IndexedTriangle<ColorTriangle> {
+	::uint32_t v[3];
+	glm::vec3 normal;
+
+	glm::vec3 getNormal() const { return normal; }
+	void setNormal(const glm::vec3 &n) { normal = n; }
+};
+
+// The vertex file, memory mapped (or read into memory where we can't map). Shared read-only between readers and threads.
+template <typename T>
+class TriVertices {
+public:
+	TriVertices() : vertices(NULL), n_vertices(0), mapped_bytes(0) {}
+
+	~TriVertices(){
+		close();
+	}
+
+	bool open(const std::string &filename){
+		close();
+#ifdef TRIVERTICES_MMAP
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd == -1) { return false; }
+		struct stat st;
+		if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+		mapped_bytes = static_cast<size_t>(st.st_size);
+		n_vertices = mapped_bytes / sizeof(TriVertex<T>);
+		if (mapped_bytes == 0) { ::close(fd); return true; }
+		void* m = mmap(NULL, mapped_bytes, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd); // the mapping keeps the file referenced
+		if (m == MAP_FAILED) { mapped_bytes = 0; n_vertices = 0; return false; }
+		vertices = static_cast<const TriVertex<T>*>(m);
+		return true;
+#else
+		FILE* f = fopen(filename.c_str(), "rb");
+		if (f == NULL) { return false; }
+		fseek(f, 0, SEEK_END);
+		copy.resize(static_cast<size_t>(ftell(f)) / sizeof(TriVertex<T>));
+		fseek(f, 0, SEEK_SET);
+		if (!copy.empty() && fread(&copy[0], sizeof(TriVertex<T>), copy.size(), f) != copy.size()) { copy.clear(); }
+		fclose(f);
+		n_vertices = copy.size();
+		vertices = copy.empty() ? NULL : &copy[0];
+		return true;
+#endif
+	}
+
+	void close(){
+#ifdef TRIVERTICES_MMAP
+		if (vertices != NULL && mapped_bytes > 0) { munmap(const_cast<TriVertex<T>*>(vertices), mapped_bytes); }
+#endif
+		copy.clear();
+		vertices = NULL; n_vertices = 0; mapped_bytes = 0;
+	}
+
+	size_t size() const{ return n_vertices; }
+	const TriVertex<T>& operator[](const size_t i) const{ return vertices[i]; }
+
+	// Expand an index triple into a full triangle, false if it points outside the vertex file
+	bool expand(const IndexedTriangle<T> &it, T &t) const{
+		if (it.v[0] >= n_vertices || it.v[1] >= n_vertices || it.v[2] >= n_vertices) { return false; }
+		t.v0 = vertices[it.v[0]].position;
+		t.v1 = vertices[it.v[1]].position;
+		t.v2 = vertices[it.v[2]].position;
+		t.setNormal(it.getNormal());
+		t.setColors(vertices[it.v[0]].getColor(), vertices[it.v[1]].getColor(), vertices[it.v[2]].getColor());
+		return true;
+	}
+
+private:
+	const TriVertex<T>* vertices;
+	size_t n_vertices;
+	size_t mapped_bytes;
+	vector<TriVertex<T> > copy;
+
+	TriVertices(const TriVertices&);
+	TriVertices& operator=(const TriVertices&);
+};
+
+// Morton code of a position on a 2^21 grid over bbox (x in the lowest bit, like the voxel grid)
+inline ::uint64_t triVertexMorton(const glm::vec3 &p, const AABox<glm::vec3> &bbox){
+	::uint32_t c[3];
+	for (int a = 0; a < 3; a++) {
+		float extent = bbox.max[a] - bbox.min[a];
+		float f = extent > 0.0f ? (p[a] - bbox.min[a]) / extent : 0.0f;
+		c[a] = static_cast<::uint32_t>(std::min(std::max(f, 0.0f), 1.0f) * 2097151.0f);
+	}
+	return morton3D_64_encode_dispatch(c[0], c[1], c[2]);
+}
+
+// Sort the vertices in morton order and the triangles by their lowest vertex, then write <base>.trivertices and <base>.tridata
+template <typename T>
+inline void writeIndexedMesh(const std::string &base, vector<TriVertex<T> > &vertices, vector<IndexedTriangle<T> > &triangles, const AABox<glm::vec3> &bbox){
+	vector<pair< ::uint64_t, ::uint32_t> > order(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		order[i] = make_pair(triVertexMorton(vertices[i].position, bbox), static_cast< ::uint32_t>(i));
+	}
+	std::sort(order.begin(), order.end());
+	vector< ::uint32_t> remap(vertices.size());
+	vector<TriVertex<T> > sorted(vertices.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		remap[order[i].second] = static_cast< ::uint32_t>(i);
+		sorted[i] = vertices[order[i].second];
+	}
+	vertices.swap(sorted);
+
+	vector<pair< ::uint32_t, size_t> > tri_order(triangles.size());
+	for (size_t i = 0; i < triangles.size(); i++) {
+		IndexedTriangle<T> &t = triangles[i];
+		for (int k = 0; k < 3; k++) { t.v[k] = remap[t.v[k]]; }
+		tri_order[i] = make_pair(std::min(t.v[0], std::min(t.v[1], t.v[2])), i);
+	}
+	std::sort(tri_order.begin(), tri_order.end());
+
+	FILE* vf = fopen((base + string(".trivertices")).c_str(), "wb");
+	if (!vertices.empty()) { fwrite(&vertices[0], sizeof(TriVertex<T>), vertices.size(), vf); }
+	fclose(vf);
+	FILE* tf = fopen((base + string(".tridata")).c_str(), "wb");
+	vector<IndexedTriangle<T> > batch;
+	for (size_t i = 0; i < tri_order.size(); i++) {
+		batch.push_back(triangles[tri_order[i].second]);
+		if (batch.size() == 65536 || i + 1 == tri_order.size()) {
+			fwrite(&batch[0], sizeof(IndexedTriangle<T>), batch.size(), tf);
+			batch.clear();
+		}
+	}
+	fclose(tf);
+}
@@ -16,8 +16,11 @@ struct TriInfo{
 	int geometry_only;
 	size_t n_triangles;
 	AABox<glm::vec3> mesh_bbox;
+	int compressed; // .tridata is a compressed stream (see tri_compress.h)
+	int indexed; // .tridata holds index triples into .trivertices (see tri_indexed.h)
+	size_t n_vertices;
 
-	TriInfo() : base_filename(""), version(version), geometry_only(geometry_only), n_triangles(0), mesh_bbox(AABox<glm::vec3>()) {} // default constructor
+	TriInfo() : base_filename(""), version(version), geometry_only(geometry_only), n_triangles(0), mesh_bbox(AABox<glm::vec3>()), compressed(0), indexed(0), n_vertices(0) {} // default constructor
 
 	// print out Tri information
 	void print() const{
@@ -25,6 +28,8 @@ struct TriInfo{
 		cout << "  tri version: " << version << endl;
 		cout << "  geometry only: " << geometry_only << endl;
 		cout << "  n_triangles: " << n_triangles << endl;
+		if (compressed) { cout << "  compressed: " << compressed << endl; }
+		if (indexed) { cout << "  indexed: " << n_vertices << " vertices" << endl; }
 		cout << "  bbox min: " << mesh_bbox.min[0] << " " << mesh_bbox.min[1] << " " << mesh_bbox.min[2] << endl;
 		cout << "  bbox max: " << mesh_bbox.max[0] << " " << mesh_bbox.max[1] << " " << mesh_bbox.max[2] << endl;
 	}
@@ -33,42 +38,51 @@ struct TriInfo{
 	bool filesExist() const{
 		string header = base_filename + string(".tri");
 		string tridata = base_filename + string(".tridata");
+		if (indexed && !file_exists(base_filename + string(".trivertices"))) { return false; }
 		return (file_exists(header) && file_exists(tridata));
 	}
 };
 
-// STDIO IO for Triangles
-inline void readTriangle(FILE* f, Triangle &t){
-	size_t read = fread(&t, TRIANGLE_SIZE*sizeof(float), 1, f);
+// STDIO IO for Triangles (GeometryTriangle or ColorTriangle records)
+template <typename T>
+inline void readTriangle(FILE* f, T &t){
+	size_t read = fread(&t, sizeof(T), 1, f);
 }
 
-inline void readTriangles(FILE* f, Triangle &t, size_t howmany){
-	size_t read = fread(&t, TRIANGLE_SIZE*sizeof(float), howmany, f);
+template <typename T>
+inline void readTriangles(FILE* f, T &t, size_t howmany){
+	size_t read = fread(&t, sizeof(T), howmany, f);
 }
 
-inline void writeTriangle(FILE* f, Triangle &t){
-	fwrite(&t, TRIANGLE_SIZE*sizeof(float), 1, f);
+template <typename T>
+inline void writeTriangle(FILE* f, const T &t){
+	fwrite(&t, sizeof(T), 1, f);
 }
 
-inline void writeTriangles(FILE* f, Triangle &t, size_t howmany){
-	fwrite(&t, TRIANGLE_SIZE*sizeof(float), howmany, f);
+template <typename T>
+inline void writeTriangles(FILE* f, const T &t, size_t howmany){
+	fwrite(&t, sizeof(T), howmany, f);
 }
 
 // FSTREAM IO for Triangles (deprecated - this slow)
-inline void readTriangle(ifstream &file, Triangle &t){
-	file.read(reinterpret_cast<char*> (&t.v0[0]), TRIANGLE_SIZE*sizeof(float));
+template <typename T>
+inline void readTriangle(ifstream &file, T &t){
+	file.read(reinterpret_cast<char*> (&t.v0[0]), sizeof(T));
 }
 
-inline void readTriangles(ifstream &file, Triangle &t, size_t howmany){
-	file.read(reinterpret_cast<char*> (&t.v0[0]), howmany*TRIANGLE_SIZE*sizeof(float));
+template <typename T>
+inline void readTriangles(ifstream &file, T &t, size_t howmany){
+	file.read(reinterpret_cast<char*> (&t.v0[0]), howmany*sizeof(T));
 }
 
-inline void writeTriangle(ofstream &file, Triangle &t){
-	file.write(reinterpret_cast<char*> (&t.v0[0]), TRIANGLE_SIZE*sizeof(float));
+template <typename T>
+inline void writeTriangle(ofstream &file, T &t){
+	file.write(reinterpret_cast<char*> (&t.v0[0]), sizeof(T));
 }
 
-inline void writeTriangles(ofstream &file, Triangle &t, size_t howmany){
-	file.write(reinterpret_cast<char*> (&t.v0[0]), howmany*TRIANGLE_SIZE*sizeof(float));
+template <typename T>
+inline void writeTriangles(ofstream &file, T &t, size_t howmany){
+	file.write(reinterpret_cast<char*> (&t.v0[0]), howmany*sizeof(T));
 }
 
 // Parsing a .tri header file and store info in TriInfo struct
@@ -91,6 +105,9 @@ inline int parseTriHeader(std::string filename, TriInfo &t){
 
 	bool done = false;
 	t.geometry_only = 0;
+	t.compressed = 0;
+	t.indexed = 0;
+	t.n_vertices = 0;
 
 	while(file.good() && !done) {
 		file >> line;
@@ -100,6 +117,12 @@ inline int parseTriHeader(std::string filename, TriInfo &t){
 			file >> t.n_triangles;
 		} else if (line.compare("geo_only") == 0) {
 			file >> t.geometry_only;
+		} else if (line.compare("compressed") == 0) {
+			file >> t.compressed;
+		} else if (line.compare("indexed") == 0) {
+			file >> t.indexed;
+		} else if (line.compare("nvertices") == 0) {
+			file >> t.n_vertices;
 		} else if (line.compare("bbox") == 0) {
 			file >> t.mesh_bbox.min[0] >> t.mesh_bbox.min[1] >> t.mesh_bbox.min[2] >> t.mesh_bbox.max[0] >> t.mesh_bbox.max[1] >> t.mesh_bbox.max[2];
 		} else { 
@@ -121,6 +144,8 @@ inline void writeTriHeader(const std::string &filename, const TriInfo &t){
 	outfile << "#tri " << t.version << endl;
 	outfile << "ntriangles " << t.n_triangles << endl;
 	outfile << "geo_only " << t.geometry_only << endl;
+	if (t.compressed) { outfile << "compressed " << t.compressed << endl; }
+	if (t.indexed) { outfile << "indexed " << t.indexed << endl << "nvertices " << t.n_vertices << endl; }
 	outfile << "bbox  " << t.mesh_bbox.min[0] << " " << t.mesh_bbox.min[1] << " " << t.mesh_bbox.min[2] << " " << t.mesh_bbox.max[0] << " " 
 		<< t.mesh_bbox.max[1] << " " << t.mesh_bbox.max[2] << endl;
 	outfile << "END" << endl;
@@ -4,12 +4,6 @@
 #include <sstream>
 #include <string>
 
-#ifdef BINARY_VOXELIZATION
-#define TRIANGLE_SIZE 9 // just the vertices
-#else
-#define TRIANGLE_SIZE 21 // vertices + normal + vertex colors
-#endif
-
 // Custom value to string method to avoid C++11 dependency causing fopenmp problems in OSX
 template <typename T>
 std::string val_to_string( T Number ) {
@@ -26,17 +20,29 @@ struct AABox {
 	AABox(T min, T max): min(min), max(max){}
 };
 
-#ifdef BINARY_VOXELIZATION
-struct Triangle {
+// The two triangle records of .tridata files (the .tri header tells which one with geo_only).
+// Both have the same payload accessors, which do nothing for geometry-only triangles, so code that handles
+// triangles can be templated on the record type instead of being compiled twice.
+
+// Geometry-only triangle: just the vertices (9 floats)
+struct GeometryTriangle {
 	glm::vec3 v0;
 	glm::vec3 v1;
 	glm::vec3 v2;
 
-	Triangle(): v0(glm::vec3()), v1(glm::vec3()), v2(glm::vec3()) {}
-	Triangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2): v0(v0), v1(v1), v2(v2) {}
+	static const bool geometry_only = true;
+
+	GeometryTriangle(): v0(glm::vec3()), v1(glm::vec3()), v2(glm::vec3()) {}
+	GeometryTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2): v0(v0), v1(v1), v2(v2) {}
+
+	glm::vec3 getNormal() const { return glm::vec3(); }
+	void setNormal(const glm::vec3 &) {}
+	glm::vec3 getColor(const int) const { return glm::vec3(); }
+	void setColors(const glm::vec3 &, const glm::vec3 &, const glm::vec3 &) {}
 };
-#else
-struct Triangle {
+
+// Triangle with a normal and vertex colors (21 floats)
+struct ColorTriangle {
 	glm::vec3 v0;
 	glm::vec3 v1;
 	glm::vec3 v2;
@@ -45,11 +51,17 @@ struct Triangle {
 	glm::vec3 v1_color;
 	glm::vec3 v2_color;
 
+	static const bool geometry_only = false;
+
 	// Default constructor
-	Triangle(): v0(glm::vec3()), v1(glm::vec3()), v2(glm::vec3()), normal(glm::vec3()), v0_color(glm::vec3()),v1_color(glm::vec3()),v2_color(glm::vec3()){}
+	ColorTriangle(): v0(glm::vec3()), v1(glm::vec3()), v2(glm::vec3()), normal(glm::vec3()), v0_color(glm::vec3()),v1_color(glm::vec3()),v2_color(glm::vec3()){}
 
 	// Constructor with all fields
-	Triangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, glm::vec3 normal, glm::vec3 v0_color, glm::vec3 v1_color, glm::vec3 v2_color): v0(v0), v1(v1), v2(v2), normal(normal),
+	ColorTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, glm::vec3 normal, glm::vec3 v0_color, glm::vec3 v1_color, glm::vec3 v2_color): v0(v0), v1(v1), v2(v2), normal(normal),
 		v0_color(v0_color), v1_color(v1_color),v2_color(v2_color){}
+
+	glm::vec3 getNormal() const { return normal; }
+	void setNormal(const glm::vec3 &n) { normal = n; }
+	glm::vec3 getColor(const int v) const { return v == 0 ? v0_color : (v == 1 ? v1_color : v2_color); } // color of vertex v
+	void setColors(const glm::vec3 &c0, const glm::vec3 &c1, const glm::vec3 &c2) { v0_color = c0; v1_color = c1; v2_color = c2; }
 };
-#endif
@@ -5,6 +5,7 @@
 #include <fstream>
 #include <iostream>
 #include <vector>
+#include <stdint.h>
 #include "tri_tools.h"
 #include "file_tools.h"
 
@@ -17,13 +18,17 @@ struct TripInfo {
 	size_t gridsize;
 	AABox<glm::vec3> mesh_bbox;
 	vector<size_t> part_tricounts;
+	vector<::uint64_t> part_morton_start, part_morton_end; // morton range [start, end) of every partition (adaptive partitions differ in size)
 	size_t n_triangles;
 	size_t n_partitions;
+	int indexed; // partitions hold index triples into the vertex file of the .tri (see tri_indexed.h)
+	string vertex_filename;
 	
 	// default constructor
-	TripInfo() : base_filename(""), version(1), geometry_only(0), gridsize(0), n_triangles(0), n_partitions(0), mesh_bbox(AABox<glm::vec3>()) {} 
+	TripInfo() : base_filename(""), version(1), geometry_only(0), gridsize(0), n_triangles(0), n_partitions(0), mesh_bbox(AABox<glm::vec3>()), indexed(0), vertex_filename("") {} 
 	// construct from TriInfo
-	TripInfo(const TriInfo &t) : base_filename(t.base_filename), version(t.version), geometry_only(t.geometry_only), gridsize(0), mesh_bbox(t.mesh_bbox), n_triangles(t.n_triangles), n_partitions(0) {} 
+	TripInfo(const TriInfo &t) : base_filename(t.base_filename), version(t.version), geometry_only(t.geometry_only), gridsize(0), mesh_bbox(t.mesh_bbox), n_triangles(t.n_triangles), n_partitions(0),
+		indexed(t.indexed), vertex_filename(t.indexed ? t.base_filename + string(".trivertices") : string("")) {} 
 
 	void print() const{
 		cout << "  base_filename: " << base_filename << endl;
@@ -34,14 +39,20 @@ struct TripInfo {
 		cout << "  bbox max: " << mesh_bbox.max[0] << " " << mesh_bbox.max[1] << " " << mesh_bbox.max[2] << endl;
 		cout << "  n_triangles: " << n_triangles << endl;
 		cout << "  n_partitions: " << n_partitions << endl;
+		if (indexed) { cout << "  vertices: " << vertex_filename << endl; }
 		for(size_t i = 0; i< n_partitions; i++){
-			cout << "  partition " << i << " - tri_count: " << part_tricounts[i] << endl;
+			cout << "  partition " << i << " - tri_count: " << part_tricounts[i] << " - morton from " << part_morton_start[i] << " to " << part_morton_end[i] << endl;
 		}
 	}
 
-	bool filesExist() const{
+	// in_memory: partitions the builder kept in memory, which have no file
+	bool filesExist(const vector<bool> &in_memory = vector<bool>()) const{
 		string header = base_filename + string(".trip");
+		if (indexed && !file_exists(vertex_filename)) { return false; }
 		for(size_t i = 0; i< n_partitions; i++){
+			if(i < in_memory.size() && in_memory[i]){
+				continue;
+			}
 			if(part_tricounts[i] > 0){ // we only require the file to be there if it contains any triangles.
 				string part_data_filename = base_filename + string("_") + val_to_string(i) + string(".tripdata");
 				if(!file_exists(part_data_filename)){
@@ -67,11 +78,17 @@ inline int parseTripHeader(const std::string &filename, TripInfo &t){
 
 	bool done = false;
 	t.geometry_only = 0;
+	t.indexed = 0;
 
 	while(file.good() && !done) {
 		file >> line;
 		if (line.compare("END") == 0) {
 			done = true; // when we encounter data keyword, we're at the end of the ASCII header
+		} else if (line.compare("indexed") == 0) {
+			file >> t.indexed;
+		} else if (line.compare("vertices") == 0) {
+			file >> ws;
+			getline(file, t.vertex_filename); // the rest of the line, paths may hold spaces
 		} else if (line.compare("gridsize") == 0) {
 			file >> t.gridsize;
 		}  else if (line.compare("n_triangles") == 0) {
@@ -83,11 +100,16 @@ inline int parseTripHeader(const std::string &filename, TripInfo &t){
 		} else if (line.compare("n_partitions") == 0) {
 			file >> t.n_partitions; // read number of partitions
 			t.part_tricounts.resize(t.n_partitions);
+			t.part_morton_start.resize(t.n_partitions);
+			t.part_morton_end.resize(t.n_partitions);
 			int index;
 			size_t tricount;
 			for(size_t i = 0; i < t.n_partitions; i++){
 				file >> index >> tricount;
 				t.part_tricounts[index] = tricount;
+				if (t.version >= 2) { // version 2 headers list the morton range of every partition
+					file >> t.part_morton_start[index] >> t.part_morton_end[index];
+				}
 			}
 		} else { 
 			cout << "  unrecognized keyword [" << line << "], skipping" << endl;
@@ -98,6 +120,13 @@ inline int parseTripHeader(const std::string &filename, TripInfo &t){
 		cout << "  error reading header" << endl; return 0;
 	}
 	file.close();
+	if (t.version < 2) { // version 1: the grid is split into n_partitions equal morton ranges
+		::uint64_t morton_part = (static_cast<::uint64_t>(t.gridsize) * t.gridsize * t.gridsize) / t.n_partitions;
+		for(size_t i = 0; i < t.n_partitions; i++){
+			t.part_morton_start[i] = i * morton_part;
+			t.part_morton_end[i] = (i + 1) * morton_part;
+		}
+	}
 	return 1;
 }
 
@@ -111,15 +140,16 @@ inline void writeTripHeader(const std::string &filename, const TripInfo &t){
 	outfile << "n_triangles " << t.n_triangles << endl;
 	outfile << "bbox  " << t.mesh_bbox.min[0] << " " << t.mesh_bbox.min[1] << " " << t.mesh_bbox.min[2] << " " << t.mesh_bbox.max[0] << " " 
 		<< t.mesh_bbox.max[1] << " " << t.mesh_bbox.max[2] << endl;
-#ifdef BINARY_VOXELIZATION
-	outfile << "geo_only " << 1 << endl;
-#else
-	outfile << "geo_only " << 0 << endl;
-#endif
+	outfile << "geo_only " << t.geometry_only << endl;
+	if (t.indexed) { outfile << "indexed " << t.indexed << endl << "vertices " << t.vertex_filename << endl; }
 	outfile << "n_partitions " << t.n_partitions << endl;
 
 	for(size_t i = 0; i < t.n_partitions; i++){
-		outfile << i << " " << t.part_tricounts[i] << endl;
+		outfile << i << " " << t.part_tricounts[i];
+		if (t.version >= 2) {
+			outfile << " " << t.part_morton_start[i] << " " << t.part_morton_end[i];
+		}
+		outfile << endl;
 	}
 	outfile << "END" << endl;
 }
@@ -116,6 +116,30 @@ static bool check3D_DecodeFunction(const decode_f_3D_wrapper<morton, coord> &fun
 	return everything_okay;
 }
 
+// Check the 3D stepping methods against encoding the stepped coordinates
+template <typename morton, typename coord>
+static bool check3D_Stepping(unsigned int times) {
+	bool everything_okay = true;
+	coord maximum = pow(2, floor((sizeof(morton) * 8) / 3.0f)) - 2; // room to step up and down
+	for (unsigned int i = 0; i < times; ++i) {
+		coord x = 1 + rand() % maximum;
+		coord y = 1 + rand() % maximum;
+		coord z = 1 + rand() % maximum;
+		morton m = m3D_e_for<morton, coord>(x, y, z);
+		morton computed[6] = { m3D_inc_x<morton>(m), m3D_inc_y<morton>(m), m3D_inc_z<morton>(m), m3D_dec_x<morton>(m), m3D_dec_y<morton>(m), m3D_dec_z<morton>(m) };
+		morton correct[6] = { m3D_e_for<morton, coord>(x + 1, y, z), m3D_e_for<morton, coord>(x, y + 1, z), m3D_e_for<morton, coord>(x, y, z + 1),
+			m3D_e_for<morton, coord>(x - 1, y, z), m3D_e_for<morton, coord>(x, y - 1, z), m3D_e_for<morton, coord>(x, y, z - 1) };
+		for (int j = 0; j < 6; j++) {
+			if (computed[j] != correct[j]) {
+				cout << endl << "    Incorrect " << (j < 3 ? "increment" : "decrement") << " of axis " << (j % 3) << " from (" << x << ", " << y << ", " << z << "): "
+					<< computed[j] << " != " << correct[j] << endl;
+				everything_okay = false;
+			}
+		}
+	}
+	return everything_okay;
+}
+
 template <typename morton, typename coord>
 static double testEncode_2D_Linear_Perf(morton(*function)(coord, coord), size_t times) {
 	Timer timer = Timer();
@@ -286,6 +310,50 @@ inline static void Decode_3D_Perf() {
 	}
 }
 
+// Walk a MAX^3 grid in x, y, z loop order: encoding every cell vs stepping one code along with the loops
+// Only the whole walk is timed, a timer call per cell would cost more than a step.
+template <typename morton, typename coord>
+static std::string testStep_3D_Perf(morton(*function)(coord, coord, coord), size_t times) {
+	Timer encode_timer = Timer();
+	Timer step_timer = Timer();
+	morton runningsum = 0;
+	for (size_t t = 0; t < times; t++) {
+		encode_timer.start();
+		for (coord i = 0; i < MAX; i++) {
+			for (coord j = 0; j < MAX; j++) {
+				for (coord k = 0; k < MAX; k++) {
+					runningsum += function(i, j, k);
+				}
+			}
+		}
+		encode_timer.stop();
+		step_timer.start();
+		morton m_i = function(0, 0, 0);
+		for (coord i = 0; i < MAX; i++, m_i = m3D_inc_x<morton>(m_i)) {
+			morton m_j = m_i;
+			for (coord j = 0; j < MAX; j++, m_j = m3D_inc_y<morton>(m_j)) {
+				morton m = m_j;
+				for (coord k = 0; k < MAX; k++, m = m3D_inc_z<morton>(m)) {
+					runningsum += m;
+				}
+			}
+		}
+		step_timer.stop();
+	}
+	running_sums.push_back(runningsum);
+	stringstream os;
+	os << setfill('0') << std::setw(6) << std::fixed << std::setprecision(3) << encode_timer.elapsed_time_milliseconds / (float)times << " ms "
+		<< step_timer.elapsed_time_milliseconds / (float)times << " ms";
+	return os.str();
+}
+
+static void Step_3D_Perf() {
+	cout << "++ Walking " << MAX << "^3 morton codes (" << total << " in total): encode every cell vs stepping" << endl;
+	for (std::vector<encode_3D_64_wrapper>::iterator it = f3D_64_encode.begin(); it != f3D_64_encode.end(); it++) {
+		cout << "    " << testStep_3D_Perf((*it).encode, times) << " : 64-bit " << (*it).description << endl;
+	}
+}
+
 void printHeader(){
 	cout << "LIBMORTON TEST SUITE" << endl;
 	cout << "--------------------" << endl;
@@ -347,6 +415,10 @@ void registerFunctions() {
 	f3D_32_decode.push_back(decode_3D_32_wrapper("BMI2 Instruction set", &m3D_d_BMI<uint_fast32_t, uint_fast16_t>));
 #endif
 
+	// Register 3D runtime-dispatched methods (whichever one this CPU gets)
+	f3D_64_encode.push_back(encode_3D_64_wrapper(string("Runtime dispatch: ") + morton3D_64_dispatch().name, &morton3D_64_encode_dispatch));
+	f3D_64_decode.push_back(decode_3D_64_wrapper(string("Runtime dispatch: ") + morton3D_64_dispatch().name, &morton3D_64_decode_dispatch<uint_fast32_t>));
+
 	// Register 2D 64-bit encode functions	
 	f2D_64_encode.push_back(encode_2D_64_wrapper("LUT Shifted ET", &m2D_e_sLUT_ET<uint_fast64_t, uint_fast32_t>));
 	f2D_64_encode.push_back(encode_2D_64_wrapper("LUT Shifted", &m2D_e_sLUT<uint_fast64_t, uint_fast32_t>));
@@ -398,6 +470,9 @@ int main(int argc, char *argv[]) {
 	check3D_EncodeCorrectness<uint_fast32_t, uint_fast16_t>(f3D_32_encode);
 	check3D_DecodeCorrectness<uint_fast64_t, uint_fast32_t>(f3D_64_decode);
 	check3D_DecodeCorrectness<uint_fast32_t, uint_fast16_t>(f3D_32_decode);
+	printf("++ Checking 3D stepping methods ... ");
+	if (check3D_Stepping<uint_fast64_t, uint_fast32_t>(10000) && check3D_Stepping<uint_fast32_t, uint_fast16_t>(10000)) { printf(" Passed. \n"); }
+	else { printf("    One or more methods failed. \n"); }
 
 	cout << "++ Checking 2D methods for correctness" << endl;
 	// TODO
@@ -408,6 +483,7 @@ int main(int argc, char *argv[]) {
 		total = MAX*MAX*MAX;
 		Encode_3D_Perf();
 		Decode_3D_Perf();
+		Step_3D_Perf();
 		printRunningSums();
 	}
 }
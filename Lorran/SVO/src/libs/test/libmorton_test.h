@@ -21,6 +21,7 @@
 #include "../libmorton/include/morton2D.h"
 #include "../libmorton/include/morton3D.h"
 #include "../libmorton/include/morton.h"
+#include "../libmorton/include/morton_dispatch.h"
 
 template <typename morton, typename coord>
 struct encode_f_2D_wrapper {
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "timer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ASYNCWRITER_PWRITE
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Size of one staging block (in bytes)
+#define ASYNCWRITER_BLOCKSIZE (4*1024*1024)
+
+// Write-combining output file: small writes are gathered in a staging block in memory,
+// full blocks are handed to a background thread which writes them out (pwrite where available).
+// There are two blocks, so the caller keeps filling one while the other is on its way to disk,
+// and only waits if the disk falls a whole block behind.
+// append: carry on at the end of an existing file (a resumed build, see OctreeBuilder::writeCheckpoint) instead of starting a new one.
+class AsyncWriter {
+public:
+	AsyncWriter(const std::string &filename, size_t blocksize = ASYNCWRITER_BLOCKSIZE, const bool append = false);
+	~AsyncWriter();
+	void write(const void* data, size_t bytes);
+	bool sync();
+	void close();
+	bool isOpen() const;
+	size_t size() const;
+
+	Timer stall_timer; // time the caller spent waiting for the writer thread
+
+private:
+	AsyncWriter(const AsyncWriter&);
+	AsyncWriter& operator=(const AsyncWriter&);
+
+	void handOff();
+	void run();
+	void writeOut(const char* data, size_t bytes);
+
+	std::string filename;
+	size_t blocksize;
+	char* blocks[2];
+	int active; // block the caller is filling
+	size_t fill; // bytes used in the active block
+	size_t total; // size of the file once everything written so far is out
+
+#ifdef ASYNCWRITER_PWRITE
+	int fd;
+	off_t file_offset;
+#else
+	FILE* file;
+#endif
+	bool failed;
+
+	// shared with the writer thread
+	std::thread writer;
+	std::mutex m;
+	std::condition_variable cv;
+	const char* pending_block; // block the writer thread owns, NULL if none
+	size_t pending_size;
+	bool closing;
+};
+
+inline AsyncWriter::AsyncWriter(const std::string &filename, size_t blocksize, const bool append) : filename(filename), blocksize(blocksize), active(0), fill(0), total(0),
+	failed(false), pending_block(NULL), pending_size(0), closing(false) {
+#ifdef ASYNCWRITER_PWRITE
+	fd = open(filename.c_str(), O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+	file_offset = 0;
+	failed = (fd == -1);
+	if (!failed && append) {
+		file_offset = lseek(fd, 0, SEEK_END);
+		total = static_cast<size_t>(file_offset);
+	}
+#else
+	file = fopen(filename.c_str(), append ? "ab" : "wb");
+	failed = (file == NULL);
+	if (!failed && append) {
+		fseek(file, 0, SEEK_END);
+		total = static_cast<size_t>(ftell(file));
+	}
+#endif
+	if (failed) {
+		cout << "Error: could not open " << filename << " for writing" << endl;
+	}
+	blocks[0] = new char[blocksize];
+	blocks[1] = new char[blocksize];
+	writer = std::thread(&AsyncWriter::run, this);
+}
+
+inline AsyncWriter::~AsyncWriter(){
+	close();
+}
+
+inline bool AsyncWriter::isOpen() const{
+	return writer.joinable();
+}
+
+inline size_t AsyncWriter::size() const{
+	return total;
+}
+
+// Copy data into the staging block, handing off blocks as they fill up
+inline void AsyncWriter::write(const void* data, size_t bytes){
+	const char* src = static_cast<const char*>(data);
+	total += bytes;
+	while (bytes > 0) {
+		size_t n = std::min(bytes, blocksize - fill);
+		memcpy(blocks[active] + fill, src, n);
+		fill += n;
+		src += n;
+		bytes -= n;
+		if (fill == blocksize) {
+			handOff();
+		}
+	}
+}
+
+// Give the active block to the writer thread and continue in the other one
+inline void AsyncWriter::handOff(){
+	std::unique_lock<std::mutex> lock(m);
+	if (pending_block != NULL) { // the other block is still being written
+		stall_timer.start();
+		cv.wait(lock, [this]{ return pending_block == NULL; });
+		stall_timer.stop();
+	}
+	pending_block = blocks[active];
+	pending_size = fill;
+	cv.notify_all();
+	active = 1 - active;
+	fill = 0;
+}
+
+// Hand off what's in the staging block and wait until everything written so far is in the file (on disk, where we can make sure).
+// False if writing failed.
+inline bool AsyncWriter::sync(){
+	if (!isOpen()) {
+		return !failed;
+	}
+	if (fill > 0) {
+		handOff();
+	}
+	{
+		std::unique_lock<std::mutex> lock(m);
+		stall_timer.start();
+		cv.wait(lock, [this]{ return pending_block == NULL; });
+		stall_timer.stop();
+	}
+#ifdef ASYNCWRITER_PWRITE
+	if (!failed && fsync(fd) != 0) {
+		cout << "Error: syncing " << filename << " failed" << endl;
+		failed = true;
+	}
+#else
+	if (!failed && fflush(file) != 0) {
+		cout << "Error: writing to " << filename << " failed" << endl;
+		failed = true;
+	}
+#endif
+	return !failed;
+}
+
+// Flush what's left, wait for the writer thread and close the file
+inline void AsyncWriter::close(){
+	if (!isOpen()) {
+		return;
+	}
+	if (fill > 0) {
+		handOff();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m);
+		closing = true;
+	}
+	cv.notify_all();
+	writer.join();
+#ifdef ASYNCWRITER_PWRITE
+	if (fd != -1) { ::close(fd); }
+#else
+	if (file != NULL) { fclose(file); }
+#endif
+	delete[] blocks[0];
+	delete[] blocks[1];
+}
+
+// Writer thread: write out blocks as they are handed over, until closed
+inline void AsyncWriter::run(){
+	std::unique_lock<std::mutex> lock(m);
+	while (true) {
+		cv.wait(lock, [this]{ return pending_block != NULL || closing; });
+		if (pending_block != NULL) {
+			const char* block = pending_block;
+			size_t size = pending_size;
+			lock.unlock();
+			writeOut(block, size);
+			lock.lock();
+			pending_block = NULL;
+			cv.notify_all();
+		}
+		else {
+			return; // closing and nothing left to write
+		}
+	}
+}
+
+inline void AsyncWriter::writeOut(const char* data, size_t bytes){
+	if (failed) {
+		return;
+	}
+#ifdef ASYNCWRITER_PWRITE
+	while (bytes > 0) {
+		ssize_t written = pwrite(fd, data, bytes, file_offset);
+		if (written <= 0) {
+			cout << "Error: writing to " << filename << " failed" << endl;
+			failed = true;
+			return;
+		}
+		data += written;
+		bytes -= written;
+		file_offset += written;
+	}
+#else
+	if (fwrite(data, 1, bytes, file) != bytes) {
+		cout << "Error: writing to " << filename << " failed" << endl;
+		failed = true;
+	}
+#endif
+}
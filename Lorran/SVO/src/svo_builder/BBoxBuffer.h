@@ -2,15 +2,42 @@
 
 #include <stdio.h>
 #include <vector>
+#include <atomic>
 #include <glm/glm.hpp>
 #include "globals.h"
 #include "intersection.h"
 #include "../libs/libtri/include/tri_tools.h"
+#include "../libs/libtri/include/tri_compress.h"
+#include "../libs/libtri/include/tri_indexed.h"
 
 using namespace std;
 using namespace glm;
 
+// A byte budget shared by all buffers that keep their triangles in memory (svo_builder -partition_memory)
+class MemoryBudget{
+public:
+	MemoryBudget(size_t limit) : limit(limit), used(0) {}
+
+	// Reserve bytes, false if they don't fit anymore
+	bool take(size_t bytes){
+		if (used.fetch_add(bytes) + bytes <= limit) { return true; }
+		used.fetch_sub(bytes);
+		return false;
+	}
+	void give(size_t bytes){ used.fetch_sub(bytes); }
+	size_t inUse() const{ return used.load(); }
+
+private:
+	size_t limit;
+	std::atomic<size_t> used;
+};
+
 // A BBoxBuffer which checks triangles against a bounding box, and writes them in batches to a given file/stream if they fit.
+// Given a lattice, it writes a compressed stream (see tri_compress.h) instead of raw triangles.
+// Indexed buffers take index triples (see tri_indexed.h) through addIndexed, and write those.
+// Given a memory budget, it keeps its triangles in memory instead, until the budget runs out: then it spills them to its file.
+// T is the triangle type of the model (GeometryTriangle or ColorTriangle, see tri_util.h).
+template <typename T>
 class BBoxBuffer{
 public:
 	FILE* file; // the file we'll write our triangles to
@@ -19,66 +46,174 @@ public:
 	size_t n_triangles; // number of triangles already in
 
 	// Buffered
-	vector<Triangle> triangle_buffer; // triangle buffer
+	vector<T> triangle_buffer; // triangle buffer
 	size_t buffer_max; // maximum of tris we buffer before writing to disk
 
+	// Compressed
+	const TriLattice* lattice; // NULL: raw triangles
+	TriBlockWriter<T>* compressor;
+
+	// Indexed
+	bool indexed;
+	vector<IndexedTriangle<T> > index_buffer;
+
+	// In memory
+	MemoryBudget* memory; // NULL: always write to the file
+	vector<vector<T> > kept; // triangles kept in memory, as the buffers we filled (so they're never copied)
+	bool spilled; // ran out of budget, everything went to the file
+
 	BBoxBuffer();
-	BBoxBuffer(const std::string &filename, AABox<vec3> bbox_world, size_t buffer_max);
+	BBoxBuffer(const std::string &filename, AABox<vec3> bbox_world, size_t buffer_max, const TriLattice* lattice = NULL, bool indexed = false);
 	~BBoxBuffer();
 
-	void processTriangle(Triangle &t, const AABox<vec3> &bbox);
+	void processTriangle(T &t, const AABox<vec3> &bbox);
+	void addTriangle(const T &t);
+	void addIndexed(const IndexedTriangle<T> &t);
+	void keepInMemory(MemoryBudget* budget);
+	bool takeTriangles(vector<vector<T> > &chunks);
 
 private:
 	void flush();
+	void openFile();
 };
 
 // default constructor
-inline BBoxBuffer::BBoxBuffer() : bbox_world(AABox<vec3>(vec3(),vec3(1,1,1))), n_triangles(0), buffer_max(1024), file(NULL), filename(""){
+template <typename T>
+inline BBoxBuffer<T>::BBoxBuffer() : bbox_world(AABox<vec3>(vec3(),vec3(1,1,1))), n_triangles(0), buffer_max(1024), file(NULL), filename(""), lattice(NULL), compressor(NULL), indexed(false), memory(NULL), spilled(false){
 }
 
 // full constructor
-inline BBoxBuffer::BBoxBuffer(const std::string &filename, AABox<vec3> bbox_world, size_t buffer_max): bbox_world(bbox_world), n_triangles(0), buffer_max(buffer_max), file(NULL), filename(filename) {
-	triangle_buffer.reserve(buffer_max); // prepare buffer
+template <typename T>
+inline BBoxBuffer<T>::BBoxBuffer(const std::string &filename, AABox<vec3> bbox_world, size_t buffer_max, const TriLattice* lattice, bool indexed): bbox_world(bbox_world), n_triangles(0), buffer_max(buffer_max),
+	file(NULL), filename(filename), lattice(lattice), compressor(NULL), indexed(indexed), memory(NULL), spilled(false) {
+	if(indexed){
+		index_buffer.reserve(buffer_max);
+	} else {
+		triangle_buffer.reserve(buffer_max); // prepare buffer
+	}
 	file = NULL;
 }
 
 //destructor
-inline BBoxBuffer::~BBoxBuffer(){
+template <typename T>
+inline BBoxBuffer<T>::~BBoxBuffer(){
 	if(buffer_max != 0){
 		flush();
 	}
+	delete compressor;
 	if(file != NULL){ // only close the file if we opened it.
 		fclose(file);
 	}
 }
 
 // Flush the buffer and write everything to disk
-inline void BBoxBuffer::flush(){
+template <typename T>
+inline void BBoxBuffer<T>::flush(){
+	if(index_buffer.size() != 0){
+		openFile();
+		fwrite(&index_buffer[0], sizeof(IndexedTriangle<T>), index_buffer.size(), file);
+		index_buffer.clear();
+	}
 	if(triangle_buffer.size() == 0){
 		return; // nothing to flush here.
 	}
-	if(file == NULL){ // if the file is not open yet, we open it.
-		file = fopen(filename.c_str(), "wb");
+	if(memory != NULL && !spilled){
+		if(memory->take(triangle_buffer.capacity() * sizeof(T))){
+			kept.push_back(vector<T>());
+			kept.back().swap(triangle_buffer);
+			triangle_buffer.reserve(buffer_max);
+			return;
+		}
+		// out of budget: what we kept goes to the file first, and the rest follows it
+		spilled = true;
+		openFile();
+		for(size_t i = 0; i < kept.size(); i++){
+			writeTriangles(file, kept[i][0], kept[i].size());
+			memory->give(kept[i].capacity() * sizeof(T));
+		}
+		vector<vector<T> >().swap(kept);
+	}
+	openFile();
+	if(compressor != NULL){
+		compressor->write(&triangle_buffer[0], triangle_buffer.size());
+	} else {
+		writeTriangles(file,triangle_buffer[0],triangle_buffer.size());
 	}
-	part_algo_timer.stop(); part_io_out_timer.start(); // TIMING
-	writeTriangles(file,triangle_buffer[0],triangle_buffer.size());
-	part_io_out_timer.stop(); part_algo_timer.start();  // TIMING
 	triangle_buffer.clear();
 }
 
+// Open the file (and start the compressed stream) when we first write to it
+template <typename T>
+inline void BBoxBuffer<T>::openFile(){
+	if(file != NULL){
+		return;
+	}
+	file = fopen(filename.c_str(), "wb");
+	if(lattice != NULL){
+		compressor = new TriBlockWriter<T>(file, *lattice);
+	}
+}
+
 // Check triangle against buffer bounding box and add it to buffer if it is in it.
-inline void BBoxBuffer::processTriangle(Triangle &t, const AABox<vec3> &bbox){
+template <typename T>
+inline void BBoxBuffer<T>::processTriangle(T &t, const AABox<vec3> &bbox){
 	if(intersectBoxBox(bbox, bbox_world)){ // triangle in this partition
-		if(buffer_max == 0){ // no buffering, just write triangle
-			part_algo_timer.stop(); part_io_out_timer.start(); // TIMING
+		addTriangle(t);
+	}
+}
+
+// Add a triangle which is known to be in this partition, write out the buffer when it's full.
+// Buffers share no state, so different threads can fill different buffers at the same time.
+template <typename T>
+inline void BBoxBuffer<T>::addTriangle(const T &t){
+	if(buffer_max == 0){ // no buffering, just write triangle
+		openFile();
+		if(compressor != NULL){
+			compressor->write(&t, 1);
+		} else {
 			writeTriangle(file, t);
-			part_io_out_timer.stop(); part_algo_timer.start();  // TIMING
-		} else { // add to buffer
-			triangle_buffer.push_back(t);
-			if(triangle_buffer.size() >= buffer_max) { // buffer full, writeout to files
-				flush();
-			}
 		}
-		n_triangles++;
+	} else { // add to buffer
+		triangle_buffer.push_back(t);
+		if(triangle_buffer.size() >= buffer_max) { // buffer full, writeout to files
+			flush();
+		}
+	}
+	n_triangles++;
+}
+
+// Add the index triple of a triangle which is known to be in this partition (indexed buffers only)
+template <typename T>
+inline void BBoxBuffer<T>::addIndexed(const IndexedTriangle<T> &t){
+	if(buffer_max == 0){
+		openFile();
+		fwrite(&t, sizeof(IndexedTriangle<T>), 1, file);
+	} else {
+		index_buffer.push_back(t);
+		if(index_buffer.size() >= buffer_max) {
+			flush();
+		}
+	}
+	n_triangles++;
+}
+
+// Keep the triangles in memory while they fit the budget (plain triangles only: not for compressed or indexed buffers)
+template <typename T>
+inline void BBoxBuffer<T>::keepInMemory(MemoryBudget* budget){
+	memory = budget;
+}
+
+// Hand over the triangles kept in memory (their bytes stay taken from the budget). False if they went to the file.
+template <typename T>
+inline bool BBoxBuffer<T>::takeTriangles(vector<vector<T> > &chunks){
+	if(memory == NULL){
+		return false;
+	}
+	flush();
+	if(spilled){
+		return false;
 	}
+	chunks.swap(kept);
+	vector<vector<T> >().swap(kept);
+	return true;
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+#include "VoxelData.h"
+#include "AsyncWriter.h"
+#include "checkpoint.h"
+
+using namespace std;
+using namespace glm;
+
+// Bricks: instead of one payload, every node gets a small block of filtered voxels (a brick) covering its whole cube,
+// so a cone tracer can sample it with hardware trilinear filtering and stops descending the tree much earlier.
+// Leaf bricks hold the voxels themselves, higher bricks (-levels) are 2x2x2 box filtered from their 8 children.
+// Bricks have no border: filtering across brick boundaries needs the neighbouring brick.
+
+// Width and height of the brick atlas, in bricks. Its depth grows with the number of bricks.
+#define BRICK_ATLAS_WIDTH 64
+
+// A brick while it is being filled: coverage-weighted sums of the voxels that fall in each texel
+struct BrickAccumulator {
+	int size; // texels along each axis
+	float samples; // voxels (leaves) or child texels (filtered bricks) that make up one texel
+	vector<vec3> color;
+	vector<vec3> normal;
+	vector<float> coverage;
+	bool empty;
+
+	BrickAccumulator() : size(0), samples(1.0f), empty(true) {}
+
+	void init(const int brick_size, const float texel_samples){
+		size = brick_size;
+		samples = texel_samples;
+		color.assign(size * size * size, vec3());
+		normal.assign(size * size * size, vec3());
+		coverage.assign(size * size * size, 0.0f);
+		empty = true;
+	}
+
+	void clear(){
+		if (empty) { return; }
+		std::fill(color.begin(), color.end(), vec3());
+		std::fill(normal.begin(), normal.end(), vec3());
+		std::fill(coverage.begin(), coverage.end(), 0.0f);
+		empty = true;
+	}
+
+	// Texels are stored x fastest, then y, then z (like the atlas)
+	size_t texel(const unsigned int x, const unsigned int y, const unsigned int z) const {
+		return (static_cast<size_t>(z) * size + y) * size + x;
+	}
+
+	// Leaf bricks: a voxel fills its texel
+	void addVoxel(const uvec3 &t, const vec3 &c, const vec3 &n){
+		size_t i = texel(t.x, t.y, t.z);
+		color[i] += c;
+		normal[i] += n;
+		coverage[i] += 1.0f;
+		empty = false;
+	}
+
+	// Filtered bricks: box filter the brick of child octant (x in bit 0, y in bit 1, z in bit 2) into our texels
+	void addChild(const BrickAccumulator &child, const unsigned int octant){
+		if (child.empty) { return; }
+		unsigned int half = size / 2;
+		uvec3 base = uvec3(octant & 1, (octant >> 1) & 1, (octant >> 2) & 1) * half;
+		float w = 1.0f / child.samples;
+		for (unsigned int z = 0; z < static_cast<unsigned int>(size); z++) {
+			for (unsigned int y = 0; y < static_cast<unsigned int>(size); y++) {
+				for (unsigned int x = 0; x < static_cast<unsigned int>(size); x++) {
+					size_t c = child.texel(x, y, z);
+					if (child.coverage[c] == 0.0f) { continue; }
+					size_t i = texel(base.x + x / 2, base.y + y / 2, base.z + z / 2);
+					color[i] += child.color[c] * w;
+					normal[i] += child.normal[c] * w;
+					coverage[i] += child.coverage[c] * w;
+				}
+			}
+		}
+		empty = false;
+	}
+
+	// Final texel values: average color, average normal and the filled fraction of the texel
+	vec3 getColor(const size_t i) const { return coverage[i] > 0.0f ? color[i] / coverage[i] : vec3(); }
+	vec3 getNormal(const size_t i) const { return length(normal[i]) > 0.0f ? normalize(normal[i]) : vec3(); }
+	float getCoverage(const size_t i) const { return coverage[i] / samples; }
+};
+
+// Writes bricks into two 3D atlases, ready to upload as 3D textures:
+// .octreebricks (RGBA8: color, alpha = coverage) and .octreebricknormals (octahedral normal, 2 x 16-bit snorm).
+// Brick i goes to (i % W, (i / W) % W, i / (W * W)) in brick units, W = BRICK_ATLAS_WIDTH. Brick 0 is empty.
+// Bricks are gathered per slab of W x W bricks, and every full slab is written out as B texel slices.
+class BrickAtlasWriter {
+public:
+	int brick_size;
+	size_t n_bricks; // bricks written, including the empty brick 0
+	size_t n_slabs; // atlas depth, in bricks
+	AsyncWriter* color_out;
+	AsyncWriter* normal_out;
+
+	BrickAtlasWriter(const std::string &base_filename, const int brick_size, const bool resume = false);
+	~BrickAtlasWriter();
+	size_t writeBrick(const BrickAccumulator &b);
+	void flush();
+	void writeCheckpoint(FILE* f) const;
+	bool readCheckpoint(FILE* f);
+
+private:
+	BrickAtlasWriter(const BrickAtlasWriter&);
+	BrickAtlasWriter& operator=(const BrickAtlasWriter&);
+
+	void writeSlab();
+
+	size_t slab_width; // texels
+	vector<::uint32_t> slab_color;
+	vector<::uint32_t> slab_normal;
+	size_t slab_fill; // bricks in the current slab
+};
+
+// resume: append to the atlases of a resumed build, readCheckpoint restores the rest
+inline BrickAtlasWriter::BrickAtlasWriter(const std::string &base_filename, const int brick_size, const bool resume) : brick_size(brick_size), n_bricks(0), n_slabs(0), slab_fill(0) {
+	color_out = new AsyncWriter(base_filename + string(".octreebricks"), ASYNCWRITER_BLOCKSIZE, resume);
+	normal_out = new AsyncWriter(base_filename + string(".octreebricknormals"), ASYNCWRITER_BLOCKSIZE, resume);
+	slab_width = BRICK_ATLAS_WIDTH * brick_size;
+	slab_color.assign(slab_width * slab_width * brick_size, 0);
+	slab_normal.assign(slab_width * slab_width * brick_size, OCTNORMAL_ZERO);
+	if (resume) {
+		return;
+	}
+	BrickAccumulator empty;
+	empty.init(brick_size, 1.0f);
+	writeBrick(empty); // brick 0: no data
+}
+
+inline BrickAtlasWriter::~BrickAtlasWriter(){
+	delete color_out;
+	delete normal_out;
+}
+
+// Copy a brick into its place in the current slab, returns its index
+inline size_t BrickAtlasWriter::writeBrick(const BrickAccumulator &b){
+	size_t bx = (slab_fill % BRICK_ATLAS_WIDTH) * brick_size;
+	size_t by = (slab_fill / BRICK_ATLAS_WIDTH) * brick_size;
+	for (int z = 0; z < brick_size; z++) {
+		for (int y = 0; y < brick_size; y++) {
+			size_t row = (static_cast<size_t>(z) * slab_width + by + y) * slab_width + bx;
+			for (int x = 0; x < brick_size; x++) {
+				size_t i = b.texel(x, y, z);
+				if (b.coverage[i] == 0.0f) { continue; }
+				slab_color[row + x] = encodeRGBA8(b.getColor(i), b.getCoverage(i));
+				slab_normal[row + x] = encodeOctNormal(b.getNormal(i));
+			}
+		}
+	}
+	slab_fill++;
+	n_bricks++;
+	if (slab_fill == BRICK_ATLAS_WIDTH * BRICK_ATLAS_WIDTH) {
+		writeSlab();
+	}
+	return n_bricks - 1;
+}
+
+inline void BrickAtlasWriter::writeSlab(){
+	color_out->write(&slab_color[0], slab_color.size() * sizeof(::uint32_t));
+	normal_out->write(&slab_normal[0], slab_normal.size() * sizeof(::uint32_t));
+	std::fill(slab_color.begin(), slab_color.end(), 0);
+	std::fill(slab_normal.begin(), slab_normal.end(), OCTNORMAL_ZERO);
+	slab_fill = 0;
+	n_slabs++;
+}
+
+// Checkpoints: the slab being filled (the full ones are in the atlas files already)
+inline void BrickAtlasWriter::writeCheckpoint(FILE* f) const{
+	writeCheckpointValue(f, n_bricks);
+	writeCheckpointValue(f, n_slabs);
+	writeCheckpointValue(f, slab_fill);
+	writeCheckpointVector(f, slab_color);
+	writeCheckpointVector(f, slab_normal);
+}
+
+inline bool BrickAtlasWriter::readCheckpoint(FILE* f){
+	return readCheckpointValue(f, n_bricks) && readCheckpointValue(f, n_slabs) && readCheckpointValue(f, slab_fill)
+		&& readCheckpointVector(f, slab_color) && readCheckpointVector(f, slab_normal) && slab_color.size() == slab_width * slab_width * brick_size;
+}
+
+// Write out the last, partially filled slab (the rest of it stays empty, so the atlas is a full box)
+inline void BrickAtlasWriter::flush(){
+	if (slab_fill > 0) {
+		writeSlab();
+	}
+}
@@ -17,7 +17,7 @@ public:
 	size_t children_base;
 	char children_offset[8];
 
-	VoxelData data_cache; // only if you want to refine octree (clustering)
+	VoxelData data_cache; // only if you want to refine octree (clustering). Packed payloads (svo_builder -packed) are packed when written.
 
 	Node();
 	bool hasChild(unsigned int i) const;
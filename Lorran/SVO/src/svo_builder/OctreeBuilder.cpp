@@ -1,76 +1,281 @@
 #include "OctreeBuilder.h"
 
+// Output files of the octree (the .octree header is written last)
+const int n_output_files = 5;
+const char* const output_files[n_output_files] = { ".octreenodes", ".octreedata", ".octreelevels", ".octreebricks", ".octreebricknormals" };
+
 // OctreeBuilder constructor: this initializes the builder and sets up the output files, ready to go
-OctreeBuilder::OctreeBuilder(std::string base_filename, size_t gridlength, bool generate_levels) :
-gridlength(gridlength), b_node_pos(0), b_data_pos(0), b_current_morton(0), generate_levels(generate_levels), base_filename(base_filename) {
+OctreeBuilder::OctreeBuilder(std::string base_filename, size_t gridlength, bool generate_levels, int node_format, int brick_size, bool geometry_only, bool packed_data, FILE* checkpoint) :
+gridlength(gridlength), b_node_pos(0), b_word_pos(0), b_data_pos(0), b_current_morton(0), generate_levels(generate_levels), node_format(node_format), brick_size(brick_size), brick_levels(0),
+geometry_only(geometry_only), packed_data(packed_data), n_partitions(0), range_start(0), range_end(0), node_out(NULL), data_out(NULL), levels_out(NULL), base_filename(base_filename), bricks_out(NULL), b_brick_morton(0) {
 	svo_algo_timer.start();
+	if (brick_size > 0){
+		brick_levels = log2(static_cast<unsigned int>(brick_size));
+	}
 
-	// Open output files
-	string nodes_name = base_filename + string(".octreenodes");
-	string data_name = base_filename + string(".octreedata");
-	node_out = fopen(nodes_name.c_str(), "wb");
-	data_out = fopen(data_name.c_str(), "wb");
-
-	// Setup building variables
-	b_maxdepth = log2(static_cast<unsigned int>(gridlength));
+	// Setup building variables: with bricks, the tree stops at the leaf bricks
+	b_maxdepth = log2(static_cast<unsigned int>(gridlength)) - brick_levels;
 	b_buffers.resize(b_maxdepth + 1);
 	for (int i = 0; i < b_maxdepth + 1; i++){
 		b_buffers[i].reserve(8);
 	}
+	if (brick_size > 0){
+		b_bricks.resize(b_maxdepth + 1);
+		for (int i = 0; i < b_maxdepth + 1; i++){
+			b_bricks[i].init(brick_size, i == b_maxdepth ? 1.0f : 8.0f); // a leaf texel is a voxel, a filtered texel 8 child texels
+		}
+	}
 
-	// Fill data arrays
-	uint_fast32_t maxm = static_cast<uint_fast32_t>(gridlength - 1);
-	b_max_morton = morton3D_64_encode(maxm,maxm,maxm);
-	svo_algo_timer.stop(); svo_io_out_timer.start(); // TIMING
-	writeVoxelData(data_out, VoxelData(), b_data_pos); // first data point is NULL
-#ifdef BINARY_VOXELIZATION
-	VoxelData v = VoxelData(0, vec3(), vec3(1.0, 1.0, 1.0)); // We store a simple white voxel in case of Binary voxelization
-	writeVoxelData(data_out, v, b_data_pos); // all leafs will refer to this
-#endif
-	svo_io_out_timer.stop(); svo_algo_timer.stop();
+	uint_fast32_t maxm = static_cast<uint_fast32_t>((gridlength >> brick_levels) - 1);
+	b_max_morton = morton3D_64_encode_dispatch(maxm,maxm,maxm);
+
+	// Resumed build: the checkpoint has the rest
+	if (checkpoint != NULL){
+		if (!readCheckpoint(checkpoint)){
+			cout << "Error: could not resume the octree from its checkpoint" << endl;
+			exit(1);
+		}
+		svo_algo_timer.stop();
+		return;
+	}
+
+	// Open output files and fill data arrays
+	openOutput(false);
+	writeData(*data_out, Node(), b_data_pos); // first data point is NULL
+	bool shared_leaf_data = geometry_only || (node_format == OCTREE_FORMAT_DAG); // the DAG only stores geometry
+	if (shared_leaf_data){
+		Node white = Node();
+		white.data_cache = VoxelData(0, vec3(), vec3(1.0, 1.0, 1.0)); // We store a simple white voxel in case of Binary voxelization
+		writeData(*data_out, white, b_data_pos); // all leafs will refer to this
+	}
+	svo_algo_timer.stop();
+}
+
+// Open the output files. append: carry on with the files of a resumed build.
+void OctreeBuilder::openOutput(const bool append){
+	node_out = new AsyncWriter(base_filename + string(output_files[0]), ASYNCWRITER_BLOCKSIZE, append);
+	data_out = new AsyncWriter(base_filename + string(output_files[1]), ASYNCWRITER_BLOCKSIZE, append);
+	if (node_format == OCTREE_FORMAT_COMPACT && generate_levels){
+		levels_out = new AsyncWriter(base_filename + string(output_files[2]), ASYNCWRITER_BLOCKSIZE, append);
+	}
+	if (brick_size > 0){
+		bricks_out = new BrickAtlasWriter(base_filename, brick_size, append);
+	}
+}
+
+// CHECKPOINTS: everything the builder needs to carry on after a crash (see checkpoint.h). The output files are synced first,
+// their sizes go into the checkpoint, and then the building state: the buffers, the output positions, the DAG nodes written
+// so far and the bricks being filled. Call it between voxels, e.g. at a partition boundary. False if the output failed.
+bool OctreeBuilder::writeCheckpoint(FILE* f){
+	AsyncWriter* writers[n_output_files] = { node_out, data_out, levels_out, NULL, NULL };
+	if (bricks_out != NULL){
+		writers[3] = bricks_out->color_out;
+		writers[4] = bricks_out->normal_out;
+	}
+	bool ok = true;
+	for (int i = 0; i < n_output_files; i++){
+		size_t size = 0;
+		if (writers[i] != NULL){
+			ok = writers[i]->sync() && ok;
+			size = writers[i]->size();
+		}
+		writeCheckpointValue(f, size);
+	}
+
+	writeCheckpointValue(f, b_maxdepth);
+	writeCheckpointValue(f, b_current_morton);
+	writeCheckpointValue(f, b_data_pos);
+	writeCheckpointValue(f, b_node_pos);
+	writeCheckpointValue(f, b_word_pos);
+	for (int d = 0; d <= b_maxdepth; d++){
+		writeCheckpointVector(f, b_buffers[d]);
+	}
+	writeCheckpointValue(f, dag_nodes.size());
+	for (unordered_map<DagNode, size_t, DagNodeHash>::const_iterator it = dag_nodes.begin(); it != dag_nodes.end(); ++it){
+		writeCheckpointValue(f, it->first);
+		writeCheckpointValue(f, it->second);
+	}
+	if (bricks_out != NULL){
+		writeCheckpointValue(f, b_brick_morton);
+		for (int d = 0; d <= b_maxdepth; d++){
+			writeCheckpointValue(f, b_bricks[d].empty);
+			if (!b_bricks[d].empty){
+				writeCheckpointVector(f, b_bricks[d].color);
+				writeCheckpointVector(f, b_bricks[d].normal);
+				writeCheckpointVector(f, b_bricks[d].coverage);
+			}
+		}
+		bricks_out->writeCheckpoint(f);
+	}
+	return ok;
+}
+
+// Resume from a checkpoint: cut the output files back to their size at the checkpoint, and restore the building state
+bool OctreeBuilder::readCheckpoint(FILE* f){
+	size_t sizes[n_output_files];
+	for (int i = 0; i < n_output_files; i++){
+		if (!readCheckpointValue(f, sizes[i])){ return false; }
+	}
+	bool has_file[n_output_files] = { true, true, node_format == OCTREE_FORMAT_COMPACT && generate_levels, brick_size > 0, brick_size > 0 };
+	for (int i = 0; i < n_output_files; i++){
+		if (has_file[i] && !truncate_file(base_filename + string(output_files[i]), sizes[i])){
+			cout << "Error: " << base_filename << output_files[i] << " is missing, or shorter than at the checkpoint" << endl;
+			return false;
+		}
+	}
+	openOutput(true);
+
+	int maxdepth;
+	if (!readCheckpointValue(f, maxdepth) || maxdepth != b_maxdepth){ return false; }
+	if (!readCheckpointValue(f, b_current_morton) || !readCheckpointValue(f, b_data_pos) || !readCheckpointValue(f, b_node_pos) || !readCheckpointValue(f, b_word_pos)){ return false; }
+	for (int d = 0; d <= b_maxdepth; d++){
+		if (!readCheckpointVector(f, b_buffers[d])){ return false; }
+	}
+	size_t n_dag_nodes;
+	if (!readCheckpointValue(f, n_dag_nodes)){ return false; }
+	dag_nodes.reserve(n_dag_nodes);
+	for (size_t i = 0; i < n_dag_nodes; i++){
+		DagNode d;
+		size_t pos;
+		if (!readCheckpointValue(f, d) || !readCheckpointValue(f, pos)){ return false; }
+		dag_nodes[d] = pos;
+	}
+	if (bricks_out != NULL){
+		if (!readCheckpointValue(f, b_brick_morton)){ return false; }
+		for (int d = 0; d <= b_maxdepth; d++){
+			if (!readCheckpointValue(f, b_bricks[d].empty)){ return false; }
+			if (!b_bricks[d].empty && (!readCheckpointVector(f, b_bricks[d].color) || !readCheckpointVector(f, b_bricks[d].normal) || !readCheckpointVector(f, b_bricks[d].coverage))){ return false; }
+		}
+		if (!bricks_out->readCheckpoint(f)){ return false; }
+	}
+	return true;
 }
 
 // Finalize the tree: add rest of empty nodes, make sure root node is on top
 void OctreeBuilder::finalizeTree(){
+	if (bricks_out != NULL && !b_bricks[b_maxdepth].empty){
+		flushLeafBrick();
+	}
+
 	// fill octree
 	if (b_current_morton < b_max_morton){
 		fastAddEmpty((b_max_morton - b_current_morton) + 1);
 	}
 
 	// write root node
-	svo_algo_timer.stop(); svo_io_out_timer.start(); // TIMING
-	writeNode(node_out, b_buffers[0][0], b_node_pos);
-	svo_io_out_timer.stop(); svo_algo_timer.start(); // TIMING
+	size_t dag_root = 0;
+	if (node_format == OCTREE_FORMAT_DAG){
+		if (b_buffers[0][0].isNull()){ // empty tree: the root still needs a node
+			dag_root = writeDagNode(*node_out, DagNode(), b_word_pos);
+			b_node_pos++;
+		}
+		else { // the root was written when its children were grouped
+			dag_root = b_buffers[0][0].children_base;
+		}
+	}
+	else {
+		writeOutNode(b_buffers[0][0], 0);
+	}
 
 	// write header
-	OctreeInfo octree_info(1, base_filename, gridlength, b_node_pos, b_data_pos);
+	OctreeInfo octree_info(node_format, base_filename, gridlength, b_node_pos, b_data_pos, levels_out != NULL, packed_data);
+	octree_info.root = dag_root;
+	octree_info.geometry_only = geometry_only;
+	octree_info.n_partitions = n_partitions;
+	octree_info.morton_start = range_start;
+	octree_info.morton_end = range_end;
+	if (bricks_out != NULL){
+		bricks_out->flush();
+		octree_info.brick_size = brick_size;
+		octree_info.n_bricks = bricks_out->n_bricks;
+		octree_info.atlas_size[0] = octree_info.atlas_size[1] = BRICK_ATLAS_WIDTH;
+		octree_info.atlas_size[2] = bricks_out->n_slabs;
+	}
 
 	svo_algo_timer.stop(); svo_io_out_timer.start(); // TIMING
 	writeOctreeHeader(base_filename + string(".octree"), octree_info);
 	svo_io_out_timer.stop(); svo_algo_timer.start(); // TIMING
 
-	// close files
-	fclose(data_out);
-	fclose(node_out);
+	// close files: this waits for the writer threads to finish
+	svo_algo_timer.stop(); svo_io_out_timer.start(); // TIMING
+	AsyncWriter* writers[5] = { node_out, data_out, levels_out, NULL, NULL };
+	if (bricks_out != NULL){
+		writers[3] = bricks_out->color_out;
+		writers[4] = bricks_out->normal_out;
+	}
+	for (int i = 0; i < 5; i++){
+		if (writers[i] == NULL){ continue; }
+		// while building, we only waited on IO when a writer was a full block behind: count that as IO instead of algorithm time
+		double stalled = writers[i]->stall_timer.elapsed_time_milliseconds;
+		svo_io_out_timer.elapsed_time_milliseconds += stalled;
+		svo_algo_timer.elapsed_time_milliseconds -= stalled;
+		writers[i]->close();
+	}
+	delete node_out;
+	delete data_out;
+	delete levels_out;
+	delete bricks_out; // deletes its writers
+	node_out = data_out = levels_out = NULL;
+	bricks_out = NULL;
+	svo_io_out_timer.stop(); svo_algo_timer.start(); // TIMING
+}
+
+// Write a node (at the given depth) in the configured node format, returns its position
+size_t OctreeBuilder::writeOutNode(const Node &n, const int depth){
+	if (node_format == OCTREE_FORMAT_CLASSIC){
+		return writeNode(*node_out, n, b_node_pos);
+	}
+	if (levels_out != NULL){ // keep the levels file in step with the node file
+		size_t dummy_pos = 0;
+		writeData(*levels_out, n, dummy_pos);
+	}
+	checkChildPointer(n.children_base);
+	return writeCompactNode(*node_out, n, depth + 1 == b_maxdepth, b_node_pos);
+}
+
+// The compact and DAG nodes have 32-bit child pointers: stop before a pointer that doesn't fit would corrupt the octree
+void OctreeBuilder::checkChildPointer(const size_t pos){
+	if (static_cast<::uint64_t>(pos) <= 0xFFFFFFFFull){
+		return;
+	}
+	cout << "Error: child pointer " << pos << " doesn't fit the 32-bit child pointers of the " << (node_format == OCTREE_FORMAT_DAG ? "DAG" : "compact")
+		<< " format, use the classic format for this grid size." << endl;
+	exit(1);
+}
+
+// Write the payload of a node, packed or not, returns its position
+size_t OctreeBuilder::writeData(AsyncWriter &out, const Node &n, size_t &pos){
+	if (packed_data){
+		return writeVoxelData(out, PackedVoxelData(n.data_cache), pos);
+	}
+	return writeVoxelData(out, n.data_cache, pos);
 }
 
 // Group 8 nodes, write non-empty nodes to disk and create parent node
-Node OctreeBuilder::groupNodes(const vector<Node> &buffer){
+// In the compact format, leaves (depth == b_maxdepth) aren't written: the parent points at their data instead.
+Node OctreeBuilder::groupNodes(const vector<Node> &buffer, const int depth){
+	if (node_format == OCTREE_FORMAT_DAG){
+		return groupDagNodes(buffer, depth);
+	}
 	Node parent = Node();
 	bool first_stored_child = true;
+	bool leaves_as_data = (node_format == OCTREE_FORMAT_COMPACT && depth == b_maxdepth);
 	for (int k = 0; k < 8; k++){
 		if (!buffer[k].isNull()){
+			size_t pos;
+			if (leaves_as_data){
+				pos = buffer[k].data;
+			}
+			else {
+				pos = writeOutNode(buffer[k], depth);
+			}
 			if (first_stored_child){
-				svo_algo_timer.stop(); svo_io_out_timer.start(); // TIMING
-				parent.children_base = writeNode(node_out, buffer[k], b_node_pos);
-				svo_io_out_timer.stop(); svo_algo_timer.start(); // TIMING
+				parent.children_base = pos;
 				parent.children_offset[k] = 0;
 				first_stored_child = false;
 			}
 			else {
-				svo_algo_timer.stop(); svo_io_out_timer.start(); // TIMING
-				parent.children_offset[k] = (char)(writeNode(node_out, buffer[k], b_node_pos) - parent.children_base);
-				svo_io_out_timer.stop(); svo_algo_timer.start(); // TIMING
+				parent.children_offset[k] = (char)(pos - parent.children_base);
 			}
 		}
 		else {
@@ -78,29 +283,71 @@ Node OctreeBuilder::groupNodes(const vector<Node> &buffer){
 		}
 	}
 
+	// BRICKS: the parent brick was filtered from the bricks of these children as they were made
+	if (generate_levels && bricks_out != NULL){
+		parent.data = bricks_out->writeBrick(b_bricks[depth - 1]);
+		if (depth - 1 > 0){ // filter it into its own parent, at the position it will take in the buffer
+			b_bricks[depth - 2].addChild(b_bricks[depth - 1], static_cast<unsigned int>(b_buffers[depth - 1].size()));
+		}
+		b_bricks[depth - 1].clear();
+	}
 	// SIMPLE LEVEL CONSTRUCTION
-	if (generate_levels){
-		VoxelData d = VoxelData();
+	else if (generate_levels){
+		vec3 color = vec3();
+		vec3 normal = vec3();
 		float notnull = 0.0f;
 		for (int i = 0; i < 8; i++){ // this node has no data: need to refine
-			if (!buffer[i].isNull())
+			if (!buffer[i].isNull()){
 				notnull++;
-			d.color += buffer[i].data_cache.color;
-			d.normal += buffer[i].data_cache.normal;
+				color += buffer[i].data_cache.getColor();
+				normal += buffer[i].data_cache.getNormal();
+			}
+		}
+		VoxelData d = VoxelData();
+		d.setColor(color / notnull);
+		vec3 tonormalize = (vec3)(normal / notnull);
+		d.setNormal(normalize(tonormalize));
+		// set it in the parent node (packed, the parent averages what went to disk)
+		parent.data_cache = packed_data ? PackedVoxelData(d).unpack() : d;
+		if (levels_out == NULL){ // compact format stores it in the levels file when the node is written
+			parent.data = writeData(*data_out, parent, b_data_pos);
 		}
-		d.color = d.color / notnull;
-		vec3 tonormalize = (vec3)(d.normal / notnull);
-		d.normal = normalize(tonormalize);
-		// set it in the parent node
-		svo_algo_timer.stop(); svo_io_out_timer.start(); // TIMING
-		parent.data = writeVoxelData(data_out, d, b_data_pos);
-		svo_io_out_timer.stop(); svo_algo_timer.start(); // TIMING
-		parent.data_cache = d;
 	}
 
 	return parent;
 }
 
+// DAG format: group 8 nodes into a parent and write it, unless an identical node was written before.
+// The children are in the DAG already (or are voxels): the children_base of a grouped node is its own word offset.
+Node OctreeBuilder::groupDagNodes(const vector<Node> &buffer, const int depth){
+	Node parent = Node();
+	DagNode d;
+	for (int k = 0; k < 8; k++){
+		if (buffer[k].isNull()){
+			continue;
+		}
+		d.words[0] |= (1 << k);
+		parent.children_offset[k] = 0; // only marks the child as present
+		if (depth == b_maxdepth){ // voxels are leaves: no node, no pointer
+			d.words[0] |= (1 << (k + 8));
+		}
+		else {
+			checkChildPointer(buffer[k].children_base);
+			d.words[d.n_words++] = static_cast<uint32_t>(buffer[k].children_base);
+		}
+	}
+	unordered_map<DagNode, size_t, DagNodeHash>::const_iterator existing = dag_nodes.find(d);
+	if (existing != dag_nodes.end()){
+		parent.children_base = existing->second;
+	}
+	else {
+		parent.children_base = writeDagNode(*node_out, d, b_word_pos);
+		b_node_pos++;
+		dag_nodes[d] = parent.children_base;
+	}
+	return parent;
+}
+
 // Add an empty datapoint at a certain buffer level, and refine upwards from there
 void OctreeBuilder::addEmptyVoxel(const int buffer){
 	b_buffers[buffer].push_back(Node());
@@ -117,7 +364,7 @@ void OctreeBuilder::refineBuffers(const int start_depth){
 				b_buffers[d - 1].push_back(Node()); // push back NULL node to represent 8 empty nodes
 			}
 			else {
-				b_buffers[d - 1].push_back(groupNodes(b_buffers[d])); // push back parent node
+				b_buffers[d - 1].push_back(groupNodes(b_buffers[d], d)); // push back parent node
 			}
 			b_buffers.at(d).clear(); // clear the 8 nodes on this level
 		}
@@ -127,8 +374,44 @@ void OctreeBuilder::refineBuffers(const int start_depth){
 	}
 }
 
+// Brick output: add a voxel to the leaf brick being filled. Voxels come in morton order, so when one
+// falls in another brick, the current brick is complete.
+void OctreeBuilder::addBrickVoxel(const ::uint64_t morton_number, const vec3 &color, const vec3 &normal){
+	::uint64_t brick_morton = morton_number >> (3 * brick_levels);
+	if (brick_morton != b_brick_morton && !b_bricks[b_maxdepth].empty){
+		flushLeafBrick();
+	}
+	b_brick_morton = brick_morton;
+	uvec3 t; // position in the brick: the low bits of the morton code
+	morton3D_64_decode_dispatch(morton_number & ((static_cast<::uint64_t>(1) << (3 * brick_levels)) - 1), t.x, t.y, t.z);
+	b_bricks[b_maxdepth].addVoxel(t, color, normal);
+}
+
+// Brick output: write the leaf brick being filled and add its node to the tree
+void OctreeBuilder::flushLeafBrick(){
+	// Padding for missed bricks
+	if (b_brick_morton != b_current_morton){
+		fastAddEmpty(b_brick_morton - b_current_morton);
+	}
+
+	Node node = Node();
+	node.data = bricks_out->writeBrick(b_bricks[b_maxdepth]);
+	if (generate_levels){
+		b_bricks[b_maxdepth - 1].addChild(b_bricks[b_maxdepth], static_cast<unsigned int>(b_buffers[b_maxdepth].size()));
+	}
+	b_bricks[b_maxdepth].clear();
+	b_buffers.at(b_maxdepth).push_back(node);
+	refineBuffers(b_maxdepth);
+
+	b_current_morton++;
+}
+
 // Add a datapoint to the octree: this is the main method used to push datapoints
 void OctreeBuilder::addVoxel(const ::uint64_t morton_number){
+	if (bricks_out != NULL){
+		addBrickVoxel(morton_number, vec3(1.0f, 1.0f, 1.0f), vec3()); // white, like the binary voxelization payload
+		return;
+	}
 	// Padding for missed morton numbers
 	if (morton_number != b_current_morton){
 		fastAddEmpty(morton_number - b_current_morton);
@@ -147,18 +430,40 @@ void OctreeBuilder::addVoxel(const ::uint64_t morton_number){
 
 // Add a datapoint to the octree: this is the main method used to push datapoints
 void OctreeBuilder::addVoxel(const VoxelData& data){
-	// Padding for missed morton numbers
-	if (data.morton != b_current_morton){
-		fastAddEmpty(data.morton - b_current_morton);
+	if (bricks_out != NULL){
+		addBrickVoxel(data.morton, data.getColor(), data.getNormal());
+		return;
 	}
+	Node node = Node(); // create empty node
+	node.data_cache = data; // store data as cache
+	addDataVoxel(node, data.morton);
+}
 
-	// Create node
+// Add a packed datapoint to the octree (it goes to disk as it is: packing what it unpacks to gives it back)
+void OctreeBuilder::addVoxel(const PackedVoxelData& data){
+	if (bricks_out != NULL){
+		addBrickVoxel(data.morton, data.getColor(), data.getNormal());
+		return;
+	}
 	Node node = Node(); // create empty node
+	node.data_cache = data.unpack(); // store data as cache
+	addDataVoxel(node, data.morton);
+}
+
+// Write the payload of a leaf node and add it to the buffers
+void OctreeBuilder::addDataVoxel(Node &node, const ::uint64_t morton_number){
+	// Padding for missed morton numbers
+	if (morton_number != b_current_morton){
+		fastAddEmpty(morton_number - b_current_morton);
+	}
+
 	// Write data point
-	svo_algo_timer.stop(); svo_io_out_timer.start(); // TIMING
-	node.data = writeVoxelData(data_out, data, b_data_pos); // store data
-	svo_io_out_timer.stop(); svo_algo_timer.start(); // TIMING
-	node.data_cache = data; // store data as cache
+	if (node_format == OCTREE_FORMAT_DAG){
+		node.data = 1; // the DAG only stores geometry, all voxels refer to the shared voxel
+	}
+	else {
+		node.data = writeData(*data_out, node, b_data_pos); // store data
+	}
 	// Add to buffers
 	b_buffers.at(b_maxdepth).push_back(node);
 	// Refine buffers
@@ -4,10 +4,13 @@
 #include <glm/glm.hpp>
 #include <fstream>
 #include <assert.h>
+#include <unordered_map>
 #include "../libs/libtri/include/tri_util.h"
 #include "globals.h"
 #include "svo_builder_util.h"
 #include "octree_io.h"
+#include "BrickAtlas.h"
+#include "checkpoint.h"
 
 using namespace std;
 using namespace glm;
@@ -22,18 +25,36 @@ public:
 	::uint64_t b_max_morton; // maximum morton position
 	size_t b_data_pos; // current output data position (array index)
 	size_t b_node_pos; // current output node position (array index)
+	size_t b_word_pos; // DAG format: current output position in 32-bit words
 
 	// configuration
 	bool generate_levels; // switch to enable basic generation of higher octree levels
+	int node_format; // OCTREE_FORMAT_CLASSIC, OCTREE_FORMAT_COMPACT or OCTREE_FORMAT_DAG
+	int brick_size; // brick output (classic nodes only): texels per brick axis, 0 for one payload per node
+	int brick_levels; // voxel levels that go into a leaf brick (log2 of brick_size)
+	bool geometry_only; // voxels carry no payload: all leaves share one white voxel
+	bool packed_data; // payloads go to disk packed (see PackedVoxelData)
+	size_t n_partitions; // sub-octree builds (-partitions, -job): partitions of the whole build, for the header (0: a full build)
+	::uint64_t range_start, range_end; // sub-octree builds: the morton range [start, end) its partitions cover
 
-	FILE* node_out;
-	FILE* data_out;
+	// output goes through background writers, so building never waits on the disk
+	AsyncWriter* node_out;
+	AsyncWriter* data_out;
+	AsyncWriter* levels_out; // compact format with levels: payloads of internal nodes, one per node
 	string base_filename;
+	unordered_map<DagNode, size_t, DagNodeHash> dag_nodes; // DAG format: every node written so far, and its word offset
+	// brick output: node.data is a brick index, leaves are bricks of brick_size^3 voxels
+	BrickAtlasWriter* bricks_out;
+	vector<BrickAccumulator> b_bricks; // the brick being filled at every depth
+	::uint64_t b_brick_morton; // morton code (in the grid of leaf bricks) of the leaf brick being filled
 
-	OctreeBuilder(std::string base_filename, size_t gridlength, bool generate_levels);
+	// checkpoint: resume from a checkpoint (see writeCheckpoint) instead of starting a new octree
+	OctreeBuilder(std::string base_filename, size_t gridlength, bool generate_levels, int node_format = OCTREE_FORMAT_CLASSIC, int brick_size = 0, bool geometry_only = false, bool packed_data = false, FILE* checkpoint = NULL);
 	void finalizeTree();
+	bool writeCheckpoint(FILE* f);
 	void addVoxel(const ::uint64_t morton_number);
 	void addVoxel(const VoxelData& point);
+	void addVoxel(const PackedVoxelData& point);
 
 private:
 	// helper methods for octree building
@@ -41,7 +62,16 @@ private:
 	void addEmptyVoxel(const int buffer);
 	bool isBufferEmpty(const vector<Node> &buffer);
 	void refineBuffers(const int start_depth);
-	Node groupNodes(const vector<Node> &buffer);
+	Node groupNodes(const vector<Node> &buffer, const int depth);
+	Node groupDagNodes(const vector<Node> &buffer, const int depth);
+	void addBrickVoxel(const ::uint64_t morton_number, const vec3 &color, const vec3 &normal);
+	void flushLeafBrick();
+	size_t writeOutNode(const Node &n, const int depth);
+	void checkChildPointer(const size_t pos);
+	size_t writeData(AsyncWriter &out, const Node &n, size_t &pos);
+	void addDataVoxel(Node &node, const ::uint64_t morton_number);
+	void openOutput(const bool append);
+	bool readCheckpoint(FILE* f);
 	int highestNonEmptyBuffer();
 	int computeBestFillBuffer(const size_t budget);
 };
@@ -2,10 +2,27 @@
 
 #include <glm/glm.hpp>
 #include <stdint.h>
+#include <cmath>
+#include "../libs/libtri/include/octnormal.h"
 
 using namespace glm;
 using namespace std;
 
+// Compact encodings of normals (octahedral, see octnormal.h) and colors, used by packed payloads and by the brick atlases
+
+// Encode a [0,1] RGB color as RGBA8 (R in the lowest byte, alpha opaque unless given)
+inline ::uint32_t encodeRGBA8(const vec3 &c, const float alpha = 1.0f){
+	::uint32_t r = static_cast<::uint32_t>(round(clamp(c.r, 0.0f, 1.0f) * 255.0f));
+	::uint32_t g = static_cast<::uint32_t>(round(clamp(c.g, 0.0f, 1.0f) * 255.0f));
+	::uint32_t b = static_cast<::uint32_t>(round(clamp(c.b, 0.0f, 1.0f) * 255.0f));
+	::uint32_t a = static_cast<::uint32_t>(round(clamp(alpha, 0.0f, 1.0f) * 255.0f));
+	return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+inline vec3 decodeRGBA8(::uint32_t e){
+	return vec3((e & 0xFF) / 255.0f, ((e >> 8) & 0xFF) / 255.0f, ((e >> 16) & 0xFF) / 255.0f);
+}
+
 // sizeof(VoxelData would work too)
 const size_t VOXELDATA_SIZE = sizeof(::uint64_t)+2 * (3 * sizeof(float));
 
@@ -19,6 +36,15 @@ struct VoxelData{
 	VoxelData() : morton(0), normal(vec3()), color(vec3()){}
 	VoxelData(::uint64_t morton, vec3 normal, vec3 color) : morton(morton), normal(normal), color(color){}
 
+	vec3 getColor() const { return color; }
+	void setColor(const vec3 &c) { color = c; }
+	vec3 getNormal() const { return normal; }
+	void setNormal(const vec3 &n) { normal = n; }
+
+	// what goes to disk: VOXELDATA_SIZE bytes starting here
+	const void* diskData() const { return &morton; }
+	void* diskData() { return &morton; }
+
 	bool operator > (const VoxelData &a) const{
 		return morton > a.morton;
 	}
@@ -26,4 +52,38 @@ struct VoxelData{
 	bool operator < (const VoxelData &a) const{
 		return morton < a.morton;
 	}
-};
\ No newline at end of file
+};
+
+// Packed payload on disk: octahedral normal + RGBA8 color. The morton code isn't stored, it's implied by the position in the octree.
+const size_t PACKED_VOXELDATA_SIZE = 2 * sizeof(::uint32_t);
+
+// Packed version of VoxelData (-packed): 16 bytes in memory, 8 on disk.
+struct PackedVoxelData{
+	::uint64_t morton;
+	::uint32_t normal; // encodeOctNormal
+	::uint32_t color; // encodeRGBA8
+
+	PackedVoxelData() : morton(0), normal(OCTNORMAL_ZERO), color(0){}
+	PackedVoxelData(::uint64_t morton, vec3 normal, vec3 color) : morton(morton), normal(encodeOctNormal(normal)), color(encodeRGBA8(color)){}
+	explicit PackedVoxelData(const VoxelData &v) : morton(v.morton), normal(encodeOctNormal(v.normal)), color(encodeRGBA8(v.color)){}
+
+	vec3 getColor() const { return decodeRGBA8(color); }
+	void setColor(const vec3 &c) { color = encodeRGBA8(c); }
+	vec3 getNormal() const { return decodeOctNormal(normal); }
+	void setNormal(const vec3 &n) { normal = encodeOctNormal(n); }
+
+	// the float payload this decodes to
+	VoxelData unpack() const { return VoxelData(morton, getNormal(), getColor()); }
+
+	// what goes to disk: PACKED_VOXELDATA_SIZE bytes starting here
+	const void* diskData() const { return &normal; }
+	void* diskData() { return &normal; }
+
+	bool operator > (const PackedVoxelData &a) const{
+		return morton > a.morton;
+	}
+
+	bool operator < (const PackedVoxelData &a) const{
+		return morton < a.morton;
+	}
+};
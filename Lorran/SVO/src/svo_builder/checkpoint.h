@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "../libs/libtri/include/file_tools.h"
+
+using namespace std;
+
+// Checkpoints of long builds (svo_builder -checkpoint, -resume). At a partition boundary, everything needed to carry on
+// goes to a .svocheckpoint file: which build it belongs to, where the main loop is (BuildCheckpoint), and the state of the
+// OctreeBuilder (see OctreeBuilder::writeCheckpoint). The output files are only ever appended to, so a checkpoint just keeps
+// their sizes, and a resumed build cuts them back to that before it carries on.
+// Checkpoints are raw memory dumps: they're only meant for the svo_builder that wrote them.
+
+#define CHECKPOINT_MAGIC 0x3154504B434F5653ULL // "SVOCKPT1"
+
+template <typename T>
+inline void writeCheckpointValue(FILE* f, const T &v){
+	fwrite(&v, sizeof(T), 1, f);
+}
+
+template <typename T>
+inline bool readCheckpointValue(FILE* f, T &v){
+	return fread(&v, sizeof(T), 1, f) == 1;
+}
+
+template <typename T>
+inline void writeCheckpointVector(FILE* f, const vector<T> &v){
+	writeCheckpointValue(f, v.size());
+	if (!v.empty()) { fwrite(&v[0], sizeof(T), v.size(), f); }
+}
+
+template <typename T>
+inline bool readCheckpointVector(FILE* f, vector<T> &v){
+	size_t n;
+	if (!readCheckpointValue(f, n)) { return false; }
+	v.resize(n);
+	return n == 0 || fread(&v[0], sizeof(T), n, f) == n;
+}
+
+inline void writeCheckpointString(FILE* f, const string &s){
+	writeCheckpointVector(f, vector<char>(s.begin(), s.end()));
+}
+
+inline bool readCheckpointString(FILE* f, string &s){
+	vector<char> c;
+	if (!readCheckpointVector(f, c)) { return false; }
+	s.assign(c.begin(), c.end());
+	return true;
+}
+
+// Write a checkpoint file next to the old one, and only then replace it: a crash while writing keeps the old checkpoint
+inline bool replaceFile(const string &tmp, const string &filename){
+#if defined(__unix__) || defined(__APPLE__)
+	return rename(tmp.c_str(), filename.c_str()) == 0;
+#else
+	remove(filename.c_str()); // rename won't replace an existing file here
+	return rename(tmp.c_str(), filename.c_str()) == 0;
+#endif
+}
+
+// Make sure what went to f is on disk before the checkpoint that describes it replaces the old one
+inline bool syncCheckpointFile(FILE* f){
+	if (fflush(f) != 0 || ferror(f)) { return false; }
+#if defined(__unix__) || defined(__APPLE__)
+	return fsync(fileno(f)) == 0;
+#else
+	return true;
+#endif
+}
+
+// The main loop part of a checkpoint
+struct BuildCheckpoint {
+	// the build it belongs to: a resumed build needs the same options and partitions
+	size_t gridsize;
+	int node_format;
+	int generate_levels;
+	int brick_size;
+	int geometry_only;
+	int packed_data;
+	size_t n_triangles;
+	size_t node_bytes; // sizeof(Node): checkpoints hold nodes as they are in memory
+	string trip_base_filename; // the partitions
+	size_t n_partitions;
+
+	// where the build is
+	size_t next_partition; // first partition that isn't in the octree yet
+	size_t nfilled;
+	size_t points_bytes; // size of the .pontos file
+	size_t svo_voxels; // colored builds: voxels kept in memory (SVO), their copies are in the .svocheckpointvoxels file
+
+	BuildCheckpoint() : gridsize(0), node_format(0), generate_levels(0), brick_size(0), geometry_only(0), packed_data(0), n_triangles(0), node_bytes(0),
+		trip_base_filename(""), n_partitions(0), next_partition(0), nfilled(0), points_bytes(0), svo_voxels(0) {}
+
+	// Same build: same options and partitions
+	bool sameBuild(const BuildCheckpoint &c) const{
+		return gridsize == c.gridsize && node_format == c.node_format && generate_levels == c.generate_levels && brick_size == c.brick_size
+			&& geometry_only == c.geometry_only && packed_data == c.packed_data && n_triangles == c.n_triangles && node_bytes == c.node_bytes
+			&& n_partitions == c.n_partitions;
+	}
+
+	void write(FILE* f) const{
+		writeCheckpointValue(f, CHECKPOINT_MAGIC);
+		writeCheckpointValue(f, gridsize);
+		writeCheckpointValue(f, node_format);
+		writeCheckpointValue(f, generate_levels);
+		writeCheckpointValue(f, brick_size);
+		writeCheckpointValue(f, geometry_only);
+		writeCheckpointValue(f, packed_data);
+		writeCheckpointValue(f, n_triangles);
+		writeCheckpointValue(f, node_bytes);
+		writeCheckpointString(f, trip_base_filename);
+		writeCheckpointValue(f, n_partitions);
+		writeCheckpointValue(f, next_partition);
+		writeCheckpointValue(f, nfilled);
+		writeCheckpointValue(f, points_bytes);
+		writeCheckpointValue(f, svo_voxels);
+	}
+
+	bool read(FILE* f){
+		::uint64_t magic = 0;
+		return readCheckpointValue(f, magic) && magic == CHECKPOINT_MAGIC
+			&& readCheckpointValue(f, gridsize) && readCheckpointValue(f, node_format) && readCheckpointValue(f, generate_levels)
+			&& readCheckpointValue(f, brick_size) && readCheckpointValue(f, geometry_only) && readCheckpointValue(f, packed_data)
+			&& readCheckpointValue(f, n_triangles) && readCheckpointValue(f, node_bytes) && readCheckpointString(f, trip_base_filename)
+			&& readCheckpointValue(f, n_partitions) && readCheckpointValue(f, next_partition) && readCheckpointValue(f, nfilled)
+			&& readCheckpointValue(f, points_bytes) && readCheckpointValue(f, svo_voxels);
+	}
+};
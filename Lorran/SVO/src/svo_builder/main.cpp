@@ -12,8 +12,12 @@
 #include <algorithm>
 
 #include "voxelizer.h"
+#include "payloads.h"
 #include "OctreeBuilder.h"
 #include "partitioner.h"
+#include "radix_sort.h"
+#include "metrics.h"
+#include "checkpoint.h"
 
 using namespace std;
 using namespace glm;
@@ -31,6 +35,18 @@ float sparseness_limit = 0.10f;
 ColorType color = COLOR_FROM_MODEL;
 vec3 fixed_color = vec3(1.0f, 1.0f, 1.0f); // fixed color is white
 bool generate_levels = false;
+int node_format = OCTREE_FORMAT_CLASSIC;
+int brick_size = 0;
+bool uniform_partitions = false;
+bool compress_partitions = false;
+size_t partition_memory = 0; // Mb of partitions to keep in memory instead of in .tripdata files
+bool sort_triangles = false;
+bool packed_data = false; // colored models: pack the payloads (see PackedVoxelData)
+size_t n_threads = 1;
+string metrics_filename = "";
+float checkpoint_minutes = -1.0f; // minutes between checkpoints (0: after every partition), < 0 for none
+bool resume_build = false; // carry on from the checkpoint of an interrupted build
+PartitionRange partition_range; // sub-octree build: only these partitions
 bool verbose = false;
 
 // trip header info
@@ -39,6 +55,7 @@ TripInfo trip_info;
 
 // buffer_size
 size_t input_buffersize = 8192;
+size_t sort_buffersize = 1 << 20; // with -sort_triangles, partitions are sorted in runs of this many triangles
 
 // timers
 Timer main_timer;
@@ -49,17 +66,14 @@ Timer part_algo_timer;
 Timer vox_total_timer;
 Timer vox_io_in_timer;
 Timer vox_algo_timer;
+Timer vox_tri_sort_timer;
 Timer svo_total_timer;
 Timer svo_io_out_timer;
 Timer svo_algo_timer;
 
 void printInfo() {
 	cout << "--------------------------------------------------------------------" << endl;
-#ifdef BINARY_VOXELIZATION
-	cout << "Out-Of-Core SVO Builder " << version << " - Geometry only version" << endl;
-#else
 	cout << "Out-Of-Core SVO Builder " << version << endl;
-#endif
 #if defined(_WIN32) || defined(_WIN64)
 	cout << "Windows " << endl;
 #endif
@@ -82,8 +96,22 @@ void printHelp() {
 	std::cout << "-s <gridsize>         Voxel gridsize, should be a power of 2. Default 512." << endl;
 	std::cout << "-l <memory_limit>     Memory limit for process, in Mb. Default 1024." << endl;
 	std::cout << "-levels               Generate intermediary voxel levels by averaging voxel data" << endl;
+	std::cout << "-compact              Write 8-byte nodes with child masks (octree format version 2) instead of the classic nodes" << endl;
+	std::cout << "-dag                  Store identical subtrees only once (sparse voxel DAG, octree format version 3). Geometry only." << endl;
+	std::cout << "-bricks <size>        Give every node a brick of size^3 filtered voxels in a 3D atlas (e.g. 4 or 8), instead of one payload" << endl;
 	std::cout << "-c <option>           Coloring of voxels (Options: model (default), fixed, linear, normal)" << endl;
+	std::cout << "-packed               Store payloads as an octahedral normal and an RGBA8 color (8 bytes instead of 32). Colored models only." << endl;
 	std::cout << "-d <percentage>       Percentage of memory limit to be used additionaly for sparseness optimization" << endl;
+	std::cout << "-t <threads>          Voxelize this many partitions in parallel, sharing the memory limit. Default 1." << endl;
+	std::cout << "-partitions <a> <b>   Only build partitions a to b, into a sub-octree of their own (stitch them with svo_merge)" << endl;
+	std::cout << "-job <k> <n>          Only build the k-th of n equal slices of the partitions (0 <= k < n), into a sub-octree of their own" << endl;
+	std::cout << "-uniform              Split the grid into equal partitions, instead of adapting them to the triangle density" << endl;
+	std::cout << "-compress             Write compressed .tripdata partition files (always on for a compressed .tridata input). Lossy: quantizes the triangles of a raw .tridata, which changes the voxelization (the same way for any -l)" << endl;
+	std::cout << "-sort_triangles       Voxelize the triangles of every partition in morton order of their centroids (sorted in runs of 1M triangles)" << endl;
+	std::cout << "-partition_memory <Mb> Keep partitions in memory instead of writing .tripdata files, up to this many Mb on top of the memory limit" << endl;
+	std::cout << "-metrics <file>       Write per-phase and per-partition times, bytes, throughput and peak memory to a JSON file (CSV if it ends in .csv)" << endl;
+	std::cout << "-checkpoint <minutes> Write a checkpoint at the first partition boundary every <minutes> (0: after every partition), to -resume from after a crash" << endl;
+	std::cout << "-resume               Carry on from the checkpoint of an interrupted build (or start from the beginning if there is none)" << endl;
 	std::cout << "-v                    Be very verbose." << endl;
 	std::cout << "-h                    Print help and exit." << endl;
 }
@@ -122,6 +150,11 @@ void parseProgramParameters(int argc, char* argv[]) {
 				printInvalid();
 				exit(0);
 			}
+			if (gridsize > (1 << 21)) {
+				cout << "Requested gridsize is too big: 64-bit morton codes hold up to 2097152 voxels per axis" << endl;
+				printInvalid();
+				exit(0);
+			}
 			i++;
 		}
 		else if (string(argv[i]) == "-l") {
@@ -143,17 +176,97 @@ void parseProgramParameters(int argc, char* argv[]) {
 			}
 			i++;
 		}
+		else if (string(argv[i]) == "-t") {
+			int threads = atoi(argv[i + 1]);
+			if (threads < 1) {
+				cout << "Requested thread count is nonsensical. Use a value >= 1" << endl;
+				printInvalid();
+				exit(0);
+			}
+			n_threads = threads;
+			i++;
+		}
 		else if (string(argv[i]) == "-v") {
 			verbose = true;
 		}
 		else if (string(argv[i]) == "-levels") {
 			generate_levels = true;
 		}
+		else if (string(argv[i]) == "-compact") {
+			node_format = OCTREE_FORMAT_COMPACT;
+		}
+		else if (string(argv[i]) == "-dag") {
+			node_format = OCTREE_FORMAT_DAG;
+		}
+		else if (string(argv[i]) == "-bricks") {
+			brick_size = atoi(argv[i + 1]);
+			if (brick_size < 2 || !isPowerOf2((unsigned int) brick_size)) {
+				cout << "Requested brick size is not a power of 2 (>= 2)" << endl;
+				printInvalid();
+				exit(0);
+			}
+			i++;
+		}
+		else if (string(argv[i]) == "-metrics" || string(argv[i]) == "--metrics") {
+			metrics_filename = string(argv[i + 1]);
+			i++;
+		}
+		else if (string(argv[i]) == "-partitions" && i + 2 < argc) {
+			long long first = atoll(argv[i + 1]), last = atoll(argv[i + 2]);
+			if (first < 0 || last < first) {
+				cout << "Requested partition range is invalid" << endl;
+				printInvalid();
+				exit(0);
+			}
+			partition_range = PartitionRange::partitions((size_t) first, (size_t) last);
+			i += 2;
+		}
+		else if (string(argv[i]) == "-job" && i + 2 < argc) {
+			long long job = atoll(argv[i + 1]), n_jobs = atoll(argv[i + 2]);
+			if (n_jobs < 1 || job < 0 || job >= n_jobs) {
+				cout << "Requested job should be in [0, n_jobs)" << endl;
+				printInvalid();
+				exit(0);
+			}
+			partition_range = PartitionRange::jobSlice((size_t) job, (size_t) n_jobs);
+			i += 2;
+		}
+		else if (string(argv[i]) == "-uniform") {
+			uniform_partitions = true;
+		}
+		else if (string(argv[i]) == "-compress") {
+			compress_partitions = true;
+		}
+		else if (string(argv[i]) == "-sort_triangles") {
+			sort_triangles = true;
+		}
+		else if (string(argv[i]) == "-partition_memory" && i + 1 < argc) {
+			int mb = atoi(argv[i + 1]);
+			if (mb < 0) {
+				cout << "Requested partition memory is nonsensical. Use a value >= 0" << endl;
+				printInvalid();
+				exit(0);
+			}
+			partition_memory = (size_t) mb;
+			i++;
+		}
+		else if (string(argv[i]) == "-packed") {
+			packed_data = true;
+		}
+		else if (string(argv[i]) == "-checkpoint" && i + 1 < argc) {
+			checkpoint_minutes = (float) atof(argv[i + 1]);
+			if (checkpoint_minutes < 0.0f) {
+				cout << "Requested checkpoint interval is nonsensical. Use a value >= 0" << endl;
+				printInvalid();
+				exit(0);
+			}
+			i++;
+		}
+		else if (string(argv[i]) == "-resume" || string(argv[i]) == "--resume") {
+			resume_build = true;
+		}
 		else if (string(argv[i]) == "-c") {
 			string color_input = string(argv[i + 1]);
-#ifdef BINARY_VOXELIZATION
-			cout << "You asked to generate colors, but we're only doing binary voxelisation." << endl;
-#else
 			if (color_input == "model") {
 				color = COLOR_FROM_MODEL;
 			}
@@ -172,7 +285,6 @@ void parseProgramParameters(int argc, char* argv[]) {
 			else {
 				cout << "Unrecognized color switch: " << color_input << ", so reverting to colors from model." << endl;
 			}
-#endif
 			i++;
 		}
 		else if (string(argv[i]) == "-h") {
@@ -182,13 +294,47 @@ void parseProgramParameters(int argc, char* argv[]) {
 			printInvalid(); exit(0);
 		}
 	}
+	if (brick_size > 0 && (size_t) brick_size >= gridsize) {
+		cout << "Requested brick size should be smaller than the gridsize" << endl;
+		printInvalid();
+		exit(0);
+	}
+	if (brick_size > 0 && node_format != OCTREE_FORMAT_CLASSIC) {
+		cout << "Bricks are written with the classic node format, so -compact and -dag are ignored." << endl;
+		node_format = OCTREE_FORMAT_CLASSIC;
+	}
+	if (partition_range.isSet() && (node_format != OCTREE_FORMAT_CLASSIC || brick_size > 0)) {
+		cout << "Sub-octrees are written with the classic node format (that's what svo_merge stitches), so -compact, -dag and -bricks are ignored." << endl;
+		node_format = OCTREE_FORMAT_CLASSIC;
+		brick_size = 0;
+	}
+	if (node_format == OCTREE_FORMAT_DAG && generate_levels) {
+		cout << "The DAG format only stores geometry, so -levels is ignored." << endl;
+		generate_levels = false;
+	}
+	if (resume_build && checkpoint_minutes < 0.0f) {
+		checkpoint_minutes = 10.0f; // a resumed build keeps writing checkpoints, so it can be resumed as well
+	}
 	if (verbose) {
 		cout << "  filename: " << filename << endl;
 		cout << "  gridsize: " << gridsize << endl;
 		cout << "  memory limit: " << voxel_memory_limit << endl;
 		cout << "  sparseness optimization limit: " << sparseness_limit << " resulting in " << (sparseness_limit*voxel_memory_limit) << " memory limit." << endl;
 		cout << "  color type: " << color_s << endl;
+		cout << "  packed payloads: " << packed_data << endl;
 		cout << "  generate levels: " << generate_levels << endl;
+		cout << "  node format: " << (node_format == OCTREE_FORMAT_DAG ? "dag" : (node_format == OCTREE_FORMAT_COMPACT ? "compact" : "classic")) << endl;
+		cout << "  bricks: " << (brick_size > 0 ? val_to_string(brick_size) + "^3" : string("off")) << endl;
+		cout << "  voxelization threads: " << n_threads << endl;
+		cout << "  metrics: " << (metrics_filename.empty() ? string("off") : metrics_filename) << endl;
+		cout << "  checkpoints: " << (checkpoint_minutes < 0.0f ? string("off") : string("every ") + val_to_string(checkpoint_minutes) + string(" minutes")) << (resume_build ? ", resuming" : "") << endl;
+		if (partition_range.isSet()) { cout << "  sub-octree: " << partition_range.tag().substr(1) << endl; }
+		cout << "  partitioning: " << (uniform_partitions ? "uniform" : "adaptive") << endl;
+		cout << "  compressed partitions: " << compress_partitions << endl;
+		cout << "  sorted triangles: " << sort_triangles << endl;
+		cout << "  partition memory: " << (partition_memory > 0 ? val_to_string(partition_memory) + " Mb" : string("off")) << endl;
+		cout << "  voxelization kernel: " << schwarzRowKernelName(selectSchwarzRowKernel()) << endl;
+		cout << "  morton encoding: " << morton3D_64_dispatch().name << endl;
 		cout << "  verbosity: " << verbose << endl;
 	}
 }
@@ -207,6 +353,7 @@ void setupTimers() {
 	vox_total_timer = Timer();
 	vox_io_in_timer = Timer();
 	vox_algo_timer = Timer();
+	vox_tri_sort_timer = Timer();
 
 	svo_total_timer = Timer();
 	svo_io_out_timer = Timer();
@@ -223,19 +370,27 @@ void printTimerInfo() {
 	cout << "  algorithm time	: " << part_algo_timer.elapsed_time_milliseconds << " ms." << endl;
 	cout << "  IO OUT time		: " << part_io_out_timer.elapsed_time_milliseconds << " ms." << endl;
 	double part_diff = part_total_timer.elapsed_time_milliseconds - part_io_in_timer.elapsed_time_milliseconds - part_algo_timer.elapsed_time_milliseconds - part_io_out_timer.elapsed_time_milliseconds;
-	cout << "  misc time		: " << part_diff << " s." << endl;
-	cout << "VOXELIZING" << endl;
+	cout << "  misc time		: " << part_diff << " ms." << endl;
+	if (n_threads > 1) {
+		cout << "VOXELIZING (summed over " << n_threads << " threads)" << endl;
+	}
+	else {
+		cout << "VOXELIZING" << endl;
+	}
 	cout << "  Total time		: " << vox_total_timer.elapsed_time_milliseconds << " ms." << endl;
 	cout << "  IO IN time		: " << vox_io_in_timer.elapsed_time_milliseconds << " ms." << endl;
 	cout << "  algorithm time	: " << vox_algo_timer.elapsed_time_milliseconds << " ms." << endl;
+	if (sort_triangles) {
+		cout << "  triangle sort time	: " << vox_tri_sort_timer.elapsed_time_milliseconds << " ms. (part of IO IN)" << endl;
+	}
 	double vox_diff = vox_total_timer.elapsed_time_milliseconds - vox_io_in_timer.elapsed_time_milliseconds - vox_algo_timer.elapsed_time_milliseconds;
-	cout << "  misc time		: " << vox_diff << " s." << endl;
+	cout << "  misc time		: " << vox_diff << " ms." << endl;
 	cout << "SVO BUILDING" << endl;
 	cout << "  Total time		: " << svo_total_timer.elapsed_time_milliseconds << " ms." << endl;
 	cout << "  IO OUT time		: " << svo_io_out_timer.elapsed_time_milliseconds << " ms." << endl;
 	cout << "  algorithm time	: " << svo_algo_timer.elapsed_time_milliseconds << " ms." << endl;
 	double svo_misc = svo_total_timer.elapsed_time_milliseconds - svo_io_out_timer.elapsed_time_milliseconds - svo_algo_timer.elapsed_time_milliseconds;
-	cout << "  misc time		: " << svo_misc << " s." << endl;
+	cout << "  misc time		: " << svo_misc << " ms." << endl;
 }
 
 // Tri header handling and error checking
@@ -250,163 +405,364 @@ void readTriHeader(string& filename, TriInfo& tri_info){
 		exit(0); // not all required files exist - exiting.
 	}
 	if (verbose) { tri_info.print(); }
-	// Check if the user is using the correct executable for type of tri file
-#ifdef BINARY_VOXELIZATION
-	if (!tri_info.geometry_only) {
-		cout << "You're using a .tri file which contains more than just geometry with a geometry-only SVO Builder! Regenerate that .tri file using tri_convert_binary." << endl;
-		exit(0);
-	}
-#else
+	// The .tri file tells which payload we build
 	if (tri_info.geometry_only) {
-		cout << "You're using a .tri file which contains only geometry with the regular SVO Builder! Regenerate that .tri file using tri_convert." << endl;
-		exit(0);
+		cout << "  geometry only model" << endl;
+		if (color != COLOR_FROM_MODEL) { cout << "You asked to generate colors, but we're only doing binary voxelisation." << endl; }
+		if (packed_data) { cout << "There are no payloads to pack in a geometry only model, so -packed is ignored." << endl; }
 	}
-#endif
 }
 
 // Trip header handling and error checking
-void readTripHeader(string& filename, TripInfo& trip_info){
+void readTripHeader(string& filename, TripInfo& trip_info, const vector<bool> &in_memory){
 	if (parseTripHeader(filename, trip_info) != 1) {
 		exit(0);
 	}
-	if (!trip_info.filesExist()) {
+	if (!trip_info.filesExist(in_memory)) {
 		cout << "Not all required .trip or .tripdata files exist. Please regenerate using svo_builder." << endl; 
 		exit(0); // not all required files exist - exiting.
 	}
 	if (verbose) { trip_info.print(); }
 }
 
-int main(int argc, char *argv[]) {
-	// Setup timers
-	setupTimers();
-	main_timer.start();
+// Geometry only: add the voxels of a partition to the builder
+void buildPartition(OctreeBuilder &builder, vector<::uint64_t> &data, const bool use_data, const ::uint64_t* voxels, const ::uint64_t start, const ::uint64_t end, vector<::uint64_t> &, ofstream &){
+	if (use_data){ // use array of morton codes to build the SVO
+		for (std::vector<::uint64_t>::iterator it = data.begin(); it != data.end(); ++it){
+			builder.addVoxel(*it);
+		}
+	}
+	else { // morton array overflowed : walk the occupancy bits instead (already in morton order)
+		size_t n_words = occupancyWords(end - start);
+		for (size_t w = 0; w < n_words; w++) {
+			::uint64_t bits = voxels[w];
+			while (bits != 0) { // visit every set bit, lowest first
+				builder.addVoxel(start + w * 64 + lowestSetBit(bits));
+				bits &= bits - 1;
+			}
+		}
+	}
+}
 
-#if defined(_WIN32) || defined(_WIN64)
-	_setmaxstdio(1024); // increase file descriptor limit in Windows
-#endif
+// Colored: recolor the voxels of a partition, add them to the builder and keep them in SVO (their count goes to the points file)
+template <typename V>
+void buildPartition(OctreeBuilder &builder, vector<V> &data, const bool, const ::uint64_t*, const ::uint64_t, const ::uint64_t, vector<V> &SVO, ofstream &arq){
+	// Arquivo
+	arq << data.size() << endl;
+	// Arquivo
 
-	// Parse program parameters
-	printInfo();
-	parseProgramParameters(argc, argv);
+	for (typename vector<V>::iterator it = data.begin(); it != data.end(); ++it){
+		if (color == COLOR_FIXED){
+			it->setColor(fixed_color);
+		}
+		else if (color == COLOR_LINEAR){ // linear color scale
+			it->setColor(mortonToRGB(it->morton, gridsize));
+		}
+		else if (color == COLOR_NORMAL){ // color models using their normals
+			vec3 normal = normalize(it->getNormal());
+			it->setColor(vec3((normal[0] + 1.0f) / 2.0f, (normal[1] + 1.0f) / 2.0f, (normal[2] + 1.0f) / 2.0f));
+		}
+		builder.addVoxel(*it);
 
-	// PARTITIONING
-	part_total_timer.start(); part_io_in_timer.start(); // TIMING
-	readTriHeader(filename, tri_info);
-	part_io_in_timer.stop();
-	size_t n_partitions = estimate_partitions(gridsize, voxel_memory_limit);
-	cout << "Partitioning data into " << n_partitions << " partitions ... "; cout.flush();
-	TripInfo trip_info = partition(tri_info, n_partitions, gridsize);
+		SVO.push_back(*it);
+
+		//cout << "(" << x << "," << y << "," << z << ")" << endl;
+		//cout << "(" << x * unitlength << "," << y * unitlength << "," << z * unitlength << ")" << endl;
+		//cout << (*it).morton << endl;
+		//vec3 normal = normalize(it->normal);
+		//arq << x * unitlength << " " << y * unitlength << " " << z * unitlength << " "
+		//	<< normal[0] << " " << normal[1] << " " << normal[2] << " "
+		//	<< (*it).color[0] << " " << (*it).color[1] << " " << (*it).color[2] << endl;
+	}
+}
+
+// Colored builds keep their voxels in memory (SVO): a checkpoint appends the ones since the last checkpoint to a file
+template <typename V>
+bool saveCheckpointVoxels(const string &filename, const vector<V> &SVO, const size_t saved){
+	if (SVO.size() == saved) { return true; }
+	FILE* f = fopen(filename.c_str(), "ab");
+	if (f == NULL) { return false; }
+	fwrite(&SVO[saved], sizeof(V), SVO.size() - saved, f);
+	bool ok = syncCheckpointFile(f);
+	fclose(f);
+	return ok;
+}
+
+// and a resumed build reads the first n back (the rest came after the checkpoint)
+template <typename V>
+bool loadCheckpointVoxels(const string &filename, vector<V> &SVO, const size_t n){
+	if (n == 0) {
+		remove(filename.c_str());
+		return true;
+	}
+	if (!truncate_file(filename, n * sizeof(V))) { return false; }
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (f == NULL) { return false; }
+	SVO.resize(n);
+	bool ok = fread(&SVO[0], sizeof(V), n, f) == n;
+	fclose(f);
+	return ok;
+}
+
+// Remove a checkpoint, the voxels it keeps and a checkpoint that was still being written
+void removeCheckpoint(const string &filename){
+	remove(filename.c_str());
+	remove((filename + string("voxels")).c_str());
+	remove((filename + string(".tmp")).c_str());
+}
+
+// Write a checkpoint (see checkpoint.h). What it refers to goes to disk first: the voxels kept in memory, the .pontos file
+// and the octree files (OctreeBuilder::writeCheckpoint). It replaces the previous checkpoint only once it's complete.
+template <typename V>
+void writeBuildCheckpoint(const string &filename, BuildCheckpoint &checkpoint, OctreeBuilder &builder, const vector<V> &SVO, ofstream &arq){
+	arq.flush();
+	checkpoint.points_bytes = static_cast<size_t>(arq.tellp());
+	bool ok = saveCheckpointVoxels(filename + string("voxels"), SVO, checkpoint.svo_voxels);
+	if (ok) { checkpoint.svo_voxels = SVO.size(); }
+	string tmp = filename + string(".tmp");
+	FILE* f = ok ? fopen(tmp.c_str(), "wb") : NULL;
+	if (f != NULL) {
+		checkpoint.write(f);
+		ok = builder.writeCheckpoint(f);
+		ok = syncCheckpointFile(f) && ok;
+		fclose(f);
+		ok = ok && replaceFile(tmp, filename);
+	}
+	if (f == NULL || !ok) {
+		cout << "Warning: could not write checkpoint " << filename << ", carrying on without it" << endl;
+		return;
+	}
+	cout << "Wrote checkpoint " << filename << " (resumes at partition " << checkpoint.next_partition << ")" << endl;
+}
+
+// Partition, voxelize and build the SVO with payload policy P (see payloads.h)
+template <class P>
+void buildSVO(BuildMetrics &metrics) {
+	typedef typename P::Tri Tri;
+	typedef typename P::Voxel Voxel;
+
+	// -resume: the checkpoint of an interrupted build. Its name doesn't depend on the partitioning, which comes next.
+	const string checkpoint_filename = tri_info.base_filename + val_to_string(gridsize) + partition_range.tag() + string(".svocheckpoint");
+	BuildCheckpoint resume_point;
+	FILE* resume_from = NULL;
+	if (resume_build) {
+		resume_from = fopen(checkpoint_filename.c_str(), "rb");
+		if (resume_from == NULL) {
+			cout << "No checkpoint " << checkpoint_filename << " to resume from, starting from the beginning." << endl;
+		}
+		else if (!resume_point.read(resume_from)) {
+			cout << "Error: " << checkpoint_filename << " is not a checkpoint of this svo_builder" << endl;
+			exit(1);
+		}
+	}
+	if (resume_from == NULL) { // a new build: an old checkpoint doesn't match its files
+		removeCheckpoint(checkpoint_filename);
+	}
+
+	bool compress = compress_partitions || tri_info.compressed;
+	MemoryPartitions<Tri> memory_partitions(partition_memory * 1024 * 1024);
+	MemoryPartitions<Tri>* memory = (partition_memory > 0) ? &memory_partitions : NULL;
+	// a resumed build uses the partitions of the interrupted one, if they're all still there (partitions kept in memory aren't)
+	string resume_trip = resume_point.trip_base_filename + string(".trip");
+	if (resume_from != NULL && file_exists(resume_trip) && parseTripHeader(resume_trip, trip_info) == 1 && trip_info.filesExist()) {
+		cout << "Using the partitions of the interrupted build (" << resume_trip << ") ... ";
+	}
+	else if (uniform_partitions) {
+		size_t n_partitions = estimate_partitions(gridsize, voxel_memory_limit, n_threads);
+		cout << "Partitioning data into " << n_partitions << " partitions ... "; cout.flush();
+		trip_info = partition(tri_info, n_partitions, gridsize, n_threads, partition_range, compress, memory);
+	}
+	else {
+		trip_info = partition_adaptive(tri_info, gridsize, voxel_memory_limit, n_threads, partition_range, compress, memory);
+	}
 	cout << "done." << endl;
 	part_total_timer.stop(); // TIMING
 
 	vox_total_timer.start(); vox_io_in_timer.start(); // TIMING
 	// Parse TRIP header
 	string tripheader = trip_info.base_filename + string(".trip");
-	readTripHeader(tripheader, trip_info);
+	readTripHeader(tripheader, trip_info, memory_partitions.in_memory);
+	// indexed partitions: all threads expand their index triples from the same (mapped) vertex file
+	TriVertices<Tri> vertices;
+	if (trip_info.indexed && !vertices.open(trip_info.vertex_filename)) {
+		cout << "Error: could not read vertex file " << trip_info.vertex_filename << endl;
+		exit(1);
+	}
 	vox_io_in_timer.stop(); // TIMING
 
 	// General voxelization calculations (stuff we need throughout voxelization process)
 	float unitlength = (trip_info.mesh_bbox.max[0] - trip_info.mesh_bbox.min[0]) / (float)trip_info.gridsize;
-	::uint64_t morton_part = (trip_info.gridsize * trip_info.gridsize * trip_info.gridsize) / trip_info.n_partitions;
-
-	char* voxels = new char[(size_t)morton_part]; // Storage for voxel on/off
-#ifdef BINARY_VOXELIZATION
-	vector<::uint64_t> data; // Dynamic storage for morton codes
-#else
-	vector<VoxelData> data; // Dynamic storage for voxel data
-#endif 
-	vector<VoxelData> SVO;
-	size_t nfilled = 0;
+	const AABox<vec3> mesh_box(vec3(0.0f), trip_info.mesh_bbox.max - trip_info.mesh_bbox.min); // the mesh, moved to the origin (for -sort_triangles)
+	::uint64_t max_morton_part = 0; // partitions can differ in size: every thread gets room for the biggest one
+	for (size_t i = 0; i < trip_info.n_partitions; i++) {
+		max_morton_part = std::max(max_morton_part, trip_info.part_morton_end[i] - trip_info.part_morton_start[i]);
+	}
+
+	// what a checkpoint of this build holds, or where the resumed build was
+	BuildCheckpoint checkpoint;
+	checkpoint.gridsize = trip_info.gridsize;
+	checkpoint.node_format = node_format;
+	checkpoint.generate_levels = generate_levels ? 1 : 0;
+	checkpoint.brick_size = brick_size;
+	checkpoint.geometry_only = P::geometry_only ? 1 : 0;
+	checkpoint.packed_data = P::packed ? 1 : 0;
+	checkpoint.n_triangles = tri_info.n_triangles;
+	checkpoint.node_bytes = sizeof(Node);
+	checkpoint.trip_base_filename = trip_info.base_filename;
+	checkpoint.n_partitions = trip_info.n_partitions;
+	if (resume_from != NULL) {
+		if (!checkpoint.sameBuild(resume_point)) {
+			cout << "Error: " << checkpoint_filename << " is the checkpoint of a build with other options or partitions. Resume with the same -s, -l, -t, -uniform, -levels, -compact, -dag, -bricks and -packed." << endl;
+			exit(1);
+		}
+		checkpoint.next_partition = resume_point.next_partition;
+		checkpoint.nfilled = resume_point.nfilled;
+		checkpoint.points_bytes = resume_point.points_bytes;
+		checkpoint.svo_voxels = resume_point.svo_voxels;
+	}
+
+	vector<Voxel> SVO;
+	size_t nfilled = checkpoint.nfilled;
+	if (resume_from != NULL && !loadCheckpointVoxels(checkpoint_filename + string("voxels"), SVO, checkpoint.svo_voxels)) {
+		cout << "Error: could not read the voxels of checkpoint " << checkpoint_filename << endl;
+		exit(1);
+	}
+	metrics.gridsize = trip_info.gridsize;
+	metrics.threads = n_threads;
+	metrics.triangles = tri_info.n_triangles;
 	vox_total_timer.stop(); // TIMING
 
 	svo_total_timer.start();
 	// create Octreebuilder which will output our SVO
-	OctreeBuilder builder = OctreeBuilder(trip_info.base_filename, trip_info.gridsize, generate_levels);
+	OctreeBuilder builder = OctreeBuilder(trip_info.base_filename, trip_info.gridsize, generate_levels, node_format, brick_size, P::geometry_only, P::packed, resume_from);
 	svo_total_timer.stop();
+	if (partition_range.isSet()) { // a sub-octree holds the morton range from its first partition up to the next one after its last, so svo_merge can check the slices fit
+		size_t lo, hi;
+		partition_range.resolve(trip_info.n_partitions, lo, hi);
+		const ::uint64_t n_voxels = static_cast<::uint64_t>(trip_info.gridsize)*trip_info.gridsize*trip_info.gridsize;
+		builder.n_partitions = trip_info.n_partitions;
+		builder.range_start = (lo == 0) ? 0 : trip_info.part_morton_start[lo];
+		builder.range_end = (hi == trip_info.n_partitions) ? n_voxels : trip_info.part_morton_start[hi];
+	}
+	if (resume_from != NULL) {
+		fclose(resume_from);
+		cout << "Resuming from checkpoint " << checkpoint_filename << " at partition " << checkpoint.next_partition << " of " << trip_info.n_partitions << endl;
+	}
 
 
 	/** Escrita de arquivo de pontos da arvore **/
-	ofstream arq(trip_info.base_filename + string(".pontos"));
+	string points_filename = trip_info.base_filename + string(".pontos");
+	if (resume_from != NULL && !truncate_file(points_filename, checkpoint.points_bytes)) {
+		cout << "Error: " << points_filename << " is missing, or shorter than at the checkpoint" << endl;
+		exit(1);
+	}
+	ofstream arq(points_filename.c_str(), resume_from != NULL ? ios::out | ios::app : ios::out);
         /** Fim da escrita de arquivo de pontos da arvore **/
 
+	Timer checkpoint_timer; // time since the last checkpoint
+	checkpoint_timer.start();
+
 
 
 	// Start voxelisation and SVO building per partition
-	for (size_t i = 0; i < trip_info.n_partitions; i++) {
-		if (trip_info.part_tricounts[i] == 0) { continue; } // skip partition if it contains no triangles
-
-		// VOXELIZATION
-		vox_total_timer.start(); // TIMING
-		cout << "Voxelizing partition " << i << " ..." << endl;
-		// morton codes for this partition
-		::uint64_t start = i * morton_part;
-		::uint64_t end = (i + 1) * morton_part;
-		// open file to read triangles
-		vox_io_in_timer.start(); // TIMING
-		std::string part_data_filename = trip_info.base_filename + string("_") + val_to_string(i) + string(".tripdata");
-		TriReader reader = TriReader(part_data_filename, trip_info.part_tricounts[i], std::min(trip_info.part_tricounts[i], input_buffersize));
-		if (verbose) { cout << "  reading " << trip_info.part_tricounts[i] << " triangles from " << part_data_filename << endl; }
-		vox_io_in_timer.stop(); // TIMING
-		// voxelize partition
-		size_t nfilled_before = nfilled;
-		bool use_data = true;
-		voxelize_schwarz_method(reader, start, end, unitlength, voxels, data, sparseness_limit, use_data, nfilled);
-		if (verbose) { cout << "  found " << nfilled - nfilled_before << " new voxels." << endl; }
-		vox_total_timer.stop(); // TIMING
-
-		// build SVO
-		cout << "Building SVO for partition " << i << " ..." << endl;
-		svo_total_timer.start(); svo_algo_timer.start(); // TIMING
-#ifdef BINARY_VOXELIZATION
-		if (use_data){ // use array of morton codes to build the SVO
-			sort(data.begin(), data.end()); // sort morton codes
-			for (std::vector<::uint64_t>::iterator it = data.begin(); it != data.end(); ++it){
-				builder.addVoxel(*it);
+	// Every thread voxelizes a partition into its own buffers, the ordered section feeds them to the builder in morton order.
+	// With 1 thread, this is the plain serial loop.
+	// the side arrays may use sparseness_limit (-d) of -l on top of it: every pipeline thread its share
+	const ::uint64_t data_max_bytes = static_cast<::uint64_t>(std::max<size_t>(voxel_memory_limit / n_threads, 1) * 1024.0 * 1024.0 * sparseness_limit);
+#pragma omp parallel num_threads(n_threads)
+	{
+		::uint64_t* voxels = new ::uint64_t[occupancyWords(max_morton_part)]; // Storage for voxel on/off (one bit per voxel)
+		vector<Voxel> data; // Dynamic storage for voxel data (morton codes only for geometry)
+		RadixSorter<Voxel> sorter; // keeps its scratch buffers across partitions
+
+#pragma omp for ordered schedule(dynamic, 1)
+		for (long long p = (long long) checkpoint.next_partition; p < (long long) trip_info.n_partitions; p++) {
+			size_t i = (size_t) p;
+			if (trip_info.part_tricounts[i] == 0) { continue; } // skip partition if it contains no triangles
+
+			// VOXELIZATION
+			Timer part_vox_timer, part_sort_timer; // TIMING (merged into the global timers in the ordered section)
+			part_vox_timer.start(); // TIMING
+#pragma omp critical(output)
+			cout << "Voxelizing partition " << i << " ..." << endl;
+			// morton codes for this partition
+			::uint64_t start = trip_info.part_morton_start[i];
+			::uint64_t end = trip_info.part_morton_end[i];
+			// open file to read triangles (or read them from memory, if the partitioner kept them)
+			std::string part_data_filename = trip_info.base_filename + string("_") + val_to_string(i) + string(".tripdata");
+			const bool in_memory = memory_partitions.has(i);
+			const size_t buffersize = std::min(trip_info.part_tricounts[i], sort_triangles ? sort_buffersize : input_buffersize);
+			const AABox<vec3>* sort_bbox = sort_triangles ? &mesh_box : NULL;
+			TriReader<Tri> reader = in_memory ? TriReader<Tri>(memory_partitions.triangles[i], trip_info.part_tricounts[i], buffersize, sort_bbox)
+				: TriReader<Tri>(part_data_filename, trip_info.part_tricounts[i], buffersize, trip_info.indexed ? &vertices : NULL, sort_bbox);
+			// voxelize partition
+			size_t part_nfilled = 0;
+			bool use_data = true;
+			voxelize_schwarz_method<P>(reader, start, end, unitlength, voxels, data, data_max_bytes, use_data, part_nfilled);
+			if (in_memory) { memory_partitions.release(i); }
+			part_vox_timer.stop(); // TIMING
+
+			// sort voxels while the builder is still busy with earlier partitions
+			size_t part_nsorted = 0; // for the metrics: partitions that walk their occupancy bits sort nothing
+			part_sort_timer.start(); // TIMING
+			if (use_data){
+				sorter.sort(data, start, end - 1); // sort
+				part_nsorted = data.size();
 			}
-		}
-		else { // morton array overflowed : using slower way to build SVO
-			::uint64_t morton_number;
-			for (size_t j = 0; j < morton_part; j++) {
-				if (!voxels[j] == EMPTY_VOXEL) {
-					morton_number = start + j;
-					builder.addVoxel(morton_number);
-				}
+			else if (!P::geometry_only){ // colored side array over its budget: sort in place, without the sorter's scratch buffers
+				std::sort(data.begin(), data.end());
+				part_nsorted = data.size();
 			}
-		}
-#else
-		sort(data.begin(), data.end()); // sort
-
-		// Arquivo
-		arq << data.size() << endl;
-		// Arquivo
+			part_sort_timer.stop(); // TIMING
+
+#pragma omp ordered
+			{
+				Timer part_build_timer; // TIMING
+				part_build_timer.start(); // TIMING
+				vox_total_timer.elapsed_time_milliseconds += part_vox_timer.elapsed_time_milliseconds; // TIMING
+				vox_tri_sort_timer.elapsed_time_milliseconds += reader.sortMilliseconds(); // TIMING
+				if (verbose) { cout << "  read " << trip_info.part_tricounts[i] << " triangles from " << part_data_filename << endl; }
+				if (verbose) { cout << "  found " << part_nfilled << " new voxels." << endl; }
+				nfilled += part_nfilled;
+
+				// build SVO
+				cout << "Building SVO for partition " << i << " ..." << endl;
+				svo_total_timer.start(); svo_algo_timer.start(); // TIMING
+				svo_algo_timer.elapsed_time_milliseconds += part_sort_timer.elapsed_time_milliseconds; // TIMING
+				svo_total_timer.elapsed_time_milliseconds += part_sort_timer.elapsed_time_milliseconds; // TIMING
+				buildPartition(builder, data, use_data, voxels, start, end, SVO, arq);
+				svo_algo_timer.stop(); svo_total_timer.stop();  // TIMING
+				part_build_timer.stop(); // TIMING
+
+				if (!metrics_filename.empty()) {
+					PartitionMetrics pm;
+					pm.index = i;
+					pm.triangles = trip_info.part_tricounts[i];
+					pm.voxels = part_nfilled;
+					pm.sorted = part_nsorted;
+					pm.bytes_read = in_memory ? 0 : metricsFileSize(part_data_filename);
+					pm.voxelize_ms = part_vox_timer.elapsed_time_milliseconds;
+					pm.sort_ms = part_sort_timer.elapsed_time_milliseconds;
+					pm.build_ms = part_build_timer.elapsed_time_milliseconds;
+					metrics.partitions.push_back(pm);
+				}
 
-		for (std::vector<VoxelData>::iterator it = data.begin(); it != data.end(); ++it){
-			if (color == COLOR_FIXED){
-				it->color = fixed_color;
-			}
-			else if (color == COLOR_LINEAR){ // linear color scale
-				it->color = mortonToRGB(it->morton, gridsize);
-			}
-			else if (color == COLOR_NORMAL){ // color models using their normals
-				vec3 normal = normalize(it->normal);
-				it->color = vec3((normal[0] + 1.0f) / 2.0f, (normal[1] + 1.0f) / 2.0f, (normal[2] + 1.0f) / 2.0f);
+				// CHECKPOINT: every partition up to this one is in the octree
+				if (checkpoint_minutes >= 0.0f) {
+					checkpoint_timer.stop();
+					if (checkpoint_timer.elapsed_time_milliseconds >= checkpoint_minutes * 60000.0) {
+						svo_total_timer.start(); svo_io_out_timer.start(); // TIMING
+						checkpoint.next_partition = i + 1;
+						checkpoint.nfilled = nfilled;
+						writeBuildCheckpoint(checkpoint_filename, checkpoint, builder, SVO, arq);
+						svo_io_out_timer.stop(); svo_total_timer.stop(); // TIMING
+						checkpoint_timer = Timer();
+					}
+					checkpoint_timer.start();
+				}
 			}
-			//builder.addVoxel(*it);
-
-			SVO.push_back(*it);
-
-			uint_fast32_t x,y,z;
-			morton3D_64_decode((*it).morton, x, y, z);
-			//cout << "(" << x << "," << y << "," << z << ")" << endl;
-			//cout << "(" << x * unitlength << "," << y * unitlength << "," << z * unitlength << ")" << endl;
-            //cout << (*it).morton << endl;
-            //vec3 normal = normalize(it->normal);
-            //arq << x * unitlength << " " << y * unitlength << " " << z * unitlength << " "
-            //	<< normal[0] << " " << normal[1] << " " << normal[2] << " "
-            //	<< (*it).color[0] << " " << (*it).color[1] << " " << (*it).color[2] << endl;
 		}
-#endif
-		svo_algo_timer.stop(); svo_total_timer.stop();  // TIMING
+		delete[] voxels;
 	}
 	cout << sizeof(SVO) << endl;
 	cout << SVO.size() << endl;
@@ -421,9 +777,64 @@ int main(int argc, char *argv[]) {
 	cout << "Total amount of voxels: " << nfilled << endl;
 	svo_total_timer.stop(); svo_algo_timer.stop(); // TIMING
 
+	removeCheckpoint(checkpoint_filename); // the octree is complete
+
+	// Bytes moved: the partitioner reads the .tridata and writes the .tripdata, which the voxelizer reads back.
+	// A single partition is a link to the .tridata, and partitions kept in memory are neither written nor read back.
+	if (!metrics_filename.empty()) {
+		const bool linked = (trip_info.n_partitions == 1);
+		metrics.voxels = nfilled;
+		metrics.bytes_read = linked ? 0 : metricsFileSize(tri_info.base_filename + string(".tridata"));
+		if (trip_info.indexed) { metrics.bytes_read += metricsFileSize(trip_info.vertex_filename); }
+		for (size_t i = 0; i < metrics.partitions.size(); i++) {
+			metrics.bytes_read += metrics.partitions[i].bytes_read;
+			if (!linked) { metrics.bytes_written += metrics.partitions[i].bytes_read; }
+			metrics.sort_ms += metrics.partitions[i].sort_ms;
+			metrics.sorted += metrics.partitions[i].sorted;
+		}
+		const char* octree_files[6] = { ".octree", ".octreenodes", ".octreedata", ".octreelevels", ".octreebricks", ".octreebricknormals" };
+		for (int f = 0; f < 6; f++) {
+			metrics.bytes_written += metricsFileSize(trip_info.base_filename + string(octree_files[f]));
+		}
+	}
+
 	// Removing .trip files which are left by partitioner
 	removeTripFiles(trip_info);
+}
+
+int main(int argc, char *argv[]) {
+	// Setup timers
+	setupTimers();
+	main_timer.start();
+
+#if defined(_WIN32) || defined(_WIN64)
+	_setmaxstdio(1024); // increase file descriptor limit in Windows
+#endif
+
+	// Parse program parameters
+	printInfo();
+	parseProgramParameters(argc, argv);
+
+	// PARTITIONING
+	part_total_timer.start(); part_io_in_timer.start(); // TIMING
+	readTriHeader(filename, tri_info);
+	part_io_in_timer.stop();
+
+	// the rest depends on the payload of the model
+	BuildMetrics metrics;
+	if (tri_info.geometry_only) {
+		buildSVO<GeometryPayload>(metrics);
+	}
+	else if (packed_data) {
+		buildSVO<PackedColorPayload>(metrics);
+	}
+	else {
+		buildSVO<ColorPayload>(metrics);
+	}
 
 	main_timer.stop();
 	printTimerInfo();
+	if (!metrics_filename.empty() && writeMetrics(metrics_filename, metrics)) {
+		cout << "Wrote metrics to " << metrics_filename << endl;
+	}
 }
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#if _MSC_VER
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "psapi.lib")
+#undef NOMINMAX
+#else
+#include <sys/resource.h>
+#endif
+#include "globals.h"
+
+using namespace std;
+
+// Build metrics (-metrics <file>): per-phase and per-partition wall times, bytes moved, throughput and peak memory,
+// written as JSON (or CSV when the file name ends in .csv) so runs can be compared across builds and grid sizes.
+// All times are in ms.
+
+struct PartitionMetrics {
+	size_t index;
+	size_t triangles;
+	size_t voxels;
+	size_t sorted; // voxels that went through a sort (0 if the partition walked its occupancy bits instead)
+	size_t bytes_read; // .tripdata
+	double voxelize_ms; // reading and voxelizing the triangles
+	double sort_ms;
+	double build_ms; // feeding the sorted voxels to the octree builder
+
+	PartitionMetrics() : index(0), triangles(0), voxels(0), sorted(0), bytes_read(0), voxelize_ms(0.0), sort_ms(0.0), build_ms(0.0) {}
+};
+
+struct BuildMetrics {
+	size_t gridsize;
+	size_t threads;
+	size_t triangles;
+	size_t voxels;
+	size_t sorted; // summed over partitions
+	size_t bytes_read; // .tridata and .tripdata
+	size_t bytes_written; // .tripdata and octree files
+	double sort_ms; // summed over partitions
+	vector<PartitionMetrics> partitions;
+
+	BuildMetrics() : gridsize(0), threads(1), triangles(0), voxels(0), sorted(0), bytes_read(0), bytes_written(0), sort_ms(0.0) {}
+};
+
+// Size of a file in bytes, 0 if it doesn't exist
+inline size_t metricsFileSize(const string &filename){
+	ifstream f(filename.c_str(), ios::in | ios::binary | ios::ate);
+	return f.good() ? static_cast<size_t>(f.tellg()) : 0;
+}
+
+// Peak resident set size of this process, in bytes
+inline size_t peakRSS(){
+#if _MSC_VER
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return 0; }
+	return static_cast<size_t>(counters.PeakWorkingSetSize);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+#if __APPLE__
+	return static_cast<size_t>(usage.ru_maxrss); // bytes
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#endif
+}
+
+// per second, 0 for an empty phase
+inline double perSecond(const size_t n, const double ms){
+	return ms > 0.0 ? n / (ms / 1000.0) : 0.0;
+}
+
+inline void writeMetricsJSON(ofstream &out, const BuildMetrics &m){
+	out << "{" << endl;
+	out << "  \"gridsize\": " << m.gridsize << "," << endl;
+	out << "  \"threads\": " << m.threads << "," << endl;
+	out << "  \"triangles\": " << m.triangles << "," << endl;
+	out << "  \"voxels\": " << m.voxels << "," << endl;
+	out << "  \"bytes_read\": " << m.bytes_read << "," << endl;
+	out << "  \"bytes_written\": " << m.bytes_written << "," << endl;
+	out << "  \"peak_rss_bytes\": " << peakRSS() << "," << endl;
+	out << "  \"total_ms\": " << main_timer.elapsed_time_milliseconds << "," << endl;
+	out << "  \"partitioning\": { \"total_ms\": " << part_total_timer.elapsed_time_milliseconds << ", \"io_in_ms\": " << part_io_in_timer.elapsed_time_milliseconds
+		<< ", \"algorithm_ms\": " << part_algo_timer.elapsed_time_milliseconds << ", \"io_out_ms\": " << part_io_out_timer.elapsed_time_milliseconds
+		<< ", \"triangles_per_s\": " << perSecond(m.triangles, part_total_timer.elapsed_time_milliseconds) << " }," << endl;
+	out << "  \"voxelizing\": { \"total_ms\": " << vox_total_timer.elapsed_time_milliseconds << ", \"io_in_ms\": " << vox_io_in_timer.elapsed_time_milliseconds
+		<< ", \"algorithm_ms\": " << vox_algo_timer.elapsed_time_milliseconds
+		<< ", \"triangles_per_s\": " << perSecond(m.triangles, vox_total_timer.elapsed_time_milliseconds) << " }," << endl;
+	out << "  \"sorting\": { \"total_ms\": " << m.sort_ms << ", \"voxels\": " << m.sorted << ", \"voxels_per_s\": " << perSecond(m.sorted, m.sort_ms) << " }," << endl;
+	out << "  \"svo_building\": { \"total_ms\": " << svo_total_timer.elapsed_time_milliseconds << ", \"io_out_ms\": " << svo_io_out_timer.elapsed_time_milliseconds
+		<< ", \"algorithm_ms\": " << svo_algo_timer.elapsed_time_milliseconds
+		<< ", \"voxels_per_s\": " << perSecond(m.voxels, svo_total_timer.elapsed_time_milliseconds) << " }," << endl;
+	out << "  \"partitions\": [";
+	for (size_t i = 0; i < m.partitions.size(); i++) {
+		const PartitionMetrics &p = m.partitions[i];
+		out << (i == 0 ? "" : ",") << endl;
+		out << "    { \"index\": " << p.index << ", \"triangles\": " << p.triangles << ", \"voxels\": " << p.voxels << ", \"sorted\": " << p.sorted << ", \"bytes_read\": " << p.bytes_read
+			<< ", \"voxelize_ms\": " << p.voxelize_ms << ", \"sort_ms\": " << p.sort_ms << ", \"build_ms\": " << p.build_ms
+			<< ", \"triangles_per_s\": " << perSecond(p.triangles, p.voxelize_ms) << ", \"voxels_per_s\": " << perSecond(p.voxels, p.build_ms) << " }";
+	}
+	out << endl << "  ]" << endl;
+	out << "}" << endl;
+}
+
+// One row per phase and per partition, with the same columns
+inline void writeMetricsCSV(ofstream &out, const BuildMetrics &m){
+	out << "phase,partition,total_ms,io_in_ms,algorithm_ms,io_out_ms,sort_ms,triangles,voxels,bytes_read,bytes_written,triangles_per_s,voxels_per_s,peak_rss_bytes" << endl;
+	out << "main,," << main_timer.elapsed_time_milliseconds << ",,,,," << m.triangles << "," << m.voxels << "," << m.bytes_read << "," << m.bytes_written << ",,," << peakRSS() << endl;
+	out << "partitioning,," << part_total_timer.elapsed_time_milliseconds << "," << part_io_in_timer.elapsed_time_milliseconds << "," << part_algo_timer.elapsed_time_milliseconds
+		<< "," << part_io_out_timer.elapsed_time_milliseconds << ",," << m.triangles << ",,,," << perSecond(m.triangles, part_total_timer.elapsed_time_milliseconds) << ",," << endl;
+	out << "voxelizing,," << vox_total_timer.elapsed_time_milliseconds << "," << vox_io_in_timer.elapsed_time_milliseconds << "," << vox_algo_timer.elapsed_time_milliseconds
+		<< ",,," << m.triangles << "," << m.voxels << ",,," << perSecond(m.triangles, vox_total_timer.elapsed_time_milliseconds) << ",," << endl;
+	out << "sorting,," << m.sort_ms << ",,,," << m.sort_ms << ",," << m.sorted << ",,,," << perSecond(m.sorted, m.sort_ms) << "," << endl;
+	out << "svo_building,," << svo_total_timer.elapsed_time_milliseconds << ",," << svo_algo_timer.elapsed_time_milliseconds << "," << svo_io_out_timer.elapsed_time_milliseconds
+		<< ",,," << m.voxels << ",,,," << perSecond(m.voxels, svo_total_timer.elapsed_time_milliseconds) << "," << endl;
+	for (size_t i = 0; i < m.partitions.size(); i++) {
+		const PartitionMetrics &p = m.partitions[i];
+		out << "partition," << p.index << "," << (p.voxelize_ms + p.sort_ms + p.build_ms) << ",," << p.voxelize_ms << ",," << p.sort_ms << "," << p.triangles << "," << p.voxels
+			<< "," << p.bytes_read << ",," << perSecond(p.triangles, p.voxelize_ms) << "," << perSecond(p.voxels, p.build_ms) << "," << endl;
+	}
+}
+
+// Write the metrics to filename: CSV if it ends in .csv, JSON otherwise
+inline bool writeMetrics(const string &filename, const BuildMetrics &m){
+	ofstream out(filename.c_str());
+	if (!out.good()) {
+		cout << "Could not open metrics file " << filename << " for writing." << endl;
+		return false;
+	}
+	out << std::fixed << std::setprecision(3);
+	bool csv = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".csv") == 0;
+	if (csv) { writeMetricsCSV(out, m); }
+	else { writeMetricsJSON(out, m); }
+	return true;
+}
@@ -2,13 +2,20 @@
 
 #include <iostream>
 #include <fstream>
+#include <functional>
 #include "../libs/libtri/include/file_tools.h"
 #include "Node.h"
+#include "AsyncWriter.h"
 
 using namespace std;
 
 // File containing all the octree IO methods
 
+// Node formats (the octree header version tells which one a file uses)
+#define OCTREE_FORMAT_CLASSIC 1 // Node: data, children_base, children_offset[8] (3 size_t per node)
+#define OCTREE_FORMAT_COMPACT 2 // CompactNode: 32-bit child pointer + valid/leaf masks (8 bytes per node)
+#define OCTREE_FORMAT_DAG 3 // DagNode: identical subtrees stored once, geometry only (4 to 36 bytes per node)
+
 // Internal format to represent an octree
 struct OctreeInfo {
 	int version;
@@ -16,9 +23,20 @@ struct OctreeInfo {
 	size_t gridlength;
 	size_t n_nodes;
 	size_t n_data;
+	bool levels; // compact format only: internal node payloads are in a separate .octreelevels file
+	bool packed_data; // .octreedata holds packed payloads (svo_builder -packed), see VoxelData.h
+	bool geometry_only; // geometry only model: all leaves refer to payload 1, one white voxel
+	size_t n_partitions; // sub-octrees (svo_builder -partitions, -job): partitions of the build they are a slice of (0: a full octree)
+	::uint64_t morton_start, morton_end; // sub-octrees: the morton range [start, end) their partitions cover
+	size_t root; // DAG format only: word offset of the root node (its nodes have different sizes)
+	int brick_size; // brick output: texels per brick axis (0: no bricks), see BrickAtlas.h
+	size_t n_bricks; // brick output: bricks in the atlases, including the empty brick 0
+	size_t atlas_size[3]; // brick output: atlas size, in bricks
 
-	OctreeInfo() : version(1), base_filename(string("")), gridlength(1024), n_nodes(0), n_data(0) {}
-	OctreeInfo(int version, string base_filename, size_t gridlength, size_t n_nodes, size_t n_data) : version(version), base_filename(base_filename), gridlength(gridlength), n_nodes(n_nodes), n_data(n_data) {} 
+	OctreeInfo() : version(1), base_filename(string("")), gridlength(1024), n_nodes(0), n_data(0), levels(false), packed_data(false), geometry_only(false), n_partitions(0), morton_start(0), morton_end(0), root(0), brick_size(0), n_bricks(0) { atlas_size[0] = atlas_size[1] = atlas_size[2] = 0; }
+	OctreeInfo(int version, string base_filename, size_t gridlength, size_t n_nodes, size_t n_data, bool levels = false, bool packed_data = false) : version(version), base_filename(base_filename), gridlength(gridlength), n_nodes(n_nodes), n_data(n_data), levels(levels), packed_data(packed_data), geometry_only(false), n_partitions(0), morton_start(0), morton_end(0), root(0), brick_size(0), n_bricks(0) {
+		atlas_size[0] = atlas_size[1] = atlas_size[2] = 0;
+	} 
 
 	void print() const{
 		cout << "  version: " << version << endl;
@@ -26,6 +44,24 @@ struct OctreeInfo {
 		cout << "  grid length: " << gridlength << endl;
 		cout << "  n_nodes: " << n_nodes << endl;
 		cout << "  n_data: " << n_data << endl;
+		if (version == OCTREE_FORMAT_COMPACT) {
+			cout << "  levels: " << levels << endl;
+		}
+		if (version == OCTREE_FORMAT_DAG) {
+			cout << "  root: " << root << endl;
+		}
+		if (brick_size > 0) {
+			cout << "  bricks: " << n_bricks << " of " << brick_size << "^3, atlas " << atlas_size[0] << " x " << atlas_size[1] << " x " << atlas_size[2] << " bricks" << endl;
+		}
+		if (packed_data) {
+			cout << "  data format: packed" << endl;
+		}
+		if (geometry_only) {
+			cout << "  geometry only" << endl;
+		}
+		if (n_partitions > 0) {
+			cout << "  sub-octree of " << n_partitions << " partitions, morton range [" << morton_start << ", " << morton_end << ")" << endl;
+		}
 	}
 
 	// check if all files required by Tri exist
@@ -33,21 +69,118 @@ struct OctreeInfo {
 		string header = base_filename + string(".octree");
 		string nodes = base_filename + string(".octreenodes");
 		string data = base_filename + string(".octreedata");
+		if (levels && !file_exists(base_filename + string(".octreelevels"))) {
+			return false;
+		}
+		if (brick_size > 0 && (!file_exists(base_filename + string(".octreebricks")) || !file_exists(base_filename + string(".octreebricknormals")))) {
+			return false;
+		}
 		return (file_exists(header) && file_exists(nodes) && file_exists(data));
 	}
 };
 
+// Compact SVO node (in the style of Laine & Karras' Efficient Sparse Voxel Octrees).
+// Children of a node are stored next to each other, in child order, so one pointer and a mask are enough.
+// Leaves don't get a node of their own: their parent points to their payloads in the .octreedata file instead.
+#define COMPACT_SHARED_LEAF_DATA 0x1 // all leaf children use the single payload at child_ptr (binary voxelization)
+
+struct CompactNode {
+	uint32_t child_ptr; // index of the first child node, or of the first leaf payload if the children are leaves
+	uint8_t valid_mask; // bit i set: child i exists
+	uint8_t leaf_mask; // bit i set: child i is a leaf
+	uint16_t flags;
+
+	CompactNode() : child_ptr(0), valid_mask(0), leaf_mask(0), flags(0) {}
+
+	bool hasChild(unsigned int i) const { return (valid_mask >> i) & 1; }
+	bool isLeafChild(unsigned int i) const { return (leaf_mask >> i) & 1; }
+	bool isLeaf() const { return valid_mask == 0; }
+
+	// Index of child i: a node index, or a payload index for leaf children. Returns 0 if there is no such child.
+	size_t getChildPos(unsigned int i) const {
+		if (!hasChild(i)) { return 0; }
+		if (isLeafChild(i) && (flags & COMPACT_SHARED_LEAF_DATA)) { return child_ptr; }
+		unsigned int rank = 0;
+		for (unsigned int k = 0; k < i; k++) { rank += (valid_mask >> k) & 1; }
+		return child_ptr + rank;
+	}
+};
+static_assert(sizeof(CompactNode) == 8, "CompactNode should be 8 bytes");
+
+// Convert a builder Node into its compact form. leaf_children tells if the children of n are leaves,
+// in which case n.children_base and n.children_offset refer to payloads instead of nodes.
+inline CompactNode toCompactNode(const Node &n, const bool leaf_children){
+	CompactNode c;
+	c.child_ptr = static_cast<uint32_t>(n.children_base);
+	int last_valid = -1;
+	for (unsigned int i = 0; i < 8; i++) {
+		if (n.hasChild(i)) {
+			c.valid_mask |= (1 << i);
+			last_valid = i;
+		}
+	}
+	if (leaf_children) {
+		c.leaf_mask = c.valid_mask;
+		if (last_valid > 0 && n.children_offset[last_valid] == 0 && c.valid_mask != (1 << last_valid)) {
+			c.flags |= COMPACT_SHARED_LEAF_DATA;
+		}
+	}
+	return c;
+}
+
+// Sparse voxel DAG node (Kaempe et al., High Resolution Sparse Voxel DAGs).
+// Identical subtrees are only stored once, so children are shared and can't be found from a single base pointer:
+// a node is a header word (valid mask in bits 0-7, leaf mask in bits 8-15) followed by the 32-bit word offset
+// of every child that isn't a leaf, in child order. The DAG only stores geometry: all voxels share payload 1.
+struct DagNode {
+	uint32_t words[9];
+	unsigned int n_words;
+
+	DagNode() : n_words(1) { words[0] = 0; }
+
+	uint8_t validMask() const { return words[0] & 0xFF; }
+	uint8_t leafMask() const { return (words[0] >> 8) & 0xFF; }
+	bool operator == (const DagNode &a) const {
+		return n_words == a.n_words && memcmp(words, a.words, n_words * sizeof(uint32_t)) == 0;
+	}
+};
+
+// Hash of a DagNode, to find identical nodes (FNV-1a over its words)
+struct DagNodeHash {
+	size_t operator()(const DagNode &n) const {
+		::uint64_t h = 0xcbf29ce484222325ull;
+		for (unsigned int i = 0; i < n.n_words; i++) {
+			h = (h ^ n.words[i]) * 0x100000001b3ull;
+		}
+		return static_cast<size_t>(h ^ (h >> 32));
+	}
+};
+
 size_t writeVoxelData(FILE* f, const VoxelData &v, size_t &b_data_pos);
+size_t writeVoxelData(FILE* f, const PackedVoxelData &v, size_t &b_data_pos);
 void readVoxelData(FILE* f, VoxelData &v);
 size_t writeNode(FILE* node_out, const Node &n, size_t &b_node_pos);
-inline void readNode(FILE* f, Node &n);
+void readNode(FILE* f, Node &n);
+size_t writeCompactNode(FILE* node_out, const Node &n, const bool leaf_children, size_t &b_node_pos);
+size_t writeVoxelData(AsyncWriter &out, const VoxelData &v, size_t &b_data_pos);
+size_t writeVoxelData(AsyncWriter &out, const PackedVoxelData &v, size_t &b_data_pos);
+size_t writeNode(AsyncWriter &node_out, const Node &n, size_t &b_node_pos);
+size_t writeCompactNode(AsyncWriter &node_out, const Node &n, const bool leaf_children, size_t &b_node_pos);
+void readCompactNode(FILE* f, CompactNode &n);
+size_t writeDagNode(AsyncWriter &node_out, const DagNode &n, size_t &b_word_pos);
 
 void writeOctreeHeader(const std::string &filename, const OctreeInfo &i);
 int parseOctreeHeader(const std::string &filename, OctreeInfo &i);
 
 // Write a data point to file
 inline size_t writeVoxelData(FILE* f, const VoxelData &v, size_t &b_data_pos){
-	fwrite(&v.morton, VOXELDATA_SIZE, 1, f);
+	fwrite(v.diskData(), VOXELDATA_SIZE, 1, f);
+	b_data_pos++;
+	return b_data_pos-1;
+}
+
+inline size_t writeVoxelData(FILE* f, const PackedVoxelData &v, size_t &b_data_pos){
+	fwrite(v.diskData(), PACKED_VOXELDATA_SIZE, 1, f);
 	b_data_pos++;
 	return b_data_pos-1;
 }
@@ -55,7 +188,7 @@ inline size_t writeVoxelData(FILE* f, const VoxelData &v, size_t &b_data_pos){
 // Read a data point from a file
 inline void readDataPoint(FILE* f, VoxelData &v){
 	v.morton = 0;
-	fread(&v.morton, VOXELDATA_SIZE, 1, f);
+	fread(v.diskData(), VOXELDATA_SIZE, 1, f);
 }
 
 // Write an octree node to file
@@ -70,14 +203,83 @@ inline void readNode(FILE* f, Node &n){
 	fread(& n.data, sizeof(size_t), 3, f);
 }
 
+// Write an octree node to file in the compact format
+inline size_t writeCompactNode(FILE* node_out, const Node &n, const bool leaf_children, size_t &b_node_pos){
+	CompactNode c = toCompactNode(n, leaf_children);
+	fwrite(&c, sizeof(CompactNode), 1, node_out);
+	b_node_pos++;
+	return b_node_pos-1;
+}
+
+// Read a CompactNode from a file
+inline void readCompactNode(FILE* f, CompactNode &n){
+	fread(&n, sizeof(CompactNode), 1, f);
+}
+
+// Write a data point to an AsyncWriter
+inline size_t writeVoxelData(AsyncWriter &out, const VoxelData &v, size_t &b_data_pos){
+	out.write(v.diskData(), VOXELDATA_SIZE);
+	b_data_pos++;
+	return b_data_pos-1;
+}
+
+inline size_t writeVoxelData(AsyncWriter &out, const PackedVoxelData &v, size_t &b_data_pos){
+	out.write(v.diskData(), PACKED_VOXELDATA_SIZE);
+	b_data_pos++;
+	return b_data_pos-1;
+}
+
+// Write an octree node to an AsyncWriter
+inline size_t writeNode(AsyncWriter &node_out, const Node &n, size_t &b_node_pos){
+	node_out.write(& n.data, sizeof(size_t) * 3);
+	b_node_pos++;
+	return b_node_pos-1;
+}
+
+// Write an octree node to an AsyncWriter in the compact format
+inline size_t writeCompactNode(AsyncWriter &node_out, const Node &n, const bool leaf_children, size_t &b_node_pos){
+	CompactNode c = toCompactNode(n, leaf_children);
+	node_out.write(&c, sizeof(CompactNode));
+	b_node_pos++;
+	return b_node_pos-1;
+}
+
+// Write a DAG node to an AsyncWriter, returns its word offset
+inline size_t writeDagNode(AsyncWriter &node_out, const DagNode &n, size_t &b_word_pos){
+	node_out.write(n.words, n.n_words * sizeof(uint32_t));
+	b_word_pos += n.n_words;
+	return b_word_pos - n.n_words;
+}
+
 // Write an octree header to a file
 inline void writeOctreeHeader(const std::string &filename, const OctreeInfo &i){
 	ofstream outfile;
 	outfile.open(filename.c_str(), ios::out);
-	outfile << "#octreeheader 1" << endl;
+	outfile << "#octreeheader " << i.version << endl;
 	outfile << "gridlength " << i.gridlength << endl;
 	outfile << "n_nodes " << i.n_nodes << endl;
 	outfile << "n_data " << i.n_data << endl;
+	if (i.version == OCTREE_FORMAT_COMPACT) {
+		outfile << "levels " << (i.levels ? 1 : 0) << endl;
+	}
+	if (i.version == OCTREE_FORMAT_DAG) {
+		outfile << "root " << i.root << endl;
+	}
+	if (i.brick_size > 0) {
+		outfile << "bricks " << i.brick_size << endl;
+		outfile << "n_bricks " << i.n_bricks << endl;
+		outfile << "brick_atlas " << i.atlas_size[0] << " " << i.atlas_size[1] << " " << i.atlas_size[2] << endl;
+	}
+	if (i.packed_data) {
+		outfile << "data_format packed" << endl;
+	}
+	if (i.geometry_only) {
+		outfile << "geometry_only 1" << endl;
+	}
+	if (i.n_partitions > 0) {
+		outfile << "partitions " << i.n_partitions << endl;
+		outfile << "morton_range " << i.morton_start << " " << i.morton_end << endl;
+	}
 	outfile << "END" << endl;
 	outfile.close();
 }
@@ -100,6 +302,15 @@ inline int parseOctreeHeader(const std::string &filename, OctreeInfo &i){
 		else if (line.compare("gridlength") == 0) {headerfile >> i.gridlength;}
 		else if (line.compare("n_nodes") == 0) {headerfile >> i.n_nodes;}
 		else if (line.compare("n_data") == 0) {headerfile >> i.n_data;}
+		else if (line.compare("levels") == 0) {headerfile >> i.levels;}
+		else if (line.compare("root") == 0) {headerfile >> i.root;}
+		else if (line.compare("bricks") == 0) {headerfile >> i.brick_size;}
+		else if (line.compare("n_bricks") == 0) {headerfile >> i.n_bricks;}
+		else if (line.compare("brick_atlas") == 0) {headerfile >> i.atlas_size[0] >> i.atlas_size[1] >> i.atlas_size[2];}
+		else if (line.compare("data_format") == 0) {headerfile >> line; i.packed_data = (line.compare("packed") == 0);}
+		else if (line.compare("geometry_only") == 0) {headerfile >> i.geometry_only;}
+		else if (line.compare("partitions") == 0) {headerfile >> i.n_partitions;}
+		else if (line.compare("morton_range") == 0) {headerfile >> i.morton_start >> i.morton_end;}
 		else { cout << "  unrecognized keyword [" << line << "], skipping" << endl;
 		char c; do { c = headerfile.get(); } while(headerfile.good() && (c != '\n'));
 		}
@@ -1,29 +1,72 @@
 #include "partitioner.h"
+#include <algorithm>
 
 using namespace std;
 using namespace glm;
 
 // Fiddle with buffer sizes here: these are defined as number of triangles
-#define input_buffersize 8192
 #define output_buffersize 8192
+#define binning_blocksize 65536
+
+// Adaptive partitioning: triangles are counted in cells this many octree levels below the biggest partition that fits in memory,
+#define adaptive_cell_levels 2
+// but never in more than this many cells,
+#define adaptive_max_cells (1 << 18)
+// and cells are at least 4^3 = 64 voxels (smaller ones only make the histogram bigger)
+#define adaptive_min_cell_size 64
+// Aim for at least this many partitions per voxelization thread, so the dense parts of a model get spread out
+#define adaptive_partitions_per_thread 4
+// Binning keeps a buffer and an open file per partition. With more partitions than this (very big grids), the triangles
+// are binned into coarse tiles (runs of partitions) first, and then every tile is split into its own partitions.
+#define max_open_partitions 256
+
+#define NO_PARTITION 0xFFFFFFFF
+
+// Partitions as runs of cells in morton order. Cells are aligned cubes of the grid, and triangles are binned per cell.
+// Uniform partitioning is the special case where every cell is a partition.
+struct PartitionPlan {
+	unsigned int cells_per_axis;
+	::uint64_t cell_size; // voxels per cell
+	vector<::uint64_t> starts, ends; // morton range [start, end) of every partition
+	vector<unsigned int> cell_partition; // partition of every cell (by cell morton code), NO_PARTITION if it has no triangles
+};
 
 // Estimate the optimal amount of partitions we need, given the requested gridsize and the overall memory limit.
-size_t estimate_partitions(const size_t gridsize, const size_t memory_limit){
+// When voxelizing with n_threads pipeline threads, every thread holds its own partition in memory, so the limit is shared between them.
+size_t estimate_partitions(const size_t gridsize, const size_t memory_limit, const size_t n_threads){
 	cout << "Estimating best partition count ..." << endl;
-	::uint64_t required = (gridsize*gridsize*gridsize*sizeof(char)) / 1024 / 1024;
+	const ::uint64_t n_voxels = static_cast<::uint64_t>(gridsize)*gridsize*gridsize; // 64-bit: 16K^3 already overflows 32 bits
+	::uint64_t required = (n_voxels / 8) / 1024 / 1024; // the voxelizer keeps one bit per voxel
+	size_t thread_limit = std::max<size_t>(memory_limit / n_threads, 1);
 	cout << "  to do this in-core I would need " << required << " Mb of system memory" << endl;
-	if (required <= memory_limit){
+	if (required <= thread_limit && n_threads == 1){
 		cout << "  memory limit of " << memory_limit << " Mb allows that" << endl;
 		return 1;
 	}
-	size_t numpartitions = 1;
-	size_t required_partition = required;
-	while (required_partition > memory_limit){
+	::uint64_t numpartitions = 1;
+	::uint64_t required_partition = required;
+	// keep splitting until a partition fits in the per-thread budget, and there is at least one partition per thread
+	while ((required_partition > thread_limit || numpartitions < n_threads) && numpartitions < n_voxels){
 		required_partition = required_partition / 8;
 		numpartitions = numpartitions * 8;
 	}
-	cout << "  going to do it in " << numpartitions << " partitions of " << required_partition << " Mb each." << endl;
-	return numpartitions;
+	if (n_threads > 1){
+		cout << "  going to do it in " << numpartitions << " partitions of " << required_partition << " Mb each, voxelizing " << n_threads << " at a time." << endl;
+	}
+	else {
+		cout << "  going to do it in " << numpartitions << " partitions of " << required_partition << " Mb each." << endl;
+	}
+	return static_cast<size_t>(numpartitions);
+}
+
+// Biggest partition (in voxels, an aligned cube) whose occupancy bitset fits in the memory of one voxelization thread
+::uint64_t max_partition_size(const size_t gridsize, const size_t memory_limit, const size_t n_threads){
+	::uint64_t size = static_cast<::uint64_t>(gridsize)*gridsize*gridsize;
+	::uint64_t thread_limit = static_cast<::uint64_t>(std::max<size_t>(memory_limit / n_threads, 1)) * 1024 * 1024; // in bytes
+	while (size / 8 > thread_limit && size > 1){
+		size = size / 8;
+	}
+	return size;
 }
 
 // Remove the temporary .trip files we made
@@ -38,11 +81,25 @@ void removeTripFiles(const TripInfo &trip_info){
 	}
 }
 
-// Create n Buffers for a total gridsize, store them in the given vector, use tri_info for filename information
-void createBuffers(const TriInfo& tri_info, const size_t n_partitions, const size_t gridsize, vector<BBoxBuffer*> &buffers){
+// Open the vertex file of an indexed mesh, returns NULL for a mesh of full triangles
+template <typename T>
+const TriVertices<T>* openVertices(const TriInfo& tri_info, TriVertices<T> &vertices){
+	if (!tri_info.indexed) { return NULL; }
+	string filename = tri_info.base_filename + string(".trivertices");
+	if (!vertices.open(filename) || vertices.size() != tri_info.n_vertices) {
+		cout << "Error: could not read the " << tri_info.n_vertices << " vertices of " << filename << endl;
+		exit(1);
+	}
+	return &vertices;
+}
+
+// Create a buffer for every partition in the plan, store them in the given vector. Buffer i writes to <prefix>_<first_index + i>.tripdata,
+// compressed on the given lattice if there is one, or as index triples if indexed
+template <typename T>
+void createBuffers(const TriInfo& tri_info, const PartitionPlan &plan, const size_t gridsize, const string &prefix, const size_t first_index, const TriLattice* lattice, const bool indexed, vector<BBoxBuffer<T>*> &buffers){
+	size_t n_partitions = plan.starts.size();
 	buffers.resize(n_partitions);
 	float unitlength = (tri_info.mesh_bbox.max[0] - tri_info.mesh_bbox.min[0]) / (float)gridsize;
-	::uint64_t morton_part = (gridsize*gridsize*gridsize) / n_partitions;
 
 	AABox<uivec3> bbox_grid;
 	AABox<vec3> bbox_world;
@@ -50,8 +107,7 @@ void createBuffers(const TriInfo& tri_info, const size_t n_partitions, const siz
 
 	for (size_t i = 0; i < n_partitions; i++){
 		// compute world bounding box
-		m3D_d_sLUT(morton_part*i, bbox_grid.min[0], bbox_grid.min[1], bbox_grid.min[2]);
-		m3D_d_sLUT((morton_part*(i + 1)) - 1, bbox_grid.max[0], bbox_grid.max[1], bbox_grid.max[2]); // -1, because z-curve skips to first block of next partition
+		bbox_grid = mortonRangeBBox(plan.starts[i], plan.ends[i]);
 		bbox_world.min[0] = bbox_grid.min[0] * unitlength;
 		bbox_world.min[1] = bbox_grid.min[1] * unitlength;
 		bbox_world.min[2] = bbox_grid.min[2] * unitlength;
@@ -61,8 +117,8 @@ void createBuffers(const TriInfo& tri_info, const size_t n_partitions, const siz
 
 		// output partition info
 		if (verbose){
-			cout << "Partitioning partition #" << i + 1 << " / " << n_partitions << " id: " << i << " ..." << endl;
-			cout << "  morton from " << morton_part*i << " to " << morton_part*(i + 1) << endl;
+			cout << "Partitioning partition #" << i + 1 << " / " << n_partitions << " id: " << first_index + i << " ..." << endl;
+			cout << "  morton from " << plan.starts[i] << " to " << plan.ends[i] << endl;
 			cout << "  grid coordinates from (" << bbox_grid.min[0] << "," << bbox_grid.min[1] << "," << bbox_grid.min[2] << ") to ("
 				<< bbox_grid.max[0] << "," << bbox_grid.max[1] << "," << bbox_grid.max[2] << ")" << endl;
 			cout << "  worldspace coordinates from (" << bbox_world.min[0] << "," << bbox_world.min[1] << "," << bbox_world.min[2] << ") to ("
@@ -70,23 +126,38 @@ void createBuffers(const TriInfo& tri_info, const size_t n_partitions, const siz
 		}
 
 		// create buffer for partition
-		filename = tri_info.base_filename + val_to_string(gridsize) + string("_") + val_to_string(n_partitions) + string("_") + val_to_string(i) + string(".tripdata");
-		buffers[i] = new BBoxBuffer(filename, bbox_world, output_buffersize);
+		filename = prefix + string("_") + val_to_string(first_index + i) + string(".tripdata");
+		buffers[i] = new BBoxBuffer<T>(filename, bbox_world, output_buffersize, lattice, indexed);
 	}
 }
 
+// A single partition can be the .tridata itself, unless -compress has to quantize a raw mesh: then it goes through
+// the lattice like the partitions of any other partitioning, so the triangles don't depend on the partition count
+inline bool linkSinglePartition(const TriInfo& tri_info, const bool compress){
+	TriLattice lattice;
+	return !compress || tri_info.indexed || isCompressedTriStream(tri_info.base_filename + string(".tridata"), lattice);
+}
+
 // Handle the special case of just needing one partition
-TripInfo partition_one(const TriInfo& tri_info, const size_t gridsize){
-	// Just copy files
+TripInfo partition_one(const TriInfo& tri_info, const size_t gridsize, const PartitionRange &range){
+	// The partition is the whole .tridata: link it instead of copying it (or write an empty one, if the range doesn't include this partition).
+	// An indexed partition still points at the vertex file of the mesh.
+	size_t lo, hi;
+	range.resolve(1, lo, hi);
 	string src = tri_info.base_filename + string(".tridata");
-	string dst = tri_info.base_filename + val_to_string(gridsize) + string("_") + val_to_string(1) + string("_") + val_to_string(0) + string(".tripdata");
-	copy_file(src, dst);
+	string dst = tri_info.base_filename + val_to_string(gridsize) + string("_") + val_to_string(1) + range.tag() + string("_") + val_to_string(0) + string(".tripdata");
+	if (range.isSet()) { cout << "  building the sub-octree of partitions [" << lo << ", " << hi << ") of 1" << endl; }
+	if (lo < hi) { link_file(src, dst); }
+	else { ofstream empty(dst.c_str(), ios::out | ios::binary); }
 
 	// Write header
 	TripInfo trip_info = TripInfo(tri_info);
+	trip_info.version = 2;
 	trip_info.part_tricounts.resize(1);
-	trip_info.part_tricounts[0] = tri_info.n_triangles;
-	trip_info.base_filename = tri_info.base_filename + val_to_string(gridsize) + string("_") + val_to_string(1);
+	trip_info.part_tricounts[0] = (lo < hi) ? tri_info.n_triangles : 0;
+	trip_info.part_morton_start.assign(1, 0);
+	trip_info.part_morton_end.assign(1, static_cast<::uint64_t>(gridsize)*gridsize*gridsize);
+	trip_info.base_filename = tri_info.base_filename + val_to_string(gridsize) + string("_") + val_to_string(1) + range.tag();
 	std::string header = trip_info.base_filename + string(".trip");
 	trip_info.gridsize = gridsize;
 	trip_info.n_partitions = 1;
@@ -96,48 +167,375 @@ TripInfo partition_one(const TriInfo& tri_info, const size_t gridsize){
 	return trip_info;
 }
 
-// Partition the mesh referenced by tri_info into n partitions for gridsize, and store information about the partitioning in trip_info
-TripInfo partition(const TriInfo& tri_info, const size_t n_partitions, const size_t gridsize){
-	// Special case: just one partition
-	if (n_partitions == 1) {
-		return partition_one(tri_info, gridsize);
+// Compute the world-space boundaries between cells along one axis: cell c spans [bounds[c], bounds[c+1]].
+// These are computed the same way as the partition bounding boxes in createBuffers, so binning against them gives exactly the same result.
+void computeCellBounds(const TriInfo& tri_info, const unsigned int per_axis, const size_t gridsize, vector<float> &bounds){
+	float unitlength = (tri_info.mesh_bbox.max[0] - tri_info.mesh_bbox.min[0]) / (float)gridsize;
+	unsigned int side = static_cast<unsigned int>(gridsize / per_axis);
+	bounds.resize(per_axis + 1);
+	for (unsigned int c = 0; c <= per_axis; c++){
+		bounds[c] = (c*side) * unitlength;
+	}
+}
+
+// Find the range [lo, hi] of cells along one axis that overlap [min, max]. Returns false if there are none.
+inline bool cellRange(const vector<float> &bounds, const float min, const float max, unsigned int &lo, unsigned int &hi){
+	size_t per_axis = bounds.size() - 1;
+	// first partition whose upper bound is >= min
+	size_t first = lower_bound(bounds.begin() + 1, bounds.end(), min) - (bounds.begin() + 1);
+	// one past the last partition whose lower bound is <= max
+	size_t last = upper_bound(bounds.begin(), bounds.end() - 1, max) - bounds.begin();
+	if (first >= per_axis || last == 0 || first > last - 1) {
+		return false;
+	}
+	lo = static_cast<unsigned int>(first);
+	hi = static_cast<unsigned int>(last - 1);
+	return true;
+}
+
+// Find the cells [lo, hi] (per axis) the bounding box of a triangle overlaps. Returns false if there are none.
+// Given a lattice, that's the triangle as it will be read back from a compressed partition.
+template <typename T>
+inline bool triangleCells(const T &t, const vector<float> &bounds, uivec3 &lo, uivec3 &hi, const TriLattice* lattice = NULL){
+	AABox<vec3> bbox = (lattice != NULL) ? computeBoundingBox(snapToLattice(t.v0, *lattice), snapToLattice(t.v1, *lattice), snapToLattice(t.v2, *lattice))
+		: computeBoundingBox(t.v0, t.v1, t.v2);
+	for (int a = 0; a < 3; a++){
+		if (!cellRange(bounds, bbox.min[a], bbox.max[a], lo[a], hi[a])) { return false; }
+	}
+	return true;
+}
+
+// Bin a triangle: append (triangle, partition) pairs for all partitions its bounding box overlaps.
+// Cells are aligned cubes in morton order, so the cell id is the morton code of its cube coordinates.
+template <typename T>
+inline void binTriangle(const T &t, const unsigned int tri_index, const vector<float> &bounds, const vector<unsigned int> &cell_partition, const TriLattice* lattice, vector<pair<unsigned int, unsigned int> > &hits){
+	uivec3 lo, hi;
+	if (!triangleCells(t, bounds, lo, hi, lattice)) { return; }
+	size_t first_hit = hits.size();
+	::uint64_t id_x = morton3D_64_encode_dispatch(lo[0], lo[1], lo[2]);
+	for (unsigned int x = lo[0]; x <= hi[0]; x++, id_x = m3D_inc_x(id_x)){
+		::uint64_t id_y = id_x;
+		for (unsigned int y = lo[1]; y <= hi[1]; y++, id_y = m3D_inc_y(id_y)){
+			::uint64_t id = id_y;
+			for (unsigned int z = lo[2]; z <= hi[2]; z++, id = m3D_inc_z(id)){
+				unsigned int p = cell_partition[id];
+				if (p != NO_PARTITION) { hits.push_back(make_pair(tri_index, p)); }
+			}
+		}
+	}
+	// a partition can hold several of the cells we touched: list it only once
+	if (hits.size() - first_hit > 1){
+		std::sort(hits.begin() + first_hit, hits.end());
+		hits.erase(std::unique(hits.begin() + first_hit, hits.end()), hits.end());
+	}
+}
+
+// Histogram pre-pass: count the triangles whose bounding box overlaps each cell
+template <typename T>
+void countCellTriangles(const TriInfo& tri_info, const vector<float> &bounds, const size_t n_cells, const size_t n_threads, vector<size_t> &counts){
+	part_io_in_timer.start(); // TIMING
+	TriVertices<T> vertex_file;
+	TriReader<T> reader(tri_info.base_filename + string(".tridata"), tri_info.n_triangles, binning_blocksize, openVertices(tri_info, vertex_file));
+	part_io_in_timer.stop(); // TIMING
+
+	vector<vector<size_t> > thread_counts(n_threads, vector<size_t>(n_cells, 0));
+	const T* block;
+	while (reader.hasNext()) {
+		part_io_in_timer.start(); // TIMING
+		long long block_size = static_cast<long long>(reader.getTriangles(block, binning_blocksize));
+		part_io_in_timer.stop(); part_algo_timer.start(); // TIMING
+#pragma omp parallel num_threads(n_threads)
+		{
+			vector<size_t> &c = thread_counts[currentThread()];
+#pragma omp for schedule(static)
+			for (long long k = 0; k < block_size; k++){
+				uivec3 lo, hi;
+				if (!triangleCells(block[k], bounds, lo, hi)) { continue; }
+				::uint64_t id_x = morton3D_64_encode_dispatch(lo[0], lo[1], lo[2]);
+				for (unsigned int x = lo[0]; x <= hi[0]; x++, id_x = m3D_inc_x(id_x)){
+					::uint64_t id_y = id_x;
+					for (unsigned int y = lo[1]; y <= hi[1]; y++, id_y = m3D_inc_y(id_y)){
+						::uint64_t id = id_y;
+						for (unsigned int z = lo[2]; z <= hi[2]; z++, id = m3D_inc_z(id)){
+							c[id]++;
+						}
+					}
+				}
+			}
+		}
+		part_algo_timer.stop(); // TIMING
+	}
+	part_algo_timer.start(); // TIMING
+	counts.assign(n_cells, 0);
+	for (size_t t = 0; t < n_threads; t++){
+		for (size_t i = 0; i < n_cells; i++){
+			counts[i] += thread_counts[t][i];
+		}
+	}
+	part_algo_timer.stop(); // TIMING
+}
+
+// Add a partition for the cells [first, last] to the plan
+inline void addPartition(PartitionPlan &plan, const size_t first, const size_t last){
+	unsigned int id = static_cast<unsigned int>(plan.starts.size());
+	plan.starts.push_back(first * plan.cell_size);
+	plan.ends.push_back((last + 1) * plan.cell_size);
+	for (size_t c = first; c <= last; c++){
+		plan.cell_partition[c] = id;
+	}
+}
+
+// Walk the cells in morton order and cut them into partitions: a partition grows until it would not fit in memory anymore
+// (max_cells) or would hold more than target triangles. So sparse regions end up in few big partitions, and dense regions in many small ones.
+// Empty cells never start or end a partition.
+void planPartitions(const vector<size_t> &counts, const size_t max_cells, const size_t target, PartitionPlan &plan){
+	plan.cell_partition.assign(counts.size(), NO_PARTITION);
+	bool open = false;
+	size_t first = 0, last = 0, tris = 0;
+	for (size_t c = 0; c < counts.size(); c++){
+		if (counts[c] == 0) { continue; }
+		if (open && (c - first + 1 > max_cells || tris + counts[c] > target)){
+			addPartition(plan, first, last);
+			open = false;
+		}
+		if (!open){
+			first = c;
+			tris = 0;
+			open = true;
+		}
+		last = c;
+		tris += counts[c];
 	}
+	if (open) { addPartition(plan, first, last); }
+}
+
+// Bin the triangles of a .tridata file into the buffers of the plan's partitions. With a vertex file, the file holds index triples,
+// and so do the partitions. With a lattice, triangles are binned where they will be once quantized.
+template <typename T>
+void binTriangles(const string &tridata, const size_t n_triangles, const PartitionPlan &plan, const vector<float> &bounds, const size_t n_threads, const TriLattice* lattice, const TriVertices<T>* vertices, vector<BBoxBuffer<T>*> &buffers){
+	const size_t n_partitions = plan.starts.size();
 
 	// Open tri_data stream
 	part_io_in_timer.start(); // TIMING
-	TriReader reader = TriReader(tri_info.base_filename + string(".tridata"), tri_info.n_triangles, input_buffersize);
+	TriReader<T> reader(tridata, n_triangles, binning_blocksize, vertices);
 	part_io_in_timer.stop(); // TIMING
 
 	part_algo_timer.start(); // TIMING
-	// Create Mortonbuffers
-	vector<BBoxBuffer*> buffers;
-	createBuffers(tri_info, n_partitions, gridsize, buffers);
+
+	// Per block of triangles: every thread bins a contiguous chunk into its own hit list, the hits are grouped by partition
+	// (keeping file order), and then every partition buffer gets its triangles from exactly one thread.
+	const T* block;
+	vector<vector<pair<unsigned int, unsigned int> > > thread_hits(n_threads);
+	vector<size_t> part_start(n_partitions + 1);
+	vector<size_t> part_fill(n_partitions);
+	vector<unsigned int> order;
+	part_algo_timer.stop(); // TIMING
 
 	while (reader.hasNext()) {
-		Triangle t;
-		part_algo_timer.stop(); part_io_in_timer.start(); // TIMING
-		reader.getTriangle(t);
+		// get a block (served from the reader without copying)
+		part_io_in_timer.start(); // TIMING
+		long long block_size = static_cast<long long>(reader.getTriangles(block, binning_blocksize));
 		part_io_in_timer.stop(); part_algo_timer.start(); // TIMING
-		AABox<vec3> bbox = computeBoundingBox(t.v0, t.v1, t.v2); // compute bounding box
-		for (int j = 0; j < n_partitions; j++){ // Test against all partitions
-			buffers[j]->processTriangle(t, bbox);
+
+		// bin it
+#pragma omp parallel num_threads(n_threads)
+		{
+			vector<pair<unsigned int, unsigned int> > &hits = thread_hits[currentThread()];
+			hits.clear();
+#pragma omp for schedule(static)
+			for (long long k = 0; k < block_size; k++){
+				binTriangle(block[k], static_cast<unsigned int>(k), bounds, plan.cell_partition, lattice, hits);
+			}
+		}
+
+		// group hits by partition (counting sort, threads handled chunks in file order)
+		std::fill(part_start.begin(), part_start.end(), 0);
+		for (size_t t = 0; t < n_threads; t++){
+			for (size_t k = 0; k < thread_hits[t].size(); k++){
+				part_start[thread_hits[t][k].second + 1]++;
+			}
 		}
+		for (size_t j = 0; j < n_partitions; j++){
+			part_start[j + 1] += part_start[j];
+			part_fill[j] = part_start[j];
+		}
+		order.resize(part_start[n_partitions]);
+		for (size_t t = 0; t < n_threads; t++){
+			for (size_t k = 0; k < thread_hits[t].size(); k++){
+				order[part_fill[thread_hits[t][k].second]++] = thread_hits[t][k].first;
+			}
+		}
+		part_algo_timer.stop(); part_io_out_timer.start(); // TIMING
+
+		// hand triangles (or their index triples) to their partition buffers, which flush to their .tripdata files
+		const IndexedTriangle<T>* block_indices = (vertices != NULL) ? reader.indices() : NULL;
+#pragma omp parallel for schedule(dynamic, 16) num_threads(n_threads)
+		for (long long j = 0; j < (long long) n_partitions; j++){
+			for (size_t k = part_start[(size_t)j]; k < part_start[(size_t)j + 1]; k++){
+				if (block_indices != NULL) { buffers[(size_t)j]->addIndexed(block_indices[order[k]]); }
+				else { buffers[(size_t)j]->addTriangle(block[order[k]]); }
+			}
+		}
+		part_io_out_timer.stop(); // TIMING
+	}
+}
+
+// Plan for the partitions [first, last) of a plan only, numbered from 0
+PartitionPlan subPlan(const PartitionPlan &plan, const size_t first, const size_t last){
+	PartitionPlan sub;
+	sub.cells_per_axis = plan.cells_per_axis;
+	sub.cell_size = plan.cell_size;
+	sub.starts.assign(plan.starts.begin() + first, plan.starts.begin() + last);
+	sub.ends.assign(plan.ends.begin() + first, plan.ends.begin() + last);
+	sub.cell_partition.assign(plan.cell_partition.size(), NO_PARTITION);
+	for (size_t c = 0; c < plan.cell_partition.size(); c++){
+		unsigned int p = plan.cell_partition[c];
+		if (p != NO_PARTITION && p >= first && p < last) { sub.cell_partition[c] = static_cast<unsigned int>(p - first); }
+	}
+	return sub;
+}
+
+// Two-level tiling, for more partitions than we can keep open at once: bin the triangles into tiles of up to
+// max_open_partitions consecutive partitions first, then split every tile into its partitions. Returns the triangle count of every partition.
+template <typename T>
+void binTiled(const TriInfo& tri_info, const PartitionPlan &plan, const size_t gridsize, const string &prefix, const vector<float> &bounds, const size_t n_threads, const TriLattice* lattice, const TriVertices<T>* vertices, MemoryPartitions<T>* memory, vector<size_t> &tricounts){
+	const size_t n_partitions = plan.starts.size();
+	const size_t n_tiles = (n_partitions + max_open_partitions - 1) / max_open_partitions;
+	cout << "  " << n_partitions << " partitions: binning into " << n_tiles << " tiles of " << max_open_partitions << " partitions first" << endl;
+
+	// a tile is a run of partitions, so a plan with one partition per tile bins into tiles
+	PartitionPlan tiles;
+	tiles.cells_per_axis = plan.cells_per_axis;
+	tiles.cell_size = plan.cell_size;
+	for (size_t t = 0; t < n_tiles; t++){
+		tiles.starts.push_back(plan.starts[t * max_open_partitions]);
+		tiles.ends.push_back(plan.ends[std::min((t + 1) * max_open_partitions, n_partitions) - 1]);
+	}
+	tiles.cell_partition.assign(plan.cell_partition.size(), NO_PARTITION);
+	for (size_t c = 0; c < plan.cell_partition.size(); c++){
+		if (plan.cell_partition[c] != NO_PARTITION) { tiles.cell_partition[c] = plan.cell_partition[c] / max_open_partitions; }
 	}
+	vector<BBoxBuffer<T>*> buffers;
+	part_algo_timer.start(); // TIMING
+	createBuffers(tri_info, tiles, gridsize, prefix + string("_tile"), 0, lattice, vertices != NULL, buffers);
 	part_algo_timer.stop(); // TIMING
+	binTriangles(tri_info.base_filename + string(".tridata"), tri_info.n_triangles, tiles, bounds, n_threads, lattice, vertices, buffers);
+	vector<size_t> tile_tricounts(n_tiles);
+	vector<string> tile_files(n_tiles);
 	part_io_out_timer.start(); // TIMING
+	for (size_t t = 0; t < n_tiles; t++){
+		tile_tricounts[t] = buffers[t]->n_triangles;
+		tile_files[t] = buffers[t]->filename;
+		delete buffers[t];
+	}
+	part_io_out_timer.stop(); // TIMING
 
-	// create TripInfo object to hold header info
-	TripInfo trip_info = TripInfo(tri_info);
+	// split every tile into its partitions
+	tricounts.assign(n_partitions, 0);
+	for (size_t t = 0; t < n_tiles; t++){
+		size_t first = t * max_open_partitions;
+		size_t last = std::min(first + max_open_partitions, n_partitions);
+		PartitionPlan sub = subPlan(plan, first, last);
+		part_algo_timer.start(); // TIMING
+		createBuffers(tri_info, sub, gridsize, prefix, first, lattice, vertices != NULL, buffers);
+		if (memory != NULL) {
+			for (size_t j = 0; j < buffers.size(); j++){ buffers[j]->keepInMemory(&memory->budget); }
+		}
+		part_algo_timer.stop(); // TIMING
+		if (tile_tricounts[t] > 0) {
+			binTriangles(tile_files[t], tile_tricounts[t], sub, bounds, n_threads, lattice, vertices, buffers);
+		}
+		part_io_out_timer.start(); // TIMING
+		for (size_t j = 0; j < buffers.size(); j++){
+			tricounts[first + j] = buffers[j]->n_triangles;
+			if (memory != NULL) { memory->in_memory[first + j] = buffers[j]->takeTriangles(memory->triangles[first + j]); }
+			delete buffers[j];
+		}
+		remove(tile_files[t].c_str());
+		part_io_out_timer.stop(); // TIMING
+	}
+}
+
+// Write the triangles of the mesh referenced by tri_info to the partitions of the plan, and store information about the partitioning in trip_info
+template <typename T>
+TripInfo partitionPlan(const TriInfo& tri_info, PartitionPlan &plan, const size_t gridsize, const size_t n_threads, const PartitionRange &range, bool compress, MemoryPartitions<T>* memory){
+	const size_t n_partitions = plan.starts.size();
+	const string prefix = tri_info.base_filename + val_to_string(gridsize) + string("_") + val_to_string(n_partitions) + range.tag();
+
+	// sub-octree build: triangles only go to the partitions in the range
+	size_t lo, hi;
+	range.resolve(n_partitions, lo, hi);
+	if (range.isSet()) {
+		cout << "  building the sub-octree of partitions [" << lo << ", " << hi << ") of " << n_partitions << endl;
+		for (size_t c = 0; c < plan.cell_partition.size(); c++){
+			if (plan.cell_partition[c] != NO_PARTITION && (plan.cell_partition[c] < lo || plan.cell_partition[c] >= hi)) { plan.cell_partition[c] = NO_PARTITION; }
+		}
+	}
 
-	// Collect ntriangles and close buffers
-	trip_info.part_tricounts.resize(n_partitions);
-	for (size_t j = 0; j < n_partitions; j++){
-		trip_info.part_tricounts[j] = buffers[j]->n_triangles;
-		delete buffers[j];
+	// compressed partitions use the lattice of a compressed input, so they hold exactly the same triangles
+	// (otherwise one over the mesh, which tri_convert moved to the origin)
+	// indexed partitions are already small, and share the vertex file of the mesh
+	TriVertices<T> vertex_file;
+	const TriVertices<T>* vertices = openVertices(tri_info, vertex_file);
+	if (compress && vertices != NULL) {
+		cout << "  the mesh is indexed: writing indexed partitions instead of compressed ones" << endl;
+		compress = false;
+	}
+	TriLattice lattice;
+	if (compress && !isCompressedTriStream(tri_info.base_filename + string(".tridata"), lattice)) {
+		lattice = triLattice(AABox<vec3>(vec3(0.0f), tri_info.mesh_bbox.max - tri_info.mesh_bbox.min));
+	}
+	// in-memory partitions hold plain triangles
+	if (memory != NULL && (compress || vertices != NULL)) {
+		cout << "  " << (compress ? "compressed" : "indexed") << " partitions go to files, not to memory" << endl;
+		memory = NULL;
+	}
+	if (memory != NULL) {
+		memory->triangles.assign(n_partitions, vector<vector<T> >());
+		memory->in_memory.assign(n_partitions, false);
 	}
 
+	vector<float> bounds;
+	computeCellBounds(tri_info, plan.cells_per_axis, gridsize, bounds);
+	vector<size_t> tricounts(n_partitions);
+	if (n_partitions > max_open_partitions) {
+		binTiled(tri_info, plan, gridsize, prefix, bounds, n_threads, compress ? &lattice : NULL, vertices, memory, tricounts);
+	}
+	else {
+		vector<BBoxBuffer<T>*> buffers;
+		part_algo_timer.start(); // TIMING
+		createBuffers(tri_info, plan, gridsize, prefix, 0, compress ? &lattice : NULL, vertices != NULL, buffers);
+		if (memory != NULL) {
+			for (size_t j = 0; j < n_partitions; j++){ buffers[j]->keepInMemory(&memory->budget); }
+		}
+		part_algo_timer.stop(); // TIMING
+		binTriangles(tri_info.base_filename + string(".tridata"), tri_info.n_triangles, plan, bounds, n_threads, compress ? &lattice : NULL, vertices, buffers);
+		part_io_out_timer.start(); // TIMING
+		for (size_t j = 0; j < n_partitions; j++){
+			tricounts[j] = buffers[j]->n_triangles;
+			if (memory != NULL) { memory->in_memory[j] = buffers[j]->takeTriangles(memory->triangles[j]); }
+			delete buffers[j];
+		}
+		part_io_out_timer.stop(); // TIMING
+	}
+	part_io_out_timer.start(); // TIMING
+	if (memory != NULL) {
+		size_t kept = 0;
+		for (size_t j = 0; j < n_partitions; j++){
+			if (memory->in_memory[j] && tricounts[j] > 0) { kept++; }
+		}
+		cout << "  kept " << kept << " partitions (" << memory->budget.inUse() / 1024 / 1024 << " Mb) in memory" << endl;
+	}
+
+	// create TripInfo object to hold header info
+	TripInfo trip_info = TripInfo(tri_info);
+	trip_info.version = 2;
+	trip_info.part_morton_start = plan.starts;
+	trip_info.part_morton_end = plan.ends;
+	trip_info.part_tricounts = tricounts;
+
 	// Write trip header
-	trip_info.base_filename = tri_info.base_filename + val_to_string(gridsize) + string("_") + val_to_string(n_partitions);
+	trip_info.base_filename = prefix;
 	std::string header = trip_info.base_filename + string(".trip");
 	trip_info.gridsize = gridsize;
 	trip_info.n_partitions = n_partitions;
@@ -146,3 +544,85 @@ TripInfo partition(const TriInfo& tri_info, const size_t n_partitions, const siz
 	part_io_out_timer.stop(); // TIMING
 	return trip_info;
 }
+
+
+// Partition the mesh referenced by tri_info into n equal partitions for gridsize, and store information about the partitioning in trip_info
+template <typename T>
+TripInfo partition(const TriInfo& tri_info, const size_t n_partitions, const size_t gridsize, const size_t n_threads, const PartitionRange &range, const bool compress, MemoryPartitions<T>* memory){
+	// Special case: just one partition, which is the .tridata itself
+	if (n_partitions == 1 && linkSinglePartition(tri_info, compress)) {
+		return partition_one(tri_info, gridsize, range);
+	}
+	// every cell is a partition
+	PartitionPlan plan;
+	plan.cells_per_axis = 1 << findPowerOf8(n_partitions); // n_partitions is always a power of 8
+	plan.cell_size = (static_cast<::uint64_t>(gridsize)*gridsize*gridsize) / n_partitions;
+	plan.cell_partition.resize(n_partitions);
+	for (size_t i = 0; i < n_partitions; i++){
+		plan.starts.push_back(i * plan.cell_size);
+		plan.ends.push_back((i + 1) * plan.cell_size);
+		plan.cell_partition[i] = static_cast<unsigned int>(i);
+	}
+	return partitionPlan(tri_info, plan, gridsize, n_threads, range, compress, memory);
+}
+
+// Partition the mesh referenced by tri_info for gridsize, adapting partition sizes to the triangle density (see planPartitions),
+// and store information about the partitioning in trip_info
+template <typename T>
+TripInfo partition_adaptive(const TriInfo& tri_info, const size_t gridsize, const size_t memory_limit, const size_t n_threads, const PartitionRange &range, const bool compress, MemoryPartitions<T>* memory){
+	cout << "Estimating best partitioning ..." << endl;
+	const ::uint64_t n_voxels = static_cast<::uint64_t>(gridsize)*gridsize*gridsize;
+	const ::uint64_t max_size = max_partition_size(gridsize, memory_limit, n_threads);
+	cout << "  to do this in-core I would need " << (n_voxels / 8) / 1024 / 1024 << " Mb of system memory" << endl;
+	// Special case: everything fits, and there's only one thread to keep busy
+	if (max_size == n_voxels && n_threads == 1){
+		cout << "  memory limit of " << memory_limit << " Mb allows that" << endl;
+		cout << "Partitioning data into 1 partition ... "; cout.flush();
+		return partition(tri_info, 1, gridsize, n_threads, range, compress, memory);
+	}
+
+	// cell size: a few levels below the biggest partition, within limits
+	PartitionPlan plan;
+	plan.cell_size = max_size;
+	for (int l = 0; l < adaptive_cell_levels && plan.cell_size / 8 >= adaptive_min_cell_size; l++){
+		plan.cell_size = plan.cell_size / 8;
+	}
+	while (n_voxels / plan.cell_size > adaptive_max_cells){
+		plan.cell_size = plan.cell_size * 8;
+	}
+	// huge grids on little memory: the histogram would need cells bigger than a partition, so use a uniform partitioning
+	if (plan.cell_size > max_size){
+		size_t n_partitions = static_cast<size_t>(n_voxels / max_size);
+		cout << "  too many partitions to adapt them to the triangle density, going to do it in " << n_partitions << " partitions of " << (max_size / 8) / 1024 / 1024 << " Mb each." << endl;
+		cout << "Partitioning data into " << n_partitions << " partitions ... "; cout.flush();
+		return partition(tri_info, n_partitions, gridsize, n_threads, range, compress, memory);
+	}
+	const size_t n_cells = static_cast<size_t>(n_voxels / plan.cell_size);
+	plan.cells_per_axis = 1 << findPowerOf8(n_cells);
+
+	// histogram pre-pass
+	vector<float> bounds;
+	computeCellBounds(tri_info, plan.cells_per_axis, gridsize, bounds);
+	vector<size_t> counts;
+	countCellTriangles<T>(tri_info, bounds, n_cells, n_threads, counts);
+	size_t total = 0;
+	for (size_t i = 0; i < n_cells; i++){
+		total += counts[i];
+	}
+	size_t n_target = adaptive_partitions_per_thread * n_threads;
+	size_t target = std::max<size_t>((total + n_target - 1) / n_target, 1);
+	planPartitions(counts, static_cast<size_t>(max_size / plan.cell_size), target, plan);
+
+	cout << "  counted triangles in " << n_cells << " cells of " << plan.cell_size << " voxels" << endl;
+	cout << "  going to do it in " << plan.starts.size() << " partitions of at most " << (max_size / 8) / 1024 / 1024 << " Mb and about " << target << " triangles each";
+	if (n_threads > 1) { cout << ", voxelizing " << n_threads << " at a time"; }
+	cout << "." << endl;
+	cout << "Partitioning data into " << plan.starts.size() << " partitions ... "; cout.flush();
+	return partitionPlan(tri_info, plan, gridsize, n_threads, range, compress, memory);
+}
+
+// Both triangle types (see tri_util.h)
+template TripInfo partition<GeometryTriangle>(const TriInfo&, const size_t, const size_t, const size_t, const PartitionRange&, const bool, MemoryPartitions<GeometryTriangle>*);
+template TripInfo partition<ColorTriangle>(const TriInfo&, const size_t, const size_t, const size_t, const PartitionRange&, const bool, MemoryPartitions<ColorTriangle>*);
+template TripInfo partition_adaptive<GeometryTriangle>(const TriInfo&, const size_t, const size_t, const size_t, const PartitionRange&, const bool, MemoryPartitions<GeometryTriangle>*);
+template TripInfo partition_adaptive<ColorTriangle>(const TriInfo&, const size_t, const size_t, const size_t, const PartitionRange&, const bool, MemoryPartitions<ColorTriangle>*);
\ No newline at end of file
@@ -5,11 +5,67 @@
 #include "../libs/libtri/include/file_tools.h"
 #include "../libs/libtri/include/TriReader.h"
 #include "../libs/libmorton/include/morton.h"
+#include "../libs/libmorton/include/morton_dispatch.h"
 #include "globals.h"
 #include "BBoxBuffer.h"
 #include "voxelizer.h"
 
+// Sub-octree builds: only the partitions in the range get their triangles (so only they get voxelized), and the temporary
+// .trip files get a tag, so several svo_builder processes can work on the same model at once. Either an explicit range of
+// partitions [first, last], or job k of n_jobs, which takes the k-th of n_jobs equal slices of the partitions.
+struct PartitionRange {
+	bool is_set, by_job;
+	size_t first, last;
+	size_t job, n_jobs;
+
+	PartitionRange() : is_set(false), by_job(false), first(0), last(0), job(0), n_jobs(1) {}
+	static PartitionRange partitions(const size_t first, const size_t last){ PartitionRange r; r.is_set = true; r.first = first; r.last = last; return r; }
+	static PartitionRange jobSlice(const size_t job, const size_t n_jobs){ PartitionRange r; r.is_set = r.by_job = true; r.job = job; r.n_jobs = n_jobs; return r; }
+
+	bool isSet() const { return is_set; }
+
+	// tag for the file names: "" for a full build
+	string tag() const{
+		if (!isSet()) { return string(""); }
+		if (by_job) { return string("_job") + val_to_string(job) + string("of") + val_to_string(n_jobs); }
+		return string("_p") + val_to_string(first) + string("-") + val_to_string(last);
+	}
+
+	// the partitions [lo, hi) this range selects out of n_partitions (can be empty)
+	void resolve(const size_t n_partitions, size_t &lo, size_t &hi) const{
+		if (!isSet()) { lo = 0; hi = n_partitions; }
+		else if (by_job) { lo = (n_partitions * job) / n_jobs; hi = (n_partitions * (job + 1)) / n_jobs; }
+		else { lo = std::min(first, n_partitions); hi = std::min(last + 1, n_partitions); }
+	}
+};
+
+// Partitions kept in memory instead of in .tripdata files (svo_builder -partition_memory), as long as they fit the budget.
+// Partitions that don't fit go to their files like before, so in_memory says where to find each one.
+template <typename T>
+struct MemoryPartitions {
+	MemoryBudget budget;
+	vector<vector<vector<T> > > triangles; // by partition id, in chunks (see BBoxBuffer::takeTriangles)
+	vector<bool> in_memory;
+
+	MemoryPartitions(const size_t budget_bytes) : budget(budget_bytes) {}
+
+	bool has(const size_t i) const{ return i < in_memory.size() && in_memory[i]; }
+
+	// Voxelized: give the memory back
+	void release(const size_t i){
+		for (size_t c = 0; c < triangles[i].size(); c++){
+			budget.give(triangles[i][c].capacity() * sizeof(T));
+		}
+		vector<vector<T> >().swap(triangles[i]);
+	}
+};
+
 // Partitioning-related stuff
-size_t estimate_partitions(const size_t gridsize, const size_t memory_limit);
+size_t estimate_partitions(const size_t gridsize, const size_t memory_limit, const size_t n_threads = 1);
+::uint64_t max_partition_size(const size_t gridsize, const size_t memory_limit, const size_t n_threads = 1);
 void removeTripFiles(const TripInfo &trip_info);
-TripInfo partition(const TriInfo& tri_info, const size_t n_partitions, const size_t gridsize);
\ No newline at end of file
+// T is the triangle type of the mesh (see tri_util.h)
+template <typename T>
+TripInfo partition(const TriInfo& tri_info, const size_t n_partitions, const size_t gridsize, const size_t n_threads = 1, const PartitionRange &range = PartitionRange(), const bool compress = false, MemoryPartitions<T>* memory = NULL);
+template <typename T>
+TripInfo partition_adaptive(const TriInfo& tri_info, const size_t gridsize, const size_t memory_limit, const size_t n_threads = 1, const PartitionRange &range = PartitionRange(), const bool compress = false, MemoryPartitions<T>* memory = NULL);
\ No newline at end of file
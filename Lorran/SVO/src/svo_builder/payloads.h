@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../libs/libtri/include/tri_util.h"
+#include "VoxelData.h"
+#include "svo_builder_util.h"
+
+using namespace std;
+
+// Payload policies: what a voxel carries. The voxelizer and the main loop are templated on one of these, so every policy
+// compiles to code that only handles its own payload, and one svo_builder picks the policy from the .tri header at runtime.
+//   Tri: the triangle records of the model (see tri_util.h)
+//   Voxel: what the voxelizer stores for every filled voxel
+//   voxel(): the Voxel for a voxel of a triangle
+
+// Geometry only: a voxel is just its morton code (the octree stores a fixed payload for every leaf, see OctreeBuilder)
+struct GeometryPayload {
+	typedef GeometryTriangle Tri;
+	typedef ::uint64_t Voxel;
+	static const bool geometry_only = true;
+	static const bool packed = false;
+
+	static Voxel voxel(const ::uint64_t morton, const Tri &) { return morton; }
+};
+
+// Color and normal of the triangle, as floats
+struct ColorPayload {
+	typedef ColorTriangle Tri;
+	typedef VoxelData Voxel;
+	static const bool geometry_only = false;
+	static const bool packed = false;
+
+	static Voxel voxel(const ::uint64_t morton, const Tri &t) { return VoxelData(morton, t.normal, average3Vec(t.v0_color, t.v1_color, t.v2_color)); }
+};
+
+// Color and normal of the triangle, packed (svo_builder -packed, see PackedVoxelData)
+struct PackedColorPayload {
+	typedef ColorTriangle Tri;
+	typedef PackedVoxelData Voxel;
+	static const bool geometry_only = false;
+	static const bool packed = true;
+
+	static Voxel voxel(const ::uint64_t morton, const Tri &t) { return PackedVoxelData(morton, t.normal, average3Vec(t.v0_color, t.v1_color, t.v2_color)); }
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "svo_builder_util.h"
+#include "VoxelData.h"
+
+using namespace std;
+
+// Widest digit we sort on per pass (2^11 buckets: the histograms stay in L1)
+#define RADIX_MAX_DIGIT_BITS 11
+// Below this many items, std::sort is faster
+#define RADIX_MIN_ITEMS 2048
+// Below this many items, we don't bother spreading a pass over threads
+#define RADIX_PARALLEL_MIN_ITEMS (256*1024)
+
+// A key and the position of its record, what we sort when records are bigger than their key
+struct RadixKeyIndex {
+	::uint64_t key;
+	size_t index;
+};
+
+// Sort keys: the morton code
+inline ::uint64_t radixKey(const ::uint64_t &m){ return m; }
+inline ::uint64_t radixKey(const VoxelData &v){ return v.morton; }
+inline ::uint64_t radixKey(const PackedVoxelData &v){ return v.morton; }
+inline ::uint64_t radixKey(const RadixKeyIndex &k){ return k.key; }
+
+// LSD radix sort for arrays keyed on morton codes in a known range [key_min, key_max].
+// Only the bits in which keys in that range can differ are sorted on, so a partition of 2^21 voxels takes 2 passes instead of 8.
+// Passes are spread over OpenMP threads (when not already inside an active parallel region).
+// Records bigger than their key are sorted as (key, index) pairs and moved into place once at the end.
+// Keep one sorter around and reuse it: the scratch buffers and histograms are only reallocated when they need to grow.
+template <typename T>
+class RadixSorter {
+public:
+	void sort(vector<T> &data, const ::uint64_t key_min, const ::uint64_t key_max);
+
+private:
+	template <typename R>
+	R* radixPasses(R* src, R* dst, const size_t n, const ::uint64_t key_min, const ::uint64_t key_max);
+
+	vector<T> scratch;
+	vector<RadixKeyIndex> pairs, pairs_scratch;
+	vector<size_t> histograms; // one row of buckets per thread
+};
+
+template <typename T>
+inline void RadixSorter<T>::sort(vector<T> &data, const ::uint64_t key_min, const ::uint64_t key_max){
+	const size_t n = data.size();
+	if (n < RADIX_MIN_ITEMS) {
+		std::sort(data.begin(), data.end());
+		return;
+	}
+	scratch.resize(n);
+	if (sizeof(T) <= sizeof(::uint64_t)) { // sort the records themselves
+		if (radixPasses(data.data(), scratch.data(), n, key_min, key_max) != data.data()) {
+			data.swap(scratch); // odd number of passes: result is in the scratch buffer
+		}
+		return;
+	}
+	pairs.resize(n);
+	pairs_scratch.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		pairs[i].key = radixKey(data[i]);
+		pairs[i].index = i;
+	}
+	RadixKeyIndex* sorted = radixPasses(pairs.data(), pairs_scratch.data(), n, key_min, key_max);
+	for (size_t i = 0; i < n; i++) {
+		scratch[i] = data[sorted[i].index];
+	}
+	data.swap(scratch);
+}
+
+// Do all radix passes, ping-ponging between src and dst. Returns the buffer holding the result.
+template <typename T>
+template <typename R>
+inline R* RadixSorter<T>::radixPasses(R* src, R* dst, const size_t n, const ::uint64_t key_min, const ::uint64_t key_max){
+	// how many bits do we need to sort on, and how do we split them over passes
+	::uint64_t range = key_max - key_min;
+	int bits = 0;
+	while (bits < 64 && (range >> bits) != 0) { bits++; }
+	if (bits == 0) { return src; } // all keys are equal
+	const int passes = (bits + RADIX_MAX_DIGIT_BITS - 1) / RADIX_MAX_DIGIT_BITS;
+	const int digit_bits = (bits + passes - 1) / passes;
+	const size_t buckets = size_t(1) << digit_bits;
+	const ::uint64_t mask = buckets - 1;
+
+	int max_threads = 1;
+#ifdef _OPENMP
+	if (n >= RADIX_PARALLEL_MIN_ITEMS) { max_threads = omp_get_max_threads(); }
+#endif
+	histograms.resize(max_threads * buckets);
+
+	for (int pass = 0; pass < passes; pass++) {
+		const int shift = pass * digit_bits;
+		int n_threads = 1;
+#pragma omp parallel num_threads(max_threads)
+		{
+#ifdef _OPENMP
+#pragma omp single
+			n_threads = omp_get_num_threads(); // we might get less than we asked for
+#endif
+			const int t = currentThread();
+			const size_t begin = (n * t) / n_threads;
+			const size_t end = (n * (t + 1)) / n_threads;
+			size_t* h = &histograms[t * buckets];
+
+			// count digits in our chunk
+			std::fill(h, h + buckets, 0);
+			for (size_t i = begin; i < end; i++) {
+				h[((radixKey(src[i]) - key_min) >> shift) & mask]++;
+			}
+#pragma omp barrier
+			// exclusive prefix sum over (bucket, thread), so the sort stays stable
+#pragma omp single
+			{
+				size_t offset = 0;
+				for (size_t b = 0; b < buckets; b++) {
+					for (int k = 0; k < n_threads; k++) {
+						size_t count = histograms[k * buckets + b];
+						histograms[k * buckets + b] = offset;
+						offset += count;
+					}
+				}
+			}
+			// scatter our chunk
+			for (size_t i = begin; i < end; i++) {
+				dst[h[((radixKey(src[i]) - key_min) >> shift) & mask]++] = src[i];
+			}
+		}
+		std::swap(src, dst);
+	}
+	return src;
+}
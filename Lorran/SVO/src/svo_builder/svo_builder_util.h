@@ -5,6 +5,10 @@
 #include <sstream>
 #include "timer.h"
 #include "../libs/libmorton/include/morton.h"
+#include "../libs/libmorton/include/morton_dispatch.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace glm;
 using namespace std;
@@ -14,10 +18,21 @@ using namespace std;
 // helper method to convert morton number to RGB color, for debug coloring purposes
 inline vec3 mortonToRGB(const ::uint64_t morton_number, const size_t gridsize){
 	unsigned int x,y,z;
-	m3D_d_sLUT(morton_number,z,y,x);
+	morton3D_64_decode_dispatch(morton_number,z,y,x);
 	return vec3((float)x/gridsize, (float)y/gridsize, (float)z/gridsize);
 }
 
+// index of the lowest set bit of a nonzero word
+inline unsigned int lowestSetBit(const ::uint64_t x){
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
 inline vec3 average3Vec(const vec3 v0, const vec3 v1, const vec3 v2){
 	vec3 answer;
 	for (unsigned int i = 0; i < 3; i++){
@@ -48,6 +63,15 @@ inline int isPowerOf2(unsigned int x){
   return ((x != 0) && !(x & (x - 1)));
 }
 
+// index of the calling thread inside an OpenMP parallel region (0 when built without OpenMP)
+inline int currentThread(){
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
 template <typename T> T clampval(const T& value, const T& low, const T& high) {
   return value < low ? low : (value > high ? high : value); 
 }
@@ -0,0 +1,366 @@
+// SVO merge: stitches sub-octrees (svo_builder -partitions / -job) into one octree.
+// Sub-octrees span the full grid, but hold the voxels of disjoint morton ranges. Wherever only one of them has a node,
+// its whole subtree is copied with rebased child and data pointers. Only the top levels, where several of them have
+// a node, are built anew.
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <glm/glm.hpp>
+#include "octree_io.h"
+#include "timer.h"
+#include "../libs/libsvo/include/mapped_file.h"
+
+using namespace std;
+using namespace glm;
+
+// Program version
+string version = "1.6 alpha";
+
+// Program parameters
+string output_base = "";
+vector<string> inputs;
+bool verbose = false;
+
+// A sub-octree: its header, its nodes and payloads (memory mapped), and where its payloads go in the output
+struct SubOctree {
+	OctreeInfo info;
+	MappedFile nodes;
+	MappedFile data;
+	size_t data_base; // output index of its payload 1 (payload 0 is the shared NULL payload)
+
+	Node node(const size_t i) const{
+		Node n;
+		memcpy(&n.data, nodes.data() + i * 3 * sizeof(size_t), 3 * sizeof(size_t));
+		return n;
+	}
+
+	// size of a payload record: packed or not (svo_builder -packed)
+	size_t recordSize() const{
+		return info.packed_data ? PACKED_VOXELDATA_SIZE : VOXELDATA_SIZE;
+	}
+
+	// read payload i into the caches of a node
+	void voxel(const size_t i, Node &n) const{
+		if (info.packed_data) {
+			PackedVoxelData packed;
+			memcpy(packed.diskData(), data.data() + i * PACKED_VOXELDATA_SIZE, PACKED_VOXELDATA_SIZE);
+			n.data_cache = packed.unpack();
+		}
+		else {
+			memcpy(n.data_cache.diskData(), data.data() + i * VOXELDATA_SIZE, VOXELDATA_SIZE);
+		}
+	}
+
+	size_t rebaseData(const size_t d) const{
+		if (d == NODATA) { return NODATA; }
+		if (info.geometry_only && d == 1) { return 1; } // the white voxel all leaves share
+		return data_base + d - 1;
+	}
+};
+
+// A node in one of the sub-octrees
+struct Source {
+	size_t tree;
+	size_t node;
+};
+
+class OctreeMerger {
+public:
+	size_t n_nodes;
+	size_t n_data;
+	size_t conflicts; // voxels that were in more than one sub-octree (the first one wins)
+
+	OctreeMerger(vector<SubOctree> &trees, AsyncWriter &node_out, AsyncWriter &data_out, bool levels, bool packed, bool geometry_only) :
+		n_nodes(0), n_data(0), conflicts(0), trees(trees), node_out(node_out), data_out(data_out), levels(levels), packed(packed), geometry_only(geometry_only) {}
+
+	void copyData();
+	Node merge(const vector<Source> &sources);
+	void writeRoot(const Node &root);
+
+private:
+	vector<SubOctree> &trees;
+	AsyncWriter &node_out;
+	AsyncWriter &data_out;
+	bool levels;
+	bool packed; // all sub-octrees have packed payloads
+	bool geometry_only; // all sub-octrees are geometry only
+
+	Node copy(const SubOctree &t, const size_t index);
+	void writeChildren(Node &parent, const Node children[8]);
+};
+
+// All payloads go to the output in sub-octree order, behind one NULL payload: a node's payload index only needs an offset.
+// Geometry only sub-octrees share their white voxel (payload 1), so it's written once, like a single build does.
+void OctreeMerger::copyData(){
+	if (packed) { writeVoxelData(data_out, PackedVoxelData(), n_data); }
+	else { writeVoxelData(data_out, VoxelData(), n_data); }
+	size_t shared = 0; // payloads at the start of every sub-octree that only go to the output once
+	if (geometry_only && trees[0].info.n_data > 1) {
+		data_out.write(trees[0].data.data() + trees[0].recordSize(), trees[0].recordSize());
+		n_data++;
+		shared = 1;
+	}
+	for (size_t k = 0; k < trees.size(); k++){
+		trees[k].data_base = n_data - shared;
+		size_t records = trees[k].info.n_data;
+		size_t record_size = trees[k].recordSize();
+		if (records > 1 + shared) {
+			data_out.write(trees[k].data.data() + (1 + shared) * record_size, (records - 1 - shared) * record_size);
+			n_data += records - 1 - shared;
+		}
+	}
+}
+
+// Write the existing children of a node next to each other (like OctreeBuilder::groupNodes), and point the parent at them
+void OctreeMerger::writeChildren(Node &parent, const Node children[8]){
+	bool first_stored_child = true;
+	for (int k = 0; k < 8; k++){
+		if (children[k].isNull()) {
+			parent.children_offset[k] = NOCHILD;
+			continue;
+		}
+		size_t pos = writeNode(node_out, children[k], n_nodes);
+		if (first_stored_child){
+			parent.children_base = pos;
+			parent.children_offset[k] = 0;
+			first_stored_child = false;
+		}
+		else {
+			parent.children_offset[k] = (char)(pos - parent.children_base);
+		}
+	}
+}
+
+// Copy the subtree below a node of one sub-octree, returns the node itself (not written yet: its parent writes it with its siblings)
+Node OctreeMerger::copy(const SubOctree &t, const size_t index){
+	Node in = t.node(index);
+	Node out = Node();
+	out.data = t.rebaseData(in.data);
+	if (levels && in.hasData()) { t.voxel(in.data, out); }
+	if (in.isLeaf()) { return out; }
+	Node children[8];
+	for (int k = 0; k < 8; k++){
+		if (in.hasChild(k)) { children[k] = copy(t, in.getChildPos(k)); }
+	}
+	writeChildren(out, children);
+	return out;
+}
+
+// Merge the nodes of several sub-octrees at the same position, returns the merged node (not written yet)
+Node OctreeMerger::merge(const vector<Source> &sources){
+	if (sources.size() == 1) {
+		return copy(trees[sources[0].tree], sources[0].node);
+	}
+	// a voxel in several sub-octrees: their morton ranges overlapped
+	bool all_leaves = true;
+	for (size_t s = 0; s < sources.size() && all_leaves; s++){
+		all_leaves = trees[sources[s].tree].node(sources[s].node).isLeaf();
+	}
+	if (all_leaves) {
+		conflicts++;
+		return copy(trees[sources[0].tree], sources[0].node);
+	}
+
+	Node out = Node();
+	Node children[8];
+	vector<Source> child_sources;
+	for (int k = 0; k < 8; k++){
+		child_sources.clear();
+		for (size_t s = 0; s < sources.size(); s++){
+			Node n = trees[sources[s].tree].node(sources[s].node);
+			if (n.hasChild(k)) {
+				Source c = { sources[s].tree, n.getChildPos(k) };
+				child_sources.push_back(c);
+			}
+		}
+		if (!child_sources.empty()) { children[k] = merge(child_sources); }
+	}
+	writeChildren(out, children);
+
+	// SIMPLE LEVEL CONSTRUCTION: average the children, like OctreeBuilder does
+	if (levels) {
+		vec3 color = vec3();
+		vec3 normal = vec3();
+		float notnull = 0.0f;
+		for (int k = 0; k < 8; k++){
+			if (!children[k].isNull()) {
+				notnull++;
+				color += children[k].data_cache.getColor();
+				normal += children[k].data_cache.getNormal();
+			}
+		}
+		VoxelData d = VoxelData();
+		if (notnull > 0.0f) {
+			d.setColor(color / notnull);
+			d.setNormal(length(normal) > 0.0f ? normalize(normal) : vec3());
+		}
+		if (packed) { // quantized, like OctreeBuilder does
+			PackedVoxelData packed = (notnull > 0.0f) ? PackedVoxelData(d) : PackedVoxelData();
+			out.data = writeVoxelData(data_out, packed, n_data);
+			out.data_cache = packed.unpack();
+		}
+		else {
+			out.data = writeVoxelData(data_out, d, n_data);
+			out.data_cache = d;
+		}
+	}
+	return out;
+}
+
+// The root goes last, like in svo_builder output
+void OctreeMerger::writeRoot(const Node &root){
+	writeNode(node_out, root, n_nodes);
+}
+
+void printInfo(){
+	cout << "-------------------------------------------------------------" << endl;
+	cout << "SVO Merge " << version << endl;
+	cout << "-------------------------------------------------------------" << endl << endl;
+}
+
+void printHelp(){
+	std::cout << "Example: svo_merge -o bunny1024 bunny1024_8_job0of2.octree bunny1024_8_job1of2.octree" << endl;
+	std::cout << "" << endl;
+	std::cout << "All available program options:" << endl;
+	std::cout << "" << endl;
+	std::cout << "-o <basename>         Output octree: <basename>.octree, .octreenodes and .octreedata" << endl;
+	std::cout << "<sub-octree.octree>   Sub-octrees to stitch together (classic node format, same grid size)" << endl;
+	std::cout << "-v                    Be very verbose." << endl;
+	std::cout << "-h                    Print help and exit." << endl;
+}
+
+void printInvalid(){
+	std::cout << "Not enough or invalid arguments, please try again.\n" << endl;
+	printHelp();
+}
+
+void parseProgramParameters(int argc, char* argv[]){
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "-o" && i + 1 < argc) {
+			output_base = argv[i + 1];
+			i++;
+		} else if (string(argv[i]) == "-v") {
+			verbose = true;
+		} else if (string(argv[i]) == "-h") {
+			printHelp(); exit(0);
+		} else if (argv[i][0] != '-') {
+			inputs.push_back(argv[i]);
+		} else {
+			printInvalid(); exit(0);
+		}
+	}
+	if (output_base.empty() || inputs.empty()) {
+		printInvalid(); exit(0);
+	}
+}
+
+// The sub-octrees must tile the grid: sorted by their morton ranges, every one starts where the one before ended.
+// Slices of builds that partitioned differently (other -s, -l, -t or -uniform) leave voxels out or hold them twice.
+bool checkMortonRanges(const vector<SubOctree> &trees){
+	const ::uint64_t n_voxels = static_cast<::uint64_t>(trees[0].info.gridlength) * trees[0].info.gridlength * trees[0].info.gridlength;
+	vector<pair<pair<::uint64_t, ::uint64_t>, size_t> > ranges; // (start, end), input
+	for (size_t k = 0; k < trees.size(); k++){
+		const OctreeInfo &i = trees[k].info;
+		if (i.n_partitions == 0) { cout << "  " << inputs[k] << " has no morton range in its header: taking it as a full octree" << endl; }
+		ranges.push_back(make_pair(i.n_partitions > 0 ? make_pair(i.morton_start, i.morton_end) : make_pair(static_cast<::uint64_t>(0), n_voxels), k));
+	}
+	std::sort(ranges.begin(), ranges.end());
+	bool ok = true;
+	::uint64_t covered = 0; // [0, covered) is in a sub-octree
+	for (size_t r = 0; r < ranges.size(); r++){
+		::uint64_t start = ranges[r].first.first, end = ranges[r].first.second;
+		if (start > covered) {
+			cout << "Error: no sub-octree holds morton range [" << covered << ", " << start << ")" << endl;
+			ok = false;
+		}
+		else if (start < covered && end > start) {
+			cout << "Error: morton range [" << start << ", " << std::min(end, covered) << ") of " << inputs[ranges[r].second] << " is in another sub-octree too" << endl;
+			ok = false;
+		}
+		covered = std::max(covered, end);
+	}
+	if (covered < n_voxels) {
+		cout << "Error: no sub-octree holds morton range [" << covered << ", " << n_voxels << ")" << endl;
+		ok = false;
+	}
+	if (!ok) { cout << "The sub-octrees don't fit together: build all jobs with the same -s, -l, -t and -uniform." << endl; }
+	return ok;
+}
+
+int main(int argc, char *argv[]){
+	printInfo();
+	parseProgramParameters(argc, argv);
+	Timer timer;
+	timer.start();
+
+	// open the sub-octrees
+	vector<SubOctree> trees(inputs.size());
+	bool levels = false;
+	for (size_t k = 0; k < inputs.size(); k++){
+		SubOctree &t = trees[k];
+		if (parseOctreeHeader(inputs[k], t.info) != 1 || !t.info.filesExist()) {
+			cout << "Could not read sub-octree " << inputs[k] << endl;
+			exit(1);
+		}
+		if (verbose) { t.info.print(); }
+		if (t.info.version != OCTREE_FORMAT_CLASSIC || t.info.brick_size > 0) {
+			cout << "Error: " << inputs[k] << " is not in the classic node format (without bricks), svo_merge can't stitch it." << endl;
+			exit(1);
+		}
+		if (t.info.gridlength != trees[0].info.gridlength) {
+			cout << "Error: " << inputs[k] << " has grid length " << t.info.gridlength << " instead of " << trees[0].info.gridlength << endl;
+			exit(1);
+		}
+		if (t.info.packed_data != trees[0].info.packed_data) {
+			cout << "Error: the payloads of " << inputs[k] << " are " << (t.info.packed_data ? "packed" : "not packed") << ", unlike those of " << inputs[0] << endl;
+			exit(1);
+		}
+		if (t.info.geometry_only != trees[0].info.geometry_only) {
+			cout << "Error: " << inputs[k] << (t.info.geometry_only ? " is" : " is not") << " geometry only, unlike " << inputs[0] << endl;
+			exit(1);
+		}
+		if (!t.nodes.open(t.info.base_filename + string(".octreenodes")) || !t.data.open(t.info.base_filename + string(".octreedata"))
+			|| t.nodes.size() < t.info.n_nodes * 3 * sizeof(size_t) || t.data.size() < t.info.n_data * t.recordSize() || t.info.n_nodes == 0) {
+			cout << "Error: the files of " << inputs[k] << " are missing or smaller than their header says" << endl;
+			exit(1);
+		}
+		// -levels: internal nodes have payloads, so the root has one unless the sub-octree is empty
+		Node root = t.node(t.info.n_nodes - 1);
+		levels = levels || (!root.isLeaf() && root.hasData());
+	}
+	if (!checkMortonRanges(trees)) { exit(1); }
+
+	// stitch them together: the root is the last node of every sub-octree
+	AsyncWriter node_out(output_base + string(".octreenodes"));
+	AsyncWriter data_out(output_base + string(".octreedata"));
+	const bool packed = trees[0].info.packed_data;
+	const bool geometry_only = trees[0].info.geometry_only;
+	OctreeMerger merger(trees, node_out, data_out, levels, packed, geometry_only);
+	cout << "Copying payloads of " << trees.size() << " sub-octrees ... "; cout.flush();
+	merger.copyData();
+	cout << "done." << endl;
+	cout << "Stitching nodes ... "; cout.flush();
+	vector<Source> roots;
+	for (size_t k = 0; k < trees.size(); k++){
+		Source r = { k, trees[k].info.n_nodes - 1 };
+		if (!trees[k].node(r.node).isNull()) { roots.push_back(r); }
+	}
+	merger.writeRoot(roots.empty() ? Node() : merger.merge(roots));
+	node_out.close();
+	data_out.close();
+	cout << "done." << endl;
+	if (merger.conflicts > 0) {
+		cout << "Warning: " << merger.conflicts << " voxels were in more than one sub-octree, kept the first one." << endl;
+	}
+
+	OctreeInfo info(OCTREE_FORMAT_CLASSIC, output_base, trees[0].info.gridlength, merger.n_nodes, merger.n_data, false, packed);
+	info.geometry_only = geometry_only;
+	writeOctreeHeader(output_base + string(".octree"), info);
+	if (verbose) { info.print(); }
+	timer.stop();
+	cout << "Merged " << trees.size() << " sub-octrees into " << output_base << ".octree (" << merger.n_nodes << " nodes, " << merger.n_data << " payloads) in "
+		<< timer.elapsed_time_milliseconds << " ms." << endl;
+	return 0;
+}
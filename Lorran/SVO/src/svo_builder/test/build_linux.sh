@@ -0,0 +1,6 @@
+g++ -O3 -m64 -std=c++11 -fopenmp radix_sort_test.cpp -o radix_sort_test
+g++ -O3 -m64 -std=c++11 voxelizer_kernels_test.cpp ../voxelizer_kernels.cpp -o voxelizer_kernels_test
+g++ -O3 -m64 -std=c++11 -fopenmp -pthread svo_reader_test.cpp ../OctreeBuilder.cpp -o svo_reader_test
+g++ -O3 -m64 -std=c++11 -fopenmp tri_compress_test.cpp -o tri_compress_test
+g++ -O3 -m64 -std=c++11 -fopenmp tri_indexed_test.cpp -o tri_indexed_test
+g++ -O3 -m64 -std=c++11 -fopenmp -pthread checkpoint_test.cpp ../OctreeBuilder.cpp -o checkpoint_test
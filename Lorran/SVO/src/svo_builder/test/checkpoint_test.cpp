@@ -0,0 +1,117 @@
+// Checkpoint tests
+// Builds octrees with OctreeBuilder in one go, and again with a crash: a checkpoint halfway, some more voxels that get lost,
+// and a new builder that resumes from the checkpoint. Both must give exactly the same files, for every node format and payload.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include "../OctreeBuilder.h"
+#include "test_fixtures.h"
+
+using namespace std;
+
+// OctreeBuilder needs the svo_builder globals
+bool verbose = false;
+Timer main_timer, part_total_timer, part_io_in_timer, part_io_out_timer, part_algo_timer;
+Timer vox_total_timer, vox_io_in_timer, vox_algo_timer, svo_total_timer, svo_io_out_timer, svo_algo_timer;
+
+struct Config {
+	string name;
+	bool levels;
+	int node_format;
+	int brick_size;
+	bool geometry_only;
+	bool packed;
+};
+
+void addVoxels(OctreeBuilder &builder, const Config &c, const vector<VoxelData> &voxels, size_t from, size_t to){
+	for (size_t i = from; i < to; i++) {
+		if (c.geometry_only) { builder.addVoxel(voxels[i].morton); }
+		else if (c.packed) { builder.addVoxel(PackedVoxelData(voxels[i])); }
+		else { builder.addVoxel(voxels[i]); }
+	}
+}
+
+OctreeBuilder* newBuilder(const string &base, size_t gridsize, const Config &c, FILE* checkpoint = NULL){
+	return new OctreeBuilder(base, gridsize, c.levels, c.node_format, c.brick_size, c.geometry_only, c.packed, checkpoint);
+}
+
+string readFile(const string &filename){
+	ifstream f(filename.c_str(), ios::in | ios::binary);
+	return string(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+}
+
+bool testResume(const Config &c, size_t gridsize, const vector<VoxelData> &voxels, double checkpoint_at){
+	const string whole = "checkpoint_test_whole", resumed = "checkpoint_test_resumed";
+	const string checkpoint_name = resumed + string(".svocheckpoint");
+
+	// in one go
+	OctreeBuilder* builder = newBuilder(whole, gridsize, c);
+	addVoxels(*builder, c, voxels, 0, voxels.size());
+	builder->finalizeTree();
+	delete builder;
+
+	// crash: a checkpoint, more voxels that make it to disk, and the builder is never finalized
+	size_t at = static_cast<size_t>(voxels.size() * checkpoint_at);
+	size_t lost = std::min(voxels.size(), at + voxels.size() / 5);
+	builder = newBuilder(resumed, gridsize, c);
+	addVoxels(*builder, c, voxels, 0, at);
+	FILE* f = fopen(checkpoint_name.c_str(), "wb");
+	bool ok = builder->writeCheckpoint(f);
+	fclose(f);
+	addVoxels(*builder, c, voxels, at, lost);
+	FILE* scratch = fopen("checkpoint_test_scratch", "wb");
+	builder->writeCheckpoint(scratch); // syncs the files
+	fclose(scratch);
+	// (the crashed builder is left as it is: its writers still hold the files)
+
+	// resume
+	f = fopen(checkpoint_name.c_str(), "rb");
+	OctreeBuilder* resumed_builder = newBuilder(resumed, gridsize, c, f);
+	fclose(f);
+	addVoxels(*resumed_builder, c, voxels, at, voxels.size());
+	resumed_builder->finalizeTree();
+	delete resumed_builder;
+
+	const char* files[6] = { ".octree", ".octreenodes", ".octreedata", ".octreelevels", ".octreebricks", ".octreebricknormals" };
+	size_t bytes = 0;
+	for (int i = 0; i < 6; i++) {
+		string a = readFile(whole + files[i]);
+		if (a != readFile(resumed + files[i])) {
+			cout << "  ERROR: " << files[i] << " differs after resuming" << endl;
+			ok = false;
+		}
+		bytes += a.size();
+		remove((whole + files[i]).c_str());
+		remove((resumed + files[i]).c_str());
+	}
+	remove(checkpoint_name.c_str());
+	remove("checkpoint_test_scratch");
+	cout << "  " << c.name << ", checkpoint at " << at << " of " << voxels.size() << " voxels: " << bytes << " bytes " << (ok ? "identical" : "FAILED") << endl;
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	cout << "Checkpoint test" << endl;
+	const size_t gridsize = 64;
+	vector<VoxelData> voxels = shellVoxels<VoxelData>(gridsize, false);
+	const Config configs[] = {
+		{ "classic", false, OCTREE_FORMAT_CLASSIC, 0, false, false },
+		{ "classic levels", true, OCTREE_FORMAT_CLASSIC, 0, false, false },
+		{ "classic levels packed", true, OCTREE_FORMAT_CLASSIC, 0, false, true },
+		{ "compact levels", true, OCTREE_FORMAT_COMPACT, 0, false, false },
+		{ "geometry only", true, OCTREE_FORMAT_CLASSIC, 0, true, false },
+		{ "dag", false, OCTREE_FORMAT_DAG, 0, true, false },
+		{ "bricks 4 levels", true, OCTREE_FORMAT_CLASSIC, 4, false, false },
+	};
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+		ok = testResume(configs[i], gridsize, voxels, 0.0) && ok;
+		ok = testResume(configs[i], gridsize, voxels, 0.37) && ok;
+		ok = testResume(configs[i], gridsize, voxels, 1.0) && ok;
+	}
+	cout << (ok ? "All tests passed." : "Some tests FAILED.") << endl;
+	return ok ? 0 : 1;
+}
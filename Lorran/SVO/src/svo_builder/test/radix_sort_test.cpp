@@ -0,0 +1,94 @@
+// RadixSorter tests
+// Checks RadixSorter against std::sort and benchmarks both on partition-like morton arrays
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include "../radix_sort.h"
+#include "../timer.h"
+
+using namespace std;
+
+// Configuration
+unsigned int times = 5;
+
+// Generate n unique morton codes in the partition [start, start + part_size), in random order
+void generateKeys(vector< ::uint64_t> &keys, size_t n, ::uint64_t start, ::uint64_t part_size, std::mt19937_64 &rng){
+	keys.clear();
+	for (::uint64_t i = 0; i < part_size && keys.size() < n; i += part_size / n) {
+		keys.push_back(start + i);
+	}
+	std::shuffle(keys.begin(), keys.end(), rng);
+}
+
+template <typename T>
+bool sameOrder(const vector<T> &a, const vector<T> &b){
+	for (size_t i = 0; i < a.size(); i++) {
+		if (radixKey(a[i]) != radixKey(b[i])) { return false; }
+	}
+	return a.size() == b.size();
+}
+
+// Sort copies of input with std::sort and RadixSorter, check results, print timings
+template <typename T>
+bool benchmark(const string &name, const vector<T> &input, ::uint64_t start, ::uint64_t end, RadixSorter<T> &sorter){
+	vector<T> a, b;
+	Timer std_timer, radix_timer;
+	bool ok = true;
+	for (unsigned int i = 0; i < times; i++) {
+		a = input; b = input;
+		std_timer.start();
+		std::sort(a.begin(), a.end());
+		std_timer.stop();
+		radix_timer.start();
+		sorter.sort(b, start, end - 1);
+		radix_timer.stop();
+		ok = ok && sameOrder(a, b);
+	}
+	cout << "  " << name << " (" << input.size() << " items): std::sort " << std_timer.elapsed_time_milliseconds / times << " ms, "
+		<< "RadixSorter " << radix_timer.elapsed_time_milliseconds / times << " ms" << (ok ? "" : "  ERROR: results differ") << endl;
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	cout << "RadixSorter test" << endl;
+#ifdef _OPENMP
+	cout << "  using up to " << omp_get_max_threads() << " threads" << endl;
+#endif
+	std::mt19937_64 rng(42);
+	RadixSorter< ::uint64_t> key_sorter; // reused over all runs, like svo_builder does per thread
+	RadixSorter<VoxelData> data_sorter;
+	bool ok = true;
+
+	// partitions of 128^3, 256^3 and 512^3 voxels, at a few fill rates
+	::uint64_t part_sizes[3] = { 128ull * 128 * 128, 256ull * 256 * 256, 512ull * 512 * 512 };
+	double fill_rates[3] = { 0.001, 0.01, 0.05 };
+	vector< ::uint64_t> keys;
+	vector<VoxelData> data;
+	for (int p = 0; p < 3; p++) {
+		::uint64_t start = part_sizes[p] * 3; // some partition in the middle of the grid
+		::uint64_t end = start + part_sizes[p];
+		for (int f = 0; f < 3; f++) {
+			size_t n = static_cast<size_t>(part_sizes[p] * fill_rates[f]);
+			cout << "Partition of " << part_sizes[p] << " voxels, " << fill_rates[f] * 100 << "% filled:" << endl;
+			generateKeys(keys, n, start, part_sizes[p], rng);
+			ok = benchmark("morton codes", keys, start, end, key_sorter) && ok;
+			data.clear();
+			for (size_t i = 0; i < keys.size(); i++) {
+				data.push_back(VoxelData(keys[i], vec3(0.0f, 1.0f, 0.0f), vec3(1.0f, 1.0f, 1.0f)));
+			}
+			ok = benchmark("voxel data", data, start, end, data_sorter) && ok;
+		}
+	}
+
+	// edge cases
+	keys.assign(10, 7);
+	ok = benchmark("equal keys", keys, 7, 8, key_sorter) && ok;
+	keys.clear();
+	for (size_t i = 0; i < 100000; i++) { keys.push_back(rng()); }
+	ok = benchmark("full 64-bit keys", keys, 0, 0xFFFFFFFFFFFFFFFFull, key_sorter) && ok;
+
+	cout << (ok ? "All tests passed." : "Some tests FAILED.") << endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,240 @@
+// SVO reader tests
+// Builds octrees with OctreeBuilder (every node format, DAG and bricks included), checks the libsvo reader against the voxels that went in,
+// and benchmarks the ray caster (rays/s)
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <string>
+#include <stdlib.h>
+#include "../OctreeBuilder.h"
+#include "../../libs/libsvo/include/svo_raycast.h"
+#include "test_fixtures.h"
+
+using namespace std;
+
+// OctreeBuilder needs the svo_builder globals
+bool verbose = false;
+Timer main_timer, part_total_timer, part_io_in_timer, part_io_out_timer, part_algo_timer;
+Timer vox_total_timer, vox_io_in_timer, vox_algo_timer, svo_total_timer, svo_io_out_timer, svo_algo_timer;
+
+// Test octree: the test shell with one octant cut away (test_fixtures.h)
+// Returns which morton codes are set.
+vector<bool> buildShell(const string &base_filename, size_t gridsize, bool levels, int node_format, int brick_size = 0){
+	vector<bool> occupied(gridsize * gridsize * gridsize, false);
+	OctreeBuilder builder(base_filename, gridsize, levels, node_format, brick_size);
+	vector<VoxelData> voxels = shellVoxels<VoxelData>(gridsize, true);
+	for (size_t i = 0; i < voxels.size(); i++) {
+		occupied[voxels[i].morton] = true;
+		builder.addVoxel(voxels[i]);
+	}
+	builder.finalizeTree();
+	return occupied;
+}
+
+// Entry and exit of a ray through the voxel (x, y, z) (slab test), false if it misses
+bool rayVoxel(const vec3 &o, const vec3 &d, const uvec3 &v, float &t_in, float &t_out){
+	vec3 lo = (vec3(v) - o) / d;
+	vec3 hi = (vec3(v) + vec3(1.0f) - o) / d;
+	vec3 t0 = min(lo, hi), t1 = max(lo, hi);
+	t_in = std::max(std::max(std::max(t0.x, t0.y), t0.z), 0.0f);
+	t_out = std::min(std::min(t1.x, t1.y), t1.z);
+	return t_in <= t_out;
+}
+
+vec3 randomDirection(std::mt19937 &rng){
+	std::normal_distribution<float> n(0.0f, 1.0f);
+	return normalize(vec3(n(rng), n(rng), n(rng)));
+}
+
+// A ray from outside the grid (or from inside, sometimes) towards a random point in it
+void randomRay(std::mt19937 &rng, size_t gridsize, vec3 &origin, vec3 &direction){
+	std::uniform_real_distribution<float> u(0.0f, static_cast<float>(gridsize));
+	vec3 target = vec3(u(rng), u(rng), u(rng));
+	if (rng() % 4 == 0) { origin = vec3(u(rng), u(rng), u(rng)); }
+	else { origin = vec3(gridsize * 0.5f) + randomDirection(rng) * (gridsize * 1.5f); }
+	direction = normalize(target - origin);
+}
+
+// Size of a file in bytes
+size_t fileSize(const string &filename){
+	ifstream f(filename.c_str(), ios::in | ios::binary | ios::ate);
+	return f.good() ? static_cast<size_t>(f.tellg()) : 0;
+}
+
+bool checkOctree(const string &name, const SVOReader &svo, const vector<bool> &occupied, vector<uvec3> &voxels){
+	bool geometry_only = (svo.info().version == SVO_FORMAT_DAG); // all voxels share a white payload
+	size_t gridsize = svo.gridLength();
+	size_t errors = 0;
+
+	// point lookups (and payloads) against what went in
+	for (::uint64_t m = 0; m < occupied.size(); m++) {
+		SVONode n;
+		bool found = svo.lookup(m, n);
+		if (found != occupied[m]) { errors++; continue; }
+		if (!found) { continue; }
+		unsigned int x, y, z;
+		morton3D_64_decode_dispatch(m, x, y, z);
+		SVOVoxel v;
+		vec3 color = geometry_only ? vec3(1.0f) : vec3(x, y, z) / static_cast<float>(gridsize);
+		if (!svo.voxel(n, v) || length(v.color - color) > 0.01f) { errors++; }
+	}
+	cout << "  " << name << ": lookups " << (errors == 0 ? "ok" : "FAILED");
+
+	// child iteration: the leaves under the root are the voxels
+	size_t leaves = 0;
+	vector<SVONode> stack(1, svo.root());
+	while (!stack.empty()) {
+		SVONode n = stack.back();
+		stack.pop_back();
+		if (n.isLeaf()) { leaves++; continue; }
+		svo.forEachChild(n, [&stack](unsigned int i, const SVONode &c) { stack.push_back(c); });
+	}
+	bool leaves_ok = (leaves == voxels.size());
+	cout << ", child iteration " << (leaves_ok ? "ok" : "FAILED");
+
+	// box queries against brute force
+	std::mt19937 rng(7);
+	bool boxes_ok = true;
+	for (int b = 0; b < 50; b++) {
+		uvec3 lo = uvec3(rng() % gridsize, rng() % gridsize, rng() % gridsize);
+		uvec3 hi = lo + uvec3(rng() % gridsize, rng() % gridsize, rng() % gridsize) / 2u;
+		size_t expected = 0;
+		for (size_t i = 0; i < voxels.size(); i++) {
+			if (all(greaterThanEqual(voxels[i], lo)) && all(lessThanEqual(voxels[i], hi))) { expected++; }
+		}
+		::uint64_t last = 0;
+		bool ordered = true;
+		size_t found = svo.queryBox(lo, hi, [&](const uvec3 &p, const SVONode &n) {
+			::uint64_t m = morton3D_64_encode_dispatch(p.x, p.y, p.z);
+			if (!occupied[m] || m < last || any(lessThan(p, lo)) || any(greaterThan(p, hi))) { ordered = false; }
+			last = m;
+		});
+		boxes_ok = boxes_ok && ordered && (found == expected);
+	}
+	cout << ", box queries " << (boxes_ok ? "ok" : "FAILED");
+
+	// rays against brute force: same first t (voxels can tie on a shared face), grazing hits may go either way
+	size_t ray_errors = 0;
+	for (int r = 0; r < 2000; r++) {
+		vec3 o, d;
+		randomRay(rng, gridsize, o, d);
+		float best = FLT_MAX, best_span = 0.0f;
+		for (size_t i = 0; i < voxels.size(); i++) {
+			float t_in, t_out;
+			if (rayVoxel(o, d, voxels[i], t_in, t_out) && t_in < best) { best = t_in; best_span = t_out - t_in; }
+		}
+		SVORayHit hit;
+		bool got = castRay(svo, o, d, hit);
+		if (!got) {
+			if (best != FLT_MAX && best_span > 1e-3f) { ray_errors++; }
+			continue;
+		}
+		float t_in, t_out;
+		bool on_voxel = (hit.depth == svo.maxDepth()) && occupied[morton3D_64_encode_dispatch(hit.position.x, hit.position.y, hit.position.z)];
+		if (!on_voxel || !rayVoxel(o, d, hit.position, t_in, t_out) || abs(hit.t - best) > 1e-2f) { ray_errors++; continue; }
+		// a coarser level of detail can't be hit any later
+		SVORayHit coarse;
+		if (!castRay(svo, o, d, coarse, FLT_MAX, svo.maxDepth() - 2) || coarse.t > hit.t + 1e-2f || coarse.depth != svo.maxDepth() - 2) { ray_errors++; }
+	}
+	cout << ", rays " << (ray_errors == 0 ? "ok" : "FAILED") << endl;
+	return errors == 0 && leaves_ok && boxes_ok && ray_errors == 0;
+}
+
+void benchmark(const string &name, const SVOReader &svo, const size_t n_rays){
+	std::mt19937 rng(1);
+	vector<vec3> origins(n_rays), directions(n_rays);
+	for (size_t i = 0; i < n_rays; i++) { randomRay(rng, svo.gridLength(), origins[i], directions[i]); }
+	Timer timer;
+	timer.start();
+	long long hits = 0;
+#pragma omp parallel for reduction(+:hits)
+	for (long long i = 0; i < static_cast<long long>(n_rays); i++) {
+		SVORayHit hit;
+		if (castRay(svo, origins[i], directions[i], hit)) { hits++; }
+	}
+	timer.stop();
+	cout << "  " << name << ": " << n_rays << " rays (" << hits << " hits) in " << timer.elapsed_time_milliseconds << " ms, "
+		<< static_cast<size_t>(n_rays / (timer.elapsed_time_milliseconds / 1000.0)) << " rays/s, "
+		<< fileSize(svo.info().base_filename + string(".octreenodes")) << " bytes of nodes" << endl;
+}
+
+int main(int argc, char *argv[]) {
+	cout << "SVO reader test" << endl;
+	size_t bench_gridsize = (argc > 1) ? atoi(argv[1]) : 256;
+	size_t bench_rays = (argc > 2) ? atoi(argv[2]) : (1 << 20);
+	const size_t gridsize = 64;
+	int formats[3] = { OCTREE_FORMAT_CLASSIC, OCTREE_FORMAT_COMPACT, OCTREE_FORMAT_DAG };
+	const char* format_names[3] = { "classic", "compact", "dag" };
+	bool ok = true;
+
+	for (int f = 0; f < 3; f++) {
+		for (int levels = 0; levels < 2; levels++) {
+			if (formats[f] == OCTREE_FORMAT_DAG && levels) { continue; } // geometry only
+			string name = string(format_names[f]) + (levels ? " + levels" : "");
+			string base = string("svo_reader_test_") + format_names[f] + (levels ? "_levels" : "");
+			vector<bool> occupied = buildShell(base, gridsize, levels != 0, formats[f]);
+			vector<uvec3> voxels;
+			for (::uint64_t m = 0; m < occupied.size(); m++) {
+				if (!occupied[m]) { continue; }
+				unsigned int x, y, z;
+				morton3D_64_decode_dispatch(m, x, y, z);
+				voxels.push_back(uvec3(x, y, z));
+			}
+			SVOReader svo;
+			if (!svo.open(base + string(".octree"))) { ok = false; continue; }
+			ok = checkOctree(name, svo, occupied, voxels) && ok;
+			if (levels) { // every internal node has a payload
+				SVOVoxel v;
+				bool root_ok = svo.voxel(svo.root(), v);
+				if (!root_ok) { cout << "  " << name << ": root has no payload, FAILED" << endl; }
+				ok = ok && root_ok;
+			}
+		}
+	}
+
+	// bricks: every voxel is a full texel of its leaf brick, and the root brick averages the whole grid
+	{
+		const int brick_size = 4;
+		vector<bool> occupied = buildShell("svo_reader_test_bricks", gridsize, true, OCTREE_FORMAT_CLASSIC, brick_size);
+		SVOReader svo;
+		bool bricks_ok = svo.open("svo_reader_test_bricks.octree") && svo.brickSize() == brick_size && (size_t(brick_size) << svo.maxDepth()) == gridsize;
+		size_t n_voxels = 0, errors = 0;
+		for (::uint64_t m = 0; bricks_ok && m < occupied.size(); m++) {
+			unsigned int x, y, z;
+			morton3D_64_decode_dispatch(m, x, y, z);
+			SVONode n;
+			SVOVoxel v;
+			float coverage = 0.0f;
+			bool found = svo.lookup(m, n) && svo.brickVoxel(n, uvec3(x, y, z) % uvec3(brick_size), v, coverage);
+			if (!occupied[m]) {
+				if (found && coverage != 0.0f) { errors++; }
+				continue;
+			}
+			n_voxels++;
+			if (!found || coverage != 1.0f || length(v.color - vec3(x, y, z) / static_cast<float>(gridsize)) > 0.01f) { errors++; }
+		}
+		float root_coverage = 0.0f;
+		for (unsigned int t = 0; bricks_ok && t < brick_size * brick_size * brick_size; t++) {
+			SVOVoxel v;
+			float c;
+			if (!svo.brickVoxel(svo.root(), uvec3(t % brick_size, (t / brick_size) % brick_size, t / (brick_size * brick_size)), v, c)) { bricks_ok = false; }
+			root_coverage += c / (brick_size * brick_size * brick_size);
+		}
+		bricks_ok = bricks_ok && errors == 0 && abs(root_coverage - n_voxels / static_cast<float>(occupied.size())) < 0.005f;
+		cout << "  bricks: " << svo.info().n_bricks << " bricks, texels and filtered root brick " << (bricks_ok ? "ok" : "FAILED") << endl;
+		ok = ok && bricks_ok;
+	}
+
+	cout << "Ray casting benchmark, " << bench_gridsize << "^3 shell" << endl;
+	for (int f = 0; f < 3; f++) {
+		string base = string("svo_reader_bench_") + format_names[f];
+		buildShell(base, bench_gridsize, false, formats[f]);
+		SVOReader svo;
+		if (!svo.open(base + string(".octree"))) { ok = false; continue; }
+		benchmark(format_names[f], svo, bench_rays);
+	}
+
+	cout << (ok ? "All tests passed." : "Some tests FAILED.") << endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// Test fixtures shared by the svo_builder and libtri tests
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+#include <glm/glm.hpp>
+#include "../../libs/libmorton/include/morton_dispatch.h"
+
+// An off-center spherical shell (center (0.45, 0.55, 0.5), radius 0.4 of the grid, 0.75 voxels thick), optionally with one octant
+// cut away so it isn't symmetric. Voxels in morton order, built as Voxel(morton, outward normal, color by position).
+template <typename Voxel>
+std::vector<Voxel> shellVoxels(size_t gridsize, bool cut_octant){
+	std::vector<Voxel> voxels;
+	glm::vec3 center = glm::vec3(0.45f, 0.55f, 0.5f) * static_cast<float>(gridsize);
+	float radius = gridsize * 0.4f;
+	for (::uint64_t m = 0; m < static_cast<::uint64_t>(gridsize) * gridsize * gridsize; m++) {
+		unsigned int x, y, z;
+		morton3D_64_decode_dispatch(m, x, y, z);
+		glm::vec3 v = glm::vec3(x + 0.5f, y + 0.5f, z + 0.5f) - center;
+		if (std::abs(glm::length(v) - radius) > 0.75f) { continue; }
+		if (cut_octant && v.x > 0.0f && v.y > 0.0f && v.z < 0.0f) { continue; }
+		voxels.push_back(Voxel(m, glm::normalize(v), glm::vec3(x, y, z) / static_cast<float>(gridsize)));
+	}
+	return voxels;
+}
+
+// A wavy surface over the unit cube (height 0.5 + 0.1 sin(10x) cos(7y)), like a scanned mesh: a grid of columns x rows quads,
+// two triangles each. Vertices row major (columns + 1 per row), triangles in quad order.
+inline void wavyMesh(size_t columns, size_t rows, std::vector<glm::vec3> &positions, std::vector<glm::uvec3> &triangles){
+	positions.clear();
+	triangles.clear();
+	for (size_t y = 0; y <= rows; y++) {
+		for (size_t x = 0; x <= columns; x++) {
+			float px = x / float(columns), py = y / float(columns);
+			positions.push_back(glm::vec3(px, py, 0.5f + 0.1f * sin(10.0f * px) * cos(7.0f * py)));
+		}
+	}
+	for (size_t y = 0; y < rows; y++) {
+		for (size_t x = 0; x < columns; x++) {
+			unsigned int i00 = static_cast<unsigned int>(y * (columns + 1) + x), i10 = i00 + 1;
+			unsigned int i01 = i00 + static_cast<unsigned int>(columns + 1), i11 = i01 + 1;
+			triangles.push_back(glm::uvec3(i00, i10, i11));
+			triangles.push_back(glm::uvec3(i00, i11, i01));
+		}
+	}
+}
@@ -0,0 +1,234 @@
+// Compressed triangle stream tests
+// Checks the LZ coder, block round trips (quantization, vertex cache, normals and colors), re-encoding stability,
+// corrupt block detection, and TriReader on a compressed file against the raw one, and reports compression ratios.
+// Everything runs for both triangle types (geometry only, and with normals and colors).
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include "../../libs/libtri/include/TriReader.h"
+#include "../timer.h"
+#include "test_fixtures.h"
+
+using namespace std;
+
+// The first n triangles of the wavy surface (test_fixtures.h), 64 quads wide (connected, shared vertices)
+template <typename T>
+void generateStrip(vector<T> &tris, size_t n, std::mt19937 &rng){
+	std::uniform_real_distribution<float> u(0.0f, 1.0f);
+	const size_t columns = 64;
+	vector<glm::vec3> positions;
+	vector<glm::uvec3> triangles;
+	wavyMesh(columns, (n / 2 + columns) / columns, positions, triangles);
+	tris.clear();
+	for (size_t i = 0; i < n; i++) {
+		T t;
+		t.v0 = positions[triangles[i].x]; t.v1 = positions[triangles[i].y]; t.v2 = positions[triangles[i].z];
+		if (!T::geometry_only) {
+			glm::vec3 normal = glm::cross(t.v1 - t.v0, t.v2 - t.v0);
+			t.setNormal(glm::normalize(normal * (u(rng) < 0.5f ? 1.0f : -1.0f))); // both hemispheres
+			t.setColors(glm::clamp(t.v0, 0.0f, 1.0f), glm::clamp(t.v1, 0.0f, 1.0f), glm::clamp(t.v2, 0.0f, 1.0f));
+		}
+		tris.push_back(t);
+	}
+}
+
+// Unconnected triangles everywhere in the unit cube
+template <typename T>
+void generateSoup(vector<T> &tris, size_t n, std::mt19937 &rng){
+	std::uniform_real_distribution<float> u(0.0f, 1.0f);
+	tris.clear();
+	for (size_t i = 0; i < n; i++) {
+		T t;
+		t.v0 = glm::vec3(u(rng), u(rng), u(rng));
+		t.v1 = t.v0 + 0.01f * glm::vec3(u(rng), u(rng), u(rng));
+		t.v2 = t.v0 - 0.01f * glm::vec3(u(rng), u(rng), u(rng));
+		if (!T::geometry_only) {
+			t.setNormal(glm::normalize(glm::vec3(u(rng) - 0.5f, u(rng) - 0.5f, u(rng) - 0.5f)));
+			t.setColors(glm::vec3(u(rng), u(rng), u(rng)), glm::vec3(1.0f), glm::vec3(1.0f));
+		}
+		tris.push_back(t);
+	}
+}
+
+bool closeTo(const glm::vec3 &a, const glm::vec3 &b, float tolerance){
+	return fabs(a.x - b.x) <= tolerance && fabs(a.y - b.y) <= tolerance && fabs(a.z - b.z) <= tolerance;
+}
+
+template <typename T>
+bool sameTriangle(const T &a, const T &b){
+	return memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+// Decoded triangles are within half a lattice step of the input (colors and normals within their precision)
+template <typename T>
+bool checkDecoded(const vector<T> &in, const vector<T> &out, const TriLattice &lattice){
+	float tolerance = static_cast<float>(lattice.step) * 0.5f + 1e-6f;
+	for (size_t i = 0; i < in.size(); i++) {
+		bool ok = closeTo(in[i].v0, out[i].v0, tolerance) && closeTo(in[i].v1, out[i].v1, tolerance) && closeTo(in[i].v2, out[i].v2, tolerance);
+		ok = ok && closeTo(in[i].getNormal(), out[i].getNormal(), 1e-3f);
+		ok = ok && closeTo(in[i].getColor(0), out[i].getColor(0), 0.5f / 255.0f + 1e-6f) && closeTo(in[i].getColor(2), out[i].getColor(2), 0.5f / 255.0f + 1e-6f);
+		if (!ok) {
+			cout << "  ERROR: triangle " << i << " decodes to (" << out[i].v0.x << "," << out[i].v0.y << "," << out[i].v0.z << ") instead of ("
+				<< in[i].v0.x << "," << in[i].v0.y << "," << in[i].v0.z << ")" << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool testLZ(std::mt19937 &rng){
+	vector<unsigned char> input, packed, output;
+	bool ok = true;
+	for (int kind = 0; kind < 3; kind++) {
+		input.clear();
+		for (size_t i = 0; i < 200000; i++) {
+			if (kind == 0) { input.push_back(static_cast<unsigned char>(rng())); } // incompressible
+			else if (kind == 1) { input.push_back(static_cast<unsigned char>((i / 7) % 5)); } // runs
+			else { input.push_back(static_cast<unsigned char>(i % 1000 < 500 ? i % 13 : rng() % 4)); } // mixed, long matches
+		}
+		packed.clear();
+		lzCompress(&input[0], input.size(), packed);
+		output.assign(input.size(), 0);
+		bool roundtrip = lzDecompress(&packed[0], packed.size(), &output[0], output.size()) && output == input;
+		bool short_output = !lzDecompress(&packed[0], packed.size(), &output[0], output.size() - 1);
+		bool truncated = !lzDecompress(&packed[0], packed.size() / 2, &output[0], output.size());
+		cout << "  LZ input " << kind << ": " << input.size() << " -> " << packed.size() << " bytes" << (roundtrip ? "" : "  ERROR: round trip failed")
+			<< (short_output && truncated ? "" : "  ERROR: corrupt input not detected") << endl;
+		ok = ok && roundtrip && short_output && truncated;
+	}
+	return ok;
+}
+
+// Encode and decode block by block, re-encode the decoded triangles: the bytes must not change
+template <typename T>
+bool testBlocks(const string &name, const vector<T> &tris, const TriLattice &lattice){
+	vector<unsigned char> encoded, reencoded;
+	for (size_t first = 0; first < tris.size(); first += TRIZ_BLOCK_TRIANGLES) {
+		encodeTriBlock(&tris[first], std::min<size_t>(TRIZ_BLOCK_TRIANGLES, tris.size() - first), lattice, encoded);
+	}
+	vector<T> decoded(tris.size());
+	size_t at = 0, count = 0;
+	bool ok = true;
+	while (at < encoded.size() && ok) {
+		::uint32_t header[3];
+		memcpy(header, &encoded[at], TRIZ_BLOCK_HEADER_SIZE);
+		ok = decodeTriBlock(&encoded[at + TRIZ_BLOCK_HEADER_SIZE], header[0], header[1], header[2], lattice, T::geometry_only, &decoded[count]);
+		at += TRIZ_BLOCK_HEADER_SIZE + header[2];
+		count += header[0];
+	}
+	ok = ok && count == tris.size() && checkDecoded(tris, decoded, lattice);
+	for (size_t first = 0; first < decoded.size() && ok; first += TRIZ_BLOCK_TRIANGLES) {
+		encodeTriBlock(&decoded[first], std::min<size_t>(TRIZ_BLOCK_TRIANGLES, decoded.size() - first), lattice, reencoded);
+	}
+	bool stable = ok && reencoded == encoded;
+	cout << "  " << name << ": " << tris.size() << " triangles, " << tris.size() * sizeof(T) << " -> " << encoded.size() << " bytes ("
+		<< (tris.size() * sizeof(T)) / double(encoded.size()) << "x)" << (ok ? "" : "  ERROR: blocks don't decode")
+		<< (stable || !ok ? "" : "  ERROR: re-encoding changes the blocks") << endl;
+
+	// corrupt the first block: a wrong vertex count, and a garbled (LZ-coded) body
+	::uint32_t header[3];
+	memcpy(header, &encoded[0], TRIZ_BLOCK_HEADER_SIZE);
+	vector<unsigned char> body(encoded.begin() + TRIZ_BLOCK_HEADER_SIZE, encoded.begin() + TRIZ_BLOCK_HEADER_SIZE + header[2]);
+	bool detected = !decodeTriBlock(&body[0], header[0] + 1, header[1], header[2], lattice, T::geometry_only, &decoded[0]);
+	for (size_t k = 0; k < body.size(); k += 3) { body[k] ^= 0x5A; }
+	detected = detected && (header[1] == header[2] || !decodeTriBlock(&body[0], header[0], header[1], header[2], lattice, T::geometry_only, &decoded[0]));
+	if (!detected) { cout << "  ERROR: corrupt block not detected" << endl; }
+	return ok && stable && detected;
+}
+
+// Write raw and compressed files (in uneven batches, like partition buffers flushing), read both back with TriReader
+template <typename T>
+bool testReader(const string &name, const vector<T> &tris, const TriLattice &lattice){
+	string raw_name = "tri_compress_test_raw.tridata", compressed_name = "tri_compress_test.tridata";
+	FILE* raw = fopen(raw_name.c_str(), "wb");
+	FILE* compressed = fopen(compressed_name.c_str(), "wb");
+	{
+		TriBlockWriter<T> writer(compressed, lattice);
+		size_t batch = 1;
+		for (size_t first = 0; first < tris.size(); first += batch, batch = batch * 3 + 1) {
+			size_t count = std::min(batch, tris.size() - first);
+			writer.write(&tris[first], count);
+		}
+	}
+	fclose(compressed);
+	// the raw file holds the quantized triangles, so both must read back the same
+	vector<T> quantized;
+	{
+		TriReader<T> reader(compressed_name, tris.size(), 1000);
+		while (reader.hasNext()) { quantized.push_back(reader.getTriangle()); }
+	}
+	writeTriangles(raw, quantized[0], quantized.size());
+	fclose(raw);
+
+	bool ok = checkDecoded(tris, quantized, lattice);
+	TriLattice found;
+	ok = ok && isCompressedTriStream(compressed_name, found) && found.step == lattice.step && !isCompressedTriStream(raw_name, found);
+	Timer raw_timer, compressed_timer;
+	size_t buffersizes[3] = { 1, 5000, 100000 };
+	for (int b = 0; b < 3 && ok; b++) {
+		raw_timer.start();
+		TriReader<T> raw_reader(raw_name, tris.size(), buffersizes[b]);
+		vector<T> a;
+		const T* batch;
+		size_t count;
+		while ((count = raw_reader.getTriangles(batch, 777)) > 0) { a.insert(a.end(), batch, batch + count); }
+		raw_timer.stop();
+		compressed_timer.start();
+		TriReader<T> compressed_reader(compressed_name, tris.size(), buffersizes[b]);
+		vector<T> c;
+		while ((count = compressed_reader.getTriangles(batch, 777)) > 0) { c.insert(c.end(), batch, batch + count); }
+		compressed_timer.stop();
+		ok = a.size() == tris.size() && c.size() == tris.size();
+		for (size_t i = 0; i < c.size() && ok; i++) { ok = sameTriangle(a[i], c[i]); }
+	}
+	// a stream of another version isn't read (version 1 had another normal encoding)
+	FILE* old = fopen(compressed_name.c_str(), "r+b");
+	::uint32_t old_version = 1;
+	fseek(old, 4, SEEK_SET);
+	fwrite(&old_version, sizeof(old_version), 1, old);
+	fclose(old);
+	ok = ok && !isCompressedTriStream(compressed_name, found);
+	cout << "  " << name << " through TriReader: raw " << raw_timer.elapsed_time_milliseconds / 3 << " ms, compressed " << compressed_timer.elapsed_time_milliseconds / 3
+		<< " ms" << (ok ? "" : "  ERROR: compressed stream reads back different triangles") << endl;
+	remove(raw_name.c_str());
+	remove(compressed_name.c_str());
+	return ok;
+}
+
+// Block and reader tests for one triangle type
+template <typename T>
+bool testTriangles(const string &kind, std::mt19937 &rng){
+	cout << " " << kind << " triangles" << endl;
+	bool ok = true;
+	TriLattice lattice = triLattice(AABox<glm::vec3>(glm::vec3(0.0f), glm::vec3(1.0f)));
+	vector<T> tris;
+	generateStrip(tris, 100000, rng);
+	ok = testBlocks("connected mesh", tris, lattice) && ok;
+	ok = testReader("connected mesh", tris, lattice) && ok;
+	generateSoup(tris, 30000, rng);
+	ok = testBlocks("triangle soup", tris, lattice) && ok;
+	ok = testReader("triangle soup", tris, lattice) && ok;
+
+	// a lattice that doesn't start at the origin, and triangles sticking out of the bbox
+	TriLattice offset = triLattice(AABox<glm::vec3>(glm::vec3(-3.0f, 2.0f, 10.0f), glm::vec3(5.0f, 10.0f, 18.0f)));
+	for (size_t i = 0; i < tris.size(); i++) {
+		tris[i].v0 = tris[i].v0 * 9.0f + glm::vec3(-3.5f, 1.5f, 9.5f);
+		tris[i].v1 = tris[i].v1 * 9.0f + glm::vec3(-3.5f, 1.5f, 9.5f);
+		tris[i].v2 = tris[i].v2 * 9.0f + glm::vec3(-3.5f, 1.5f, 9.5f);
+	}
+	ok = testBlocks("offset bbox", tris, offset) && ok;
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	cout << "Compressed triangle stream test" << endl;
+	std::mt19937 rng(42);
+	bool ok = testLZ(rng);
+	ok = testTriangles<GeometryTriangle>("geometry only", rng) && ok;
+	ok = testTriangles<ColorTriangle>("colored", rng) && ok;
+
+	cout << (ok ? "All tests passed." : "Some tests FAILED.") << endl;
+	return ok ? 0 : 1;
+}
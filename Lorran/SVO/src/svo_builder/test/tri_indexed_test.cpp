@@ -0,0 +1,162 @@
+// Indexed triangle format tests
+// Writes a connected mesh with writeIndexedMesh, checks the morton order of the vertices and the order of the triangles,
+// reads it back through TriReader (triangles and their index triples, as is and morton sorted), and checks that bad indices are caught.
+// Everything runs for both triangle types (geometry only, and with normals and colors).
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include "../../libs/libtri/include/TriReader.h"
+#include "test_fixtures.h"
+
+using namespace std;
+
+// The wavy surface (test_fixtures.h) as a square grid of quads, in scrambled order (like a mesh from a modelling tool)
+template <typename T>
+void generateGrid(vector<TriVertex<T> > &vertices, vector<IndexedTriangle<T> > &triangles, size_t columns, std::mt19937 &rng){
+	std::uniform_real_distribution<float> u(0.0f, 1.0f);
+	vector<glm::vec3> positions;
+	vector<glm::uvec3> indices;
+	wavyMesh(columns, columns, positions, indices);
+	vertices.clear();
+	triangles.clear();
+	for (size_t i = 0; i < positions.size(); i++) {
+		TriVertex<T> v;
+		v.position = positions[i];
+		if (!T::geometry_only) { v.setColor(glm::vec3(u(rng), u(rng), u(rng))); }
+		vertices.push_back(v);
+	}
+	for (size_t i = 0; i < indices.size(); i++) {
+		IndexedTriangle<T> t;
+		t.v[0] = indices[i].x; t.v[1] = indices[i].y; t.v[2] = indices[i].z;
+		if (!T::geometry_only) { t.setNormal(glm::normalize(glm::vec3(u(rng) - 0.5f, u(rng) - 0.5f, 1.0f))); }
+		triangles.push_back(t);
+	}
+	std::shuffle(triangles.begin(), triangles.end(), rng);
+}
+
+// Everything a triangle carries, to compare triangles regardless of their order in the file
+template <typename T>
+vector<float> triangleKey(const T &t){
+	vector<float> k;
+	const glm::vec3 parts[7] = { t.v0, t.v1, t.v2, t.getNormal(), t.getColor(0), t.getColor(1), t.getColor(2) };
+	for (int p = 0; p < (T::geometry_only ? 3 : 7); p++) {
+		k.push_back(parts[p][0]); k.push_back(parts[p][1]); k.push_back(parts[p][2]);
+	}
+	return k;
+}
+
+template <typename T>
+bool testRoundTrip(const string &base, size_t columns, std::mt19937 &rng){
+	vector<TriVertex<T> > vertices;
+	vector<IndexedTriangle<T> > triangles;
+	generateGrid(vertices, triangles, columns, rng);
+	const AABox<glm::vec3> bbox(glm::vec3(0.0f), glm::vec3(1.0f));
+
+	// the triangles as they went in
+	vector<vector<float> > expected;
+	for (size_t i = 0; i < triangles.size(); i++) {
+		T t;
+		t.v0 = vertices[triangles[i].v[0]].position;
+		t.v1 = vertices[triangles[i].v[1]].position;
+		t.v2 = vertices[triangles[i].v[2]].position;
+		t.setNormal(triangles[i].getNormal());
+		t.setColors(vertices[triangles[i].v[0]].getColor(), vertices[triangles[i].v[1]].getColor(), vertices[triangles[i].v[2]].getColor());
+		expected.push_back(triangleKey(t));
+	}
+	std::sort(expected.begin(), expected.end());
+	size_t n_triangles = triangles.size();
+	writeIndexedMesh(base, vertices, triangles, bbox);
+
+	bool ok = true;
+	TriVertices<T> vertex_file;
+	if (!vertex_file.open(base + string(".trivertices")) || vertex_file.size() != vertices.size()) {
+		cout << "  ERROR: could not map the vertex file" << endl;
+		return false;
+	}
+	for (size_t i = 1; i < vertex_file.size() && ok; i++) {
+		ok = triVertexMorton(vertex_file[i - 1].position, bbox) <= triVertexMorton(vertex_file[i].position, bbox);
+	}
+	if (!ok) { cout << "  ERROR: vertices are not in morton order" << endl; }
+
+	// read back in uneven batches, and check every batch against its index triples
+	TriReader<T> reader(base + string(".tridata"), n_triangles, 1000, &vertex_file);
+	vector<vector<float> > read;
+	const T* batch;
+	size_t count;
+	::uint32_t last_min = 0;
+	bool ordered = true, consistent = true;
+	while ((count = reader.getTriangles(batch, 333)) > 0) {
+		const IndexedTriangle<T>* ids = reader.indices();
+		for (size_t k = 0; k < count; k++) {
+			T t;
+			consistent = consistent && vertex_file.expand(ids[k], t) && triangleKey(t) == triangleKey(batch[k]);
+			::uint32_t m = std::min(ids[k].v[0], std::min(ids[k].v[1], ids[k].v[2]));
+			ordered = ordered && m >= last_min;
+			last_min = m;
+			read.push_back(triangleKey(batch[k]));
+		}
+	}
+	std::sort(read.begin(), read.end());
+	if (!ordered) { cout << "  ERROR: triangles are not sorted by their lowest vertex" << endl; }
+	if (!consistent) { cout << "  ERROR: TriReader::indices() doesn't match the triangles of its batch" << endl; }
+	if (read != expected) { cout << "  ERROR: the indexed mesh reads back different triangles" << endl; }
+	ok = ok && ordered && consistent && read == expected;
+
+	// read back sorted in runs of 1000: every run in morton order of the centroids (down to the 33 top key bits the sort uses)
+	{
+		TriReader<T> sorted_reader(base + string(".tridata"), n_triangles, 1000, &vertex_file, &bbox);
+		vector<vector<float> > sorted_read;
+		size_t served = 0;
+		::uint64_t last_key = 0;
+		bool in_order = true, sorted_consistent = true;
+		while ((count = sorted_reader.getTriangles(batch, 333)) > 0) {
+			const IndexedTriangle<T>* ids = sorted_reader.indices();
+			for (size_t k = 0; k < count; k++, served++) {
+				T t;
+				sorted_consistent = sorted_consistent && vertex_file.expand(ids[k], t) && triangleKey(t) == triangleKey(batch[k]);
+				::uint64_t key = triVertexMorton((batch[k].v0 + batch[k].v1 + batch[k].v2) / 3.0f, bbox) >> 30;
+				in_order = in_order && (served % 1000 == 0 || key >= last_key);
+				last_key = key;
+				sorted_read.push_back(triangleKey(batch[k]));
+			}
+		}
+		std::sort(sorted_read.begin(), sorted_read.end());
+		if (!in_order) { cout << "  ERROR: sorted runs are not in morton order" << endl; }
+		if (!sorted_consistent) { cout << "  ERROR: sorting lost track of the index triples" << endl; }
+		if (sorted_read != expected) { cout << "  ERROR: sorting changed the triangles" << endl; }
+		ok = ok && in_order && sorted_consistent && sorted_read == expected;
+	}
+
+	// indices past the end of the vertex file
+	IndexedTriangle<T> bad = IndexedTriangle<T>();
+	bad.v[2] = static_cast< ::uint32_t>(vertex_file.size());
+	T t;
+	if (vertex_file.expand(bad, t)) {
+		cout << "  ERROR: an index past the vertex file was expanded" << endl;
+		ok = false;
+	}
+
+	FILE* f = fopen((base + string(".tridata")).c_str(), "rb");
+	fseek(f, 0, SEEK_END);
+	size_t indexed_bytes = static_cast<size_t>(ftell(f)) + vertex_file.size() * sizeof(TriVertex<T>);
+	fclose(f);
+	cout << "  " << columns << "x" << columns << " grid: " << n_triangles << " triangles, " << vertex_file.size() << " vertices, "
+		<< indexed_bytes << " bytes indexed vs " << n_triangles * sizeof(T) << " bytes of full triangles" << endl;
+	vertex_file.close();
+	remove((base + string(".tridata")).c_str());
+	remove((base + string(".trivertices")).c_str());
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	cout << "Indexed triangle format test" << endl;
+	std::mt19937 rng(42);
+	bool ok = testRoundTrip<GeometryTriangle>("tri_indexed_test_a", 7, rng);
+	ok = testRoundTrip<GeometryTriangle>("tri_indexed_test_b", 300, rng) && ok;
+	ok = testRoundTrip<ColorTriangle>("tri_indexed_test_c", 7, rng) && ok;
+	ok = testRoundTrip<ColorTriangle>("tri_indexed_test_d", 300, rng) && ok;
+	cout << (ok ? "All tests passed." : "Some tests FAILED.") << endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+// Voxelizer kernel tests
+// Checks that every Schwarz-Seidel row kernel the CPU supports agrees bit-exactly with the original per-voxel test, and times them
+
+#include <iostream>
+#include <random>
+#include "../voxelizer_kernels.h"
+#include "../intersection.h"
+#include "../timer.h"
+
+using namespace std;
+
+// The per-voxel overlap test as the voxelizer used to do it, kept here as the reference
+bool referenceTest(const SchwarzTriangle &s, const float unitlength, const int x, const int y, const int z){
+	vec3 p = vec3(x*unitlength, y*unitlength, z*unitlength);
+	float nDOTp = dot(s.n, p);
+	if ((nDOTp + s.d1) * (nDOTp + s.d2) > 0.0f){ return false; }
+	vec2 p_xy = vec2(p[0], p[1]);
+	vec2 p_yz = vec2(p[1], p[2]);
+	vec2 p_zx = vec2(p[2], p[0]);
+	for (int i = 0; i < 3; i++) {
+		if ((dot(s.n_xy_e[i], p_xy) + s.d_xy_e[i]) < 0.0f){ return false; }
+		if ((dot(s.n_yz_e[i], p_yz) + s.d_yz_e[i]) < 0.0f){ return false; }
+		if ((dot(s.n_zx_e[i], p_zx) + s.d_zx_e[i]) < 0.0f){ return false; }
+	}
+	return true;
+}
+
+GeometryTriangle makeTriangle(vec3 v0, vec3 v1, vec3 v2){
+	GeometryTriangle t;
+	t.v0 = v0; t.v1 = v1; t.v2 = v2;
+	return t;
+}
+
+// Run a kernel over the bounding box of a triangle, count overlapping voxels.
+// If mismatches is given, compare every voxel against the reference test. Without a kernel, only run the reference.
+size_t checkTriangle(SchwarzRowKernel kernel, const GeometryTriangle &t, const float unitlength, const int gridsize, size_t* mismatches){
+	SchwarzTriangle s;
+	setupSchwarzTriangle(t, unitlength, s);
+	AABox<vec3> b = computeBoundingBox(t.v0, t.v1, t.v2);
+	ivec3 lo = clamp(ivec3(b.min / unitlength), ivec3(0), ivec3(gridsize - 1));
+	ivec3 hi = clamp(ivec3(b.max / unitlength), ivec3(0), ivec3(gridsize - 1));
+	size_t hits = 0;
+	SchwarzRow row;
+	for (int x = lo.x; x <= hi.x; x++) {
+		for (int y = lo.y; y <= hi.y; y++) {
+			if (kernel == NULL) {
+				for (int z = lo.z; z <= hi.z; z++) { hits += referenceTest(s, unitlength, x, y, z); }
+				continue;
+			}
+			bool row_ok = setupSchwarzRow(s, unitlength, x, y, row);
+			for (int z0 = lo.z; z0 <= hi.z; z0 += 8) {
+				int count = std::min(8, hi.z - z0 + 1);
+				unsigned int pass = row_ok ? kernel(row, z0, count) : 0;
+				if (mismatches != NULL) {
+					for (int i = 0; i < count; i++) {
+						if (referenceTest(s, unitlength, x, y, z0 + i) != (((pass >> i) & 1) != 0)) { (*mismatches)++; }
+					}
+				}
+				while (pass != 0) { hits++; pass &= pass - 1; }
+			}
+		}
+	}
+	return hits;
+}
+
+int main(int argc, char *argv[]) {
+	cout << "Voxelizer kernel test" << endl;
+	const int gridsize = 256;
+	const float unitlength = 1.0f / gridsize;
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> pos(0.0f, 1.0f);
+	std::uniform_real_distribution<float> offset(-0.05f, 0.05f);
+
+	// small triangles (like a finely tessellated mesh), big ones, and degenerate ones (NaN normals)
+	vector<GeometryTriangle> triangles;
+	for (int i = 0; i < 20000; i++) {
+		vec3 a = vec3(pos(rng), pos(rng), pos(rng));
+		triangles.push_back(makeTriangle(a, a + vec3(offset(rng), offset(rng), offset(rng)), a + vec3(offset(rng), offset(rng), offset(rng))));
+	}
+	for (int i = 0; i < 50; i++) {
+		triangles.push_back(makeTriangle(vec3(pos(rng), pos(rng), pos(rng)), vec3(pos(rng), pos(rng), pos(rng)), vec3(pos(rng), pos(rng), pos(rng))));
+	}
+	for (int i = 0; i < 100; i++) {
+		vec3 a = vec3(pos(rng), pos(rng), pos(rng));
+		vec3 b = vec3(pos(rng), pos(rng), pos(rng));
+		triangles.push_back(makeTriangle(a, a, b)); // zero area
+		triangles.push_back(makeTriangle(a, (a + b) * 0.5f, b)); // collinear
+	}
+
+	// reference timing
+	Timer reference_timer;
+	reference_timer.start();
+	size_t reference_hits = 0;
+	for (size_t i = 0; i < triangles.size(); i++) {
+		reference_hits += checkTriangle(NULL, triangles[i], unitlength, gridsize, NULL);
+	}
+	reference_timer.stop();
+	cout << "  per-voxel reference: " << reference_hits << " voxels in " << reference_timer.elapsed_time_milliseconds << " ms" << endl;
+
+	SchwarzRowKernel kernels[3] = { &schwarzRowScalar, &schwarzRowSSE4, &schwarzRowAVX2 };
+	bool supported[3] = { true, cpuSupportsSSE4(), cpuSupportsAVX2() };
+	bool ok = true;
+	for (int k = 0; k < 3; k++) {
+		cout << "  " << schwarzRowKernelName(kernels[k]) << " row kernel: ";
+		if (!supported[k]) { cout << "not supported on this CPU, skipped" << endl; continue; }
+		size_t mismatches = 0, hits = 0;
+		for (size_t i = 0; i < triangles.size(); i++) {
+			checkTriangle(kernels[k], triangles[i], unitlength, gridsize, &mismatches);
+		}
+		Timer timer;
+		timer.start();
+		for (size_t i = 0; i < triangles.size(); i++) {
+			hits += checkTriangle(kernels[k], triangles[i], unitlength, gridsize, NULL);
+		}
+		timer.stop();
+		cout << hits << " voxels in " << timer.elapsed_time_milliseconds << " ms, " << mismatches << " mismatches" << endl;
+		ok = ok && (mismatches == 0) && (hits == reference_hits);
+	}
+	cout << "  selected kernel: " << schwarzRowKernelName(selectSchwarzRowKernel()) << endl;
+
+	cout << (ok ? "All tests passed." : "Some tests FAILED.") << endl;
+	return ok ? 0 : 1;
+}
@@ -7,21 +7,25 @@ using namespace glm;
 #define Y 1
 #define Z 2
 
+// Number of triangles we ask the reader for at once
+#define voxelize_batchsize 8192
+
+// Morton code offsets of z = 0 .. 8 (z sits in bits 2, 5, 8, 11 ...) and the mask of all z bits,
+// to step through the 8-voxel rows of the Schwarz-Seidel kernels
+static const ::uint64_t z_offsets[9] = { 0x0, 0x4, 0x20, 0x24, 0x100, 0x104, 0x120, 0x124, 0x800 };
+static const ::uint64_t z_mask = m3D_x_mask<::uint64_t>() << 2;
+
 // Implementation of algorithm from http://citeseerx.ist.psu.edu/viewdoc/summary?doi=10.1.1.12.6294 (Huang et al.)
 // Adapted for mortoncode -based subgrids
 
-#ifdef BINARY_VOXELIZATION
-void voxelize_huang_method(TriReader &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, bool* voxels, size_t &nfilled) {
-	for (size_t i = 0; i < (morton_end - morton_start); i++){ voxels[i] = EMPTY_VOXEL; }
-#else
-void voxelize_huang_method(TriReader &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, size_t* voxels, vector<VoxelData>& voxel_data, size_t &nfilled) {
+template <class P>
+void voxelize_huang_method(TriReader<typename P::Tri> &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, size_t* voxels, vector<typename P::Voxel>& voxel_data, size_t &nfilled) {
 	for (size_t i = 0; i < (morton_end - morton_start); i++){ voxels[i] = EMPTY_VOXEL; }
 	voxel_data.clear();
-#endif
 	// compute partition min and max in grid coords
 	AABox<uivec3> p_bbox_grid;
-	m3D_d_sLUT(morton_start, p_bbox_grid.min[2], p_bbox_grid.min[1], p_bbox_grid.min[0]);
-	m3D_d_sLUT(morton_end - 1, p_bbox_grid.max[2], p_bbox_grid.max[1], p_bbox_grid.max[0]);
+	morton3D_64_decode_dispatch(morton_start, p_bbox_grid.min[2], p_bbox_grid.min[1], p_bbox_grid.min[0]);
+	morton3D_64_decode_dispatch(morton_end - 1, p_bbox_grid.max[2], p_bbox_grid.max[1], p_bbox_grid.max[0]);
 	// misc calc
 	float unit_div = 1.0f / unitlength;
 	float radius = unitlength / 2.0f;
@@ -29,7 +33,7 @@ void voxelize_huang_method(TriReader &reader, const ::uint64_t morton_start, con
 	// voxelize every triangle
 	while (reader.hasNext()) {
 		// read triangle
-		Triangle t;
+		typename P::Tri t;
 
 		//		algo_timer.stop(); io_timer_in.start();
 		reader.getTriangle(t);
@@ -62,11 +66,13 @@ void voxelize_huang_method(TriReader &reader, const ::uint64_t morton_start, con
 		Cylinder cyl2 = Cylinder(t.v2, t.v0, radius);
 		Plane S = Plane(t.v0, t.v1, t.v2);
 
-		// test possible grid boxes for overlap
-		for (unsigned int x = t_bbox_grid.min[0]; x <= t_bbox_grid.max[0]; x++){
-			for (unsigned int y = t_bbox_grid.min[1]; y <= t_bbox_grid.max[1]; y++){
-				for (unsigned int z = t_bbox_grid.min[2]; z <= t_bbox_grid.max[2]; z++){
-					::uint64_t index = morton3D_64_encode(z, y, x);
+		// test possible grid boxes for overlap, stepping the morton code along instead of encoding every box (z is in the x bits here)
+		::uint64_t index_x = morton3D_64_encode_dispatch(t_bbox_grid.min[2], t_bbox_grid.min[1], t_bbox_grid.min[0]);
+		for (unsigned int x = t_bbox_grid.min[0]; x <= t_bbox_grid.max[0]; x++, index_x = m3D_inc_z(index_x)){
+			::uint64_t index_y = index_x;
+			for (unsigned int y = t_bbox_grid.min[1]; y <= t_bbox_grid.max[1]; y++, index_y = m3D_inc_y(index_y)){
+				::uint64_t index = index_y;
+				for (unsigned int z = t_bbox_grid.min[2]; z <= t_bbox_grid.max[2]; z++, index = m3D_inc_x(index)){
 
 					assert(index - morton_start < (morton_end - morton_start));
 
@@ -78,12 +84,8 @@ void voxelize_huang_method(TriReader &reader, const ::uint64_t morton_start, con
 					if (isPointInSphere(middle_point, sphere0) ||
 						isPointInSphere(middle_point, sphere1) ||
 						isPointInSphere(middle_point, sphere2)){
-#ifdef BINARY_VOXELIZATION
-						voxels[index - morton_start] = true;
-#else
-						voxel_data.push_back(VoxelData(index, t.normal, average3Vec(t.v0_color, t.v1_color, t.v2_color)));
+						voxel_data.push_back(P::voxel(index, t));
 						voxels[index - morton_start] = voxel_data.size() - 1;
-#endif
 						nfilled++;
 						continue;
 					}
@@ -91,12 +93,8 @@ void voxelize_huang_method(TriReader &reader, const ::uint64_t morton_start, con
 					if (isPointinCylinder(middle_point, cyl0) ||
 						isPointinCylinder(middle_point, cyl1) ||
 						isPointinCylinder(middle_point, cyl2)){
-#ifdef BINARY_VOXELIZATION
-						voxels[index - morton_start] = true;
-#else
-						voxel_data.push_back(VoxelData(index, t.normal, average3Vec(t.v0_color, t.v1_color, t.v2_color)));
+						voxel_data.push_back(P::voxel(index, t));
 						voxels[index - morton_start] = voxel_data.size() - 1;
-#endif
 						nfilled++;
 						continue;
 					}
@@ -114,12 +112,8 @@ void voxelize_huang_method(TriReader &reader, const ::uint64_t morton_start, con
 						float s2 = dot(cross(S.normal,t.v2-t.v1), middle_point-t.v1);
 						float s3 = dot(cross(S.normal,t.v0-t.v2), middle_point-t.v2);
 						if (((s1 <= 0) == (s2 <= 0)) && ((s2 <= 0) == (s3 <= 0))){
-#ifdef BINARY_VOXELIZATION
-							voxels[index - morton_start] = true;
-#else
-							voxel_data.push_back(VoxelData(index, t.normal, average3Vec(t.v0_color, t.v1_color, t.v2_color)));
+							voxel_data.push_back(P::voxel(index, t));
 							voxels[index - morton_start] = voxel_data.size() - 1;
-#endif
 							nfilled++;
 							continue;
 						}
@@ -133,55 +127,52 @@ void voxelize_huang_method(TriReader &reader, const ::uint64_t morton_start, con
 // Implementation of algorithm from http://research.michael-schwarz.com/publ/2010/vox/ (Schwarz & Seidel)
 // Adapted for mortoncode -based subgrids
 
-#ifdef BINARY_VOXELIZATION
-void voxelize_schwarz_method(TriReader &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, char* voxels, vector<::uint64_t> &data, float sparseness_limit, bool &use_data, size_t &nfilled) {
-#else
-void voxelize_schwarz_method(TriReader &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, char* voxels, vector<VoxelData> &data, float sparseness_limit, bool &use_data, size_t &nfilled) {
-#endif
-	vox_algo_timer.start();
-	memset(voxels, EMPTY_VOXEL, (morton_end - morton_start)*sizeof(char));
+template <class P>
+void voxelize_schwarz_method(TriReader<typename P::Tri> &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, ::uint64_t* voxels, vector<typename P::Voxel> &data, const ::uint64_t data_max_bytes, bool &use_data, size_t &nfilled) {
+	// local timers: this method can run on several pipeline threads at once, so we only merge into the global ones at the end
+	Timer algo_timer, io_in_timer;
+	algo_timer.start();
+	memset(voxels, 0, occupancyWords(morton_end - morton_start)*sizeof(::uint64_t));
 	data.clear();
 
-	// compute partition min and max in grid coords
-	AABox<uivec3> p_bbox_grid;
-	m3D_d_sLUT(morton_start, p_bbox_grid.min[0], p_bbox_grid.min[1], p_bbox_grid.min[2]); // note: flipped inputs here 0, 1, 2 vs 2, 1, 0
-	m3D_d_sLUT(morton_end - 1, p_bbox_grid.max[0], p_bbox_grid.max[1], p_bbox_grid.max[2]); // note: flipped inputs here 0, 1, 2 vs 2, 1, 0
+	// compute partition min and max in grid coords (adaptive partitions need not be cubes: then the box holds voxels of other partitions too)
+	const ::uint64_t morton_range = morton_end - morton_start;
+	AABox<uivec3> p_bbox_grid = mortonRangeBBox(morton_start, morton_end);
 
-	// compute maximum grow size for data array
-#ifdef BINARY_VOXELIZATION
-	size_t data_max_items;
+	// compute maximum grow size for data array (smaller payloads fit more voxels)
+	size_t data_max_items = 0;
 	if (use_data){
-		::uint64_t max_bytes_data = (::uint64_t) (((morton_end - morton_start)*sizeof(char)) * sparseness_limit);
-
-		data_max_items = max_bytes_data / sizeof(::uint64_t);
-		data_max_items = max_bytes_data / sizeof(VoxelData);
+		data_max_items = data_max_bytes / sizeof(typename P::Voxel);
 	}
-#endif
 
 	// COMMON PROPERTIES FOR ALL TRIANGLES
 	float unit_div = 1.0f / unitlength;
-	vec3 delta_p = vec3(unitlength, unitlength, unitlength);
+	static const SchwarzRowKernel row_kernel = selectSchwarzRowKernel(); // overlap test for a row of voxels, fastest one this CPU supports
 
-	// voxelize every triangle
-	while (reader.hasNext()) {
+	// voxelize every triangle, reading them in batches straight from the reader (no copies)
+	const typename P::Tri* batch = NULL;
+	size_t batch_size = 0;
+	size_t batch_pos = 0;
+	while (batch_pos < batch_size || reader.hasNext()) {
 		// read triangle
-		Triangle t;
-
-		vox_algo_timer.stop(); vox_io_in_timer.start();
-		reader.getTriangle(t);
-		vox_io_in_timer.stop(); vox_algo_timer.start();
+		if (batch_pos == batch_size) {
+			algo_timer.stop(); io_in_timer.start();
+			batch_size = reader.getTriangles(batch, voxelize_batchsize);
+			batch_pos = 0;
+			io_in_timer.stop(); algo_timer.start();
+		}
+		const typename P::Tri &t = batch[batch_pos++];
 
-#ifdef BINARY_VOXELIZATION
 		if (use_data){
 			if (data.size() > data_max_items){
 				if (verbose){
-					cout << "Sparseness optimization side-array overflowed, reverting to slower voxelization." << endl;
+					// geometry only drops the array and walks the occupancy bits, colored voxels need it: it's sorted in place instead
+					cout << "Sparseness optimization side-array overflowed, " << (P::geometry_only ? "reverting to slower voxelization." : "sorting it in place (slower).") << endl;
 					cout << data.size() << " > " << data_max_items << endl;
 				}
 				use_data = false;
 			}
 		}
-#endif
 
 		// compute triangle bbox in world and grid
 		//cout << "(" << t.v0[0] * unit_div << "," << t.v0[1] * unit_div << "," << t.v0[2] * unit_div << ")" << endl;
@@ -203,103 +194,51 @@ void voxelize_schwarz_method(TriReader &reader, const ::uint64_t morton_start, c
 		t_bbox_grid.max[2] = clampval<int>(t_bbox_grid.max[2], p_bbox_grid.min[2], p_bbox_grid.max[2]);
 
 		// COMMON PROPERTIES FOR THE TRIANGLE
-		vec3 e0 = t.v1 - t.v0;
-		vec3 e1 = t.v2 - t.v1;
-		vec3 e2 = t.v0 - t.v2;
-		vec3 n = normalize(cross(e0,e1)); // triangle normal
-		// PLANE TEST PROPERTIES
-		vec3 c = vec3(0.0f, 0.0f, 0.0f); // critical point
-		if (n[X] > 0) { c[X] = unitlength; }
-		if (n[Y] > 0) { c[Y] = unitlength; }
-		if (n[Z] > 0) { c[Z] = unitlength; }
-		float d1 = dot(n,c-t.v0);
-		float d2 = dot(n,(delta_p - c) - t.v0);
-		// PROJECTION TEST PROPERTIES
-		// XY plane
-		vec2 n_xy_e0 = vec2(-1.0f*e0[Y], e0[X]);
-		vec2 n_xy_e1 = vec2(-1.0f*e1[Y], e1[X]);
-		vec2 n_xy_e2 = vec2(-1.0f*e2[Y], e2[X]);
-		if (n[Z] < 0.0f) {
-			n_xy_e0 = -1.0f * n_xy_e0;
-			n_xy_e1 = -1.0f * n_xy_e1;
-			n_xy_e2 = -1.0f * n_xy_e2;
-		}
-		float d_xy_e0 = (-1.0f * dot(n_xy_e0,vec2(t.v0[X], t.v0[Y]))) + std::max(0.0f, unitlength*n_xy_e0[0]) + std::max(0.0f, unitlength*n_xy_e0[1]);
-		float d_xy_e1 = (-1.0f * dot(n_xy_e1,vec2(t.v1[X], t.v1[Y]))) + std::max(0.0f, unitlength*n_xy_e1[0]) + std::max(0.0f, unitlength*n_xy_e1[1]);
-		float d_xy_e2 = (-1.0f * dot(n_xy_e2,vec2(t.v2[X], t.v2[Y]))) + std::max(0.0f, unitlength*n_xy_e2[0]) + std::max(0.0f, unitlength*n_xy_e2[1]);
-		// YZ plane
-		vec2 n_yz_e0 = vec2(-1.0f*e0[Z], e0[Y]);
-		vec2 n_yz_e1 = vec2(-1.0f*e1[Z], e1[Y]);
-		vec2 n_yz_e2 = vec2(-1.0f*e2[Z], e2[Y]);
-		if (n[X] < 0.0f) {
-			n_yz_e0 = -1.0f * n_yz_e0;
-			n_yz_e1 = -1.0f * n_yz_e1;
-			n_yz_e2 = -1.0f * n_yz_e2;
-		}
-		float d_yz_e0 = (-1.0f * dot(n_yz_e0,vec2(t.v0[Y], t.v0[Z]))) + std::max(0.0f, unitlength*n_yz_e0[0]) + std::max(0.0f, unitlength*n_yz_e0[1]);
-		float d_yz_e1 = (-1.0f * dot(n_yz_e1,vec2(t.v1[Y], t.v1[Z]))) + std::max(0.0f, unitlength*n_yz_e1[0]) + std::max(0.0f, unitlength*n_yz_e1[1]);
-		float d_yz_e2 = (-1.0f * dot(n_yz_e2,vec2(t.v2[Y], t.v2[Z]))) + std::max(0.0f, unitlength*n_yz_e2[0]) + std::max(0.0f, unitlength*n_yz_e2[1]);
-		// ZX plane
-		vec2 n_zx_e0 = vec2(-1.0f*e0[X], e0[Z]);
-		vec2 n_zx_e1 = vec2(-1.0f*e1[X], e1[Z]);
-		vec2 n_zx_e2 = vec2(-1.0f*e2[X], e2[Z]);
-		if (n[Y] < 0.0f) {
-			n_zx_e0 = -1.0f * n_zx_e0;
-			n_zx_e1 = -1.0f * n_zx_e1;
-			n_zx_e2 = -1.0f * n_zx_e2;
-		}
-		float d_xz_e0 = (-1.0f * dot(n_zx_e0,vec2(t.v0[Z], t.v0[X]))) + std::max(0.0f, unitlength*n_zx_e0[0]) + std::max(0.0f, unitlength*n_zx_e0[1]);
-		float d_xz_e1 = (-1.0f * dot(n_zx_e1,vec2(t.v1[Z], t.v1[X]))) + std::max(0.0f, unitlength*n_zx_e1[0]) + std::max(0.0f, unitlength*n_zx_e1[1]);
-		float d_xz_e2 = (-1.0f * dot(n_zx_e2,vec2(t.v2[Z], t.v2[X]))) + std::max(0.0f, unitlength*n_zx_e2[0]) + std::max(0.0f, unitlength*n_zx_e2[1]);
-
-		// test possible grid boxes for overlap
-		for (int x = t_bbox_grid.min[0]; x <= t_bbox_grid.max[0]; x++){
-			for (int y = t_bbox_grid.min[1]; y <= t_bbox_grid.max[1]; y++){
-				for (int z = t_bbox_grid.min[2]; z <= t_bbox_grid.max[2]; z++){
-
-					::uint64_t index = morton3D_64_encode(x, y, z);
-
-					if (voxels[index - morton_start] == FULL_VOXEL){ continue; } // already marked, continue
-
-					// TRIANGLE PLANE THROUGH BOX TEST
-					vec3 p = vec3(x*unitlength, y*unitlength, z*unitlength);
-					float nDOTp = dot(n,p);
-					if ((nDOTp + d1) * (nDOTp + d2) > 0.0f){ continue; }
-
-					// PROJECTION TESTS
-					// XY
-					vec2 p_xy = vec2(p[X], p[Y]);
-					if ((dot(n_xy_e0,p_xy) + d_xy_e0) < 0.0f){ continue; }
-					if ((dot(n_xy_e1,p_xy) + d_xy_e1) < 0.0f){ continue; }
-					if ((dot(n_xy_e2,p_xy) + d_xy_e2) < 0.0f){ continue; }
-
-					// YZ
-					vec2 p_yz = vec2(p[Y], p[Z]);
-					if ((dot(n_yz_e0,p_yz) + d_yz_e0) < 0.0f){ continue; }
-					if ((dot(n_yz_e1,p_yz) + d_yz_e1) < 0.0f){ continue; }
-					if ((dot(n_yz_e2,p_yz) + d_yz_e2) < 0.0f){ continue; }
-
-					// XZ	
-					vec2 p_zx = vec2(p[Z], p[X]);
-					if ((dot(n_zx_e0,p_zx) + d_xz_e0) < 0.0f){ continue; }
-					if ((dot(n_zx_e1,p_zx) + d_xz_e1) < 0.0f){ continue; }
-					if ((dot(n_zx_e2,p_zx) + d_xz_e2) < 0.0f){ continue; }
-
-#ifdef BINARY_VOXELIZATION
-					voxels[index - morton_start] = FULL_VOXEL;
-					if (use_data){ data.push_back(index); }
-#else
-					voxels[index - morton_start] = FULL_VOXEL;
-					data.push_back(VoxelData(index, t.normal, average3Vec(t.v0_color, t.v1_color, t.v2_color))); // we ignore data limits for colored voxelization
-#endif
-					nfilled++;
-					continue;
+		SchwarzTriangle st;
+		setupSchwarzTriangle(t, unitlength, st);
+
+		// test possible grid boxes for overlap, a row of up to 8 voxels along z at a time
+		// the morton code is stepped along with the loops instead of encoding every box
+		SchwarzRow row;
+		::uint64_t index_x = morton3D_64_encode_dispatch(t_bbox_grid.min[0], t_bbox_grid.min[1], t_bbox_grid.min[2]);
+		for (int x = t_bbox_grid.min[0]; x <= t_bbox_grid.max[0]; x++, index_x = m3D_inc_x(index_x)){
+			::uint64_t index_y = index_x;
+			for (int y = t_bbox_grid.min[1]; y <= t_bbox_grid.max[1]; y++, index_y = m3D_inc_y(index_y)){
+				if (!setupSchwarzRow(st, unitlength, x, y, row)){ continue; } // XY projection test fails for the whole row
+				::uint64_t index_z0 = index_y;
+				for (int z0 = t_bbox_grid.min[2]; z0 <= t_bbox_grid.max[2]; z0 += 8, index_z0 = m3D_add_axis(index_z0, z_offsets[8], z_mask)){
+					unsigned int pass = row_kernel(row, z0, std::min(8, t_bbox_grid.max[2] - z0 + 1));
+					while (pass != 0){
+						::uint64_t index = m3D_add_axis(index_z0, z_offsets[lowestSetBit(pass)], z_mask);
+						pass &= pass - 1;
+
+						if (index - morton_start >= morton_range){ continue; } // in the bounding box, but another partition's voxel
+						if (isVoxelFull(voxels, index - morton_start)){ continue; } // already marked, continue
+
+						setVoxelFull(voxels, index - morton_start);
+						if (!P::geometry_only || use_data){ data.push_back(P::voxel(index, t)); }
+						nfilled++;
+					}
 				}
 			}
 		}
 	}
+	algo_timer.stop();
+#pragma omp critical(vox_timers)
+	{
+		vox_algo_timer.elapsed_time_milliseconds += algo_timer.elapsed_time_milliseconds;
+		vox_io_in_timer.elapsed_time_milliseconds += io_in_timer.elapsed_time_milliseconds;
+	}
 }
 
+// The payload policies svo_builder picks from
+template void voxelize_huang_method<GeometryPayload>(TriReader<GeometryTriangle>&, const ::uint64_t, const ::uint64_t, const float, size_t*, vector<::uint64_t>&, size_t&);
+template void voxelize_huang_method<ColorPayload>(TriReader<ColorTriangle>&, const ::uint64_t, const ::uint64_t, const float, size_t*, vector<VoxelData>&, size_t&);
+template void voxelize_huang_method<PackedColorPayload>(TriReader<ColorTriangle>&, const ::uint64_t, const ::uint64_t, const float, size_t*, vector<PackedVoxelData>&, size_t&);
+template void voxelize_schwarz_method<GeometryPayload>(TriReader<GeometryTriangle>&, const ::uint64_t, const ::uint64_t, const float, ::uint64_t*, vector<::uint64_t>&, const ::uint64_t, bool&, size_t&);
+template void voxelize_schwarz_method<ColorPayload>(TriReader<ColorTriangle>&, const ::uint64_t, const ::uint64_t, const float, ::uint64_t*, vector<VoxelData>&, const ::uint64_t, bool&, size_t&);
+template void voxelize_schwarz_method<PackedColorPayload>(TriReader<ColorTriangle>&, const ::uint64_t, const ::uint64_t, const float, ::uint64_t*, vector<PackedVoxelData>&, const ::uint64_t, bool&, size_t&);
+
 //#ifdef BINARY_VOXELIZATION
 //void voxelize_partition3(TriReader &reader, const uint64_t morton_start, const uint64_t morton_end, const float unitlength, char* voxels, vector<uint64_t> &data, float sparseness_limit, bool &use_data, size_t &nfilled){
 //	vox_algo_timer.start();
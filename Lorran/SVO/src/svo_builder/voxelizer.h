@@ -5,9 +5,13 @@
 #include "../libs/libtri/include/tri_tools.h"
 #include "../libs/libtri/include/TriReader.h"
 #include "../libs/libmorton/include/morton.h"
+#include "../libs/libmorton/include/morton_dispatch.h"
 #include "globals.h"
 #include "intersection.h"
 #include "VoxelData.h"
+#include "payloads.h"
+#include "voxelizer_kernels.h"
+#include "svo_builder_util.h"
 
 // Voxelization-related stuff
 typedef uvec3 uivec3;
@@ -16,17 +20,56 @@ using namespace std;
 #define EMPTY_VOXEL 0
 #define FULL_VOXEL 1
 
-#ifdef BINARY_VOXELIZATION
-void voxelize_huang_method(TriReader &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, bool* voxels, size_t &nfilled);
-#else
-void voxelize_huang_method(TriReader &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, size_t* voxels, vector<VoxelData>& voxel_data, size_t &nfilled);
-#endif
+// Occupancy of a partition: one bit per voxel, in morton order, 64 voxels per word
+inline size_t occupancyWords(const ::uint64_t n_voxels){
+	return static_cast<size_t>((n_voxels + 63) / 64);
+}
+
+inline bool isVoxelFull(const ::uint64_t* voxels, const ::uint64_t i){
+	return ((voxels[i >> 6] >> (i & 63)) & 1) != 0;
+}
+
+inline void setVoxelFull(::uint64_t* voxels, const ::uint64_t i){
+	voxels[i >> 6] |= (::uint64_t(1) << (i & 63));
+}
 
-#ifdef BINARY_VOXELIZATION
-void voxelize_schwarz_method(TriReader &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, char* voxels, vector<::uint64_t> &data, float sparseness_limit, bool &use_data, size_t &nfilled);
+// Set a voxel when several threads fill the same partition, returns if it was already full
+inline bool atomicSetVoxelFull(::uint64_t* voxels, const ::uint64_t i){
+	::uint64_t bit = ::uint64_t(1) << (i & 63);
+#ifdef _MSC_VER
+	return (_InterlockedOr64(reinterpret_cast<volatile __int64*>(&voxels[i >> 6]), bit) & bit) != 0;
 #else
-void voxelize_schwarz_method(TriReader &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, char* voxels, vector<VoxelData> &data, float sparseness_limit, bool &use_data, size_t &nfilled);
+	return (__atomic_fetch_or(&voxels[i >> 6], bit, __ATOMIC_RELAXED) & bit) != 0;
 #endif
+}
+
+// Grid bounding box of the morton range [start, end), which doesn't have to be a cube (adaptive partitions):
+// walk the range as the biggest aligned cubes that fit, and combine their corners
+inline AABox<uivec3> mortonRangeBBox(::uint64_t start, const ::uint64_t end){
+	AABox<uivec3> bbox;
+	bool first = true;
+	while (start < end){
+		::uint64_t size = 1;
+		while (size <= (end - start) / 8 && (start & (size * 8 - 1)) == 0){ size *= 8; }
+		uivec3 lo, hi;
+		morton3D_64_decode_dispatch(start, lo[0], lo[1], lo[2]);
+		morton3D_64_decode_dispatch(start + size - 1, hi[0], hi[1], hi[2]);
+		bbox.min = first ? lo : glm::min(bbox.min, lo);
+		bbox.max = first ? hi : glm::max(bbox.max, hi);
+		first = false;
+		start += size;
+	}
+	return bbox;
+}
+
+// P is the payload policy (see payloads.h): voxel_data/data gets a P::Voxel for every filled voxel
+template <class P>
+void voxelize_huang_method(TriReader<typename P::Tri> &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, size_t* voxels, vector<typename P::Voxel>& voxel_data, size_t &nfilled);
+
+// use_data tells whether the side array data stayed under data_max_bytes. Geometry only, data is dropped past it (the
+// occupancy bits still have every voxel); colored voxels are only in data, so it keeps them all.
+template <class P>
+void voxelize_schwarz_method(TriReader<typename P::Tri> &reader, const ::uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, ::uint64_t* voxels, vector<typename P::Voxel> &data, const ::uint64_t data_max_bytes, bool &use_data, size_t &nfilled);
 
 //#ifdef BINARY_VOXELIZATION
 //void voxelize_partition3(TriReader &reader, const uint64_t morton_start, const ::uint64_t morton_end, const float unitlength, char* voxels, vector<::uint64_t> &data, float sparseness_limit, bool &use_data, size_t &nfilled);
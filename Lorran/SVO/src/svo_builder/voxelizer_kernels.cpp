@@ -0,0 +1,90 @@
+#include "voxelizer_kernels.h"
+
+// SIMD kernels need GCC/Clang on x86 (function-level target attributes and __builtin_cpu_supports)
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define VOXELIZER_SIMD
+#include <immintrin.h>
+#endif
+
+unsigned int schwarzRowScalar(const SchwarzRow &r, const int z0, const int count){
+	unsigned int pass = 0;
+	for (int i = 0; i < count; i++) {
+		if (schwarzRowTest(r, z0 + i)) { pass |= (1u << i); }
+	}
+	return pass;
+}
+
+#ifdef VOXELIZER_SIMD
+
+bool cpuSupportsSSE4(){
+	return __builtin_cpu_supports("sse4.1") != 0;
+}
+
+bool cpuSupportsAVX2(){
+	return __builtin_cpu_supports("avx2") != 0;
+}
+
+// 4 voxels at a time. Comparisons are ordered: a NaN fails no test, just like in the scalar code.
+__attribute__((target("sse4.1")))
+static inline int schwarzFail4(const SchwarzRow &r, const __m128 p_z){
+	const __m128 zero = _mm_setzero_ps();
+	__m128 ndotp = _mm_add_ps(_mm_set1_ps(r.row_ndotp), _mm_mul_ps(_mm_set1_ps(r.n_z), p_z));
+	__m128 plane = _mm_mul_ps(_mm_add_ps(ndotp, _mm_set1_ps(r.d1)), _mm_add_ps(ndotp, _mm_set1_ps(r.d2)));
+	__m128 fail = _mm_cmpgt_ps(plane, zero);
+	for (int i = 0; i < 3; i++) {
+		__m128 yz = _mm_add_ps(_mm_add_ps(_mm_set1_ps(r.row_yz[i]), _mm_mul_ps(_mm_set1_ps(r.n_yz_z[i]), p_z)), _mm_set1_ps(r.d_yz[i]));
+		__m128 zx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(r.n_zx_z[i]), p_z), _mm_set1_ps(r.row_zx[i])), _mm_set1_ps(r.d_zx[i]));
+		fail = _mm_or_ps(fail, _mm_or_ps(_mm_cmplt_ps(yz, zero), _mm_cmplt_ps(zx, zero)));
+	}
+	return _mm_movemask_ps(fail);
+}
+
+__attribute__((target("sse4.1")))
+unsigned int schwarzRowSSE4(const SchwarzRow &r, const int z0, const int count){
+	const __m128 unit = _mm_set1_ps(r.unitlength);
+	__m128i z = _mm_add_epi32(_mm_set1_epi32(z0), _mm_setr_epi32(0, 1, 2, 3));
+	int fail = schwarzFail4(r, _mm_mul_ps(_mm_cvtepi32_ps(z), unit));
+	if (count > 4) {
+		z = _mm_add_epi32(z, _mm_set1_epi32(4));
+		fail |= schwarzFail4(r, _mm_mul_ps(_mm_cvtepi32_ps(z), unit)) << 4;
+	}
+	return ~fail & ((1u << count) - 1);
+}
+
+__attribute__((target("avx2")))
+unsigned int schwarzRowAVX2(const SchwarzRow &r, const int z0, const int count){
+	const __m256 zero = _mm256_setzero_ps();
+	__m256i z = _mm256_add_epi32(_mm256_set1_epi32(z0), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256 p_z = _mm256_mul_ps(_mm256_cvtepi32_ps(z), _mm256_set1_ps(r.unitlength));
+	__m256 ndotp = _mm256_add_ps(_mm256_set1_ps(r.row_ndotp), _mm256_mul_ps(_mm256_set1_ps(r.n_z), p_z));
+	__m256 plane = _mm256_mul_ps(_mm256_add_ps(ndotp, _mm256_set1_ps(r.d1)), _mm256_add_ps(ndotp, _mm256_set1_ps(r.d2)));
+	__m256 fail = _mm256_cmp_ps(plane, zero, _CMP_GT_OQ);
+	for (int i = 0; i < 3; i++) {
+		__m256 yz = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(r.row_yz[i]), _mm256_mul_ps(_mm256_set1_ps(r.n_yz_z[i]), p_z)), _mm256_set1_ps(r.d_yz[i]));
+		__m256 zx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(r.n_zx_z[i]), p_z), _mm256_set1_ps(r.row_zx[i])), _mm256_set1_ps(r.d_zx[i]));
+		fail = _mm256_or_ps(fail, _mm256_or_ps(_mm256_cmp_ps(yz, zero, _CMP_LT_OQ), _mm256_cmp_ps(zx, zero, _CMP_LT_OQ)));
+	}
+	return ~_mm256_movemask_ps(fail) & ((1u << count) - 1);
+}
+
+#else
+
+// No SIMD kernels on this compiler/platform: everything goes through the scalar kernel
+bool cpuSupportsSSE4(){ return false; }
+bool cpuSupportsAVX2(){ return false; }
+unsigned int schwarzRowSSE4(const SchwarzRow &r, const int z0, const int count){ return schwarzRowScalar(r, z0, count); }
+unsigned int schwarzRowAVX2(const SchwarzRow &r, const int z0, const int count){ return schwarzRowScalar(r, z0, count); }
+
+#endif
+
+SchwarzRowKernel selectSchwarzRowKernel(){
+	if (cpuSupportsAVX2()) { return &schwarzRowAVX2; }
+	if (cpuSupportsSSE4()) { return &schwarzRowSSE4; }
+	return &schwarzRowScalar;
+}
+
+const char* schwarzRowKernelName(SchwarzRowKernel kernel){
+	if (kernel == &schwarzRowAVX2) { return "AVX2"; }
+	if (kernel == &schwarzRowSSE4) { return "SSE4.1"; }
+	return "scalar";
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include "../libs/libtri/include/tri_util.h"
+
+using namespace std;
+using namespace glm;
+
+// Schwarz-Seidel triangle/box overlap test, split up so a row of voxels along z can be tested at once.
+// Every expression is evaluated in the same order as the original per-voxel test, so all kernels agree bit-exactly.
+
+// Properties of a triangle for the overlap test (only depend on the triangle and the unit length)
+struct SchwarzTriangle {
+	vec3 n; // triangle normal
+	float d1, d2; // plane test
+	vec2 n_xy_e[3], n_yz_e[3], n_zx_e[3]; // edge normals in the three projections
+	float d_xy_e[3], d_yz_e[3], d_zx_e[3];
+};
+
+// Everything of the overlap test that is constant along a row (x, y, *): the XY projection test passes
+// for the whole row or for none of it, and the x and y parts of the other dot products only need computing once.
+struct SchwarzRow {
+	float unitlength;
+	// plane test: dot(n, p) = row_ndotp + n_z * p_z
+	float n_z, row_ndotp, d1, d2;
+	// YZ projection: dot(n_yz_e, (p_y, p_z)) = row_yz + n_yz_z * p_z
+	float row_yz[3], n_yz_z[3], d_yz[3];
+	// ZX projection: dot(n_zx_e, (p_z, p_x)) = n_zx_z * p_z + row_zx
+	float n_zx_z[3], row_zx[3], d_zx[3];
+};
+
+// Row kernel: test voxels z0 .. z0 + count - 1 (count <= 8) of a row, bit i of the result is set if voxel z0 + i overlaps
+typedef unsigned int (*SchwarzRowKernel)(const SchwarzRow &r, const int z0, const int count);
+
+// Pick the fastest row kernel this CPU supports (AVX2, SSE4.1 or scalar), and its name for reporting
+SchwarzRowKernel selectSchwarzRowKernel();
+const char* schwarzRowKernelName(SchwarzRowKernel kernel);
+unsigned int schwarzRowScalar(const SchwarzRow &r, const int z0, const int count);
+unsigned int schwarzRowSSE4(const SchwarzRow &r, const int z0, const int count);
+unsigned int schwarzRowAVX2(const SchwarzRow &r, const int z0, const int count);
+bool cpuSupportsSSE4();
+bool cpuSupportsAVX2();
+
+template <class T>
+inline void setupSchwarzTriangle(const T &t, const float unitlength, SchwarzTriangle &s){
+	vec3 delta_p = vec3(unitlength, unitlength, unitlength);
+	vec3 e[3] = { t.v1 - t.v0, t.v2 - t.v1, t.v0 - t.v2 };
+	const vec3* v[3] = { &t.v0, &t.v1, &t.v2 };
+	s.n = normalize(cross(e[0], e[1])); // triangle normal
+	// PLANE TEST PROPERTIES
+	vec3 c = vec3(0.0f, 0.0f, 0.0f); // critical point
+	if (s.n.x > 0) { c.x = unitlength; }
+	if (s.n.y > 0) { c.y = unitlength; }
+	if (s.n.z > 0) { c.z = unitlength; }
+	s.d1 = dot(s.n, c - t.v0);
+	s.d2 = dot(s.n, (delta_p - c) - t.v0);
+	// PROJECTION TEST PROPERTIES
+	for (int i = 0; i < 3; i++) {
+		// XY plane
+		s.n_xy_e[i] = vec2(-1.0f*e[i].y, e[i].x);
+		if (s.n.z < 0.0f) { s.n_xy_e[i] = -1.0f * s.n_xy_e[i]; }
+		s.d_xy_e[i] = (-1.0f * dot(s.n_xy_e[i], vec2(v[i]->x, v[i]->y))) + std::max(0.0f, unitlength*s.n_xy_e[i][0]) + std::max(0.0f, unitlength*s.n_xy_e[i][1]);
+		// YZ plane
+		s.n_yz_e[i] = vec2(-1.0f*e[i].z, e[i].y);
+		if (s.n.x < 0.0f) { s.n_yz_e[i] = -1.0f * s.n_yz_e[i]; }
+		s.d_yz_e[i] = (-1.0f * dot(s.n_yz_e[i], vec2(v[i]->y, v[i]->z))) + std::max(0.0f, unitlength*s.n_yz_e[i][0]) + std::max(0.0f, unitlength*s.n_yz_e[i][1]);
+		// ZX plane
+		s.n_zx_e[i] = vec2(-1.0f*e[i].x, e[i].z);
+		if (s.n.y < 0.0f) { s.n_zx_e[i] = -1.0f * s.n_zx_e[i]; }
+		s.d_zx_e[i] = (-1.0f * dot(s.n_zx_e[i], vec2(v[i]->z, v[i]->x))) + std::max(0.0f, unitlength*s.n_zx_e[i][0]) + std::max(0.0f, unitlength*s.n_zx_e[i][1]);
+	}
+}
+
+// Set up the row (x, y, *) of the test. Returns false if the XY projection test rules out the whole row.
+inline bool setupSchwarzRow(const SchwarzTriangle &s, const float unitlength, const int x, const int y, SchwarzRow &r){
+	float p_x = x*unitlength;
+	float p_y = y*unitlength;
+	// XY
+	vec2 p_xy = vec2(p_x, p_y);
+	for (int i = 0; i < 3; i++) {
+		if ((dot(s.n_xy_e[i], p_xy) + s.d_xy_e[i]) < 0.0f){ return false; }
+	}
+	r.unitlength = unitlength;
+	r.n_z = s.n.z;
+	r.row_ndotp = s.n.x * p_x + s.n.y * p_y;
+	r.d1 = s.d1;
+	r.d2 = s.d2;
+	for (int i = 0; i < 3; i++) {
+		r.row_yz[i] = s.n_yz_e[i][0] * p_y;
+		r.n_yz_z[i] = s.n_yz_e[i][1];
+		r.d_yz[i] = s.d_yz_e[i];
+		r.n_zx_z[i] = s.n_zx_e[i][0];
+		r.row_zx[i] = s.n_zx_e[i][1] * p_x;
+		r.d_zx[i] = s.d_zx_e[i];
+	}
+	return true;
+}
+
+// Test a single voxel (x, y, z) of a row
+inline bool schwarzRowTest(const SchwarzRow &r, const int z){
+	float p_z = z*r.unitlength;
+	// TRIANGLE PLANE THROUGH BOX TEST
+	float nDOTp = r.row_ndotp + r.n_z * p_z;
+	if ((nDOTp + r.d1) * (nDOTp + r.d2) > 0.0f){ return false; }
+	// PROJECTION TESTS
+	for (int i = 0; i < 3; i++) {
+		if (((r.row_yz[i] + r.n_yz_z[i] * p_z) + r.d_yz[i]) < 0.0f){ return false; }
+	}
+	for (int i = 0; i < 3; i++) {
+		if (((r.n_zx_z[i] * p_z + r.row_zx[i]) + r.d_zx[i]) < 0.0f){ return false; }
+	}
+	return true;
+}
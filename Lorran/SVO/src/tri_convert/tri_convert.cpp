@@ -7,6 +7,8 @@
 #include <string>
 #include <sstream>
 #include "tri_convert_util.h"
+#include "../libs/libtri/include/tri_compress.h"
+#include "../libs/libtri/include/tri_indexed.h"
 
 using namespace std;
 using namespace trimesh;
@@ -17,15 +19,14 @@ string version = "1.6 alpha";
 // Program parameters
 string filename = "";
 bool recompute_normals = false;
+bool compress = false;
+bool indexed = false;
+bool binary = false;
 glm::vec3 fixed_color = glm::vec3(1.0f, 1.0f, 1.0f);
 
 void printInfo(){
 	cout << "-------------------------------------------------------------" << endl;
-#ifdef BINARY_VOXELIZATION
-	cout << "Tri Converter " << version << " - BINARY VOXELIZATION"<< endl;
-#else
-	cout << "Tri Converter " << version << " - GEOMETRY+NORMALS"<< endl;
-#endif
+	cout << "Tri Converter " << version << endl;
 #if defined(_WIN32) || defined(_WIN64)
 	cout << "Windows ";
 #endif
@@ -46,6 +47,9 @@ void printHelp(){
 	std::cout << "" << endl;
 	std::cout << "-f <filename>         Path to a model input file (.ply, .obj, .3ds, .sm, .ray or .off)." << endl;
 	std::cout << "-r                    Recompute face normals." << endl;
+	std::cout << "-compress             Write a compressed .tridata stream (quantized, LZ-coded blocks)." << endl;
+	std::cout << "-indexed              Write an indexed mesh: shared vertices in .trivertices, index triples in .tridata." << endl;
+	std::cout << "-binary               Write geometry only (no normals or colors), for binary voxelization." << endl;
 	std::cout << "-h                    Print help and exit." << endl;
 }
 
@@ -65,6 +69,12 @@ void parseProgramParameters(int argc, char* argv[]){
 				i++;
 			} else if (string(argv[i]) == "-r") {
 				recompute_normals = true;
+			} else if (string(argv[i]) == "-compress") {
+				compress = true;
+			} else if (string(argv[i]) == "-indexed") {
+				indexed = true;
+			} else if (string(argv[i]) == "-binary") {
+				binary = true;
 			} else if(string(argv[i]) == "-h") {
 				printHelp(); exit(0);
 			} else {
@@ -73,62 +83,91 @@ void parseProgramParameters(int argc, char* argv[]){
 	}
 	cout << "  filename: " << filename << endl;
 	cout << "  recompute normals: " << recompute_normals << endl;
-}
-
-int main(int argc, char *argv[]){
-	printInfo();
-
-	// Parse parameters
-	parseProgramParameters(argc,argv);
-
-	// Read mesh
-	TriMesh *themesh = TriMesh::read(filename.c_str());
-	themesh->need_faces(); // unpack triangle strips so we have faces
-	themesh->need_bbox(); // compute the bounding box
-#ifndef BINARY_VOXELIZATION
-	themesh->need_normals(); // check if there are normals, and if not, recompute them
-	// TODO: Check for colors here, inform user about decision
-#endif
-	AABox<glm::vec3> mesh_bbox = createMeshBBCube(themesh); // pad the mesh BBOX out to be a cube
-
-	// Moving mesh to origin
-	cout << "Moving mesh to origin ... "; 
-	Timer timer = Timer();
-	for(size_t i = 0; i < themesh->vertices.size() ; i++){
-		themesh->vertices[i] = themesh->vertices[i] - toTriMesh(mesh_bbox.min);
+	if (compress && indexed) {
+		cout << "Pick one of -compress and -indexed" << endl;
+		printInvalid(); exit(0);
 	}
-	cout << "done in " << timer.elapsed_time_milliseconds << " s." << endl;
+	cout << "  compressed: " << compress << endl;
+	cout << "  indexed: " << indexed << endl;
+	cout << "  geometry only: " << binary << endl;
+}
 
-	// Write mesh to format we can stream in
-	string base = filename.substr(0,filename.find_last_of("."));
+// Write the moved mesh as .tri/.tridata (and .trivertices), with triangle records T (GeometryTriangle for -binary)
+template <typename T>
+void writeTriFiles(TriMesh *themesh, const AABox<glm::vec3> &mesh_bbox, const string &base){
 	std::string tri_header_out_name = base + string(".tri");
 	std::string tri_out_name = base + string(".tridata");
 
-	FILE* tri_out = fopen(tri_out_name.c_str(), "w");
+	if (indexed) {
+		// the mesh is already indexed: keep its vertices and faces, writeIndexedMesh puts them in morton order
+		cout << "Writing indexed mesh ... "; Timer timer = Timer();
+		vector<TriVertex<T> > vertices(themesh->vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++){
+			vertices[i].position = toGLM(themesh->vertices[i]);
+			if (!T::geometry_only && !themesh->colors.empty()) { vertices[i].setColor(toGLM(themesh->colors[i])); }
+		}
+		vector<IndexedTriangle<T> > triangles(themesh->faces.size());
+		for (size_t i = 0; i < triangles.size(); i++){
+			for (int k = 0; k < 3; k++){ triangles[i].v[k] = static_cast< ::uint32_t>(themesh->faces[i][k]); }
+			if (!T::geometry_only) { triangles[i].setNormal(recompute_normals ? computeFaceNormal(themesh, i) : getShadingFaceNormal(themesh, i)); }
+		}
+		writeIndexedMesh(base, vertices, triangles, AABox<glm::vec3>(glm::vec3(0.0f), mesh_bbox.max - mesh_bbox.min));
+		cout << "done in " << timer.elapsed_time_milliseconds << " ms." << endl;
+
+		cout << "Writing header to " << tri_header_out_name << " ... " << endl;
+		TriInfo tri_info;
+		tri_info.version = 1;
+		tri_info.mesh_bbox = mesh_bbox;
+		tri_info.n_triangles = triangles.size();
+		tri_info.indexed = 1;
+		tri_info.n_vertices = vertices.size();
+		tri_info.geometry_only = T::geometry_only ? 1 : 0;
+		writeTriHeader(tri_header_out_name, tri_info);
+		tri_info.print();
+		cout << "Done." << endl;
+		return;
+	}
+
+	FILE* tri_out = fopen(tri_out_name.c_str(), "wb");
+	// compressed: triangles are collected and written a batch of blocks at a time, on a lattice over the (moved) bbox
+	TriBlockWriter<T>* compressor = NULL;
+	vector<T> batch;
+	if (compress) {
+		compressor = new TriBlockWriter<T>(tri_out, triLattice(AABox<glm::vec3>(glm::vec3(0.0f), mesh_bbox.max - mesh_bbox.min)));
+		batch.reserve(16 * TRIZ_BLOCK_TRIANGLES);
+	}
 
-	cout << "Writing mesh triangles ... "; timer.reset();
-	Triangle t = Triangle();
+	cout << "Writing mesh triangles ... "; Timer timer = Timer();
+	T t = T();
 	// Write all triangles to data file
 	for(size_t i = 0; i < themesh->faces.size(); i++){
 		t.v0 = toGLM(themesh->vertices[themesh->faces[i][0]]);
 		t.v1 = toGLM(themesh->vertices[themesh->faces[i][1]]);
 		t.v2 = toGLM(themesh->vertices[themesh->faces[i][2]]);
-#ifndef BINARY_VOXELIZATION
-		// COLLECT VERTEX COLORS
-		if(!themesh->colors.empty()){ // if this mesh has colors, we're going to use them
-			t.v0_color = toGLM(themesh->colors[themesh->faces[i][0]]);
-			t.v1_color = toGLM(themesh->colors[themesh->faces[i][1]]);
-			t.v2_color = toGLM(themesh->colors[themesh->faces[i][2]]);
-		} 
-		// COLLECT NORMALS
-		if(recompute_normals){
-			t.normal = computeFaceNormal(themesh,i); // recompute normals
+		if (!T::geometry_only) {
+			// COLLECT VERTEX COLORS
+			if(!themesh->colors.empty()){ // if this mesh has colors, we're going to use them
+				t.setColors(toGLM(themesh->colors[themesh->faces[i][0]]), toGLM(themesh->colors[themesh->faces[i][1]]), toGLM(themesh->colors[themesh->faces[i][2]]));
+			} 
+			// COLLECT NORMALS
+			if(recompute_normals){
+				t.setNormal(computeFaceNormal(themesh,i)); // recompute normals
+			} else {
+				t.setNormal(getShadingFaceNormal(themesh,i)); // use mesh provided normals
+			}
+		}
+		if (compressor == NULL) {
+			writeTriangle(tri_out,t);
 		} else {
-			t.normal = getShadingFaceNormal(themesh,i); // use mesh provided normals
+			batch.push_back(t);
+			if (batch.size() == 16 * TRIZ_BLOCK_TRIANGLES) { compressor->write(&batch[0], batch.size()); batch.clear(); }
 		}
-#endif
-		writeTriangle(tri_out,t);
 	}
+	if (compressor != NULL) {
+		if (!batch.empty()) { compressor->write(&batch[0], batch.size()); }
+		delete compressor;
+	}
+	fclose(tri_out);
 	cout << "done in " << timer.elapsed_time_milliseconds << " ms." << endl;
 
 	// Prepare tri_info and write header
@@ -137,12 +176,42 @@ int main(int argc, char *argv[]){
 	tri_info.version = 1;
 	tri_info.mesh_bbox = mesh_bbox;
 	tri_info.n_triangles = themesh->faces.size();
-#ifdef BINARY_VOXELIZATION
-	tri_info.geometry_only = 1;
-#else
-	tri_info.geometry_only = 0;
-#endif
+	tri_info.compressed = compress ? 1 : 0;
+	tri_info.geometry_only = T::geometry_only ? 1 : 0;
 	writeTriHeader(tri_header_out_name, tri_info);
 	tri_info.print();
 	cout << "Done." << endl;
 }
+
+int main(int argc, char *argv[]){
+	printInfo();
+
+	// Parse parameters
+	parseProgramParameters(argc,argv);
+
+	// Read mesh
+	TriMesh *themesh = TriMesh::read(filename.c_str());
+	themesh->need_faces(); // unpack triangle strips so we have faces
+	themesh->need_bbox(); // compute the bounding box
+	if (!binary) {
+		themesh->need_normals(); // check if there are normals, and if not, recompute them
+		// TODO: Check for colors here, inform user about decision
+	}
+	AABox<glm::vec3> mesh_bbox = createMeshBBCube(themesh); // pad the mesh BBOX out to be a cube
+
+	// Moving mesh to origin
+	cout << "Moving mesh to origin ... "; 
+	Timer timer = Timer();
+	for(size_t i = 0; i < themesh->vertices.size() ; i++){
+		themesh->vertices[i] = themesh->vertices[i] - toTriMesh(mesh_bbox.min);
+	}
+	cout << "done in " << timer.elapsed_time_milliseconds << " s." << endl;
+
+	// Write mesh to format we can stream in
+	string base = filename.substr(0,filename.find_last_of("."));
+	if (binary) {
+		writeTriFiles<GeometryTriangle>(themesh, mesh_bbox, base);
+	} else {
+		writeTriFiles<ColorTriangle>(themesh, mesh_bbox, base);
+	}
+}
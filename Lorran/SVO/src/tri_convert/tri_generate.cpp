@@ -0,0 +1,347 @@
+// Synthetic mesh generator: writes procedural meshes straight to .tri/.tridata, so the svo_builder pipeline can be
+// benchmarked at any triangle count without shipping models (see linux/benchmark.sh).
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <cstring>
+#include <unordered_map>
+#include "timer.h"
+#include "../libs/libtri/include/tri_util.h"
+#include "../libs/libtri/include/tri_tools.h"
+#include "../libs/libtri/include/tri_compress.h"
+#include "../libs/libtri/include/tri_indexed.h"
+
+using namespace std;
+
+// Program version
+string version = "1.6 alpha";
+
+// Program parameters
+string shape = "sphere";
+string base_filename = "";
+size_t n_triangles = 100000;
+size_t n_clusters = 0; // triangle soup: 0 = uniform, otherwise gaussian clusters
+unsigned int seed = 1;
+bool compress = false;
+bool indexed = false;
+bool binary = false;
+
+void printInfo(){
+	cout << "-------------------------------------------------------------" << endl;
+	cout << "Tri Generator " << version << endl;
+	cout << "-------------------------------------------------------------" << endl << endl;
+}
+
+void printHelp(){
+	std::cout << "Example: tri_generate -shape terrain -n 1000000 -o terrain1m" << endl;
+	std::cout << "" << endl;
+	std::cout << "All available program options:" << endl;
+	std::cout << "" << endl;
+	std::cout << "-shape <shape>        Procedural mesh (Options: sphere (default), terrain, soup)" << endl;
+	std::cout << "-n <triangles>        Approximate number of triangles. Default 100000." << endl;
+	std::cout << "-clusters <k>         Triangle soup: spread the triangles over k gaussian clusters instead of uniformly." << endl;
+	std::cout << "-seed <seed>          Random seed (terrain and soup). Default 1." << endl;
+	std::cout << "-compress             Write a compressed .tridata stream (quantized, LZ-coded blocks)." << endl;
+	std::cout << "-indexed              Write an indexed mesh: shared vertices in <basename>.trivertices, index triples in .tridata." << endl;
+	std::cout << "-binary               Write geometry only (no normals or colors), for binary voxelization." << endl;
+	std::cout << "-o <basename>         Output files <basename>.tri and <basename>.tridata. Default: <shape>_<n>." << endl;
+	std::cout << "-h                    Print help and exit." << endl;
+}
+
+void printInvalid(){
+	std::cout << "Not enough or invalid arguments, please try again.\n" << endl;
+	printHelp();
+}
+
+void parseProgramParameters(int argc, char* argv[]){
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "-shape" && i + 1 < argc) {
+			shape = argv[i + 1];
+			if (shape != "sphere" && shape != "terrain" && shape != "soup") {
+				cout << "Unknown shape " << shape << endl;
+				printInvalid(); exit(0);
+			}
+			i++;
+		} else if (string(argv[i]) == "-n" && i + 1 < argc) {
+			n_triangles = strtoull(argv[i + 1], NULL, 10);
+			if (n_triangles < 8) {
+				cout << "Requested triangle count should be at least 8" << endl;
+				printInvalid(); exit(0);
+			}
+			i++;
+		} else if (string(argv[i]) == "-clusters" && i + 1 < argc) {
+			n_clusters = strtoull(argv[i + 1], NULL, 10);
+			i++;
+		} else if (string(argv[i]) == "-seed" && i + 1 < argc) {
+			seed = static_cast<unsigned int>(atoi(argv[i + 1]));
+			i++;
+		} else if (string(argv[i]) == "-o" && i + 1 < argc) {
+			base_filename = argv[i + 1];
+			i++;
+		} else if (string(argv[i]) == "-compress") {
+			compress = true;
+		} else if (string(argv[i]) == "-indexed") {
+			indexed = true;
+		} else if (string(argv[i]) == "-binary") {
+			binary = true;
+		} else if (string(argv[i]) == "-h") {
+			printHelp(); exit(0);
+		} else {
+			printInvalid(); exit(0);
+		}
+	}
+	if (compress && indexed) {
+		cout << "Pick one of -compress and -indexed" << endl;
+		printInvalid(); exit(0);
+	}
+	if (base_filename.empty()) {
+		base_filename = shape + string("_") + val_to_string(n_triangles);
+	}
+	cout << "  shape: " << shape << endl;
+	cout << "  triangles: " << n_triangles << endl;
+	if (shape == "soup") { cout << "  clusters: " << n_clusters << endl; }
+	cout << "  seed: " << seed << endl;
+	cout << "  compressed: " << compress << endl;
+	cout << "  indexed: " << indexed << endl;
+	cout << "  geometry only: " << binary << endl;
+	cout << "  output: " << base_filename << ".tri" << endl;
+}
+
+// Vertices with exactly the same position are one shared vertex of an indexed mesh (colors come from the position)
+struct VertexKey {
+	::uint32_t bits[3];
+	bool operator==(const VertexKey &o) const { return bits[0] == o.bits[0] && bits[1] == o.bits[1] && bits[2] == o.bits[2]; }
+};
+
+struct VertexKeyHash {
+	size_t operator()(const VertexKey &k) const { return static_cast<size_t>((k.bits[0] * 0x9E3779B97F4A7C15ull) ^ (k.bits[1] * 0xC2B2AE3D27D4EB4Full) ^ (k.bits[2] * 0x165667B19E3779F9ull)); }
+};
+
+// Streams triangles to the .tridata file. All shapes live in the unit cube, which is the mesh bbox.
+// An indexed mesh is gathered in memory instead, and written when the writer closes.
+// T is the triangle record: GeometryTriangle (-binary) or ColorTriangle.
+template <typename T>
+class TriangleWriter {
+public:
+	size_t count;
+
+	TriangleWriter(const string &base, bool compress, bool indexed) : count(0), out(NULL), compressor(NULL), base(base), indexed(indexed) {
+		if (indexed) { return; }
+		string filename = base + string(".tridata");
+		out = fopen(filename.c_str(), "wb");
+		if (out == NULL) {
+			cout << "Could not open " << filename << " for writing." << endl;
+			exit(1);
+		}
+		if (compress) { compressor = new TriBlockWriter<T>(out, triLattice(AABox<glm::vec3>(glm::vec3(0.0f), glm::vec3(1.0f)))); }
+		buffer.reserve(BUFFER_TRIANGLES);
+	}
+
+	~TriangleWriter(){
+		if (indexed) {
+			writeIndexedMesh(base, vertices, triangles, AABox<glm::vec3>(glm::vec3(0.0f), glm::vec3(1.0f)));
+			return;
+		}
+		flush();
+		delete compressor;
+		fclose(out);
+	}
+
+	size_t vertexCount() const { return vertices.size(); }
+
+	// Vertex colors come from the vertex positions, the normal is the face normal
+	void add(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2){
+		T t;
+		t.v0 = v0;
+		t.v1 = v1;
+		t.v2 = v2;
+		if (!T::geometry_only) {
+			glm::vec3 n = glm::cross(v1 - v0, v2 - v0);
+			t.setNormal(glm::length(n) > 0.0f ? glm::normalize(n) : glm::vec3(0.0f, 0.0f, 1.0f));
+			t.setColors(glm::clamp(v0, 0.0f, 1.0f), glm::clamp(v1, 0.0f, 1.0f), glm::clamp(v2, 0.0f, 1.0f));
+		}
+		if (indexed) {
+			IndexedTriangle<T> it;
+			it.v[0] = vertexIndex(v0);
+			it.v[1] = vertexIndex(v1);
+			it.v[2] = vertexIndex(v2);
+			it.setNormal(t.getNormal());
+			triangles.push_back(it);
+			count++;
+			return;
+		}
+		buffer.push_back(t);
+		count++;
+		if (buffer.size() == BUFFER_TRIANGLES) { flush(); }
+	}
+
+private:
+	static const size_t BUFFER_TRIANGLES = 1 << 16;
+	FILE* out;
+	TriBlockWriter<T>* compressor; // NULL: raw triangles
+	vector<T> buffer;
+
+	// indexed mesh
+	string base;
+	bool indexed;
+	vector<TriVertex<T> > vertices;
+	vector<IndexedTriangle<T> > triangles;
+	unordered_map<VertexKey, ::uint32_t, VertexKeyHash> vertex_ids;
+
+	::uint32_t vertexIndex(const glm::vec3 &p){
+		VertexKey k;
+		memcpy(k.bits, &p[0], sizeof(k.bits));
+		unordered_map<VertexKey, ::uint32_t, VertexKeyHash>::iterator it = vertex_ids.find(k);
+		if (it != vertex_ids.end()) { return it->second; }
+		TriVertex<T> v;
+		v.position = p;
+		v.setColor(glm::clamp(p, 0.0f, 1.0f));
+		::uint32_t id = static_cast< ::uint32_t>(vertices.size());
+		vertices.push_back(v);
+		vertex_ids[k] = id;
+		return id;
+	}
+
+	void flush(){
+		if (buffer.empty()) { return; }
+		if (compressor != NULL) { compressor->write(&buffer[0], buffer.size()); }
+		else { writeTriangles(out, buffer[0], buffer.size()); }
+		buffer.clear();
+	}
+};
+
+// Tessellated sphere (latitude/longitude): evenly spread over a thin shell
+template <typename T>
+void generateSphere(TriangleWriter<T> &w, size_t n){
+	size_t rings = std::max<size_t>(2, static_cast<size_t>(sqrt(n / 4.0)));
+	size_t segments = 2 * rings;
+	const glm::vec3 center(0.5f);
+	const float radius = 0.45f;
+	const double pi = 3.14159265358979323846;
+	for (size_t r = 0; r < rings; r++) {
+		double theta0 = pi * r / rings, theta1 = pi * (r + 1) / rings;
+		for (size_t s = 0; s < segments; s++) {
+			double phi0 = 2.0 * pi * s / segments, phi1 = 2.0 * pi * (s + 1) / segments;
+			glm::vec3 p00 = center + radius * glm::vec3(sin(theta0) * cos(phi0), sin(theta0) * sin(phi0), cos(theta0));
+			glm::vec3 p01 = center + radius * glm::vec3(sin(theta0) * cos(phi1), sin(theta0) * sin(phi1), cos(theta0));
+			glm::vec3 p10 = center + radius * glm::vec3(sin(theta1) * cos(phi0), sin(theta1) * sin(phi0), cos(theta1));
+			glm::vec3 p11 = center + radius * glm::vec3(sin(theta1) * cos(phi1), sin(theta1) * sin(phi1), cos(theta1));
+			// the rings at the poles collapse to a fan
+			if (r != 0) { w.add(p00, p10, p01); }
+			if (r != rings - 1) { w.add(p01, p10, p11); }
+		}
+	}
+}
+
+// Value noise: a random value on every integer lattice point, smoothly interpolated
+float latticeValue(int x, int y, unsigned int seed){
+	unsigned int h = static_cast<unsigned int>(x) * 374761393u + static_cast<unsigned int>(y) * 668265263u + seed * 2246822519u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	return (h ^ (h >> 16)) / 4294967295.0f;
+}
+
+float valueNoise(float x, float y, unsigned int seed){
+	int xi = static_cast<int>(floor(x)), yi = static_cast<int>(floor(y));
+	float fx = x - xi, fy = y - yi;
+	fx = fx * fx * (3.0f - 2.0f * fx);
+	fy = fy * fy * (3.0f - 2.0f * fy);
+	float a = latticeValue(xi, yi, seed), b = latticeValue(xi + 1, yi, seed);
+	float c = latticeValue(xi, yi + 1, seed), d = latticeValue(xi + 1, yi + 1, seed);
+	return (a + (b - a) * fx) + ((c + (d - c) * fx) - (a + (b - a) * fx)) * fy;
+}
+
+// fractal sum of octaves, in [0,1]
+float terrainHeight(float x, float y, unsigned int seed){
+	float h = 0.0f, amplitude = 0.5f, frequency = 4.0f;
+	for (int octave = 0; octave < 6; octave++) {
+		h += amplitude * valueNoise(x * frequency, y * frequency, seed + octave);
+		amplitude *= 0.5f;
+		frequency *= 2.0f;
+	}
+	return h / (1.0f - 2.0f * amplitude); // the amplitudes add up to 1 - 2 * the next one
+}
+
+// Noise terrain: a heightfield, so the triangles crowd into a thin, bumpy layer of the grid
+template <typename T>
+void generateTerrain(TriangleWriter<T> &w, size_t n, unsigned int seed){
+	size_t k = std::max<size_t>(2, static_cast<size_t>(sqrt(n / 2.0)));
+	vector<float> row0(k + 1), row1(k + 1);
+	for (size_t x = 0; x <= k; x++) { row1[x] = terrainHeight(x / float(k), 0.0f, seed); }
+	for (size_t y = 0; y < k; y++) {
+		row0.swap(row1);
+		for (size_t x = 0; x <= k; x++) { row1[x] = terrainHeight(x / float(k), (y + 1) / float(k), seed); }
+		float y0 = y / float(k), y1 = (y + 1) / float(k);
+		for (size_t x = 0; x < k; x++) {
+			float x0 = x / float(k), x1 = (x + 1) / float(k);
+			// heights go to [0.1, 0.9] of the cube
+			glm::vec3 p00(x0, y0, 0.1f + 0.8f * row0[x]), p10(x1, y0, 0.1f + 0.8f * row0[x + 1]);
+			glm::vec3 p01(x0, y1, 0.1f + 0.8f * row1[x]), p11(x1, y1, 0.1f + 0.8f * row1[x + 1]);
+			w.add(p00, p10, p11);
+			w.add(p00, p11, p01);
+		}
+	}
+}
+
+// Triangle soup: unconnected triangles, about as big as the average spacing between them
+template <typename T>
+void generateSoup(TriangleWriter<T> &w, size_t n, size_t clusters, unsigned int seed){
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> u(0.0f, 1.0f);
+	std::normal_distribution<float> g(0.0f, 1.0f);
+	float edge = 1.0f / static_cast<float>(cbrt(static_cast<double>(n)));
+	vector<glm::vec3> centers;
+	for (size_t c = 0; c < clusters; c++) { centers.push_back(glm::vec3(0.2f) + 0.6f * glm::vec3(u(rng), u(rng), u(rng))); }
+	for (size_t i = 0; i < n; i++) {
+		glm::vec3 p;
+		if (clusters == 0) { p = glm::vec3(u(rng), u(rng), u(rng)); }
+		else { p = centers[rng() % clusters] + 0.05f * glm::vec3(g(rng), g(rng), g(rng)); }
+		glm::vec3 v0 = glm::clamp(p, 0.0f, 1.0f);
+		glm::vec3 v1 = glm::clamp(p + edge * glm::vec3(u(rng) - 0.5f, u(rng) - 0.5f, u(rng) - 0.5f), 0.0f, 1.0f);
+		glm::vec3 v2 = glm::clamp(p + edge * glm::vec3(u(rng) - 0.5f, u(rng) - 0.5f, u(rng) - 0.5f), 0.0f, 1.0f);
+		w.add(v0, v1, v2);
+	}
+}
+
+// Generate the shape with triangle records T, returns the number of triangles written
+template <typename T>
+size_t generateMesh(size_t &n_vertices){
+	TriangleWriter<T> w(base_filename, compress, indexed);
+	if (shape == "sphere") { generateSphere(w, n_triangles); }
+	else if (shape == "terrain") { generateTerrain(w, n_triangles, seed); }
+	else { generateSoup(w, n_triangles, n_clusters, seed); }
+	n_vertices = w.vertexCount();
+	return w.count;
+}
+
+int main(int argc, char *argv[]){
+	printInfo();
+	parseProgramParameters(argc, argv);
+
+	std::string tri_header_out_name = base_filename + string(".tri");
+	cout << "Writing mesh triangles ... "; cout.flush();
+	Timer timer = Timer();
+	timer.start();
+	size_t n_vertices;
+	size_t written = binary ? generateMesh<GeometryTriangle>(n_vertices) : generateMesh<ColorTriangle>(n_vertices);
+	timer.stop();
+	cout << "done in " << timer.elapsed_time_milliseconds << " ms." << endl;
+
+	// Prepare tri_info and write header
+	cout << "Writing header to " << tri_header_out_name << " ... " << endl;
+	TriInfo tri_info;
+	tri_info.version = 1;
+	tri_info.mesh_bbox = AABox<glm::vec3>(glm::vec3(0.0f), glm::vec3(1.0f));
+	tri_info.n_triangles = written;
+	tri_info.compressed = compress ? 1 : 0;
+	tri_info.indexed = indexed ? 1 : 0;
+	tri_info.n_vertices = n_vertices;
+	tri_info.geometry_only = binary ? 1 : 0;
+	writeTriHeader(tri_header_out_name, tri_info);
+	tri_info.print();
+	cout << "Done." << endl;
+}